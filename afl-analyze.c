@@ -53,6 +53,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif /* !MAP_ANONYMOUS */
 
 static s32 child_pid;                 /* PID of the tested program         */
 
@@ -73,8 +78,16 @@ static u32 in_len,                    /* Input data length                 */
 
 static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
 
+static u32 jobs = 1;                  /* Number of probe workers (-j)      */
+
 static s32 shm_id,                    /* ID of the SHM region              */
-           dev_null_fd = -1;          /* FD to /dev/null                   */
+           shm_owner,                 /* PID owning shm_id / prog_in       */
+           dev_null_fd = -1,          /* FD to /dev/null                   */
+           out_fd = -1,               /* Persistent FD for stdin input     */
+           fsrv_ctl_fd = -1,          /* Fork server control pipe (write)  */
+           fsrv_st_fd;                /* Fork server status pipe (read)    */
+
+static s32 forksrv_pid;               /* PID of the fork server            */
 
 static u8  edges_only,                /* Ignore hit counts?                */
            use_hex_offsets,           /* Show hex offsets?                 */
@@ -84,6 +97,20 @@ static volatile u8
            stop_soon,                 /* Ctrl-C pressed?                   */
            child_timed_out;           /* Child timed out?                  */
 
+/* Checksums gathered for one input byte by the four walking-byte probes;
+   lives in a shared mapping so that probe workers can fill it in. */
+
+struct probe_rec {
+
+  u32 xor_ff, xor_01, sub_10, add_10;
+
+};
+
+static struct probe_rec* probe_recs;  /* One record per input byte         */
+
+static u32 *worker_execs,             /* Per-worker exec counts            */
+           *worker_hangs;             /* Per-worker hang counts            */
+
 
 /* Constants used for describing byte behavior. */
 
@@ -150,10 +177,14 @@ static inline u8 anything_set(void) {
 }
 
 
-/* Get rid of shared memory and temp files (atexit handler). */
+/* Get rid of shared memory and temp files (atexit handler). The owner
+   check keeps forked probe workers from tearing down each other's (or the
+   parent's) state when globals are inherited across fork(). */
 
 static void remove_shm(void) {
 
+  if (getpid() != shm_owner) return;
+
   unlink(prog_in); /* Ignore errors */
   shmctl(shm_id, IPC_RMID, NULL);
 
@@ -170,6 +201,8 @@ static void setup_shm(void) {
 
   if (shm_id < 0) PFATAL("shmget() failed");
 
+  shm_owner = getpid();
+
   atexit(remove_shm);
 
   shm_str = alloc_printf("%d", shm_id);
@@ -179,7 +212,7 @@ static void setup_shm(void) {
   ck_free(shm_str);
 
   trace_bits = shmat(shm_id, NULL, 0);
-  
+
   if (trace_bits == (void *)-1) PFATAL("shmat() failed");
 
 }
@@ -238,47 +271,51 @@ static s32 write_to_file(u8* path, u8* mem, u32 len) {
 static void handle_timeout(int sig) {
 
   child_timed_out = 1;
+
   if (child_pid > 0) kill(child_pid, SIGKILL);
+  else if (child_pid == -1 && forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
 
 }
 
 
-/* Execute target application. Returns exec checksum, or 0 if program
-   times out. */
+/* Spin up fork server. This is a stripped-down cousin of the afl-fuzz
+   routine of the same name; called lazily on the first run_target(), so
+   every probe worker gets a server of its own. */
 
-static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
+static void init_forkserver(char** argv) {
 
   static struct itimerval it;
-  int status = 0;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
 
-  s32 prog_in_fd;
-  u32 cksum;
+  if (use_stdin) {
 
-  memset(trace_bits, 0, MAP_SIZE);
-  MEM_BARRIER();
+    unlink(prog_in); /* Ignore errors */
+
+    out_fd = open(prog_in, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (out_fd < 0) PFATAL("Unable to create '%s'", prog_in);
 
-  prog_in_fd = write_to_file(prog_in, mem, len);
+  }
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
 
-  child_pid = fork();
+  forksrv_pid = fork();
 
-  if (child_pid < 0) PFATAL("fork() failed");
+  if (forksrv_pid < 0) PFATAL("fork() failed");
 
-  if (!child_pid) {
+  if (!forksrv_pid) {
 
     struct rlimit r;
 
-    if (dup2(use_stdin ? prog_in_fd : dev_null_fd, 0) < 0 ||
-        dup2(dev_null_fd, 1) < 0 ||
-        dup2(dev_null_fd, 2) < 0) {
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
 
-      *(u32*)trace_bits = EXEC_FAIL_SIG;
-      PFATAL("dup2() failed");
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
 
     }
 
-    close(dev_null_fd);
-    close(prog_in_fd);
-
     if (mem_limit) {
 
       r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
@@ -298,6 +335,30 @@ static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
     r.rlim_max = r.rlim_cur = 0;
     setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
 
+    setsid();
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (use_stdin) {
+
+      dup2(out_fd, 0);
+      close(out_fd);
+
+    } else dup2(dev_null_fd, 0);
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(dev_null_fd);
+
+    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+
     execv(target_path, argv);
 
     *(u32*)trace_bits = EXEC_FAIL_SIG;
@@ -305,17 +366,114 @@ static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
 
   }
 
-  close(prog_in_fd);
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  child_pid = -1;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  child_pid = 0;
+
+  if (rlen == 4) return;
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+
+  if (waitpid(forksrv_pid, &status, 0) <= 0)
+    PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status))
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute '%s'", argv[0]);
+
+  FATAL("Fork server handshake failed");
+
+}
+
+
+/* Write the probe input to the file read by the target. */
+
+static void write_to_testcase(u8* mem, u32 len) {
+
+  if (use_stdin) {
+
+    lseek(out_fd, 0, SEEK_SET);
+    ck_write(out_fd, mem, len, prog_in);
 
-  /* Configure timeout, wait for child, cancel timeout. */
+    if (ftruncate(out_fd, len)) PFATAL("ftruncate() failed");
+    lseek(out_fd, 0, SEEK_SET);
+
+  } else close(write_to_file(prog_in, mem, len));
+
+}
+
+
+/* Execute target application via the fork server. Returns exec checksum,
+   or 0 if program times out. */
+
+static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
+
+  static struct itimerval it;
+  static u32 prev_timed_out;
+
+  int status = 0;
+  s32 res;
+  u32 cksum;
+
+  if (fsrv_ctl_fd < 0) init_forkserver(argv);
+
+  write_to_testcase(mem, len);
+
+  memset(trace_bits, 0, MAP_SIZE);
+  MEM_BARRIER();
 
   child_timed_out = 0;
+
+  if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+
+    if (stop_soon) goto user_abort;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+    if (stop_soon) goto user_abort;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
   it.it_value.tv_sec = (exec_tmout / 1000);
   it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
 
   setitimer(ITIMER_REAL, &it, NULL);
 
-  if (waitpid(child_pid, &status, 0) <= 0) FATAL("waitpid() failed");
+  if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+
+    if (stop_soon) goto user_abort;
+    RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+
+  }
 
   child_pid = 0;
   it.it_value.tv_sec = 0;
@@ -323,19 +481,20 @@ static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
 
   setitimer(ITIMER_REAL, &it, NULL);
 
-  MEM_BARRIER();
-
-  /* Clean up bitmap, analyze exit condition, etc. */
+  prev_timed_out = child_timed_out;
 
-  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
-    FATAL("Unable to execute '%s'", argv[0]);
+  MEM_BARRIER();
 
   classify_counts(trace_bits);
   total_execs++;
 
   if (stop_soon) {
+
+user_abort:
+
     SAYF(cRST cLRD "\n+++ Analysis aborted by user +++\n" cRST);
     exit(1);
+
   }
 
   /* Always discard inputs that time out. */
@@ -557,6 +716,113 @@ static void dump_hex(u8* buf, u32 len, u8* b_data) {
 
 
 
+/* Run the four walking-byte probes for input byte i, leaving the four
+   checksums in probe_recs[i]. */
+
+static void probe_byte(char** argv, u32 i) {
+
+  struct probe_rec* r = &probe_recs[i];
+
+  /* Perform walking byte adjustments across the file. We perform four
+     operations designed to elicit some response from the underlying
+     code. */
+
+  in_data[i] ^= 0xff;
+  r->xor_ff = run_target(argv, in_data, in_len, 0);
+
+  in_data[i] ^= 0xfe;
+  r->xor_01 = run_target(argv, in_data, in_len, 0);
+
+  in_data[i] = (in_data[i] ^ 0x01) - 0x10;
+  r->sub_10 = run_target(argv, in_data, in_len, 0);
+
+  in_data[i] += 0x20;
+  r->add_10 = run_target(argv, in_data, in_len, 0);
+  in_data[i] -= 0x10;
+
+}
+
+
+/* Rewrite any argv entries that point at the parent's temp file so that
+   they point at ours instead. Needed because @@ substitution happens
+   before probe workers fork off. */
+
+static void retarget_file_args(char** argv, u8* old_path) {
+
+  u32 i = 0;
+  u8* cwd = getcwd(NULL, 0);
+  u8 *old_subst, *new_subst;
+
+  if (!cwd) PFATAL("getcwd() failed");
+
+  old_subst = (old_path[0] == '/') ? old_path
+              : alloc_printf("%s/%s", cwd, old_path);
+  new_subst = (prog_in[0] == '/') ? prog_in
+              : alloc_printf("%s/%s", cwd, prog_in);
+
+  while (argv[i]) {
+
+    u8* loc = strstr(argv[i], old_subst);
+
+    if (loc) {
+
+      u8* n_arg;
+
+      *loc = 0;
+      n_arg = alloc_printf("%s%s%s", argv[i], new_subst,
+                           loc + strlen(old_subst));
+      argv[i] = n_arg;
+
+    }
+
+    i++;
+
+  }
+
+  free(cwd); /* not tracked */
+
+}
+
+
+/* Probe worker body: take every jobs-th byte, write results into the
+   shared probe_recs[] array, and exit. Each worker gets its own SHM
+   segment, temp file and fork server. */
+
+static void probe_worker(char** argv, u32 worker_id) {
+
+  u8* old_prog_in = prog_in;
+  u32 i;
+
+  /* Drop the parent's fork server; a new one is spun up on the first
+     run_target() once our own SHM id is in the environment. */
+
+  close(fsrv_ctl_fd);
+  close(fsrv_st_fd);
+  if (out_fd >= 0) { close(out_fd); out_fd = -1; }
+
+  fsrv_ctl_fd = -1;
+  forksrv_pid = 0;
+
+  prog_in = alloc_printf("%s.%u", old_prog_in, worker_id);
+
+  setup_shm();
+
+  /* Note that @@ may be in play even when use_stdin is set, since the
+     original temp file doubles as the substituted path. */
+
+  retarget_file_args(argv, old_prog_in);
+
+  for (i = worker_id; i < in_len && !stop_soon; i += jobs)
+    probe_byte(argv, i);
+
+  worker_execs[worker_id] = total_execs;
+  worker_hangs[worker_id] = exec_hangs;
+
+  exit(stop_soon ? 1 : 0);
+
+}
+
+
 /* Actually analyze! */
 
 static void analyze(char** argv) {
@@ -575,29 +841,68 @@ static void analyze(char** argv) {
   show_legend();
 #endif /* USE_COLOR */
 
-  for (i = 0; i < in_len; i++) {
+  /* Gather the probe checksums, in parallel if so requested. The shared
+     mapping also carries per-worker exec and hang counts. */
 
-    u32 xor_ff, xor_01, sub_10, add_10;
-    u8  xff_orig, x01_orig, s10_orig, a10_orig;
+  probe_recs = mmap(0, in_len * sizeof(struct probe_rec) +
+                    jobs * 2 * sizeof(u32), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (probe_recs == MAP_FAILED) PFATAL("mmap() failed");
+
+  worker_execs = (u32*)(probe_recs + in_len);
+  worker_hangs = worker_execs + jobs;
+
+  if (jobs > 1) {
+
+    u32 alive = jobs;
 
-    /* Perform walking byte adjustments across the file. We perform four
-       operations designed to elicit some response from the underlying
-       code. */
+    for (i = 0; i < jobs; i++) {
 
-    in_data[i] ^= 0xff;
-    xor_ff = run_target(argv, in_data, in_len, 0);
+      s32 pid = fork();
 
-    in_data[i] ^= 0xfe;
-    xor_01 = run_target(argv, in_data, in_len, 0);
+      if (pid < 0) PFATAL("fork() failed");
+      if (!pid) probe_worker(argv, i);
 
-    in_data[i] = (in_data[i] ^ 0x01) - 0x10;
-    sub_10 = run_target(argv, in_data, in_len, 0);
+    }
+
+    while (alive) {
+
+      int status;
+
+      if (waitpid(-1, &status, 0) <= 0) PFATAL("waitpid() failed");
+
+      alive--;
+
+      if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status)))
+        stop_soon = 1;
 
-    in_data[i] += 0x20;
-    add_10 = run_target(argv, in_data, in_len, 0);
-    in_data[i] -= 0x10;
+    }
+
+    if (stop_soon) {
+      SAYF(cRST cLRD "\n+++ Analysis aborted by user +++\n" cRST);
+      exit(1);
+    }
 
-    /* Classify current behavior. */
+    for (i = 0; i < jobs; i++) {
+
+      total_execs += worker_execs[i];
+      exec_hangs  += worker_hangs[i];
+
+    }
+
+  } else
+
+    for (i = 0; i < in_len; i++) probe_byte(argv, i);
+
+  /* Classify the behavior of every byte. This is a pure function of the
+     recorded checksums, so the verdicts don't depend on -j. */
+
+  for (i = 0; i < in_len; i++) {
+
+    u32 xor_ff = probe_recs[i].xor_ff, xor_01 = probe_recs[i].xor_01,
+        sub_10 = probe_recs[i].sub_10, add_10 = probe_recs[i].add_10;
+    u8  xff_orig, x01_orig, s10_orig, a10_orig;
 
     xff_orig = (xor_ff == orig_cksum);
     x01_orig = (xor_01 == orig_cksum);
@@ -632,7 +937,7 @@ static void analyze(char** argv) {
     prev_s10 = sub_10;
     prev_a10 = add_10;
 
-  } 
+  }
 
   dump_hex(in_data, in_len, b_data);
 
@@ -816,6 +1121,7 @@ static void usage(u8* argv0) {
        "  -f file       - input file read by the tested program (stdin)\n"
        "  -t msec       - timeout for each run (%u ms)\n"
        "  -m megs       - memory limit for child process (%u MB)\n"
+       "  -j jobs       - number of concurrent probe workers (1)\n"
        "  -Q            - use binary-only instrumentation (QEMU mode)\n\n"
 
        "Analysis settings:\n\n"
@@ -963,7 +1269,7 @@ int main(int argc, char** argv) {
 
   SAYF(cCYA "afl-analyze " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
 
-  while ((opt = getopt(argc,argv,"+i:f:m:t:eQV")) > 0)
+  while ((opt = getopt(argc,argv,"+i:f:m:t:j:eQV")) > 0)
 
     switch (opt) {
 
@@ -1035,6 +1341,12 @@ int main(int argc, char** argv) {
 
         break;
 
+      case 'j':
+
+        jobs = atoi(optarg);
+        if (jobs < 1 || jobs > 256) FATAL("Bad value of -j");
+        break;
+
       case 'Q':
 
         if (qemu_mode) FATAL("Multiple -Q options not supported");
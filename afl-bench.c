@@ -0,0 +1,638 @@
+/*
+  Copyright 2016 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - hot path microbenchmarks
+   ---------------------------------------------
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+
+   Measures the per-op cost of the routines that dominate the afl-fuzz
+   inner loop - classify_counts(), has_new_bits(), hash32(), and the
+   bitmap counting helpers - plus, when given an instrumented binary,
+   the full fork server round trip. Run it before and after touching
+   anything in bitmap-inl.h or hash.h; "make bench" does the whole dance
+   against an instrumented copy of test-instr.c.
+
+   Usage: afl-bench [ -d density_pct ] [ /path/to/instrumented_binary ]
+
+   Each benchmark is calibrated to a fixed wall-clock batch, repeated
+   several times after warm-up, and reported as mean ns/op with the
+   standard deviation across repetitions. The trailing key : value block
+   is in the fuzzer_stats format, so CI can diff runs the same way it
+   already parses fuzzer stats.
+
+   Mind the usual microbenchmarking caveats: pin the process to an idle
+   core (taskset), mind frequency scaling, and compare distributions,
+   not single runs. The synthetic trace is random bytes at the given
+   density (default 2%, roughly a small parser target), and repeated
+   classification measures the steady state - the zero-skipping pattern
+   is the same as with fresh counts, which is what matters.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "hash.h"
+
+static u32 map_size = MAP_SIZE;       /* Sized like afl-fuzz would        */
+
+#include "bitmap-inl.h"
+
+/* How many timed repetitions per benchmark, and the wall-clock length a
+   calibrated batch aims for: */
+
+#define BENCH_REPS          8
+#define BENCH_TARGET_NS     50000000ULL
+#define BENCH_FORK_MS       750
+
+static u8 *trace,                     /* Synthetic trace map              */
+          *virgin;                    /* Virgin map in the steady state   */
+
+static u32 density = 2;              /* Nonzero trace bytes, in percent  */
+
+static volatile u32 sink;             /* Defeats dead code elimination    */
+
+/* Results, collected for the final machine-readable block. */
+
+static u8*    res_key[16];
+static double res_mean[16], res_sd[16];
+static u32    res_cnt;
+
+/* Fork server plumbing, cribbed from afl-showmap. */
+
+static s32 forksrv_pid,               /* PID of the fork server           */
+           child_pid,                 /* PID of the target                */
+           fsrv_ctl_fd,               /* Fork server control pipe (write) */
+           fsrv_st_fd,                /* Fork server status pipe (read)   */
+           prog_in_fd,                /* Input file fed to stdin          */
+           shm_id = -1;               /* ID of the SHM region             */
+
+static u8* trace_bits;                /* SHM with instrumentation bitmap  */
+
+static u8  child_timed_out;           /* Target timed out?                */
+
+static u8* target_path;               /* Binary under test                */
+
+
+/* Get unix time in nanoseconds. */
+
+static u64 get_cur_time_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+
+/* Fill the synthetic trace with pseudo-random counts at the requested
+   density; a fixed-seed LCG keeps runs comparable across versions. */
+
+static void setup_maps(void) {
+
+  u32 rnd = 0x5DEECE66, i;
+
+  trace  = ck_alloc(map_size);
+  virgin = ck_alloc(map_size);
+
+  for (i = 0; i < map_size; i++) {
+
+    rnd = rnd * 1103515245 + 12345;
+
+    if ((rnd >> 16) % 100 < density)
+      trace[i] = 1 + ((rnd >> 8) & 0xfe);
+
+  }
+
+  /* Put the virgin map into the steady state an ongoing session sees:
+     everything in the trace already observed, nothing else touched. */
+
+  memset(virgin, 255, map_size);
+
+  classify_counts(trace, map_size);
+  sink += has_new_bits_in(trace, virgin, map_size);
+
+}
+
+
+/* The benchmarked ops. Note that classify_counts() is idempotent, so
+   re-classifying measures the steady state (see the file header). */
+
+static void op_classify(void)      { classify_counts(trace, map_size); }
+
+static void op_classify_scalar(void) {
+  classify_counts_scalar(trace, map_size);
+}
+
+static void op_classify_hash(void) {
+  sink += classify_counts_hash(trace, map_size, HASH_CONST);
+}
+
+static void op_has_new_bits(void) {
+  sink += has_new_bits_in(trace, virgin, map_size);
+}
+
+static void op_count_bytes(void)   { sink += count_bytes(trace, map_size); }
+
+static void op_count_non_255(void) {
+  sink += count_non_255_bytes(virgin, map_size);
+}
+
+static void op_hash32(void) { sink += hash32(trace, map_size, HASH_CONST); }
+
+
+/* Remember a result for the final key : value block. */
+
+static void record_result(u8* key, double mean, double sd) {
+
+  res_key[res_cnt]  = key;
+  res_mean[res_cnt] = mean;
+  res_sd[res_cnt]   = sd;
+  res_cnt++;
+
+}
+
+
+/* Integer-free sqrt via Newton's method, to keep libm off the link
+   line for this one call site. */
+
+static double sqrt_approx(double x) {
+
+  double g = x > 1 ? x : 1;
+  u32 i;
+
+  if (x <= 0) return 0;
+
+  for (i = 0; i < 64; i++) g = (g + x / g) / 2;
+
+  return g;
+
+}
+
+
+/* Calibrate, warm up, and time one operation. */
+
+static void run_bench(u8* name, u8* key, void (*op)(void)) {
+
+  double vals[BENCH_REPS], mean = 0, var = 0;
+  u64 iters = 1, t0, elapsed;
+  u32 r, i;
+
+  /* Grow the batch until it runs long enough to time reliably, then
+     scale it to the target length. This doubles as warm-up. */
+
+  while (1) {
+
+    t0 = get_cur_time_ns();
+    for (i = 0; i < iters; i++) op();
+    elapsed = get_cur_time_ns() - t0;
+
+    if (elapsed >= BENCH_TARGET_NS / 8 || iters >= (1 << 30)) break;
+
+    iters <<= 1;
+
+  }
+
+  if (elapsed) {
+
+    iters = iters * BENCH_TARGET_NS / elapsed;
+    if (!iters) iters = 1;
+
+  }
+
+  for (r = 0; r < BENCH_REPS; r++) {
+
+    t0 = get_cur_time_ns();
+    for (i = 0; i < iters; i++) op();
+    vals[r] = (double)(get_cur_time_ns() - t0) / iters;
+
+  }
+
+  for (r = 0; r < BENCH_REPS; r++) mean += vals[r];
+  mean /= BENCH_REPS;
+
+  for (r = 0; r < BENCH_REPS; r++)
+    var += (vals[r] - mean) * (vals[r] - mean);
+
+  var /= BENCH_REPS - 1;
+
+  ACTF("%-22s: %12.1f ns/op (+/- %.1f)", name, mean, sqrt_approx(var));
+
+  record_result(key, mean, sqrt_approx(var));
+
+}
+
+
+/* Get rid of the SHM region and the fork server (atexit handler). */
+
+static void at_exit_handler(void) {
+
+  if (shm_id >= 0) shmctl(shm_id, IPC_RMID, NULL);
+  if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+
+}
+
+
+/* Configure shared memory, exactly like the fuzzer would. */
+
+static void setup_shm(void) {
+
+  u8* shm_str;
+
+  shm_id = shmget(IPC_PRIVATE, map_size, IPC_CREAT | IPC_EXCL | 0600);
+
+  if (shm_id < 0) PFATAL("shmget() failed");
+
+  shm_str = alloc_printf("%d", shm_id);
+  setenv(SHM_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
+
+  trace_bits = shmat(shm_id, NULL, 0);
+
+  if (trace_bits == (void*)-1) PFATAL("shmat() failed");
+
+}
+
+
+/* Handle timeout (SIGALRM). */
+
+static void handle_timeout(int sig) {
+
+  child_timed_out = 1;
+
+  if (child_pid > 0) kill(child_pid, SIGKILL);
+  else if (child_pid == -1 && forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+
+}
+
+
+/* Spin up the fork server; a stripped-down cousin of the afl-fuzz
+   routine of the same name. */
+
+static void init_forkserver(char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
+
+  ACTF("Spinning up the fork server...");
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  forksrv_pid = fork();
+
+  if (forksrv_pid < 0) PFATAL("fork() failed");
+
+  if (!forksrv_pid) {
+
+    struct rlimit r;
+    s32 dev_null_fd = open("/dev/null", O_RDWR);
+
+    if (dev_null_fd < 0) PFATAL("Unable to open /dev/null");
+
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+
+    }
+
+    r.rlim_max = r.rlim_cur = 0;
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+    setsid();
+
+    dup2(prog_in_fd, 0);
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(dev_null_fd);
+
+    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+
+    execv(target_path, argv);
+
+    *(u32*)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((EXEC_TIMEOUT * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((EXEC_TIMEOUT * FORK_WAIT_MULT) % 1000) * 1000;
+
+  child_pid = -1;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  child_pid = 0;
+
+  if (rlen == 4) {
+
+    /* Newer instrumentation announces its map size in the hello. */
+
+    if (FS_IS_MAPSIZE(status)) {
+
+      u32 child_map = 1 << FS_MAPSIZE_POW2(status);
+
+      if (child_map > map_size)
+        FATAL("Target uses a %u-byte coverage map; too big for us",
+              child_map);
+
+      map_size = child_map;
+
+    }
+
+    return;
+
+  }
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server");
+
+  if (waitpid(forksrv_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status))
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute '%s'", target_path);
+
+  FATAL("No instrumentation detected (non-instrumented binary?)");
+
+}
+
+
+/* One full fork server round trip, timers and map wipe included, to
+   mirror what a single fuzzing execution costs. */
+
+static void forksrv_exec(void) {
+
+  static struct itimerval it;
+
+  u32 zero = 0;
+  int status;
+  s32 res;
+
+  lseek(prog_in_fd, 0, SEEK_SET);
+
+  memset(trace_bits, 0, map_size);
+  MEM_BARRIER();
+
+  if ((res = write(fsrv_ctl_fd, &zero, 4)) != 4)
+    RPFATAL(res, "Unable to request new process from fork server");
+
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4)
+    RPFATAL(res, "Unable to request new process from fork server");
+
+  if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  it.it_value.tv_sec = (EXEC_TIMEOUT / 1000);
+  it.it_value.tv_usec = (EXEC_TIMEOUT % 1000) * 1000;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if ((res = read(fsrv_st_fd, &status, 4)) != 4)
+    RPFATAL(res, "Unable to communicate with fork server");
+
+  child_pid = 0;
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if (child_timed_out) FATAL("Target timed out - not much of a benchmark");
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute '%s'", target_path);
+
+  classify_counts(trace_bits, map_size);
+  sink += has_new_bits_in(trace_bits, virgin, map_size);
+
+}
+
+
+/* Time the end-to-end execution rate through the fork server. */
+
+static void bench_forkserver(char** argv) {
+
+  double vals[BENCH_REPS], mean = 0, var = 0;
+  u64 t0;
+  u32 execs, r, i;
+
+  u8 fn[64];
+
+  /* The target's stdin: one byte, rewound before every exec. */
+
+  sprintf(fn, ".afl-bench-%u", getpid());
+
+  prog_in_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if (prog_in_fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  unlink(fn); /* Keep the fd, lose the name. */
+
+  ck_write(prog_in_fd, "0", 1, fn);
+
+  signal(SIGALRM, handle_timeout);
+
+  init_forkserver(argv);
+
+  /* Warm up and size the batches to roughly BENCH_FORK_MS each. */
+
+  t0 = get_cur_time_ns();
+  for (i = 0; i < 100; i++) forksrv_exec();
+
+  execs = (u64)100 * BENCH_FORK_MS * 1000000 / (get_cur_time_ns() - t0);
+  if (!execs) execs = 1;
+
+  for (r = 0; r < BENCH_REPS; r++) {
+
+    t0 = get_cur_time_ns();
+    for (i = 0; i < execs; i++) forksrv_exec();
+    vals[r] = (double)execs * 1000000000 / (get_cur_time_ns() - t0);
+
+  }
+
+  for (r = 0; r < BENCH_REPS; r++) mean += vals[r];
+  mean /= BENCH_REPS;
+
+  for (r = 0; r < BENCH_REPS; r++)
+    var += (vals[r] - mean) * (vals[r] - mean);
+
+  var /= BENCH_REPS - 1;
+
+  ACTF("%-22s: %12.1f execs/sec (+/- %.1f)", "forkserver round trip",
+       mean, sqrt_approx(var));
+
+  record_result("forksrv_execs_sec", mean, sqrt_approx(var));
+  record_result("forksrv_us", 1000000 / mean, 0);
+
+}
+
+
+/* Display usage hints. */
+
+static void usage(u8* argv0) {
+
+  SAYF("\n%s [ options ] [ /path/to/instrumented_binary ]\n\n"
+
+       "Options:\n\n"
+
+       "  -d pct        - density of the synthetic trace map, in percent"
+       " (default: 2)\n\n"
+
+       "Times the afl-fuzz hot path routines, and - when given an "
+       "instrumented\nbinary - the full fork server round trip. See the "
+       "'bench' make target.\n\n",
+
+       argv0);
+
+  exit(1);
+
+}
+
+
+int main(int argc, char** argv) {
+
+  s32 opt;
+  u32 i;
+
+  SAYF(cCYA "afl-bench " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
+
+  while ((opt = getopt(argc, argv, "+d:h")) > 0)
+
+    switch (opt) {
+
+      case 'd':
+
+        density = atoi(optarg);
+        if (!density || density > 100) FATAL("Bad value for -d");
+        break;
+
+      default: usage(argv[0]);
+
+    }
+
+  if (optind < argc - 1) usage(argv[0]);
+
+  atexit(at_exit_handler);
+
+  init_count_class16();
+
+#ifdef HAVE_AVX2_DISPATCH
+  OKF("Vectorized (AVX2) paths %s.",
+      bitmap_use_avx2() ? "enabled" : "not available");
+#endif /* HAVE_AVX2_DISPATCH */
+
+  setup_maps();
+
+  ACTF("Timing the hot path helpers (map_size = %u, density = %u%%)...",
+       map_size, density);
+
+  run_bench("classify_counts", "classify_ns", op_classify);
+  run_bench("classify_counts scalar", "classify_scalar_ns",
+            op_classify_scalar);
+  run_bench("classify_counts_hash", "classify_hash_ns", op_classify_hash);
+  run_bench("has_new_bits", "has_new_bits_ns", op_has_new_bits);
+  run_bench("count_bytes", "count_bytes_ns", op_count_bytes);
+  run_bench("count_non_255_bytes", "count_non_255_ns", op_count_non_255);
+  run_bench("hash32", "hash32_ns", op_hash32);
+
+  if (optind < argc) {
+
+    target_path = argv[optind];
+
+    setup_shm();
+    bench_forkserver(argv + optind);
+
+  } else
+
+    WARNF("No binary given - skipping the fork server benchmark.");
+
+  /* The machine-readable summary, in the fuzzer_stats format. */
+
+  SAYF("\n");
+  SAYF("afl_version       : " VERSION "\n");
+  SAYF("map_size          : %u\n", map_size);
+  SAYF("trace_density     : %u\n", density);
+
+#ifdef HAVE_AVX2_DISPATCH
+  SAYF("avx2              : %u\n", bitmap_use_avx2() ? 1 : 0);
+#else
+  SAYF("avx2              : 0\n");
+#endif /* ^HAVE_AVX2_DISPATCH */
+
+  for (i = 0; i < res_cnt; i++)
+    SAYF("%-18s: %0.02f\n", res_key[i], res_mean[i]);
+
+  for (i = 0; i < res_cnt; i++)
+
+    if (res_sd[i]) {
+
+      u8* k = alloc_printf("%s_sd", res_key[i]);
+      SAYF("%-18s: %0.02f\n", k, res_sd[i]);
+      ck_free(k);
+
+    }
+
+  return 0;
+
+}
@@ -0,0 +1,1237 @@
+/*
+  Copyright 2025 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - corpus minimization tool
+   ---------------------------------------------
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+
+   A native replacement for the old afl-cmin shell script. Finds the smallest
+   subset of files in the input directory that still triggers the full range
+   of instrumentation data points seen in the starting corpus.
+
+   Unlike the script, which paid one execve() of afl-showmap (and one of the
+   target) per input file, this version drives the target through the fork
+   server and can fan the corpus out across several worker processes (-j),
+   so large corpora minimize at a rate comparable to afl-fuzz itself.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "hash.h"
+#include "bitmap-inl.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif /* !MAP_ANONYMOUS */
+
+/* A file that is yet to win a tuple. */
+
+#define NO_FILE 0xffffffff
+
+struct corpus_file {
+
+  u8* fname;                          /* Base name of the file             */
+  u32 size;                           /* Size in bytes                     */
+
+};
+
+static struct corpus_file* corpus;    /* Corpus files, sorted by size      */
+static u32 corpus_cnt;                /* Number of usable corpus files     */
+
+static u8 *in_dir,                    /* Input directory                   */
+          *out_dir,                   /* Output directory                  */
+          *prog_in,                   /* Targeted program input file       */
+          *target_path,               /* Path to target binary             */
+          *doc_path;                  /* Path to docs                      */
+
+static u32 exec_tmout = EXEC_TIMEOUT; /* Exec timeout (ms)                 */
+
+static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
+
+static u32 jobs = 1;                  /* Number of worker processes (-j)   */
+
+static s32 shm_id = -1,               /* ID of the SHM region              */
+           dev_null_fd = -1,          /* FD to /dev/null                   */
+           out_fd = -1,               /* FD to the program's input file    */
+           fsrv_ctl_fd,               /* Fork server control pipe (write)  */
+           fsrv_st_fd;                /* Fork server status pipe (read)    */
+
+static s32 forksrv_pid,               /* PID of the fork server            */
+           child_pid;                 /* PID of the tested program         */
+
+static u8* trace_bits;                /* SHM with instrumentation bitmap   */
+
+static u8  edges_only,                /* Ignore hit counts?                */
+           crash_only,                /* Keep crashing inputs only?        */
+           allow_any,                 /* Keep inputs regardless of fault?  */
+           qemu_mode,                 /* Running in QEMU mode?             */
+           use_stdin = 1;             /* Use stdin for program input?      */
+
+static volatile u8
+           stop_soon,                 /* Ctrl-C pressed?                   */
+           child_timed_out;           /* Child timed out?                  */
+
+/* Per-worker state living in a shared anonymous mapping, so that the
+   parent can merge results and report progress. best_map[] holds, for
+   every tuple, the index of the smallest corpus file seen hitting it. */
+
+struct worker_state {
+
+  u32* best_map;                      /* Best corpus file per tuple        */
+
+  volatile u32 done;                  /* Files processed so far            */
+
+  u32 crashes,                        /* Crashing inputs encountered       */
+      tmouts,                         /* Timeouts encountered              */
+      skipped;                        /* Inputs skipped (wrong fault type) */
+
+};
+
+static struct worker_state* workers;  /* One slot per worker               */
+
+/* Fault codes returned by run_target(). */
+
+enum {
+  /* 00 */ FAULT_NONE,
+  /* 01 */ FAULT_TMOUT,
+  /* 02 */ FAULT_CRASH,
+  /* 03 */ FAULT_ERROR
+};
+
+
+/* Get rid of shared memory and temp files (atexit handler). */
+
+static void remove_shm(void) {
+
+  if (prog_in) unlink(prog_in); /* Ignore errors */
+  if (shm_id >= 0) shmctl(shm_id, IPC_RMID, NULL);
+
+}
+
+
+/* Configure shared memory. Every process that runs the target - each worker
+   and, later, the parent - calls this to get a trace map of its own. */
+
+static void setup_shm(void) {
+
+  u8* shm_str;
+
+  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+
+  if (shm_id < 0) PFATAL("shmget() failed");
+
+  shm_str = alloc_printf("%d", shm_id);
+
+  setenv(SHM_ENV_VAR, shm_str, 1);
+
+  ck_free(shm_str);
+
+  trace_bits = shmat(shm_id, NULL, 0);
+
+  if (trace_bits == (void *)-1) PFATAL("shmat() failed");
+
+}
+
+
+/* Handle timeout signal. */
+
+static void handle_timeout(int sig) {
+
+  if (child_pid > 0) {
+
+    child_timed_out = 1;
+    kill(child_pid, SIGKILL);
+
+  } else if (child_pid == -1 && forksrv_pid > 0) {
+
+    child_timed_out = 1;
+    kill(forksrv_pid, SIGKILL);
+
+  }
+
+}
+
+
+/* Handle Ctrl-C and the like. */
+
+static void handle_stop_sig(int sig) {
+
+  stop_soon = 1;
+
+  if (child_pid > 0) kill(child_pid, SIGKILL);
+  if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+
+}
+
+
+/* Setup signal handlers, duh. */
+
+static void setup_signal_handlers(void) {
+
+  struct sigaction sa;
+
+  sa.sa_handler   = NULL;
+  sa.sa_flags     = SA_RESTART;
+  sa.sa_sigaction = NULL;
+
+  sigemptyset(&sa.sa_mask);
+
+  /* Various ways of saying "stop". */
+
+  sa.sa_handler = handle_stop_sig;
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  /* Exec timeout notifications. */
+
+  sa.sa_handler = handle_timeout;
+  sigaction(SIGALRM, &sa, NULL);
+
+}
+
+
+/* Spin up fork server. This is a stripped-down cousin of the afl-fuzz
+   routine of the same name. */
+
+static void init_forkserver(char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  forksrv_pid = fork();
+
+  if (forksrv_pid < 0) PFATAL("fork() failed");
+
+  if (!forksrv_pid) {
+
+    struct rlimit r;
+
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+
+    }
+
+    if (mem_limit) {
+
+      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+    }
+
+    r.rlim_max = r.rlim_cur = 0;
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+    setsid();
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (use_stdin) {
+
+      dup2(out_fd, 0);
+      close(out_fd);
+
+    } else dup2(dev_null_fd, 0);
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(dev_null_fd);
+
+    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+
+    setenv("ASAN_OPTIONS", "abort_on_error=1:"
+                           "detect_leaks=0:"
+                           "symbolize=0:"
+                           "allocator_may_return_null=1", 0);
+
+    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
+                           "symbolize=0:"
+                           "abort_on_error=1:"
+                           "allocator_may_return_null=1:"
+                           "msan_track_origins=0", 0);
+
+    execv(target_path, argv);
+
+    *(u32*)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if (rlen == 4) return;
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+
+  if (waitpid(forksrv_pid, &status, 0) <= 0)
+    PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status))
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute target application ('%s')", argv[0]);
+
+  FATAL("Fork server handshake failed");
+
+}
+
+
+/* Write input to the file read by the target. */
+
+static void write_to_testcase(void* mem, u32 len) {
+
+  s32 fd = out_fd;
+
+  if (!use_stdin) {
+
+    unlink(prog_in); /* Ignore errors */
+
+    fd = open(prog_in, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", prog_in);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  ck_write(fd, mem, len, prog_in);
+
+  if (!use_stdin) close(fd); else {
+
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  }
+
+}
+
+
+/* Execute the target via the fork server; returns one of the FAULT_*
+   codes, with the classified trace left in trace_bits[]. */
+
+static u8 run_target(char** argv) {
+
+  static struct itimerval it;
+  static u32 prev_timed_out;
+
+  int status = 0;
+  s32 res;
+
+  memset(trace_bits, 0, MAP_SIZE);
+  MEM_BARRIER();
+
+  child_timed_out = 0;
+
+  if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+
+    if (stop_soon) return FAULT_ERROR;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+    if (stop_soon) return FAULT_ERROR;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  it.it_value.tv_sec = (exec_tmout / 1000);
+  it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+
+    if (stop_soon) return FAULT_ERROR;
+    RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+
+  }
+
+  if (!WIFSTOPPED(status)) child_pid = 0;
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  prev_timed_out = child_timed_out;
+
+  MEM_BARRIER();
+
+  classify_counts(trace_bits, MAP_SIZE);
+
+  if (edges_only) {
+
+    u32 i = MAP_SIZE;
+    u8* mem = trace_bits;
+
+    while (i--) {
+      if (*mem) *mem = 1;
+      mem++;
+    }
+
+  }
+
+  if (child_timed_out) return FAULT_TMOUT;
+
+  if (WIFSIGNALED(status) && !stop_soon) return FAULT_CRASH;
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) == MSAN_ERROR)
+    return FAULT_CRASH;
+
+  return FAULT_NONE;
+
+}
+
+
+static void detect_file_args(char** argv);
+
+
+/* Set up the temp file and the fork server for the calling process. Called
+   once in every process that runs the target, after the fork, so that each
+   one gets a temp file (and an @@ substitution) of its own. */
+
+static void start_target(char** argv) {
+
+  u8* use_dir = ".";
+
+  if (access(use_dir, R_OK | W_OK | X_OK)) {
+
+    use_dir = getenv("TMPDIR");
+    if (!use_dir) use_dir = "/tmp";
+
+  }
+
+  prog_in = alloc_printf("%s/.afl-cmin-temp-%u", use_dir, getpid());
+
+  if (!use_stdin) detect_file_args(argv);
+
+  if (use_stdin) {
+
+    unlink(prog_in); /* Ignore errors */
+
+    out_fd = open(prog_in, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (out_fd < 0) PFATAL("Unable to create '%s'", prog_in);
+
+  }
+
+  init_forkserver(argv);
+
+}
+
+
+/* Read a corpus file into a freshly allocated buffer. */
+
+static u8* read_corpus_file(u32 idx, u32* len_p) {
+
+  struct stat st;
+  u8* fn = alloc_printf("%s/%s", in_dir, corpus[idx].fname);
+  u8* mem;
+  s32 fd = open(fn, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st)) PFATAL("Unable to open '%s'", fn);
+
+  mem = ck_alloc_nozero(st.st_size);
+
+  ck_read(fd, mem, st.st_size, fn);
+
+  close(fd);
+  ck_free(fn);
+
+  *len_p = st.st_size;
+  return mem;
+
+}
+
+
+/* Worker body: run every jobs-th corpus file, record the smallest file
+   seen for every tuple. Since corpus[] is sorted by size, a lower index
+   always means a smaller (or equally-sized, earlier-sorting) file. */
+
+static void worker_loop(char** argv, u32 worker_id) {
+
+  struct worker_state* ws = &workers[worker_id];
+  u32 i;
+
+  setup_shm();
+  atexit(remove_shm);
+  start_target(argv);
+
+  for (i = worker_id; i < corpus_cnt; i += jobs) {
+
+    u32 len, t;
+    u8* mem = read_corpus_file(i, &len);
+    u8  fault, keep;
+
+    write_to_testcase(mem, len);
+    fault = run_target(argv);
+
+    ck_free(mem);
+
+    if (stop_soon) exit(1);
+
+    ws->done++;
+
+    if (fault == FAULT_TMOUT) { ws->tmouts++; continue; }
+
+    if (fault == FAULT_CRASH) ws->crashes++;
+
+    keep = allow_any || (crash_only ? (fault == FAULT_CRASH)
+                                    : (fault == FAULT_NONE));
+
+    if (!keep) { ws->skipped++; continue; }
+
+    for (t = 0; t < MAP_SIZE; t++)
+      if (trace_bits[t] && i < ws->best_map[t]) ws->best_map[t] = i;
+
+  }
+
+  exit(0);
+
+}
+
+
+/* Read the input directory, skipping dotfiles, zero-length and oversized
+   entries; sort the rest by size (and name, for determinism). */
+
+static int compare_corpus_file(const void* p1, const void* p2) {
+
+  const struct corpus_file *f1 = p1, *f2 = p2;
+
+  if (f1->size != f2->size) return (f1->size > f2->size) ? 1 : -1;
+
+  return strcmp(f1->fname, f2->fname);
+
+}
+
+static void read_corpus_dir(void) {
+
+  struct dirent** nl;
+  s32 nl_cnt, i;
+  u32 alloc_cnt = 0, skipped_big = 0;
+
+  nl_cnt = scandir(in_dir, &nl, NULL, alphasort);
+
+  if (nl_cnt < 0) PFATAL("Unable to open '%s'", in_dir);
+
+  for (i = 0; i < nl_cnt; i++) {
+
+    struct stat st;
+    u8* fn = alloc_printf("%s/%s", in_dir, nl[i]->d_name);
+
+    if (nl[i]->d_name[0] == '.' || lstat(fn, &st) || !S_ISREG(st.st_mode) ||
+        !st.st_size) {
+
+      ck_free(fn);
+      free(nl[i]);
+      continue;
+
+    }
+
+    ck_free(fn);
+
+    if (st.st_size > MAX_FILE) {
+
+      skipped_big++;
+      free(nl[i]);
+      continue;
+
+    }
+
+    if (corpus_cnt == alloc_cnt) {
+
+      alloc_cnt = alloc_cnt ? alloc_cnt * 2 : 1024;
+      corpus = ck_realloc(corpus, alloc_cnt * sizeof(struct corpus_file));
+
+    }
+
+    corpus[corpus_cnt].fname = ck_strdup(nl[i]->d_name);
+    corpus[corpus_cnt].size  = st.st_size;
+    corpus_cnt++;
+
+    free(nl[i]);
+
+  }
+
+  free(nl); /* not tracked */
+
+  if (skipped_big)
+    WARNF("Skipped %u files over %u kB - consider trimming them first.",
+          skipped_big, MAX_FILE / 1024);
+
+  if (!corpus_cnt) FATAL("No usable files in '%s'", in_dir);
+
+  qsort(corpus, corpus_cnt, sizeof(struct corpus_file), compare_corpus_file);
+
+  ACTF("Found %u usable files in '%s'.", corpus_cnt, in_dir);
+
+}
+
+
+/* Prepare the output directory; it must not already contain files. */
+
+static void setup_out_dir(void) {
+
+  DIR* d;
+  struct dirent* de;
+
+  if (mkdir(out_dir, 0700)) {
+
+    if (errno != EEXIST) PFATAL("Unable to create '%s'", out_dir);
+
+    d = opendir(out_dir);
+
+    if (!d) PFATAL("Unable to open '%s'", out_dir);
+
+    while ((de = readdir(d)))
+      if (de->d_name[0] != '.')
+        FATAL("Directory '%s' exists and is not empty - delete it first",
+              out_dir);
+
+    closedir(d);
+
+  }
+
+}
+
+
+/* Copy a winning corpus file to the output directory, same base name. */
+
+static void copy_to_out_dir(u32 idx) {
+
+  u8* dst_fn = alloc_printf("%s/%s", out_dir, corpus[idx].fname);
+  u32 len;
+  u8* mem = read_corpus_file(idx, &len);
+  s32 fd;
+
+  fd = open(dst_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", dst_fn);
+
+  ck_write(fd, mem, len, dst_fn);
+
+  close(fd);
+  ck_free(mem);
+  ck_free(dst_fn);
+
+}
+
+
+/* Fork off the workers, babysit them, and report progress. */
+
+static void run_workers(char** argv) {
+
+  u32 i, alive = jobs;
+  s32* pids = ck_alloc(jobs * sizeof(s32));
+
+  ACTF("Tracing the corpus with %u worker%s...", jobs, jobs == 1 ? "" : "s");
+
+  for (i = 0; i < jobs; i++) {
+
+    pids[i] = fork();
+
+    if (pids[i] < 0) PFATAL("fork() failed");
+    if (!pids[i]) worker_loop(argv, i);
+
+  }
+
+  while (alive && !stop_soon) {
+
+    int status;
+    s32 pid = waitpid(-1, &status, WNOHANG);
+    u32 done = 0;
+
+    if (pid > 0) {
+
+      alive--;
+
+      if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status))) {
+
+        for (i = 0; i < jobs; i++) kill(pids[i], SIGTERM);
+        FATAL("Worker failed (see messages above)");
+
+      }
+
+      continue;
+
+    }
+
+    for (i = 0; i < jobs; i++) done += workers[i].done;
+
+    SAYF("\r    Processed %u/%u files...", done, corpus_cnt);
+    fflush(stdout);
+
+    usleep(100000);
+
+  }
+
+  SAYF("\r");
+
+  if (stop_soon) {
+
+    while (waitpid(-1, NULL, 0) > 0);
+    FATAL("Interrupted by user");
+
+  }
+
+  ck_free(pids);
+
+  OKF("Corpus traced (%u files).", corpus_cnt);
+
+}
+
+
+/* Merge per-worker results and perform the tuple-ownership reduction.
+   Same greedy pass as the shell script: walk the tuples in map order and,
+   for every tuple not yet covered, keep the smallest file that hits it,
+   crediting it with everything else it touches. The handful of winners is
+   re-executed to obtain their full traces. */
+
+static void minimize_corpus(char** argv) {
+
+  static u8 covered[MAP_SIZE];
+
+  u32* best_map = workers[0].best_map;
+  u32 t, i, all_tuples = 0, kept = 0;
+  u32 crashes = 0, tmouts = 0, skipped = 0;
+
+  for (i = 1; i < jobs; i++)
+    for (t = 0; t < MAP_SIZE; t++)
+      if (workers[i].best_map[t] < best_map[t])
+        best_map[t] = workers[i].best_map[t];
+
+  for (i = 0; i < jobs; i++) {
+
+    crashes += workers[i].crashes;
+    tmouts  += workers[i].tmouts;
+    skipped += workers[i].skipped;
+
+  }
+
+  if (tmouts)
+    WARNF("%u files timed out and were not considered.", tmouts);
+
+  if (skipped)
+    WARNF("%u files %s and were not considered%s.", skipped,
+          crash_only ? "did not crash" : "caused crashes",
+          crash_only ? "" : " (-C to keep them instead)");
+
+  for (t = 0; t < MAP_SIZE; t++) if (best_map[t] != NO_FILE) all_tuples++;
+
+  if (!all_tuples)
+    FATAL("No instrumentation output from any input file%s",
+          crash_only ? "" : " - check the target binary");
+
+  ACTF("Minimizing over %u tuples...", all_tuples);
+
+  /* The winners need a fork server of our own to get re-traced. */
+
+  setup_shm();
+  atexit(remove_shm);
+  start_target(argv);
+
+  for (t = 0; t < MAP_SIZE; t++) {
+
+    u32 len, t2;
+    u8* mem;
+
+    if (best_map[t] == NO_FILE || covered[t]) continue;
+
+    i = best_map[t];
+
+    mem = read_corpus_file(i, &len);
+    write_to_testcase(mem, len);
+    run_target(argv);
+    ck_free(mem);
+
+    if (stop_soon) FATAL("Interrupted by user");
+
+    for (t2 = 0; t2 < MAP_SIZE; t2++)
+      if (trace_bits[t2]) covered[t2] = 1;
+
+    /* In case the target misbehaves on the second run, make sure we still
+       advance past the tuple that got this file selected. */
+
+    covered[t] = 1;
+
+    copy_to_out_dir(i);
+    kept++;
+
+  }
+
+  OKF("Narrowed down to %u file%s, saved in '%s'.", kept,
+      kept == 1 ? "" : "s", out_dir);
+
+  if (crashes && !crash_only)
+    WARNF("One or more crashes were encountered - check your target binary!");
+
+}
+
+
+/* Detect @@ in args. */
+
+static void detect_file_args(char** argv) {
+
+  u32 i = 0;
+  u8* cwd = getcwd(NULL, 0);
+
+  if (!cwd) PFATAL("getcwd() failed");
+
+  while (argv[i]) {
+
+    u8* aa_loc = strstr(argv[i], "@@");
+
+    if (aa_loc) {
+
+      u8 *aa_subst, *n_arg;
+
+      /* Be sure that we're always using fully-qualified paths. */
+
+      if (prog_in[0] == '/') aa_subst = prog_in;
+      else aa_subst = alloc_printf("%s/%s", cwd, prog_in);
+
+      /* Construct a replacement argv value. */
+
+      *aa_loc = 0;
+      n_arg = alloc_printf("%s%s%s", argv[i], aa_subst, aa_loc + 2);
+      argv[i] = n_arg;
+      *aa_loc = '@';
+
+      if (prog_in[0] != '/') ck_free(aa_subst);
+
+    }
+
+    i++;
+
+  }
+
+  free(cwd); /* not tracked */
+
+}
+
+
+/* Check whether @@ appears anywhere in argv. */
+
+static u8 uses_file_args(char** argv) {
+
+  u32 i = 0;
+
+  while (argv[i]) {
+
+    if (strstr(argv[i], "@@")) return 1;
+    i++;
+
+  }
+
+  return 0;
+
+}
+
+
+/* Display usage hints. */
+
+static void usage(u8* argv0) {
+
+  SAYF("\n%s [ options ] -- /path/to/target_app [ ... ]\n\n"
+
+       "Required parameters:\n\n"
+
+       "  -i dir        - input directory with the starting corpus\n"
+       "  -o dir        - output directory for minimized files\n\n"
+
+       "Execution control settings:\n\n"
+
+       "  -t msec       - timeout for each run (%u ms)\n"
+       "  -m megs       - memory limit for child process (%u MB)\n"
+       "  -j jobs       - number of concurrent worker processes (1)\n"
+       "  -Q            - use binary-only instrumentation (QEMU mode)\n\n"
+
+       "Minimization settings:\n\n"
+
+       "  -C            - keep crashing inputs, reject everything else\n"
+       "  -e            - solve for edge coverage only, ignore hit counts\n\n"
+
+       "Other stuff:\n\n"
+
+       "  -V            - show version number and exit\n\n"
+
+       "For additional tips, please consult %s/README.\n\n",
+
+       argv0, EXEC_TIMEOUT, MEM_LIMIT, doc_path);
+
+  exit(1);
+
+}
+
+
+/* Find binary. */
+
+static void find_binary(u8* fname) {
+
+  u8* env_path = 0;
+  struct stat st;
+
+  if (strchr(fname, '/') || !(env_path = getenv("PATH"))) {
+
+    target_path = ck_strdup(fname);
+
+    if (stat(target_path, &st) || !S_ISREG(st.st_mode) ||
+        !(st.st_mode & 0111) || st.st_size < 4)
+      FATAL("Program '%s' not found or not executable", fname);
+
+  } else {
+
+    while (env_path) {
+
+      u8 *cur_elem, *delim = strchr(env_path, ':');
+
+      if (delim) {
+
+        cur_elem = ck_alloc(delim - env_path + 1);
+        memcpy(cur_elem, env_path, delim - env_path);
+        delim++;
+
+      } else cur_elem = ck_strdup(env_path);
+
+      env_path = delim;
+
+      if (cur_elem[0])
+        target_path = alloc_printf("%s/%s", cur_elem, fname);
+      else
+        target_path = ck_strdup(fname);
+
+      ck_free(cur_elem);
+
+      if (!stat(target_path, &st) && S_ISREG(st.st_mode) &&
+          (st.st_mode & 0111) && st.st_size >= 4) break;
+
+      ck_free(target_path);
+      target_path = 0;
+
+    }
+
+    if (!target_path) FATAL("Program '%s' not found or not executable", fname);
+
+  }
+
+}
+
+
+/* Fix up argv for QEMU. */
+
+static char** get_qemu_argv(u8* own_loc, char** argv, int argc) {
+
+  char** new_argv = ck_alloc(sizeof(char*) * (argc + 4));
+  u8 *tmp, *cp, *rsl, *own_copy;
+
+  /* Workaround for a QEMU stability glitch. */
+
+  setenv("QEMU_LOG", "nochain", 1);
+
+  memcpy(new_argv + 3, argv + 1, sizeof(char*) * argc);
+
+  new_argv[2] = target_path;
+  new_argv[1] = "--";
+
+  tmp = getenv("AFL_PATH");
+
+  if (tmp) {
+
+    cp = alloc_printf("%s/afl-qemu-trace", tmp);
+
+    if (access(cp, X_OK))
+      FATAL("Unable to find '%s'", tmp);
+
+    target_path = new_argv[0] = cp;
+    return new_argv;
+
+  }
+
+  own_copy = ck_strdup(own_loc);
+  rsl = strrchr(own_copy, '/');
+
+  if (rsl) {
+
+    *rsl = 0;
+
+    cp = alloc_printf("%s/afl-qemu-trace", own_copy);
+    ck_free(own_copy);
+
+    if (!access(cp, X_OK)) {
+
+      target_path = new_argv[0] = cp;
+      return new_argv;
+
+    }
+
+  } else ck_free(own_copy);
+
+  if (!access(BIN_PATH "/afl-qemu-trace", X_OK)) {
+
+    target_path = new_argv[0] = BIN_PATH "/afl-qemu-trace";
+    return new_argv;
+
+  }
+
+  FATAL("Unable to find 'afl-qemu-trace'.");
+
+}
+
+
+/* Main entry point */
+
+int main(int argc, char** argv) {
+
+  s32 opt;
+  u8  mem_limit_given = 0, timeout_given = 0;
+  u32 i;
+  char** use_argv;
+
+  doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
+
+  SAYF(cCYA "afl-cmin " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
+
+  while ((opt = getopt(argc, argv, "+i:o:m:t:j:eCQV")) > 0)
+
+    switch (opt) {
+
+      case 'i':
+
+        if (in_dir) FATAL("Multiple -i options not supported");
+        in_dir = optarg;
+        break;
+
+      case 'o':
+
+        if (out_dir) FATAL("Multiple -o options not supported");
+        out_dir = optarg;
+        break;
+
+      case 'e':
+
+        if (edges_only) FATAL("Multiple -e options not supported");
+        edges_only = 1;
+        break;
+
+      case 'C':
+
+        if (crash_only) FATAL("Multiple -C options not supported");
+        crash_only = 1;
+        break;
+
+      case 'j':
+
+        jobs = atoi(optarg);
+
+        if (jobs < 1 || jobs > 256) FATAL("Bad value of -j");
+        break;
+
+      case 'm': {
+
+          u8 suffix = 'M';
+
+          if (mem_limit_given) FATAL("Multiple -m options not supported");
+          mem_limit_given = 1;
+
+          if (!strcmp(optarg, "none")) {
+
+            mem_limit = 0;
+            break;
+
+          }
+
+          if (sscanf(optarg, "%llu%c", &mem_limit, &suffix) < 1 ||
+              optarg[0] == '-') FATAL("Bad syntax used for -m");
+
+          switch (suffix) {
+
+            case 'T': mem_limit *= 1024 * 1024; break;
+            case 'G': mem_limit *= 1024; break;
+            case 'k': mem_limit /= 1024; break;
+            case 'M': break;
+
+            default:  FATAL("Unsupported suffix or bad syntax for -m");
+
+          }
+
+          if (mem_limit < 5) FATAL("Dangerously low value of -m");
+
+          if (sizeof(rlim_t) == 4 && mem_limit > 2000)
+            FATAL("Value of -m out of range on 32-bit systems");
+
+        }
+
+        break;
+
+      case 't':
+
+        if (timeout_given) FATAL("Multiple -t options not supported");
+        timeout_given = 1;
+
+        exec_tmout = atoi(optarg);
+
+        if (exec_tmout < 10 || optarg[0] == '-')
+          FATAL("Dangerously low value of -t");
+
+        break;
+
+      case 'Q':
+
+        if (qemu_mode) FATAL("Multiple -Q options not supported");
+        if (!mem_limit_given) mem_limit = MEM_LIMIT_QEMU;
+
+        qemu_mode = 1;
+        break;
+
+      case 'V': /* Show version number */
+
+        /* Version number has been printed already, just quit. */
+        exit(0);
+
+      default:
+
+        usage(argv[0]);
+
+    }
+
+  if (optind == argc || !in_dir || !out_dir) usage(argv[0]);
+
+  if (getenv("AFL_CMIN_CRASHES_ONLY")) crash_only = 1;
+  if (getenv("AFL_CMIN_ALLOW_ANY")) allow_any = 1;
+
+  init_count_class16();
+  setup_signal_handlers();
+
+  dev_null_fd = open("/dev/null", O_RDWR);
+  if (dev_null_fd < 0) PFATAL("Unable to open /dev/null");
+
+  if (getenv("AFL_PRELOAD")) {
+    setenv("LD_PRELOAD", getenv("AFL_PRELOAD"), 1);
+    setenv("DYLD_INSERT_LIBRARIES", getenv("AFL_PRELOAD"), 1);
+  }
+
+  find_binary(argv[optind]);
+
+  if (qemu_mode)
+    use_argv = get_qemu_argv(argv[0], argv + optind, argc - optind);
+  else
+    use_argv = argv + optind;
+
+  use_stdin = !uses_file_args(use_argv);
+
+  SAYF("\n");
+
+  read_corpus_dir();
+  setup_out_dir();
+
+  if (jobs > corpus_cnt) jobs = corpus_cnt;
+
+  /* Per-worker state lives in a shared mapping set up before the fork;
+     best_map[] starts out with NO_FILE (all bits set) everywhere. */
+
+  workers = mmap(0, jobs * (sizeof(struct worker_state) +
+                 MAP_SIZE * sizeof(u32)), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (workers == MAP_FAILED) PFATAL("mmap() failed");
+
+  for (i = 0; i < jobs; i++) {
+
+    workers[i].best_map = (u32*)((u8*)(workers + jobs) +
+                          i * MAP_SIZE * sizeof(u32));
+
+    memset(workers[i].best_map, 0xff, MAP_SIZE * sizeof(u32));
+
+  }
+
+  run_workers(use_argv);
+
+  minimize_corpus(use_argv);
+
+  OKF("We're done here. Have a nice day!\n");
+
+  exit(0);
+
+}
@@ -42,6 +42,9 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "bitmap-inl.h"
+#include "telemetry.h"
+#include "netsync.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -66,11 +69,23 @@
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/file.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
 #  include <sys/sysctl.h>
 #endif /* __APPLE__ || __FreeBSD__ || __OpenBSD__ */
 
+#ifdef __linux__
+#  include <sys/prctl.h>
+#endif /* __linux__ */
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif /* !MAP_ANONYMOUS */
+
 /* For systems that have sched_setaffinity; right now just Linux, but one
    can hope... */
 
@@ -150,14 +165,143 @@ static s32 forksrv_pid,               /* PID of the fork server           */
 
 EXP_ST u8* trace_bits;                /* SHM with instrumentation bitmap  */
 
-EXP_ST u8  virgin_bits[MAP_SIZE],     /* Regions yet untouched by fuzzing */
-           virgin_tmout[MAP_SIZE],    /* Bits we haven't seen in tmouts   */
-           virgin_crash[MAP_SIZE];    /* Bits we haven't seen in crashes  */
+EXP_ST u8 *virgin_bits,               /* Regions yet untouched by fuzzing */
+          *virgin_tmout,              /* Bits we haven't seen in tmouts   */
+          *virgin_crash;              /* Bits we haven't seen in crashes  */
 
-static u8  var_bytes[MAP_SIZE];       /* Bytes that appear to be variable */
+static u8* var_bytes;                 /* Bytes that appear to be variable */
+
+EXP_ST u32 map_size = MAP_SIZE;       /* Usable coverage map size; set via
+                                         AFL_MAP_SIZE, may shrink to the
+                                         size announced by the target     */
 
 static s32 shm_id;                    /* ID of the SHM region             */
 
+static s32 shm_fuzz_id = -1;          /* ID of the test case SHM region   */
+static u8* shm_fuzz;                  /* SHM with the current test case   */
+static u8  shm_testcase_mode;         /* Deliver test cases via SHM?      */
+
+/* Shared-memory sync ring (AFL_SHM_SYNC): a single mmap'd file in sync_dir
+   where every instance publishes (path, len, cksum) records for its new
+   finds, so that peers can pick them up without rescanning each other's
+   queue directories. Records are only ever appended; a record becomes
+   visible once its seq field is set to index + 1. */
+
+struct sync_ring_rec {
+
+  volatile u32 seq;                   /* Publication marker (index + 1)   */
+  u32 cksum;                          /* exec_cksum of the find           */
+  u32 len;                            /* Input length                     */
+  u8  path[SYNC_RING_PATH];           /* Path relative to sync_dir        */
+
+};
+
+struct sync_ring_hdr {
+
+  u32 version;                        /* SYNC_RING_VERSION                */
+  u32 slots;                          /* Slot count (power of two)        */
+  volatile u32 head;                  /* Next slot to be claimed          */
+  u32 unused;                         /* Reserved                         */
+
+};
+
+static struct sync_ring_hdr* sync_ring;  /* Mapped ring, or NULL          */
+static u32 sync_ring_pos;             /* Next record we will consume      */
+static u8  shm_sync_mode,             /* Sync through the ring?           */
+           sync_ring_primed;          /* Did the initial full dir scan?   */
+
+/* Checksums of everything already in our queue, kept in a small
+   open-addressing hash set so that ring imports can be skipped without
+   executing them. */
+
+static u32 *cksum_set;                /* Hash set of queue checksums      */
+static u32 cksum_set_size,            /* Allocated slots (power of two)   */
+           cksum_set_used;            /* Populated slots                  */
+
+static void cksum_set_add(u32 ck);
+
+/* Network sync (AFL_NET_SYNC): rather than rendezvousing in a shared
+   sync_dir, instances connect to an afl-netsync broker and stream their
+   new queue entries to every other connected instance; see netsync.h for
+   the wire format. The broker connection is best-effort - when it drops,
+   fuzzing continues and reconnection is retried in the background. */
+
+static u8* net_sync_addr;             /* host:port of the broker          */
+static s32 net_sync_fd = -1;          /* Broker socket, or -1 if down     */
+static u8  net_sync_mode,             /* AFL_NET_SYNC requested?          */
+           net_syncing;               /* Importing? (suppresses echo)     */
+static u64 net_retry_at;              /* Earliest reconnect time (ms)     */
+static u8* net_in_buf;                /* Frame reassembly buffer          */
+static u32 net_in_len,                /* Bytes reassembled so far         */
+           net_import_cnt;            /* Cases pulled off the wire        */
+
+/* Write-behind ring (AFL_ASYNC_WRITE): new queue entries, crashes, and
+   stats updates are copied into a shared byte ring and flushed to disk by
+   a forked-off writer process, so that a slow (e.g. NFS-backed) output
+   directory does not stall the fuzzing loop. Head and tail are
+   free-running byte counters; records wrap around the ring modulo
+   AWRITE_RING_SIZE. */
+
+struct awrite_hdr {
+
+  volatile u32 head;                  /* Ring bytes produced so far       */
+  volatile u32 tail;                  /* Ring bytes consumed so far       */
+  volatile u8  quit;                  /* Ask the writer to wind down      */
+
+};
+
+struct awrite_rec {
+
+  u32 data_len;                       /* Payload size                     */
+  u16 path_len;                       /* Path size, including NUL         */
+  u8  mode;                           /* AW_EXCL / AW_TRUNC / AW_APPEND   */
+  u8  unused;                         /* Reserved                         */
+
+};
+
+#define AW_EXCL   0
+#define AW_TRUNC  1
+#define AW_APPEND 2
+
+static struct awrite_hdr* aw_hdr;     /* Mapped control block, or NULL    */
+static u8* aw_ring;                   /* The data ring itself             */
+static u8  want_async_write,          /* AFL_ASYNC_WRITE requested?       */
+           async_write_mode;          /* Write-behind up and running?     */
+static s32 aw_pid = -1;               /* PID of the writer process        */
+
+/* Crash triage (AFL_CRASH_TRIAGE): crashing inputs are handed to a
+   forked-off worker through a shared ring. The worker re-runs each one
+   against its own fork server, dedups on the simplified faulting-path
+   checksum plus signal, and owns all writes to the crashes/ directory;
+   duplicates become hard links rather than fresh copies. */
+
+struct triage_hdr {
+
+  volatile u32 head;                  /* Ring bytes produced so far       */
+  volatile u32 tail;                  /* Ring bytes consumed so far       */
+  volatile u8  quit;                  /* Ask the worker to wind down      */
+  volatile u32 uniq;                  /* Unique, reproducible bugs        */
+  volatile u32 dups;                  /* Crashes hard-linked as dupes     */
+  volatile u32 noise;                 /* Crashes that did not reproduce   */
+
+};
+
+struct triage_rec {
+
+  u32 len;                            /* Input length                     */
+  u32 cksum;                          /* Fuzz-time crash signature        */
+  u16 op_len;                         /* describe_op() size, incl. NUL    */
+  u8  sig;                            /* Fuzz-time signal number          */
+  u8  unused;                         /* Reserved                         */
+
+};
+
+static struct triage_hdr* tr_hdr;     /* Mapped control block, or NULL    */
+static u8* tr_ring;                   /* The hand-off ring itself         */
+static u8  crash_triage_mode;         /* AFL_CRASH_TRIAGE requested?      */
+static s32 triage_pid = -1;           /* PID of the triage process        */
+static u32 triage_drops;              /* Crashes dropped on full ring     */
+
 static volatile u8 stop_soon,         /* Ctrl-C pressed?                  */
                    clear_screen = 1,  /* Window resized?                  */
                    child_timed_out;   /* Traced process timed out?        */
@@ -210,6 +354,9 @@ static s32 splicing_with = -1;        /* Splicing with which test case?   */
 
 static u32 master_id, master_max;     /* Master instance job splitting    */
 
+static u32 multicore_jobs,            /* Number of -j workers requested   */
+           worker_id;                 /* Our worker index in -j mode      */
+
 static u32 syncing_case;              /* Syncing with case #...           */
 
 static s32 stage_cur_byte,            /* Byte offset of current stage op  */
@@ -233,17 +380,44 @@ static s32 cpu_core_count;            /* CPU core count                   */
 #ifdef HAVE_AFFINITY
 
 static s32 cpu_aff = -1;       	      /* Selected CPU core                */
+static s32 cpu_aff_child = -1;        /* Sibling thread for fork server   */
 
 #endif /* HAVE_AFFINITY */
 
 static FILE* plot_file;               /* Gnuplot output file              */
 
+static struct afl_telemetry* telemetry; /* Live counters for afl-whatsup  */
+
+/* Power schedules (-p). The classic heuristic in calculate_score() is the
+   "exploit" strategy; the others divert energy toward rarely-exercised
+   paths based on how often each path has been seen (n_fuzz_tab). */
+
+enum {
+  /* 00 */ SCHED_EXPLOIT,             /* Classic AFL scoring (default)    */
+  /* 01 */ SCHED_EXPLORE,             /* No handicap / depth bonuses      */
+  /* 02 */ SCHED_FAST,                /* Exponential, frequency-scaled    */
+  /* 03 */ SCHED_COE,                 /* Cut off exponential              */
+  /* 04 */ SCHED_LIN,                 /* Linear, frequency-scaled         */
+  /* 05 */ SCHED_QUAD                 /* Quadratic, frequency-scaled      */
+};
+
+static u8   schedule = SCHED_EXPLOIT; /* Selected power schedule          */
+
+static u32* n_fuzz_tab;               /* Per-path exec counts, bucketed by
+                                         exec cksum; only allocated when
+                                         the schedule needs them          */
+
+static u32  trace_cksum;              /* Cksum of the classified trace for
+                                         the last exec; only kept current
+                                         when n_fuzz_tab is in use        */
+
 struct queue_entry {
 
   u8* fname;                          /* File name for the test case      */
   u32 len;                            /* Input length                     */
 
   u8  cal_failed,                     /* Calibration failed?              */
+      cal_left,                       /* Deferred calibration runs left   */
       trim_done,                      /* Trimmed?                         */
       was_fuzzed,                     /* Had any fuzzing done yet?        */
       passed_det,                     /* Deterministic stages passed?     */
@@ -253,15 +427,23 @@ struct queue_entry {
       fs_redundant;                   /* Marked as redundant in the fs?   */
 
   u32 bitmap_size,                    /* Number of bits set in bitmap     */
-      exec_cksum;                     /* Checksum of the execution trace  */
+      exec_cksum,                     /* Checksum of the execution trace  */
+      fuzz_level;                     /* Times selected for fuzzing       */
 
   u64 exec_us,                        /* Execution time (us)              */
       handicap,                       /* Number of queue cycles behind    */
-      depth;                          /* Path depth                       */
+      depth,                          /* Path depth                       */
+      fav_factor;                     /* Cached exec_us * len             */
 
   u8* trace_mini;                     /* Trace bytes, if kept             */
   u32 tc_ref;                         /* Trace bytes ref count            */
 
+  u8* cached;                         /* Cached input bytes, if resident  */
+  u32 cached_len;                     /* Length of the cached copy        */
+
+  struct queue_entry *lru_prev,       /* Corpus cache LRU links; only     */
+                     *lru_next;       /*   valid while cached is set      */
+
   struct queue_entry *next,           /* Next element, if any             */
                      *next_100;       /* 100 elements ahead               */
 
@@ -272,8 +454,40 @@ static struct queue_entry *queue,     /* Fuzzing queue (linked list)      */
                           *queue_top, /* Top of the list                  */
                           *q_prev100; /* Previous 100 marker              */
 
+static struct ck_arena q_arena;       /* Arena for immortal queue metadata */
+
+/* In-memory corpus cache: queue entry contents, pinned up to a byte
+   budget so that the hot fuzzing rounds never re-read input files. The
+   resident entries form an LRU list threaded through the queue structs. */
+
+static struct queue_entry *qc_head,   /* Hottest cached entry             */
+                          *qc_tail;   /* Coldest cached entry             */
+
+static u64 qc_bytes,                  /* Bytes currently cached           */
+           qc_budget = CORPUS_CACHE_SIZE; /* Cache limit (0 = disabled)   */
+
+static u8  det_resuming;              /* Det checkpoint loaded for entry? */
+static u32 det_ck_stage,              /* Checkpointed stage id            */
+           det_ck_pos,                /* Position within that stage       */
+           det_ck_eff_cnt,            /* Saved effector byte count        */
+           det_ck_eff_len;            /* Saved effector map length        */
+static u8* det_ck_eff;                /* Saved effector map               */
+
 static struct queue_entry*
-  top_rated[MAP_SIZE];                /* Top entries for bitmap bytes     */
+  *top_rated;                         /* Top entries for bitmap bytes     */
+
+static u32 *tr_slots,                 /* Occupied top_rated[] slots,      */
+           tr_slot_cnt;               /* kept sorted; see cull_queue()    */
+
+static struct queue_entry **fav_prev, /* Favored set as of the last cull  */
+                          **fav_cur;  /* Favored set being built          */
+
+static u32 fav_prev_cnt,              /* Entries in fav_prev              */
+           fav_cur_cnt,               /* Entries in fav_cur               */
+           fav_alloc;                 /* Allocated size of both arrays    */
+
+static struct queue_entry
+  *last_cull_top;                     /* queue_top as of the last cull    */
 
 struct extra_data {
   u8* data;                           /* Dictionary token data            */
@@ -287,6 +501,28 @@ static u32 extras_cnt;                /* Total number of tokens read      */
 static struct extra_data* a_extras;   /* Automatically selected extras    */
 static u32 a_extras_cnt;              /* Total number of tokens available */
 
+/* Prefix trie over the user extras, built once by load_extras(). The
+   dictionary stages use it to find every token that already matches the
+   input at a given offset in a single walk, instead of memcmp()ing each
+   of the extras_cnt tokens in turn. Children hang off a per-node sibling
+   list, except at the root, which gets a direct 256-way table. */
+
+struct ext_trie_node {
+  u32 child;                          /* First child, 0 if none           */
+  u32 sibling;                        /* Next sibling, 0 if none          */
+  s32 ext_id;                         /* Extra ending here, -1 if none    */
+  u8  byte;                           /* Edge label                       */
+};
+
+static struct ext_trie_node* ext_trie;  /* Node pool; slot 0 is the null  */
+static u32 ext_trie_cnt;              /* Nodes in use                     */
+static u32 ext_trie_root[256];        /* Root children, by first byte     */
+
+static u8*  ext_matched;              /* Extras matching at current pos   */
+static u8*  ext_dup;                  /* Exact duplicates, never fuzzed   */
+static u32* ext_hits;                 /* Flags set by the last trie walk  */
+static u32  ext_hits_cnt;
+
 static u8* (*post_handler)(u8* buf, u32* len);
 
 /* Interesting values, as per config.h */
@@ -406,6 +642,81 @@ static void shuffle_ptrs(void** ptrs, u32 cnt) {
 
 #ifdef HAVE_AFFINITY
 
+/* Mark the CPUs named by a sysfs cpulist string ("0-31,64-95") in val[]. */
+
+static void mark_cpu_list(u8* str, s32* val, s32 mark, u32 cnt) {
+
+  u8* tok = (u8*)strtok((char*)str, ",");
+
+  while (tok) {
+
+    u32 lo, hi;
+
+    if (sscanf((char*)tok, "%u-%u", &lo, &hi) == 1) hi = lo;
+
+    for (; lo <= hi && lo < cnt; lo++) val[lo] = mark;
+
+    tok = (u8*)strtok(NULL, ",");
+
+  }
+
+}
+
+
+/* Read the NUMA and SMT topology from /sys: cpu_node[i] gets the memory
+   node of CPU i, cpu_pair[i] the lowest-numbered hardware thread sharing
+   its physical core. Degrades to a flat single-node, no-SMT view when the
+   files are absent. Returns the number of nodes seen. */
+
+static u32 read_cpu_topology(s32* cpu_node, s32* cpu_pair, u32 cnt) {
+
+  u32 i, node;
+
+  for (i = 0; i < cnt; i++) {
+    cpu_node[i] = 0;
+    cpu_pair[i] = i;
+  }
+
+  for (node = 0; node < cnt; node++) {
+
+    u8* fn = alloc_printf("/sys/devices/system/node/node%u/cpulist", node);
+    FILE* f = fopen(fn, "r");
+    u8 tmp[MAX_LINE];
+
+    ck_free(fn);
+
+    if (!f) break;
+
+    if (fgets(tmp, MAX_LINE, f)) mark_cpu_list(tmp, cpu_node, node, cnt);
+
+    fclose(f);
+
+  }
+
+  for (i = 0; i < cnt; i++) {
+
+    u8* fn = alloc_printf("/sys/devices/system/cpu/cpu%u/topology/"
+                          "thread_siblings_list", i);
+    FILE* f = fopen(fn, "r");
+    u8 tmp[MAX_LINE];
+    u32 first;
+
+    ck_free(fn);
+
+    if (!f) continue;
+
+    if (fgets(tmp, MAX_LINE, f) && sscanf(tmp, "%u", &first) == 1 &&
+        first < cnt) cpu_pair[i] = first;
+
+    fclose(f);
+
+  }
+
+  return node ? node : 1;
+
+}
+
+
 /* Build a list of processes bound to specific cores. Returns -1 if nothing
    can be found. Assumes an upper bound of 4k CPUs. */
 
@@ -416,7 +727,8 @@ static void bind_to_free_cpu(void) {
   cpu_set_t c;
 
   u8 cpu_used[4096] = { 0 };
-  u32 i;
+  u32 i, n_nodes;
+  s32 *cpu_node, *cpu_pair;
 
   if (cpu_core_count < 2) return;
 
@@ -490,20 +802,83 @@ static void bind_to_free_cpu(void) {
   }
 
   closedir(d);
+
+  /* Pull in the NUMA / SMT layout, so that we can prefer a physical core
+     with every hardware thread free (landing on the busy half of a
+     hyperthread pair degrades both tenants) and reserve the sibling
+     thread for the fork server. */
+
+  cpu_node = ck_alloc(cpu_core_count * sizeof(s32));
+  cpu_pair = ck_alloc(cpu_core_count * sizeof(s32));
+
+  n_nodes  = read_cpu_topology(cpu_node, cpu_pair, cpu_core_count);
+
   if (cpu_to_bind_given) {
 
     if (cpu_to_bind >= cpu_core_count)
       FATAL("The CPU core id to bind should be between 0 and %u", cpu_core_count - 1);
-    
+
     if (cpu_used[cpu_to_bind])
       FATAL("The CPU core #%u to bind is not free!", cpu_to_bind);
 
     i = cpu_to_bind;
-    
+
   } else {
 
-    for (i = 0; i < cpu_core_count; i++) if (!cpu_used[i]) break;
-    
+    u32 j;
+    s32 best_node = -1;
+    u32* node_free = ck_alloc(n_nodes * sizeof(u32));
+
+    /* Count fully-free physical cores per node, then settle on the node
+       with the most of them - spreading instances out keeps the memory
+       bus contention down - and grab its first such core. */
+
+    for (i = 0; i < cpu_core_count; i++) {
+
+      u8 all_free = 1;
+
+      if (cpu_pair[i] != i) continue;      /* Not a pair leader. */
+
+      for (j = 0; j < cpu_core_count; j++)
+        if (cpu_pair[j] == i && cpu_used[j]) { all_free = 0; break; }
+
+      if (all_free) node_free[cpu_node[i]]++;
+
+    }
+
+    for (i = 0; i < n_nodes; i++)
+      if (best_node < 0 || node_free[i] > node_free[best_node])
+        best_node = i;
+
+    if (node_free[best_node]) {
+
+      for (i = 0; i < cpu_core_count; i++) {
+
+        u8 all_free = 1;
+
+        if (cpu_pair[i] != i || cpu_node[i] != best_node) continue;
+
+        for (j = 0; j < cpu_core_count; j++)
+          if (cpu_pair[j] == i && cpu_used[j]) { all_free = 0; break; }
+
+        if (all_free) break;
+
+      }
+
+    } else {
+
+      /* No untouched physical cores left; fall back to any free hardware
+         thread, as before. */
+
+      for (i = 0; i < cpu_core_count; i++) if (!cpu_used[i]) break;
+
+      if (i != cpu_core_count)
+        WARNF("Only hyperthread siblings of busy cores left - sharing one.");
+
+    }
+
+    ck_free(node_free);
+
   }
 
   if (i == cpu_core_count) {
@@ -519,7 +894,30 @@ static void bind_to_free_cpu(void) {
 
   }
 
-  OKF("Found a free CPU core, binding to #%u.", i);
+  /* If the chosen core has a free sibling thread, reserve it for the fork
+     server: run_target_start() overlaps the target's runtime with our own
+     bookkeeping, and the pair shares L1/L2, so the two halves complement
+     each other nicely. */
+
+  {
+
+    u32 j;
+
+    for (j = 0; j < (u32)cpu_core_count; j++)
+      if (j != i && cpu_pair[j] == cpu_pair[i] && !cpu_used[j]) {
+        cpu_aff_child = j;
+        break;
+      }
+
+  }
+
+  if (cpu_aff_child >= 0)
+    OKF("Binding to CPU #%u (node %u), fork server to sibling #%u.",
+        i, cpu_node[i], cpu_aff_child);
+  else if (n_nodes > 1)
+    OKF("Found a free CPU core, binding to #%u (node %u).", i, cpu_node[i]);
+  else
+    OKF("Found a free CPU core, binding to #%u.", i);
 
   cpu_aff = i;
 
@@ -529,6 +927,9 @@ static void bind_to_free_cpu(void) {
   if (sched_setaffinity(0, sizeof(c), &c))
     PFATAL("sched_setaffinity failed");
 
+  ck_free(cpu_node);
+  ck_free(cpu_pair);
+
 }
 
 #endif /* HAVE_AFFINITY */
@@ -719,6 +1120,133 @@ static u8* DTD(u64 cur_ms, u64 event_ms) {
 }
 
 
+/* Deterministic stages can take hours on large inputs, and a restart used
+   to throw all of that work away for any entry without passed_det. To avoid
+   this, we periodically checkpoint the current stage id and position -
+   plus the effector map, once it has been computed - into a .state sidecar
+   that fuzz_one() consults before redoing the stages. */
+
+static u8* det_ckpt_fname(struct queue_entry* q) {
+
+  u8* fn = strrchr(q->fname, '/');
+
+  return alloc_printf("%s/queue/.state/det_progress/%s", out_dir, fn + 1);
+
+}
+
+
+/* Write a progress checkpoint for the entry being fuzzed. Throttled, so
+   the deterministic loops only touch the disk every DET_CKPT_INTERVAL
+   positions; eff_map is NULL for the stages that precede its creation. */
+
+static void save_det_checkpoint(u32 stage_id, u32 pos, u32 len,
+                                u8* eff_map, u32 eff_len, u32 eff_cnt) {
+
+  static u32 last_stage = (u32)-1, last_pos;
+
+  u32 hdr[4];
+  u8* fn;
+  s32 fd;
+
+  if (stage_id == last_stage && pos - last_pos < DET_CKPT_INTERVAL) return;
+
+  last_stage = stage_id;
+  last_pos   = pos;
+
+  hdr[0] = len;
+  hdr[1] = stage_id;
+  hdr[2] = pos;
+  hdr[3] = eff_cnt;
+
+  fn = det_ckpt_fname(queue_cur);
+
+  fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  ck_write(fd, hdr, sizeof(hdr), fn);
+  if (eff_map) ck_write(fd, eff_map, eff_len, fn);
+
+  close(fd);
+  ck_free(fn);
+
+}
+
+
+/* Try to load a checkpoint for the entry we are about to fuzz, filling in
+   det_resuming and the det_ck_* values. Stale or malformed files are
+   silently ignored. */
+
+static void load_det_checkpoint(struct queue_entry* q) {
+
+  struct stat st;
+  u32 hdr[4];
+  u8* fn;
+  s32 fd;
+
+  det_resuming = 0;
+
+  fn = det_ckpt_fname(q);
+  fd = open(fn, O_RDONLY);
+  ck_free(fn);
+
+  if (fd < 0) return;
+
+  if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(hdr) &&
+      read(fd, hdr, sizeof(hdr)) == sizeof(hdr) &&
+      hdr[0] == q->len && hdr[1] <= STAGE_EXTRAS_AO) {
+
+    u32 elen = st.st_size - sizeof(hdr);
+
+    ck_free(det_ck_eff);
+    det_ck_eff = 0;
+
+    if (elen) {
+      det_ck_eff = ck_alloc_nozero(elen);
+      if (read(fd, det_ck_eff, elen) != elen) {
+        ck_free(det_ck_eff);
+        det_ck_eff = 0;
+        elen = 0;
+      }
+    }
+
+    det_ck_stage   = hdr[1];
+    det_ck_pos     = hdr[2];
+    det_ck_eff_cnt = hdr[3];
+    det_ck_eff_len = elen;
+
+    /* A checkpoint past the 8/8 stage is useless without the map. */
+
+    det_resuming = (det_ck_stage < STAGE_FLIP8 || det_ck_eff);
+
+  }
+
+  close(fd);
+
+}
+
+
+/* Figure out where a deterministic stage should start, based on any loaded
+   checkpoint: at stage_max (i.e., nowhere) for stages the previous session
+   already completed, at the saved position for the interrupted stage, and
+   at 0 for everything past it. Stages are visited in increasing id order,
+   so we can drop det_resuming as soon as we catch up. */
+
+static u32 det_stage_init(u32 stage_id, u32 stage_max) {
+
+  if (!det_resuming) return 0;
+
+  if (det_ck_stage <= stage_id) {
+
+    det_resuming = 0;
+    return (det_ck_stage == stage_id) ? det_ck_pos : 0;
+
+  }
+
+  return stage_max;
+
+}
+
+
 /* Mark deterministic checks as done for a particular queue entry. We use the
    .state file to avoid repeating deterministic fuzzing when resuming aborted
    scans. */
@@ -736,6 +1264,12 @@ static void mark_as_det_done(struct queue_entry* q) {
 
   ck_free(fn);
 
+  /* Any in-progress checkpoint is now obsolete. */
+
+  fn = det_ckpt_fname(q);
+  unlink(fn); /* Ignore errors */
+  ck_free(fn);
+
   q->passed_det = 1;
 
 }
@@ -799,13 +1333,15 @@ static void mark_as_redundant(struct queue_entry* q, u8 state) {
 }
 
 
-/* Append new test case to the queue. */
+/* Append new test case to the queue. Queue entries are immortal, so both
+   the struct and a copy of the file name come from a bump arena instead of
+   the general-purpose allocator; the caller keeps ownership of fname. */
 
 static void add_to_queue(u8* fname, u32 len, u8 passed_det) {
 
-  struct queue_entry* q = ck_alloc(sizeof(struct queue_entry));
+  struct queue_entry* q = ck_arena_alloc(&q_arena, sizeof(struct queue_entry));
 
-  q->fname        = fname;
+  q->fname        = ck_arena_strdup(&q_arena, fname);
   q->len          = len;
   q->depth        = cur_depth + 1;
   q->passed_det   = passed_det;
@@ -846,218 +1382,209 @@ EXP_ST void destroy_queue(void) {
   while (q) {
 
     n = q->next;
-    ck_free(q->fname);
     ck_free(q->trace_mini);
-    ck_free(q);
+    ck_free(q->cached);
     q = n;
 
   }
 
+  ck_arena_destroy(&q_arena);
+
 }
 
 
-/* Write bitmap to file. The bitmap is useful mostly for the secret
-   -B option, to focus a separate fuzzing session on a particular
-   interesting input without rediscovering all the others. */
+static void aw_drain(void);
 
-EXP_ST void write_bitmap(void) {
+static struct ck_scratch sc_qc;       /* Bypass buffer for reads of
+                                         entries too big to cache         */
 
-  u8* fname;
-  s32 fd;
+/* Evict the corpus cache entry, returning its bytes to the budget. */
 
-  if (!bitmap_changed) return;
-  bitmap_changed = 0;
+static void queue_cache_drop(struct queue_entry* q) {
 
-  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
-  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (!q->cached) return;
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+  if (q->lru_prev) q->lru_prev->lru_next = q->lru_next;
+  else qc_head = q->lru_next;
 
-  ck_write(fd, virgin_bits, MAP_SIZE, fname);
+  if (q->lru_next) q->lru_next->lru_prev = q->lru_prev;
+  else qc_tail = q->lru_prev;
 
-  close(fd);
-  ck_free(fname);
+  qc_bytes -= q->cached_len;
 
-}
+  ck_free(q->cached);
 
+  q->cached   = 0;
+  q->lru_prev = q->lru_next = 0;
 
-/* Read bitmap from file. This is for the -B option again. */
+}
 
-EXP_ST void read_bitmap(u8* fname) {
 
-  s32 fd = open(fname, O_RDONLY);
+/* Reserve a cache slot for the entry, evicting colder ones to make room.
+   Returns the buffer to be filled by the caller, or NULL if the entry is
+   not worth caching. */
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+static u8* queue_cache_slot(struct queue_entry* q) {
 
-  ck_read(fd, virgin_bits, MAP_SIZE, fname);
+  if (!qc_budget || q->cached || q->len > qc_budget / 4) return NULL;
 
-  close(fd);
+  while (qc_bytes + q->len > qc_budget) {
 
-}
+    struct queue_entry* v = qc_tail;
 
+    /* Favored entries are the ones fuzz_one() keeps coming back to, so
+       sacrifice cold non-favored ones first. */
 
-/* Check if the current execution path brings anything new to the table.
-   Update virgin bits to reflect the finds. Returns 1 if the only change is
-   the hit-count for a particular tuple; 2 if there are new tuples seen. 
-   Updates the map, so subsequent calls will always return 0.
+    while (v && v->favored) v = v->lru_prev;
+    if (!v) v = qc_tail;
 
-   This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+    queue_cache_drop(v);
 
-static inline u8 has_new_bits(u8* virgin_map) {
+  }
 
-#ifdef WORD_SIZE_64
+  q->cached     = ck_alloc_nozero(q->len);
+  q->cached_len = q->len;
 
-  u64* current = (u64*)trace_bits;
-  u64* virgin  = (u64*)virgin_map;
+  q->lru_prev = 0;
+  q->lru_next = qc_head;
 
-  u32  i = (MAP_SIZE >> 3);
+  if (qc_head) qc_head->lru_prev = q; else qc_tail = q;
+  qc_head = q;
 
-#else
+  qc_bytes += q->len;
 
-  u32* current = (u32*)trace_bits;
-  u32* virgin  = (u32*)virgin_map;
+  return q->cached;
 
-  u32  i = (MAP_SIZE >> 2);
+}
 
-#endif /* ^WORD_SIZE_64 */
 
-  u8   ret = 0;
+/* Opportunistically cache contents that are already sitting in memory,
+   sparing the read-back when the entry comes up for fuzzing. */
 
-  while (i--) {
+static void queue_cache_put(struct queue_entry* q, const u8* mem) {
 
-    /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
-       that have not been already cleared from the virgin map - since this will
-       almost always be the case. */
+  u8* slot = queue_cache_slot(q);
 
-    if (unlikely(*current) && unlikely(*current & *virgin)) {
+  if (slot) memcpy(slot, mem, q->len);
 
-      if (likely(ret < 2)) {
+}
 
-        u8* cur = (u8*)current;
-        u8* vir = (u8*)virgin;
 
-        /* Looks like we have not found any new bytes yet; see if any non-zero
-           bytes in current[] are pristine in virgin[]. */
+/* Get the contents of a queue entry, preferably straight from the cache.
+   The returned buffer stays valid until the next cache operation and must
+   not be modified by the caller. */
 
-#ifdef WORD_SIZE_64
+static u8* queue_cache_fetch(struct queue_entry* q) {
 
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-            (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-            (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff)) ret = 2;
-        else ret = 1;
+  s32 fd;
+  u8* mem;
 
-#else
+  if (q->cached) {
 
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff)) ret = 2;
-        else ret = 1;
+    if (q->cached_len == q->len) {
 
-#endif /* ^WORD_SIZE_64 */
+      /* Bump the entry to the head of the LRU list. */
+
+      if (qc_head != q) {
+
+        q->lru_prev->lru_next = q->lru_next;
+
+        if (q->lru_next) q->lru_next->lru_prev = q->lru_prev;
+        else qc_tail = q->lru_prev;
+
+        q->lru_prev = 0;
+        q->lru_next = qc_head;
+        qc_head->lru_prev = q;
+        qc_head = q;
 
       }
 
-      *virgin &= ~*current;
+      return q->cached;
 
     }
 
-    current++;
-    virgin++;
+    /* Stale length - the file was rewritten behind our back. */
 
-  }
+    queue_cache_drop(q);
 
-  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
+  }
 
-  return ret;
+  /* Cache miss. The entry's file may still sit in the write-behind ring,
+     so let the writer catch up before reading it back. */
 
-}
+  aw_drain();
 
+  mem = queue_cache_slot(q);
 
-/* Count the number of bits set in the provided bitmap. Used for the status
-   screen several times every second, does not have to be fast. */
+  if (!mem) mem = ck_scratch_get(&sc_qc, q->len);
 
-static u32 count_bits(u8* mem) {
+  fd = open(q->fname, O_RDONLY);
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+  if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
 
-  while (i--) {
+  ck_read(fd, mem, q->len, q->fname);
 
-    u32 v = *(ptr++);
+  close(fd);
 
-    /* This gets called on the inverse, virgin bitmap; optimize for sparse
-       data. */
+  return mem;
 
-    if (v == 0xffffffff) {
-      ret += 32;
-      continue;
-    }
+}
 
-    v -= ((v >> 1) & 0x55555555);
-    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
 
-  }
+/* Write bitmap to file. The bitmap is useful mostly for the secret
+   -B option, to focus a separate fuzzing session on a particular
+   interesting input without rediscovering all the others. */
 
-  return ret;
+EXP_ST void write_bitmap(void) {
 
-}
+  u8* fname;
+  s32 fd;
 
+  if (!bitmap_changed) return;
+  bitmap_changed = 0;
 
-#define FF(_b)  (0xff << ((_b) << 3))
+  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
+  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 
-/* Count the number of bytes set in the bitmap. Called fairly sporadically,
-   mostly to update the status screen or calibrate and examine confirmed
-   new paths. */
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-static u32 count_bytes(u8* mem) {
+  ck_write(fd, virgin_bits, map_size, fname);
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+  close(fd);
+  ck_free(fname);
 
-  while (i--) {
+}
 
-    u32 v = *(ptr++);
 
-    if (!v) continue;
-    if (v & FF(0)) ret++;
-    if (v & FF(1)) ret++;
-    if (v & FF(2)) ret++;
-    if (v & FF(3)) ret++;
+/* Read bitmap from file. This is for the -B option again. */
 
-  }
+EXP_ST void read_bitmap(u8* fname) {
 
-  return ret;
+  s32 fd = open(fname, O_RDONLY);
 
-}
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
+  ck_read(fd, virgin_bits, map_size, fname);
 
-/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
-   status screen, several calls per second or so. */
+  close(fd);
 
-static u32 count_non_255_bytes(u8* mem) {
+}
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
 
-  while (i--) {
+/* Check if the current execution path brings anything new to the table.
+   Update virgin bits to reflect the finds. Returns 1 if the only change is
+   the hit-count for a particular tuple; 2 if there are new tuples seen. 
+   Updates the map, so subsequent calls will always return 0.
 
-    u32 v = *(ptr++);
+   This function is called after every exec() on a fairly large buffer, so
+   it needs to be fast. The heavy lifting lives in bitmap-inl.h, which picks
+   a vectorized kernel when the CPU has one. */
 
-    /* This is called on the virgin bitmap, so optimize for the most likely
-       case. */
+static inline u8 has_new_bits(u8* virgin_map) {
 
-    if (v == 0xffffffff) continue;
-    if ((v & FF(0)) != FF(0)) ret++;
-    if ((v & FF(1)) != FF(1)) ret++;
-    if ((v & FF(2)) != FF(2)) ret++;
-    if ((v & FF(3)) != FF(3)) ret++;
+  u8 ret = has_new_bits_in(trace_bits, virgin_map, map_size);
 
-  }
+  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
 
   return ret;
 
@@ -1080,7 +1607,7 @@ static const u8 simplify_lookup[256] = {
 
 static void simplify_trace(u64* mem) {
 
-  u32 i = MAP_SIZE >> 3;
+  u32 i = map_size >> 3;
 
   while (i--) {
 
@@ -1111,7 +1638,7 @@ static void simplify_trace(u64* mem) {
 
 static void simplify_trace(u32* mem) {
 
-  u32 i = MAP_SIZE >> 2;
+  u32 i = map_size >> 2;
 
   while (i--) {
 
@@ -1136,119 +1663,76 @@ static void simplify_trace(u32* mem) {
 #endif /* ^WORD_SIZE_64 */
 
 
-/* Destructively classify execution counts in a trace. This is used as a
-   preprocessing step for any newly acquired traces. Called on every exec,
-   must be fast. */
-
-static const u8 count_class_lookup8[256] = {
-
-  [0]           = 0,
-  [1]           = 1,
-  [2]           = 2,
-  [3]           = 4,
-  [4 ... 7]     = 8,
-  [8 ... 15]    = 16,
-  [16 ... 31]   = 32,
-  [32 ... 127]  = 64,
-  [128 ... 255] = 128
-
-};
-
-static u16 count_class_lookup16[65536];
-
+/* Get rid of shared memory (atexit handler). */
 
-EXP_ST void init_count_class16(void) {
+static void remove_shm(void) {
 
-  u32 b1, b2;
+  shmctl(shm_id, IPC_RMID, NULL);
 
-  for (b1 = 0; b1 < 256; b1++) 
-    for (b2 = 0; b2 < 256; b2++)
-      count_class_lookup16[(b1 << 8) + b2] = 
-        (count_class_lookup8[b1] << 8) |
-        count_class_lookup8[b2];
+  if (shm_fuzz_id >= 0) shmctl(shm_fuzz_id, IPC_RMID, NULL);
 
 }
 
 
-#ifdef WORD_SIZE_64
-
-static inline void classify_counts(u64* mem) {
-
-  u32 i = MAP_SIZE >> 3;
-
-  while (i--) {
-
-    /* Optimize for sparse bitmaps. */
-
-    if (unlikely(*mem)) {
+/* Compact trace bytes into a smaller bitmap. We effectively just drop the
+   count information here. This is called only sporadically, for some
+   new paths. */
 
-      u16* mem16 = (u16*)mem;
+static void minimize_bits(u8* dst, u8* src) {
 
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
-      mem16[2] = count_class_lookup16[mem16[2]];
-      mem16[3] = count_class_lookup16[mem16[3]];
+  u32 i = 0;
 
-    }
+  while (i < map_size) {
 
-    mem++;
+    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
+    i++;
 
   }
 
 }
 
-#else
-
-static inline void classify_counts(u32* mem) {
 
-  u32 i = MAP_SIZE >> 2;
-
-  while (i--) {
-
-    /* Optimize for sparse bitmaps. */
+/* Record a newly-occupied top_rated[] slot in tr_slots[], keeping the list
+   sorted so that cull_queue() can walk winners in map order without touching
+   the (mostly empty) remainder of top_rated[]. Slots are never vacated, so
+   this list only ever grows. */
 
-    if (unlikely(*mem)) {
+static void tr_slot_insert(u32 slot) {
 
-      u16* mem16 = (u16*)mem;
+  u32 lo = 0, hi = tr_slot_cnt;
 
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
+  while (lo < hi) {
 
-    }
+    u32 mid = (lo + hi) >> 1;
 
-    mem++;
+    if (tr_slots[mid] < slot) lo = mid + 1; else hi = mid;
 
   }
 
-}
-
-#endif /* ^WORD_SIZE_64 */
-
-
-/* Get rid of shared memory (atexit handler). */
-
-static void remove_shm(void) {
+  memmove(tr_slots + lo + 1, tr_slots + lo,
+          (tr_slot_cnt - lo) * sizeof(u32));
 
-  shmctl(shm_id, IPC_RMID, NULL);
+  tr_slots[lo] = slot;
+  tr_slot_cnt++;
 
 }
 
 
-/* Compact trace bytes into a smaller bitmap. We effectively just drop the
-   count information here. This is called only sporadically, for some
-   new paths. */
-
-static void minimize_bits(u8* dst, u8* src) {
+/* Append an entry to the in-progress favored set (fav_cur), growing the
+   arrays as needed. */
 
-  u32 i = 0;
+static void fav_push(struct queue_entry* q) {
 
-  while (i < MAP_SIZE) {
+  if (fav_cur_cnt == fav_alloc) {
 
-    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
-    i++;
+    fav_alloc = fav_alloc ? fav_alloc * 2 : 64;
+    fav_prev  = ck_realloc(fav_prev, fav_alloc * sizeof(struct queue_entry*));
+    fav_cur   = ck_realloc(fav_cur,  fav_alloc * sizeof(struct queue_entry*));
 
   }
 
+  fav_cur[fav_cur_cnt++] = q;
+
 }
 
 
@@ -1265,12 +1749,13 @@ static void minimize_bits(u8* dst, u8* src) {
 static void update_bitmap_score(struct queue_entry* q) {
 
   u32 i;
-  u64 fav_factor = q->exec_us * q->len;
+
+  q->fav_factor = q->exec_us * q->len;
 
   /* For every byte set in trace_bits[], see if there is a previous winner,
      and how it compares to us. */
 
-  for (i = 0; i < MAP_SIZE; i++)
+  for (i = 0; i < map_size; i++)
 
     if (trace_bits[i]) {
 
@@ -1278,7 +1763,7 @@ static void update_bitmap_score(struct queue_entry* q) {
 
          /* Faster-executing or smaller test cases are favored. */
 
-         if (fav_factor > top_rated[i]->exec_us * top_rated[i]->len) continue;
+         if (q->fav_factor > top_rated[i]->fav_factor) continue;
 
          /* Looks like we're going to win. Decrease ref count for the
             previous winner, discard its trace_bits[] if necessary. */
@@ -1288,7 +1773,7 @@ static void update_bitmap_score(struct queue_entry* q) {
            top_rated[i]->trace_mini = 0;
          }
 
-       }
+       } else tr_slot_insert(i);
 
        /* Insert ourselves as the new winner. */
 
@@ -1296,7 +1781,7 @@ static void update_bitmap_score(struct queue_entry* q) {
        q->tc_ref++;
 
        if (!q->trace_mini) {
-         q->trace_mini = ck_alloc(MAP_SIZE >> 3);
+         q->trace_mini = ck_alloc(map_size >> 3);
          minimize_bits(q->trace_mini, trace_bits);
        }
 
@@ -1316,53 +1801,82 @@ static void update_bitmap_score(struct queue_entry* q) {
 static void cull_queue(void) {
 
   struct queue_entry* q;
-  static u8 temp_v[MAP_SIZE >> 3];
-  u32 i;
+  struct queue_entry** tmp;
+  static u8* temp_v;
+  u32 i, si;
 
   if (dumb_mode || !score_changed) return;
 
+  if (!temp_v) temp_v = ck_alloc(map_size >> 3);
+
   score_changed = 0;
 
-  memset(temp_v, 255, MAP_SIZE >> 3);
+  memset(temp_v, 255, map_size >> 3);
 
   queued_favored  = 0;
   pending_favored = 0;
 
-  q = queue;
+  /* Only entries favored by the previous cull can have the flag set, so
+     there is no need to walk the whole queue to clear it. */
 
-  while (q) {
-    q->favored = 0;
-    q = q->next;
-  }
+  for (i = 0; i < fav_prev_cnt; i++) fav_prev[i]->favored = 0;
+
+  fav_cur_cnt = 0;
 
   /* Let's see if anything in the bitmap isn't captured in temp_v.
-     If yes, and if it has a top_rated[] contender, let's use it. */
+     If yes, and if it has a top_rated[] contender, let's use it. We walk
+     tr_slots[] rather than all of top_rated[], which is equivalent but
+     skips the empty slots. */
+
+  for (si = 0; si < tr_slot_cnt; si++) {
 
-  for (i = 0; i < MAP_SIZE; i++)
-    if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
+    i = tr_slots[si];
 
-      u32 j = MAP_SIZE >> 3;
+    if (temp_v[i >> 3] & (1 << (i & 7))) {
+
+      u32 j = map_size >> 3;
 
       /* Remove all bits belonging to the current entry from temp_v. */
 
-      while (j--) 
+      while (j--)
         if (top_rated[i]->trace_mini[j])
           temp_v[j] &= ~top_rated[i]->trace_mini[j];
 
       top_rated[i]->favored = 1;
       queued_favored++;
 
+      fav_push(top_rated[i]);
+
       if (!top_rated[i]->was_fuzzed) pending_favored++;
 
     }
 
-  q = queue;
+  }
+
+  /* Refresh the on-disk redundancy markers. Only entries whose favored
+     status could have changed need a look: members of the old and new
+     favored sets, plus anything queued since the last cull. */
+
+  for (i = 0; i < fav_prev_cnt; i++)
+    if (!fav_prev[i]->favored) mark_as_redundant(fav_prev[i], 1);
+
+  for (i = 0; i < fav_cur_cnt; i++)
+    mark_as_redundant(fav_cur[i], 0);
+
+  q = last_cull_top ? last_cull_top->next : queue;
 
   while (q) {
     mark_as_redundant(q, !q->favored);
     q = q->next;
   }
 
+  last_cull_top = queue_top;
+
+  tmp          = fav_prev;
+  fav_prev     = fav_cur;
+  fav_cur      = tmp;
+  fav_prev_cnt = fav_cur_cnt;
+
 }
 
 
@@ -1372,12 +1886,20 @@ EXP_ST void setup_shm(void) {
 
   u8* shm_str;
 
-  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
+  /* In -j mode, the virgin maps are shared and were initialized once in
+     setup_multicore(); wiping them here would erase every claim made by
+     workers that started earlier in the stagger. */
+
+  if (!multicore_jobs) {
 
-  memset(virgin_tmout, 255, MAP_SIZE);
-  memset(virgin_crash, 255, MAP_SIZE);
+    if (!in_bitmap) memset(virgin_bits, 255, map_size);
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+    memset(virgin_tmout, 255, map_size);
+    memset(virgin_crash, 255, map_size);
+
+  }
+
+  shm_id = shmget(IPC_PRIVATE, map_size, IPC_CREAT | IPC_EXCL | 0600);
 
   if (shm_id < 0) PFATAL("shmget() failed");
 
@@ -1395,9 +1917,42 @@ EXP_ST void setup_shm(void) {
   ck_free(shm_str);
 
   trace_bits = shmat(shm_id, NULL, 0);
-  
+
   if (trace_bits == (void *)-1) PFATAL("shmat() failed");
 
+  /* Have the classify kernels log which 32-byte chunks they saw non-zero,
+     so that run_target_start() can usually reset just those. */
+
+  cc_dirty = ck_alloc((map_size >> 5) * sizeof(u32));
+
+  /* Fault the segment in right away: we are already bound to a CPU at
+     this point, so the kernel's first-touch policy places the trace map
+     on our local NUMA node - which is also the fork server's, since that
+     runs on the sibling hardware thread. */
+
+  memset(trace_bits, 0, map_size);
+
+  /* With AFL_SHM_TESTCASE, set up a second segment used to hand test cases
+     to targets built with __AFL_FUZZ_TESTCASE_BUF (see llvm_mode/README.llvm).
+     Layout is a 32-bit length word followed by up to MAX_FILE data bytes. */
+
+  if (shm_testcase_mode) {
+
+    shm_fuzz_id = shmget(IPC_PRIVATE, MAX_FILE + 4,
+                         IPC_CREAT | IPC_EXCL | 0600);
+
+    if (shm_fuzz_id < 0) PFATAL("shmget() failed");
+
+    shm_str = alloc_printf("%d", shm_fuzz_id);
+    setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
+
+    shm_fuzz = shmat(shm_fuzz_id, NULL, 0);
+
+    if (shm_fuzz == (void *)-1) PFATAL("shmat() failed");
+
+  }
+
 }
 
 
@@ -1510,6 +2065,8 @@ static void read_testcases(void) {
 
     add_to_queue(fn, st.st_size, passed_det);
 
+    ck_free(fn);
+
   }
 
   free(nl); /* not tracked */
@@ -1551,6 +2108,122 @@ static int compare_extras_use_d(const void* p1, const void* p2) {
 
 /* Read extras from a file, sort by size. */
 
+/* Trie helpers for the user extras. Nodes are referenced by index, since
+   the pool can move when it grows. */
+
+static u32 ext_trie_new_node(u8 byte) {
+
+  ext_trie = ck_realloc_block(ext_trie, (ext_trie_cnt + 1) *
+               sizeof(struct ext_trie_node));
+
+  ext_trie[ext_trie_cnt].child   = 0;
+  ext_trie[ext_trie_cnt].sibling = 0;
+  ext_trie[ext_trie_cnt].ext_id  = -1;
+  ext_trie[ext_trie_cnt].byte    = byte;
+
+  return ext_trie_cnt++;
+
+}
+
+
+/* Index the loaded extras. Called once, after load_extras() has sorted
+   them. Tokens that are byte-for-byte duplicates of an earlier one are
+   flagged in ext_dup[] and never fuzzed - the old linear guard used to
+   skip those by accident, and doing it on purpose is strictly better. */
+
+static void build_extra_trie(void) {
+
+  u32 i, d;
+
+  ext_trie_cnt = 1;                   /* Slot 0 stays the null node. */
+  ext_trie = ck_realloc_block(ext_trie, sizeof(struct ext_trie_node));
+
+  ext_matched = ck_alloc(extras_cnt);
+  ext_dup     = ck_alloc(extras_cnt);
+  ext_hits    = ck_alloc(extras_cnt * sizeof(u32));
+
+  for (i = 0; i < extras_cnt; i++) {
+
+    u32 cur = 0;
+
+    for (d = 0; d < extras[i].len; d++) {
+
+      u8  b = extras[i].data[d];
+      u32 nxt;
+
+      if (!cur) {
+
+        nxt = ext_trie_root[b];
+        if (!nxt) nxt = ext_trie_root[b] = ext_trie_new_node(b);
+
+      } else {
+
+        nxt = ext_trie[cur].child;
+
+        while (nxt && ext_trie[nxt].byte != b) nxt = ext_trie[nxt].sibling;
+
+        if (!nxt) {
+
+          nxt = ext_trie_new_node(b);
+          ext_trie[nxt].sibling = ext_trie[cur].child;
+          ext_trie[cur].child   = nxt;
+
+        }
+
+      }
+
+      cur = nxt;
+
+    }
+
+    if (ext_trie[cur].ext_id >= 0) ext_dup[i] = 1;
+    else ext_trie[cur].ext_id = i;
+
+  }
+
+}
+
+
+/* Walk the trie from buf, flagging in ext_matched[] every user extra of
+   up to max_len bytes that matches there (i.e., whose overwrite would be
+   a no-op). Flags from the previous walk are cleared first, so callers
+   need no cleanup of their own. */
+
+static void extra_trie_matches(u8* buf, u32 max_len) {
+
+  u32 cur, d = 1;
+
+  while (ext_hits_cnt) ext_matched[ext_hits[--ext_hits_cnt]] = 0;
+
+  if (!max_len) return;
+
+  cur = ext_trie_root[buf[0]];
+
+  while (cur) {
+
+    u32 nxt;
+
+    if (ext_trie[cur].ext_id >= 0) {
+
+      ext_matched[ext_trie[cur].ext_id] = 1;
+      ext_hits[ext_hits_cnt++] = ext_trie[cur].ext_id;
+
+    }
+
+    if (d >= max_len) return;
+
+    nxt = ext_trie[cur].child;
+
+    while (nxt && ext_trie[nxt].byte != buf[d]) nxt = ext_trie[nxt].sibling;
+
+    cur = nxt;
+    d++;
+
+  }
+
+}
+
+
 static void load_extras_file(u8* fname, u32* min_len, u32* max_len,
                              u32 dict_level) {
 
@@ -1783,6 +2456,8 @@ check_and_sort:
     WARNF("More than %u tokens - will use them probabilistically.",
           MAX_DET_EXTRAS);
 
+  build_extra_trie();
+
 }
 
 
@@ -2021,6 +2696,26 @@ EXP_ST void init_forkserver(char** argv) {
 
     struct rlimit r;
 
+#ifdef HAVE_AFFINITY
+
+    /* Move the fork server - and, by inheritance, every target process -
+       onto the sibling hardware thread reserved by bind_to_free_cpu().
+       The pipelined stages overlap the target's runtime with our own
+       bookkeeping, so the two sides no longer time-share one thread. */
+
+    if (cpu_aff_child >= 0) {
+
+      cpu_set_t c;
+
+      CPU_ZERO(&c);
+      CPU_SET(cpu_aff_child, &c);
+
+      sched_setaffinity(0, sizeof(c), &c); /* Ignore errors */
+
+    }
+
+#endif /* HAVE_AFFINITY */
+
     /* Umpf. On OpenBSD, the default fd limit for root users is set to
        soft 128. Let's try to fix that... */
 
@@ -2147,11 +2842,38 @@ EXP_ST void init_forkserver(char** argv) {
   setitimer(ITIMER_REAL, &it, NULL);
 
   /* If we have a four-byte "hello" message from the server, we're all set.
+     Newer instrumentation announces its compiled-in map size in that word;
+     adopt it if it is smaller than ours, bail out if it is bigger, and
+     treat anything unrecognized as a legacy hello meaning MAP_SIZE.
      Otherwise, try to figure out what went wrong. */
 
   if (rlen == 4) {
+
+    if (FS_IS_MAPSIZE(status)) {
+
+      u32 child_map = 1 << FS_MAPSIZE_POW2(status);
+
+      if (FS_MAPSIZE_POW2(status) < 6 || FS_MAPSIZE_POW2(status) > 24)
+        FATAL("Fork server announced nonsensical map size (2^%u)",
+              FS_MAPSIZE_POW2(status));
+
+      if (child_map > map_size)
+        FATAL("Target was built with a %u-byte coverage map - set "
+              "AFL_MAP_SIZE=%u and try again", child_map, child_map);
+
+      if (child_map < map_size) {
+
+        map_size = child_map;
+        ACTF("Target uses a %u-byte coverage map, scanning that much.",
+             map_size);
+
+      }
+
+    }
+
     OKF("All right - fork server is up.");
     return;
+
   }
 
   if (child_timed_out)
@@ -2284,25 +3006,42 @@ EXP_ST void init_forkserver(char** argv) {
 }
 
 
-/* Execute target application, monitoring for timeouts. Return status
-   information. The called program will update trace_bits[]. */
+static u32 prev_timed_out;            /* Carried between run_target calls */
 
-static u8 run_target(char** argv, u32 timeout) {
+static u8  trace_dirty_ok;            /* Dirty-chunk log covers the map?  */
+static u32 trace_resets;              /* Resets since last full map wipe  */
 
-  static struct itimerval it;
-  static u32 prev_timed_out = 0;
-  static u64 exec_ms = 0;
+/* Kick off a single execution of the target, without waiting for it to
+   finish. The caller gets the child running and can spend the child's
+   runtime on useful work (see the pipelined havoc loop in fuzz_one()),
+   then must reap it with run_target_finish(). Returns 1 if we are
+   shutting down and no child was started. */
 
-  int status = 0;
-  u32 tb4;
+static u8 run_target_start(char** argv, u32 timeout) {
+
+  static struct itimerval it;
 
   child_timed_out = 0;
 
-  /* After this memset, trace_bits[] are effectively volatile, so we
+  /* After this reset, trace_bits[] are effectively volatile, so we
      must prevent any earlier operations from venturing into that
-     territory. */
+     territory. The classify pass over the previous run usually left us a
+     log of the chunks it saw non-zero, in which case zeroing just those
+     is enough; do a full wipe whenever the log is stale and, as a safety
+     net, at a modest interval regardless. */
 
-  memset(trace_bits, 0, MAP_SIZE);
+  if (trace_dirty_ok && ++trace_resets & (MAP_WIPE_INTERVAL - 1)) {
+
+    classify_dirty_reset(trace_bits);
+
+  } else {
+
+    memset(trace_bits, 0, map_size);
+    cc_dirty_cnt = 0;
+
+  }
+
+  trace_dirty_ok = 0;
   MEM_BARRIER();
 
   /* If we're running in "dumb" mode, we can't rely on the fork server
@@ -2396,14 +3135,14 @@ static u8 run_target(char** argv, u32 timeout) {
 
     if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
 
-      if (stop_soon) return 0;
+      if (stop_soon) return 1;
       RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
     }
 
     if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
 
-      if (stop_soon) return 0;
+      if (stop_soon) return 1;
       RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
     }
@@ -2412,24 +3151,39 @@ static u8 run_target(char** argv, u32 timeout) {
 
   }
 
-  /* Configure timeout, as requested by user, then wait for child to terminate. */
+  /* Configure timeout, as requested by user. The SIGALRM handler simply
+     kills the child_pid and sets child_timed_out. */
 
   it.it_value.tv_sec = (timeout / 1000);
   it.it_value.tv_usec = (timeout % 1000) * 1000;
 
   setitimer(ITIMER_REAL, &it, NULL);
 
-  /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
+  return 0;
 
-  if (dumb_mode == 1 || no_forkserver) {
+}
 
-    if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
 
-  } else {
+/* Reap the execution started by run_target_start() and classify the
+   results. Returns one of the FAULT_* codes. */
 
-    s32 res;
+static u8 run_target_finish(u32 timeout) {
 
-    if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+  static struct itimerval it;
+  static u64 exec_ms = 0;
+
+  int status = 0;
+  u32 tb4;
+
+  if (dumb_mode == 1 || no_forkserver) {
+
+    if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
+
+  } else {
+
+    s32 res;
+
+    if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
 
       if (stop_soon) return 0;
       RPFATAL(res, "Unable to communicate with fork server (OOM?)");
@@ -2459,11 +3213,15 @@ static u8 run_target(char** argv, u32 timeout) {
 
   tb4 = *(u32*)trace_bits;
 
-#ifdef WORD_SIZE_64
-  classify_counts((u64*)trace_bits);
-#else
-  classify_counts((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+  /* Frequency-based schedules hash every single trace; fold that hash
+     into the classification sweep instead of doing a second one. */
+
+  if (n_fuzz_tab)
+    trace_cksum = classify_counts_hash(trace_bits, map_size, HASH_CONST);
+  else
+    classify_counts(trace_bits, map_size);
+
+  trace_dirty_ok = 1;
 
   prev_timed_out = child_timed_out;
 
@@ -2501,6 +3259,18 @@ static u8 run_target(char** argv, u32 timeout) {
 }
 
 
+/* Execute target application, monitoring for timeouts. Return status
+   information. The called program will update trace_bits[]. */
+
+static u8 run_target(char** argv, u32 timeout) {
+
+  if (run_target_start(argv, timeout)) return 0;
+
+  return run_target_finish(timeout);
+
+}
+
+
 /* Write modified data to file for testing. If out_file is set, the old file
    is unlinked and a new one is created. Otherwise, out_fd is rewound and
    truncated. */
@@ -2509,6 +3279,17 @@ static void write_to_testcase(void* mem, u32 len) {
 
   s32 fd = out_fd;
 
+  /* In SHM test case mode, the target picks the input up straight from the
+     shared segment - no file I/O or syscalls involved. */
+
+  if (shm_testcase_mode) {
+
+    *(u32*)shm_fuzz = len;
+    memcpy(shm_fuzz + 4, mem, len);
+    return;
+
+  }
+
   if (out_file) {
 
     unlink(out_file); /* Ignore errors. */
@@ -2538,6 +3319,19 @@ static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
   s32 fd = out_fd;
   u32 tail_len = len - skip_at - skip_len;
 
+  if (shm_testcase_mode) {
+
+    *(u32*)shm_fuzz = len - skip_len;
+
+    if (skip_at) memcpy(shm_fuzz + 4, mem, skip_at);
+
+    if (tail_len)
+      memcpy(shm_fuzz + 4 + skip_at, mem + skip_at + skip_len, tail_len);
+
+    return;
+
+  }
+
   if (out_file) {
 
     unlink(out_file); /* Ignore errors. */
@@ -2571,9 +3365,9 @@ static void show_stats(void);
 static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
                          u32 handicap, u8 from_queue) {
 
-  static u8 first_trace[MAP_SIZE];
+  static u8* first_trace;
 
-  u8  fault = 0, new_bits = 0, var_detected = 0, hnb = 0,
+  u8  fault = 0, new_bits = 0, var_detected = 0, hnb = 0, stale_trace = 0,
       first_run = (q->exec_cksum == 0);
 
   u64 start_us, stop_us;
@@ -2593,7 +3387,16 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
   q->cal_failed++;
 
   stage_name = "calibration";
-  stage_max  = fast_cal ? 3 : CAL_CYCLES;
+  stage_max  = fast_cal ? CAL_CYCLES_MIN : CAL_CYCLES;
+
+  /* Resuming runs deferred by the adaptive early exit below? */
+
+  if (q->cal_left) {
+
+    stage_max   = q->cal_left;
+    q->cal_left = 0;
+
+  }
 
   /* Make sure the forkserver is up before we do anything, and let's not
      count its spin-up time toward binary calibration. */
@@ -2601,13 +3404,13 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
   if (dumb_mode != 1 && !no_forkserver && !forksrv_pid)
     init_forkserver(argv);
 
-  if (q->exec_cksum) {
+  if (!first_trace) first_trace = ck_alloc(map_size);
 
-    memcpy(first_trace, trace_bits, MAP_SIZE);
-    hnb = has_new_bits(virgin_bits);
-    if (hnb > new_bits) new_bits = hnb;
+  /* With an exec_cksum already on record, we are picking up a deferred
+     calibration; trace_bits and first_trace hold data from some unrelated
+     execution, so the first run below must re-establish the baseline. */
 
-  }
+  if (q->exec_cksum) stale_trace = 1;
 
   start_us = get_cur_time_us();
 
@@ -2626,12 +3429,12 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
     if (stop_soon || fault != crash_mode) goto abort_calibration;
 
-    if (!dumb_mode && !stage_cur && !count_bytes(trace_bits)) {
+    if (!dumb_mode && !stage_cur && !count_bytes(trace_bits, map_size)) {
       fault = FAULT_NOINST;
       goto abort_calibration;
     }
 
-    cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    cksum = hash32(trace_bits, map_size, HASH_CONST);
 
     if (q->exec_cksum != cksum) {
 
@@ -2640,28 +3443,48 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
       if (q->exec_cksum) {
 
-        u32 i;
-
-        for (i = 0; i < MAP_SIZE; i++) {
+        if (stale_trace) {
 
-          if (!var_bytes[i] && first_trace[i] != trace_bits[i]) {
+          /* Nothing valid to diff against yet; start a fresh baseline
+             from this run. */
 
-            var_bytes[i] = 1;
-            stage_max    = CAL_CYCLES_LONG;
+          memcpy(first_trace, trace_bits, map_size);
+          stale_trace = 0;
+          stage_max   = CAL_CYCLES_LONG;
 
-          }
-
-        }
+        } else if (mark_var_bytes(var_bytes, first_trace, trace_bits,
+                                  map_size))
+          stage_max = CAL_CYCLES_LONG;
 
         var_detected = 1;
 
       } else {
 
         q->exec_cksum = cksum;
-        memcpy(first_trace, trace_bits, MAP_SIZE);
+        memcpy(first_trace, trace_bits, map_size);
+
+        if (shm_sync_mode || net_sync_mode) cksum_set_add(cksum);
 
       }
 
+    } else if (stale_trace) {
+
+      memcpy(first_trace, trace_bits, map_size);
+      stale_trace = 0;
+
+    }
+
+    /* Adaptive early exit: if the first CAL_CYCLES_MIN runs all produced
+       the same checksum, the case is stable enough to start fuzzing with.
+       Defer the remaining runs until the entry is actually selected -
+       which, for cases flooding in through sync, is often never. */
+
+    if (stage_cur + 1 == CAL_CYCLES_MIN && stage_max > CAL_CYCLES_MIN &&
+        !var_detected && !dumb_mode) {
+
+      q->cal_left = stage_max - CAL_CYCLES_MIN;
+      stage_max   = CAL_CYCLES_MIN;
+
     }
 
   }
@@ -2675,7 +3498,7 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
      This is used for fuzzing air time calculations in calculate_score(). */
 
   q->exec_us     = (stop_us - start_us) / stage_max;
-  q->bitmap_size = count_bytes(trace_bits);
+  q->bitmap_size = count_bytes(trace_bits, map_size);
   q->handicap    = handicap;
   q->cal_failed  = 0;
 
@@ -2701,7 +3524,7 @@ abort_calibration:
 
   if (var_detected) {
 
-    var_byte_count = count_bytes(var_bytes);
+    var_byte_count = count_bytes(var_bytes, map_size);
 
     if (!q->var_behavior) {
       mark_as_variable(q);
@@ -2727,9 +3550,9 @@ static void check_map_coverage(void) {
 
   u32 i;
 
-  if (count_bytes(trace_bits) < 100) return;
+  if (count_bytes(trace_bits, map_size) < 100) return;
 
-  for (i = (1 << (MAP_SIZE_POW2 - 1)); i < MAP_SIZE; i++)
+  for (i = (map_size >> 1); i < map_size; i++)
     if (trace_bits[i]) return;
 
   WARNF("Recompile binary with newer version of afl to improve coverage!");
@@ -2750,24 +3573,16 @@ static void perform_dry_run(char** argv) {
 
     u8* use_mem;
     u8  res;
-    s32 fd;
 
     u8* fn = strrchr(q->fname, '/') + 1;
 
     ACTF("Attempting dry run with '%s'...", fn);
 
-    fd = open(q->fname, O_RDONLY);
-    if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
+    /* This doubles as a warm-up of the corpus cache with the seeds. */
 
-    use_mem = ck_alloc_nozero(q->len);
-
-    if (read(fd, use_mem, q->len) != q->len)
-      FATAL("Short read from '%s'", q->fname);
-
-    close(fd);
+    use_mem = queue_cache_fetch(q);
 
     res = calibrate_case(argv, q, use_mem, 0, 1);
-    ck_free(use_mem);
 
     if (stop_soon) return;
 
@@ -3045,15 +3860,33 @@ static void pivot_inputs(void) {
 
     }
 
-    /* Pivot to the new queue entry. */
+    /* Pivot to the new queue entry. The old name just goes stale in the
+       arena; the handful of bytes is not worth chasing. */
 
     link_or_copy(q->fname, nfn);
-    ck_free(q->fname);
-    q->fname = nfn;
+    q->fname = ck_arena_strdup(&q_arena, nfn);
+    ck_free(nfn);
 
     /* Make sure that the passed_det value carries over, too. */
 
-    if (q->passed_det) mark_as_det_done(q);
+    if (q->passed_det) mark_as_det_done(q); else {
+
+      /* If the (resumed) input directory recorded partial deterministic
+         progress for this entry, carry it over under the new name. */
+
+      u8* ofn = alloc_printf("%s/.state/det_progress/%s", in_dir, rsl);
+
+      if (!access(ofn, R_OK)) {
+
+        u8* dfn = det_ckpt_fname(q);
+        link_or_copy(ofn, dfn);
+        ck_free(dfn);
+
+      }
+
+      ck_free(ofn);
+
+    }
 
     q = q->next;
     id++;
@@ -3065,1528 +3898,2815 @@ static void pivot_inputs(void) {
 }
 
 
-#ifndef SIMPLE_FILES
+/* Insert a checksum into the queue checksum set without growing it.
+   Returns 1 if the entry was new. */
 
-/* Construct a file name for a new test case, capturing the operation
-   that led to its discovery. Uses a static buffer. */
+static u8 cksum_set_insert(u32 ck) {
 
-static u8* describe_op(u8 hnb) {
+  u32 idx = ck & (cksum_set_size - 1);
 
-  static u8 ret[256];
+  while (cksum_set[idx]) {
 
-  if (syncing_party) {
+    if (cksum_set[idx] == ck) return 0;
+    idx = (idx + 1) & (cksum_set_size - 1);
 
-    sprintf(ret, "sync:%s,src:%06u", syncing_party, syncing_case);
+  }
 
-  } else {
+  cksum_set[idx] = ck;
+  return 1;
 
-    sprintf(ret, "src:%06u", current_entry);
+}
 
-    if (splicing_with >= 0)
-      sprintf(ret + strlen(ret), "+%06u", splicing_with);
 
-    sprintf(ret + strlen(ret), ",op:%s", stage_short);
+/* Remember the checksum of a queue entry, growing the set as needed. Used
+   with AFL_SHM_SYNC to skip ring imports we have already seen. */
 
-    if (stage_cur_byte >= 0) {
+static void cksum_set_add(u32 ck) {
 
-      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
+  if (!ck) return;
 
-      if (stage_val_type != STAGE_VAL_NONE)
-        sprintf(ret + strlen(ret), ",val:%s%+d", 
-                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
-                stage_cur_val);
+  if (!cksum_set) {
 
-    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
+    cksum_set_size = 1 << 16;
+    cksum_set = ck_alloc(cksum_set_size * sizeof(u32));
 
   }
 
-  if (hnb == 2) strcat(ret, ",+cov");
+  if (!cksum_set_insert(ck)) return;
 
-  return ret;
+  /* Keep the load factor under 50%. */
 
-}
+  if (++cksum_set_used > cksum_set_size / 2) {
 
-#endif /* !SIMPLE_FILES */
+    u32* old_set  = cksum_set;
+    u32  old_size = cksum_set_size, i;
 
+    cksum_set_size <<= 1;
+    cksum_set = ck_alloc(cksum_set_size * sizeof(u32));
 
-/* Write a message accompanying the crash directory :-) */
+    for (i = 0; i < old_size; i++)
+      if (old_set[i]) cksum_set_insert(old_set[i]);
 
-static void write_crash_readme(void) {
+    ck_free(old_set);
 
-  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
-  s32 fd;
-  FILE* f;
+  }
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  ck_free(fn);
+}
 
-  /* Do not die on errors here - that would be impolite. */
 
-  if (fd < 0) return;
+static u8 cksum_set_has(u32 ck) {
 
-  f = fdopen(fd, "w");
+  u32 idx;
 
-  if (!f) {
-    close(fd);
-    return;
-  }
+  if (!cksum_set || !ck) return 0;
 
-  fprintf(f, "Command line used to find this crash:\n\n"
+  idx = ck & (cksum_set_size - 1);
 
-             "%s\n\n"
+  while (cksum_set[idx]) {
 
-             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
-             "memory limit. The limit used for this fuzzing session was %s.\n\n"
+    if (cksum_set[idx] == ck) return 1;
+    idx = (idx + 1) & (cksum_set_size - 1);
 
-             "Need a tool to minimize test cases before investigating the crashes or sending\n"
-             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
+  }
 
-             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
-             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
-             "add your finds to the gallery at:\n\n"
+  return 0;
 
-             "  http://lcamtuf.coredump.cx/afl/\n\n"
+}
 
-             "Thanks :-)\n",
 
-             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
+/* Publish one of our new queue entries to the sync ring. Slot claims go
+   through an atomic increment; the record becomes visible to consumers only
+   once seq is stamped, so no further locking is needed. */
 
-  fclose(f);
+static void sync_ring_publish(u8* fn, u32 len, u32 cksum) {
 
-}
+  struct sync_ring_rec* rec;
+  u8* base;
+  u32 idx;
 
+  if (!sync_ring) return;
 
-/* Check if the result of an execve() during routine fuzzing is interesting,
-   save or queue the input test case for further analysis if so. Returns 1 if
-   entry is saved, 0 otherwise. */
+  base = strrchr(fn, '/');
+  if (!base) return;
 
-static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
+  idx = __sync_fetch_and_add(&sync_ring->head, 1);
+  rec = (struct sync_ring_rec*)(sync_ring + 1) + (idx & (sync_ring->slots - 1));
 
-  u8  *fn = "";
-  u8  hnb;
-  s32 fd;
-  u8  keeping = 0, res;
+  rec->seq = 0;
+  MEM_BARRIER();
 
-  if (fault == crash_mode) {
+  rec->cksum = cksum;
+  rec->len   = len;
+  snprintf(rec->path, SYNC_RING_PATH, "%s/queue/%s", sync_id, base + 1);
 
-    /* Keep only if there are new bits in the map, add to queue for
-       future fuzzing, etc. */
+  MEM_BARRIER();
+  rec->seq = idx + 1;
 
-    if (!(hnb = has_new_bits(virgin_bits))) {
-      if (crash_mode) total_crashes++;
-      return 0;
-    }    
+}
 
-#ifndef SIMPLE_FILES
 
-    fn = alloc_printf("%s/queue/id:%06u,%s", out_dir, queued_paths,
-                      describe_op(hnb));
+/* Establish a TCP connection to the sync broker. Returns the socket, or
+   -1 on failure; the caller decides whether that is fatal. */
 
-#else
+static s32 net_sync_connect(void) {
 
-    fn = alloc_printf("%s/queue/id_%06u", out_dir, queued_paths);
+  struct addrinfo hints, *res, *p;
+  struct timeval tv;
+  u8 *host, *port;
+  s32 fd = -1;
+  int on = 1;
 
-#endif /* ^!SIMPLE_FILES */
+  host = ck_strdup(net_sync_addr);
+  port = strrchr(host, ':');
 
-    add_to_queue(fn, len, 0);
+  if (!port) FATAL("AFL_NET_SYNC should be in the form host:port");
 
-    if (hnb == 2) {
-      queue_top->has_new_cov = 1;
-      queued_with_cov++;
-    }
+  *(port++) = 0;
 
-    queue_top->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
 
-    /* Try to calibrate inline; this also calls update_bitmap_score() when
-       successful. */
+  if (getaddrinfo(host, port, &hints, &res)) {
+    ck_free(host);
+    return -1;
+  }
 
-    res = calibrate_case(argv, queue_top, mem, queue_cycle - 1, 0);
+  for (p = res; p; p = p->ai_next) {
 
-    if (res == FAULT_ERROR)
-      FATAL("Unable to execute target application");
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd < 0) continue;
 
-    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0) PFATAL("Unable to create '%s'", fn);
-    ck_write(fd, mem, len, fn);
-    close(fd);
+    if (!connect(fd, p->ai_addr, p->ai_addrlen)) break;
 
-    keeping = 1;
+    close(fd);
+    fd = -1;
 
   }
 
-  switch (fault) {
+  freeaddrinfo(res);
+  ck_free(host);
 
-    case FAULT_TMOUT:
+  if (fd < 0) return -1;
 
-      /* Timeouts are not very interesting, but we're still obliged to keep
-         a handful of samples. We use the presence of new bits in the
-         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
-         just keep everything. */
+  /* Finds are small and rare, so get them on the wire right away; and do
+     not let a wedged broker stall the fuzzing loop for long. */
 
-      total_tmouts++;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
 
-      if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
+  tv.tv_sec  = NET_SYNC_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 
-      if (!dumb_mode) {
+  return fd;
 
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+}
 
-        if (!has_new_bits(virgin_tmout)) return keeping;
 
-      }
+/* Shed a dead or misbehaving broker connection and schedule a quiet
+   retry; fuzzing itself is unaffected. */
 
-      unique_tmouts++;
+static void net_sync_drop(void) {
 
-      /* Before saving, we make sure that it's a genuine hang by re-running
-         the target with a more generous timeout (unless the default timeout
-         is already generous). */
+  WARNF("Broker connection lost; will retry every %u sec.", NET_SYNC_RETRY);
 
-      if (exec_tmout < hang_tmout) {
+  close(net_sync_fd);
 
-        u8 new_fault;
-        write_to_testcase(mem, len);
-        new_fault = run_target(argv, hang_tmout);
+  net_sync_fd  = -1;
+  net_in_len   = 0;
+  net_retry_at = get_cur_time() + NET_SYNC_RETRY * 1000;
 
-        /* A corner case that one user reported bumping into: increasing the
-           timeout actually uncovers a crash. Make sure we don't discard it if
-           so. */
+}
 
-        if (!stop_soon && new_fault == FAULT_CRASH) goto keep_as_crash;
 
-        if (stop_soon || new_fault != FAULT_TMOUT) return keeping;
+/* Push out a full buffer, riding out short writes and EINTR. Returns
+   non-zero on failure (including an SO_SNDTIMEO timeout). */
 
-      }
+static u8 net_write_all(const void* mem, u32 len) {
 
-#ifndef SIMPLE_FILES
+  const u8* ptr = mem;
 
-      fn = alloc_printf("%s/hangs/id:%06llu,%s", out_dir,
-                        unique_hangs, describe_op(0));
+  while (len) {
 
-#else
+    s32 res = send(net_sync_fd, ptr, len, MSG_NOSIGNAL);
 
-      fn = alloc_printf("%s/hangs/id_%06llu", out_dir,
-                        unique_hangs);
+    if (res <= 0) {
 
-#endif /* ^!SIMPLE_FILES */
+      if (res < 0 && errno == EINTR) continue;
+      return 1;
 
-      unique_hangs++;
+    }
 
-      last_hang_time = get_cur_time();
+    ptr += res;
+    len -= res;
 
-      break;
+  }
 
-    case FAULT_CRASH:
+  return 0;
 
-keep_as_crash:
+}
 
-      /* This is handled in a manner roughly similar to timeouts,
-         except for slightly different limits and no need to re-run test
-         cases. */
 
-      total_crashes++;
+/* Stream a new find to the broker. Failures are not fatal: the entry is
+   in our queue either way, and the connection will be retried later. */
 
-      if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
+static void net_sync_publish(const u8* mem, u32 len, u32 cksum) {
 
-      if (!dumb_mode) {
+  static u8* summary;
 
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+  struct net_sync_msg msg;
 
-        if (!has_new_bits(virgin_crash)) return keeping;
+  /* Do not echo entries that just came in over the wire; the broker has
+     already relayed them to everyone else. */
 
-      }
+  if (net_sync_fd < 0 || net_syncing) return;
 
-      if (!unique_crashes) write_crash_readme();
+  if (!summary) summary = ck_alloc(map_size >> 3);
 
-#ifndef SIMPLE_FILES
+  memset(summary, 0, map_size >> 3);
+  minimize_bits(summary, trace_bits);
 
-      fn = alloc_printf("%s/crashes/id:%06llu,sig:%02u,%s", out_dir,
-                        unique_crashes, kill_signal, describe_op(0));
+  msg.magic    = NET_SYNC_MAGIC;
+  msg.version  = NET_SYNC_VERSION;
+  msg.map_size = map_size;
+  msg.cksum    = cksum;
+  msg.len      = len;
 
-#else
+  if (net_write_all(&msg, sizeof(msg)) ||
+      net_write_all(summary, map_size >> 3) ||
+      net_write_all(mem, len)) net_sync_drop();
 
-      fn = alloc_printf("%s/crashes/id_%06llu_%02u", out_dir, unique_crashes,
-                        kill_signal);
+}
 
-#endif /* ^!SIMPLE_FILES */
 
-      unique_crashes++;
+/* Copy bytes into the write-behind ring at byte offset 'at', wrapping
+   around the end as needed; aw_get() is the mirror image. */
 
-      last_crash_time = get_cur_time();
-      last_crash_execs = total_execs;
+static void aw_put(u32 at, const void* mem, u32 len) {
 
-      break;
+  u32 off = at & (AWRITE_RING_SIZE - 1);
+  u32 rem = AWRITE_RING_SIZE - off;
 
-    case FAULT_ERROR: FATAL("Unable to execute target application");
+  if (len <= rem) memcpy(aw_ring + off, mem, len);
+  else {
 
-    default: return keeping;
+    memcpy(aw_ring + off, mem, rem);
+    memcpy(aw_ring, (u8*)mem + rem, len - rem);
 
   }
 
-  /* If we're here, we apparently want to save the crash or hang
-     test case, too. */
+}
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  if (fd < 0) PFATAL("Unable to create '%s'", fn);
-  ck_write(fd, mem, len, fn);
-  close(fd);
 
-  ck_free(fn);
+static void aw_get(u32 at, void* mem, u32 len) {
 
-  return keeping;
+  u32 off = at & (AWRITE_RING_SIZE - 1);
+  u32 rem = AWRITE_RING_SIZE - off;
+
+  if (len <= rem) memcpy(mem, aw_ring + off, len);
+  else {
+
+    memcpy(mem, aw_ring + off, rem);
+    memcpy((u8*)mem + rem, aw_ring, len - rem);
+
+  }
 
 }
 
 
-/* When resuming, try to find the queue position to start from. This makes sense
-   only when resuming, and when we can find the original fuzzer_stats. */
+/* Make sure the writer process is still with us; both the submission and
+   the drain paths would otherwise spin forever on its behalf. */
 
-static u32 find_start_position(void) {
+static void aw_check_writer(void) {
 
-  static u8 tmp[4096]; /* Ought to be enough for anybody. */
+  if (aw_pid > 0 && waitpid(aw_pid, NULL, WNOHANG) > 0) {
 
-  u8  *fn, *off;
-  s32 fd, i;
-  u32 ret;
+    aw_pid = -1;
+    FATAL("Write-behind process went away");
 
-  if (!resuming_fuzz) return 0;
+  }
 
-  if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
-  else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+}
 
-  fd = open(fn, O_RDONLY);
-  ck_free(fn);
 
-  if (fd < 0) return 0;
+/* Hand one file over to the writer. This only blocks when the ring is
+   full - i.e., when we have AWRITE_RING_SIZE bytes of writes in flight
+   and a synchronous write would have been stalling anyway. */
 
-  i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
-  close(fd);
+static void aw_submit(u8* path, const void* mem, u32 len, u8 mode) {
 
-  off = strstr(tmp, "cur_path          : ");
-  if (!off) return 0;
+  struct awrite_rec rec;
 
-  ret = atoi(off + 20);
-  if (ret >= queued_paths) ret = 0;
-  return ret;
+  u32 plen = strlen(path) + 1;
+  u32 need = sizeof(rec) + plen + len;
+  u32 head;
 
-}
+  rec.data_len = len;
+  rec.path_len = plen;
+  rec.mode     = mode;
+  rec.unused   = 0;
 
+  while (AWRITE_RING_SIZE - (aw_hdr->head - aw_hdr->tail) < need) {
 
-/* The same, but for timeouts. The idea is that when resuming sessions without
-   -t given, we don't want to keep auto-scaling the timeout over and over
-   again to prevent it from growing due to random flukes. */
+    aw_check_writer();
+    usleep(100);
 
-static void find_timeout(void) {
+  }
 
-  static u8 tmp[4096]; /* Ought to be enough for anybody. */
+  head = aw_hdr->head;
 
-  u8  *fn, *off;
-  s32 fd, i;
-  u32 ret;
+  aw_put(head, &rec, sizeof(rec));
+  aw_put(head + sizeof(rec), path, plen);
+  aw_put(head + sizeof(rec) + plen, mem, len);
 
-  if (!resuming_fuzz) return;
+  MEM_BARRIER();
+  aw_hdr->head = head + need;
 
-  if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
-  else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+}
 
-  fd = open(fn, O_RDONLY);
-  ck_free(fn);
 
-  if (fd < 0) return;
+/* Wait for the writer to catch up. Called before anything that may read
+   back a file we queued; when there is no backlog, this is a single
+   volatile load. */
 
-  i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
-  close(fd);
+static void aw_drain(void) {
 
-  off = strstr(tmp, "exec_timeout      : ");
-  if (!off) return;
+  if (!aw_hdr) return;
 
-  ret = atoi(off + 20);
-  if (ret <= 4) return;
+  while (aw_hdr->tail != aw_hdr->head) {
 
-  exec_tmout = ret;
-  timeout_given = 3;
+    aw_check_writer();
+    usleep(100);
+
+  }
 
 }
 
 
-/* Update stats file for unattended monitoring. */
+/* Main loop of the forked-off writer: pop records, write files, bump the
+   tail. Does not return. */
 
-static void write_stats_file(double bitmap_cvg, double stability, double eps) {
+static void aw_writer_loop(void) {
 
-  static double last_bcvg, last_stab, last_eps;
-  static struct rusage usage;
+  s32 fuzzer_pid = getppid();
+  u8* data = ck_alloc_nozero(AWRITE_RING_SIZE);
+  u8  path[4096]; /* Ought to be enough for anybody. */
 
-  u8* fn = alloc_printf("%s/fuzzer_stats", out_dir);
-  s32 fd;
-  FILE* f;
+  /* Keyboard interrupts go to the whole process group; stopping is the
+     fuzzer's call, relayed through the quit flag once we have drained. */
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
 
-  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+  while (1) {
 
-  ck_free(fn);
+    struct awrite_rec rec;
 
-  f = fdopen(fd, "w");
+    u32 tail = aw_hdr->tail;
+    s32 fd, flags;
 
-  if (!f) PFATAL("fdopen() failed");
+    if (tail == aw_hdr->head) {
 
-  /* Keep last values in case we're called from another context
-     where exec/sec stats and such are not readily available. */
+      if (aw_hdr->quit) exit(0);
+      if (getppid() != fuzzer_pid) exit(1);
 
-  if (!bitmap_cvg && !stability && !eps) {
-    bitmap_cvg = last_bcvg;
-    stability  = last_stab;
-    eps        = last_eps;
-  } else {
-    last_bcvg = bitmap_cvg;
-    last_stab = stability;
-    last_eps  = eps;
-  }
+      usleep(1000);
+      continue;
 
-  fprintf(f, "start_time        : %llu\n"
-             "last_update       : %llu\n"
-             "fuzzer_pid        : %u\n"
-             "cycles_done       : %llu\n"
-             "execs_done        : %llu\n"
-             "execs_per_sec     : %0.02f\n"
-             "paths_total       : %u\n"
-             "paths_favored     : %u\n"
-             "paths_found       : %u\n"
-             "paths_imported    : %u\n"
-             "max_depth         : %u\n"
-             "cur_path          : %u\n" /* Must match find_start_position() */
-             "pending_favs      : %u\n"
-             "pending_total     : %u\n"
-             "variable_paths    : %u\n"
-             "stability         : %0.02f%%\n"
-             "bitmap_cvg        : %0.02f%%\n"
-             "unique_crashes    : %llu\n"
-             "unique_hangs      : %llu\n"
-             "last_path         : %llu\n"
-             "last_crash        : %llu\n"
-             "last_hang         : %llu\n"
-             "execs_since_crash : %llu\n"
-             "exec_timeout      : %u\n" /* Must match find_timeout() */
-             "afl_banner        : %s\n"
-             "afl_version       : " VERSION "\n"
-             "target_mode       : %s%s%s%s%s%s%s\n"
-             "command_line      : %s\n"
-             "slowest_exec_ms   : %llu\n",
-             start_time / 1000, get_cur_time() / 1000, getpid(),
-             queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
-             queued_paths, queued_favored, queued_discovered, queued_imported,
-             max_depth, current_entry, pending_favored, pending_not_fuzzed,
-             queued_variable, stability, bitmap_cvg, unique_crashes,
-             unique_hangs, last_path_time / 1000, last_crash_time / 1000,
-             last_hang_time / 1000, total_execs - last_crash_execs,
-             exec_tmout, use_banner,
-             qemu_mode ? "qemu " : "", dumb_mode ? " dumb " : "",
-             no_forkserver ? "no_forksrv " : "", crash_mode ? "crash " : "",
-             persistent_mode ? "persistent " : "", deferred_mode ? "deferred " : "",
-             (qemu_mode || dumb_mode || no_forkserver || crash_mode ||
-              persistent_mode || deferred_mode) ? "" : "default",
-             orig_cmdline, slowest_exec_ms);
-             /* ignore errors */
+    }
 
-  /* Get rss value from the children
-     We must have killed the forkserver process and called waitpid
-     before calling getrusage */
-  if (getrusage(RUSAGE_CHILDREN, &usage)) {
-      WARNF("getrusage failed");
-  } else if (usage.ru_maxrss == 0) {
-    fprintf(f, "peak_rss_mb       : not available while afl is running\n");
-  } else {
-#ifdef __APPLE__
-    fprintf(f, "peak_rss_mb       : %zu\n", usage.ru_maxrss >> 20);
-#else
-    fprintf(f, "peak_rss_mb       : %zu\n", usage.ru_maxrss >> 10);
-#endif /* ^__APPLE__ */
-  }
+    MEM_BARRIER();
 
-  fclose(f);
+    aw_get(tail, &rec, sizeof(rec));
+    aw_get(tail + sizeof(rec), path, rec.path_len);
+    aw_get(tail + sizeof(rec) + rec.path_len, data, rec.data_len);
 
-}
+    switch (rec.mode) {
 
+      case AW_TRUNC:  flags = O_WRONLY | O_CREAT | O_TRUNC;  break;
+      case AW_APPEND: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+      default:        flags = O_WRONLY | O_CREAT | O_EXCL;   break;
 
-/* Update the plot file if there is a reason to. */
+    }
 
-static void maybe_update_plot_file(double bitmap_cvg, double eps) {
+    fd = open(path, flags, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", path);
+    ck_write(fd, data, rec.data_len, path);
+    close(fd);
 
-  static u32 prev_qp, prev_pf, prev_pnf, prev_ce, prev_md;
-  static u64 prev_qc, prev_uc, prev_uh;
+    MEM_BARRIER();
+    aw_hdr->tail = tail + sizeof(rec) + rec.path_len + rec.data_len;
 
-  if (prev_qp == queued_paths && prev_pf == pending_favored && 
-      prev_pnf == pending_not_fuzzed && prev_ce == current_entry &&
-      prev_qc == queue_cycle && prev_uc == unique_crashes &&
-      prev_uh == unique_hangs && prev_md == max_depth) return;
+  }
 
-  prev_qp  = queued_paths;
-  prev_pf  = pending_favored;
-  prev_pnf = pending_not_fuzzed;
-  prev_ce  = current_entry;
-  prev_qc  = queue_cycle;
-  prev_uc  = unique_crashes;
-  prev_uh  = unique_hangs;
-  prev_md  = max_depth;
+}
 
-  /* Fields in the file:
 
-     unix_time, cycles_done, cur_path, paths_total, paths_not_fuzzed,
-     favored_not_fuzzed, unique_crashes, unique_hangs, max_depth,
-     execs_per_sec */
+/* Fork off the write-behind process (AFL_ASYNC_WRITE). */
 
-  fprintf(plot_file, 
-          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
-          get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
-          pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
-          unique_hangs, max_depth, eps); /* ignore errors */
+EXP_ST void setup_async_writer(void) {
 
-  fflush(plot_file);
+  if (!want_async_write) return;
 
-}
+  ACTF("Spinning up the write-behind process...");
 
+  aw_hdr = mmap(0, sizeof(struct awrite_hdr) + AWRITE_RING_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
+  if (aw_hdr == MAP_FAILED) PFATAL("mmap() failed");
 
-/* A helper function for maybe_delete_out_dir(), deleting all prefixed
-   files in a directory. */
+  aw_ring = (u8*)(aw_hdr + 1);
 
-static u8 delete_files(u8* path, u8* prefix) {
+  /* Flush stdio before forking, or the writer inherits (and eventually
+     replays) whatever startup output is still sitting in the buffer. */
 
-  DIR* d;
-  struct dirent* d_ent;
+  fflush(stdout);
 
-  d = opendir(path);
+  aw_pid = fork();
+  if (aw_pid < 0) PFATAL("fork() failed");
 
-  if (!d) return 0;
+  if (!aw_pid) aw_writer_loop(); /* Does not return */
 
-  while ((d_ent = readdir(d))) {
+  async_write_mode = 1;
 
-    if (d_ent->d_name[0] != '.' && (!prefix ||
-        !strncmp(d_ent->d_name, prefix, strlen(prefix)))) {
+  OKF("All right - write-behind process is up.");
 
-      u8* fname = alloc_printf("%s/%s", path, d_ent->d_name);
-      if (unlink(fname)) PFATAL("Unable to delete '%s'", fname);
-      ck_free(fname);
+}
 
-    }
 
-  }
+/* Wind down the writer: let it drain the backlog, then reap it. Later
+   writes go back to the synchronous path. */
 
-  closedir(d);
+static void stop_async_writer(void) {
 
-  return !!rmdir(path);
+  if (aw_pid <= 0) return;
 
-}
+  aw_drain();
+  aw_hdr->quit = 1;
 
+  if (waitpid(aw_pid, NULL, 0) <= 0) WARNF("error waitpid\n");
 
-/* Get the number of runnable processes, with some simple smoothing. */
+  aw_pid = -1;
+  async_write_mode = 0;
 
-static double get_runnable_processes(void) {
+}
 
-  static double res;
 
-#if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
+#ifndef SIMPLE_FILES
 
-  /* I don't see any portable sysctl or so that would quickly give us the
-     number of runnable processes; the 1-minute load average can be a
-     semi-decent approximation, though. */
+/* Construct a file name for a new test case, capturing the operation
+   that led to its discovery. Uses a static buffer. */
 
-  if (getloadavg(&res, 1) != 1) return 0;
+static u8* describe_op(u8 hnb) {
 
-#else
+  static u8 ret[256];
 
-  /* On Linux, /proc/stat is probably the best way; load averages are
-     computed in funny ways and sometimes don't reflect extremely short-lived
-     processes well. */
+  if (syncing_party) {
 
-  FILE* f = fopen("/proc/stat", "r");
-  u8 tmp[1024];
-  u32 val = 0;
+    sprintf(ret, "sync:%s,src:%06u", syncing_party, syncing_case);
 
-  if (!f) return 0;
+  } else {
 
-  while (fgets(tmp, sizeof(tmp), f)) {
+    sprintf(ret, "src:%06u", current_entry);
 
-    if (!strncmp(tmp, "procs_running ", 14) ||
-        !strncmp(tmp, "procs_blocked ", 14)) val += atoi(tmp + 14);
+    if (splicing_with >= 0)
+      sprintf(ret + strlen(ret), "+%06u", splicing_with);
 
-  }
- 
-  fclose(f);
+    sprintf(ret + strlen(ret), ",op:%s", stage_short);
 
-  if (!res) {
+    if (stage_cur_byte >= 0) {
 
-    res = val;
+      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
 
-  } else {
+      if (stage_val_type != STAGE_VAL_NONE)
+        sprintf(ret + strlen(ret), ",val:%s%+d", 
+                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
+                stage_cur_val);
 
-    res = res * (1.0 - 1.0 / AVG_SMOOTHING) +
-          ((double)val) * (1.0 / AVG_SMOOTHING);
+    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
 
   }
 
-#endif /* ^(__APPLE__ || __FreeBSD__ || __OpenBSD__) */
+  if (hnb == 2) strcat(ret, ",+cov");
 
-  return res;
+  return ret;
 
 }
 
+#endif /* !SIMPLE_FILES */
 
-/* Delete the temporary directory used for in-place session resume. */
-
-static void nuke_resume_dir(void) {
 
-  u8* fn;
+/* Write a message accompanying the crash directory :-) */
 
-  fn = alloc_printf("%s/_resume/.state/deterministic_done", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+static void write_crash_readme(void) {
 
-  fn = alloc_printf("%s/_resume/.state/auto_extras", out_dir);
-  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
-  ck_free(fn);
+  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
+  s32 fd;
+  FILE* f;
 
-  fn = alloc_printf("%s/_resume/.state/redundant_edges", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
   ck_free(fn);
 
-  fn = alloc_printf("%s/_resume/.state/variable_behavior", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  /* Do not die on errors here - that would be impolite. */
 
-  fn = alloc_printf("%s/_resume/.state", out_dir);
-  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  if (fd < 0) return;
 
-  fn = alloc_printf("%s/_resume", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  f = fdopen(fd, "w");
 
-  return;
+  if (!f) {
+    close(fd);
+    return;
+  }
 
-dir_cleanup_failed:
+  fprintf(f, "Command line used to find this crash:\n\n"
 
-  FATAL("_resume directory cleanup failed");
+             "%s\n\n"
 
-}
+             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
+             "memory limit. The limit used for this fuzzing session was %s.\n\n"
 
+             "Need a tool to minimize test cases before investigating the crashes or sending\n"
+             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
 
-/* Delete fuzzer output directory if we recognize it as ours, if the fuzzer
-   is not currently running, and if the last run time isn't too great. */
+             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
+             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
+             "add your finds to the gallery at:\n\n"
 
-static void maybe_delete_out_dir(void) {
+             "  http://lcamtuf.coredump.cx/afl/\n\n"
 
-  FILE* f;
-  u8 *fn = alloc_printf("%s/fuzzer_stats", out_dir);
+             "Thanks :-)\n",
 
-  /* See if the output directory is locked. If yes, bail out. If not,
-     create a lock that will persist for the lifetime of the process
-     (this requires leaving the descriptor open).*/
+             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
 
-  out_dir_fd = open(out_dir, O_RDONLY);
-  if (out_dir_fd < 0) PFATAL("Unable to open '%s'", out_dir);
+  fclose(f);
 
-#ifndef __sun
+}
 
-  if (flock(out_dir_fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK) {
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Looks like the job output directory is being actively used by another\n"
-         "    instance of afl-fuzz. You will need to choose a different %s\n"
-         "    or stop the other process first.\n",
-         sync_id ? "fuzzer ID" : "output location");
+/* Copy bytes into the triage ring at byte offset 'at', wrapping around
+   the end as needed; tr_get() is the mirror image. */
 
-    FATAL("Directory '%s' is in use", out_dir);
+static void tr_put(u32 at, const void* mem, u32 len) {
+
+  u32 off = at & (TRIAGE_RING_SIZE - 1);
+  u32 rem = TRIAGE_RING_SIZE - off;
+
+  if (len <= rem) memcpy(tr_ring + off, mem, len);
+  else {
+
+    memcpy(tr_ring + off, mem, rem);
+    memcpy(tr_ring, (u8*)mem + rem, len - rem);
 
   }
 
-#endif /* !__sun */
+}
 
-  f = fopen(fn, "r");
 
-  if (f) {
+static void tr_get(u32 at, void* mem, u32 len) {
 
-    u64 start_time, last_update;
+  u32 off = at & (TRIAGE_RING_SIZE - 1);
+  u32 rem = TRIAGE_RING_SIZE - off;
 
-    if (fscanf(f, "start_time     : %llu\n"
-                  "last_update    : %llu\n", &start_time, &last_update) != 2)
-      FATAL("Malformed data in '%s'", fn);
+  if (len <= rem) memcpy(mem, tr_ring + off, len);
+  else {
 
-    fclose(f);
+    memcpy(mem, tr_ring + off, rem);
+    memcpy((u8*)mem + rem, tr_ring, len - rem);
 
-    /* Let's see how much work is at stake. */
+  }
 
-    if (!in_place_resume && last_update - start_time > OUTPUT_GRACE * 60) {
+}
 
-      SAYF("\n" cLRD "[-] " cRST
-           "The job output directory already exists and contains the results of more\n"
-           "    than %u minutes worth of fuzzing. To avoid data loss, afl-fuzz will *NOT*\n"
-           "    automatically delete this data for you.\n\n"
 
-           "    If you wish to start a new session, remove or rename the directory manually,\n"
-           "    or specify a different output location for this job. To resume the old\n"
-           "    session, put '-' as the input directory in the command line ('-i -') and\n"
-           "    try again.\n", OUTPUT_GRACE);
+/* Fuzzer-side pre-filter: the set of fuzz-time crash signatures already
+   handed over, so the ring only ever sees the first instance of each.
+   Same open-addressing scheme as the sync cksum set. */
 
-       FATAL("At-risk data found in '%s'", out_dir);
+static u32* ts_tab;                   /* The set itself                   */
+static u32  ts_size,                  /* Allocated slots, power of two    */
+            ts_used;                  /* Slots in use                     */
 
-    }
+static u8 ts_insert(u32 ck) {
 
-  }
+  u32 idx = ck & (ts_size - 1);
 
-  ck_free(fn);
+  while (ts_tab[idx]) {
 
-  /* The idea for in-place resume is pretty simple: we temporarily move the old
-     queue/ to a new location that gets deleted once import to the new queue/
-     is finished. If _resume/ already exists, the current queue/ may be
-     incomplete due to an earlier abort, so we want to use the old _resume/
-     dir instead, and we let rename() fail silently. */
+    if (ts_tab[idx] == ck) return 0;
+    idx = (idx + 1) & (ts_size - 1);
 
-  if (in_place_resume) {
+  }
 
-    u8* orig_q = alloc_printf("%s/queue", out_dir);
+  ts_tab[idx] = ck;
+  return 1;
 
-    in_dir = alloc_printf("%s/_resume", out_dir);
+}
 
-    rename(orig_q, in_dir); /* Ignore errors */
 
-    OKF("Output directory exists, will attempt session resume.");
+static void ts_add(u32 ck) {
 
-    ck_free(orig_q);
+  if (!ck) return;
 
-  } else {
+  if (!ts_tab) {
 
-    OKF("Output directory exists but deemed OK to reuse.");
+    ts_size = 1 << 12;
+    ts_tab  = ck_alloc(ts_size * sizeof(u32));
 
   }
 
-  ACTF("Deleting old session data...");
+  if (!ts_insert(ck)) return;
 
-  /* Okay, let's get the ball rolling! First, we need to get rid of the entries
-     in <out_dir>/.synced/.../id:*, if any are present. */
+  /* Keep the load factor under 50%. */
 
-  if (!in_place_resume) {
+  if (++ts_used > ts_size / 2) {
 
-    fn = alloc_printf("%s/.synced", out_dir);
-    if (delete_files(fn, NULL)) goto dir_cleanup_failed;
-    ck_free(fn);
+    u32* old_tab  = ts_tab;
+    u32  old_size = ts_size, i;
 
-  }
+    ts_size <<= 1;
+    ts_tab = ck_alloc(ts_size * sizeof(u32));
 
-  /* Next, we need to clean up <out_dir>/queue/.state/ subdirectories: */
+    for (i = 0; i < old_size; i++)
+      if (old_tab[i]) ts_insert(old_tab[i]);
 
-  fn = alloc_printf("%s/queue/.state/deterministic_done", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+    ck_free(old_tab);
 
-  fn = alloc_printf("%s/queue/.state/auto_extras", out_dir);
-  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
-  ck_free(fn);
+  }
 
-  fn = alloc_printf("%s/queue/.state/redundant_edges", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+}
 
-  fn = alloc_printf("%s/queue/.state/variable_behavior", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
 
-  /* Then, get rid of the .state subdirectory itself (should be empty by now)
-     and everything matching <out_dir>/queue/id:*. */
+static u8 ts_has(u32 ck) {
 
-  fn = alloc_printf("%s/queue/.state", out_dir);
-  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  u32 idx;
 
-  fn = alloc_printf("%s/queue", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  if (!ts_tab || !ck) return 0;
 
-  /* All right, let's do <out_dir>/crashes/id:* and <out_dir>/hangs/id:*. */
+  idx = ck & (ts_size - 1);
 
-  if (!in_place_resume) {
+  while (ts_tab[idx]) {
 
-    fn = alloc_printf("%s/crashes/README.txt", out_dir);
-    unlink(fn); /* Ignore errors */
-    ck_free(fn);
+    if (ts_tab[idx] == ck) return 1;
+    idx = (idx + 1) & (ts_size - 1);
 
   }
 
-  fn = alloc_printf("%s/crashes", out_dir);
+  return 0;
 
-  /* Make backup of the crashes directory if it's not empty and if we're
-     doing in-place resume. */
+}
 
-  if (in_place_resume && rmdir(fn)) {
 
-    time_t cur_t = time(0);
-    struct tm* t = localtime(&cur_t);
+/* Make sure the triage process is still with us. */
 
-#ifndef SIMPLE_FILES
+static void triage_check_worker(void) {
 
-    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+  if (triage_pid > 0 && waitpid(triage_pid, NULL, WNOHANG) > 0) {
 
-#else
+    triage_pid = -1;
+    FATAL("Crash triage process went away");
 
-    u8* nfn = alloc_printf("%s_%04u%02u%02u%02u%02u%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+  }
 
-#endif /* ^!SIMPLE_FILES */
+}
 
-    rename(fn, nfn); /* Ignore errors. */
-    ck_free(nfn);
 
-  }
+/* Worker-side dedup store: one entry per distinct re-run signature, with
+   a hash index on top so lookups stay O(1) as bugs pile up. */
 
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+struct triage_bug {
 
-  fn = alloc_printf("%s/hangs", out_dir);
+  u32 cksum;                          /* Re-run crash signature           */
+  u32 hits;                           /* Total occurrences seen           */
+  u8* fname;                          /* First saved file, link target    */
+  u8  sig;                            /* Signal number                    */
 
-  /* Backup hangs, too. */
+};
 
-  if (in_place_resume && rmdir(fn)) {
+static struct triage_bug* tb_list;    /* The bugs themselves              */
+static u32  tb_cnt, tb_alloc;         /* Entries used / allocated         */
+static u32* tb_idx;                   /* cksum -> list index + 1          */
+static u32  tb_idx_size;              /* Size of the above, power of two  */
 
-    time_t cur_t = time(0);
-    struct tm* t = localtime(&cur_t);
 
-#ifndef SIMPLE_FILES
+/* Look up a signature in the store; returns list index + 1, or 0. */
 
-    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+static u32 tb_lookup(u32 cksum) {
 
-#else
+  u32 idx;
 
-    u8* nfn = alloc_printf("%s_%04u%02u%02u%02u%02u%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+  if (!tb_idx) return 0;
 
-#endif /* ^!SIMPLE_FILES */
+  idx = cksum & (tb_idx_size - 1);
 
-    rename(fn, nfn); /* Ignore errors. */
-    ck_free(nfn);
+  while (tb_idx[idx]) {
 
-  }
+    if (tb_list[tb_idx[idx] - 1].cksum == cksum) return tb_idx[idx];
+    idx = (idx + 1) & (tb_idx_size - 1);
 
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  }
 
-  /* And now, for some finishing touches. */
+  return 0;
 
-  fn = alloc_printf("%s/.cur_input", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+}
 
-  fn = alloc_printf("%s/fuzz_bitmap", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
 
-  if (!in_place_resume) {
-    fn  = alloc_printf("%s/fuzzer_stats", out_dir);
-    if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-    ck_free(fn);
-  }
+static void tb_index_insert(u32 cksum, u32 val) {
 
-  fn = alloc_printf("%s/plot_data", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  u32 idx = cksum & (tb_idx_size - 1);
 
-  OKF("Output dir cleanup successful.");
+  while (tb_idx[idx]) idx = (idx + 1) & (tb_idx_size - 1);
 
-  /* Wow... is that all? If yes, celebrate! */
+  tb_idx[idx] = val;
 
-  return;
+}
 
-dir_cleanup_failed:
 
-  SAYF("\n" cLRD "[-] " cRST
-       "Whoops, the fuzzer tried to reuse your output directory, but bumped into\n"
-       "    some files that shouldn't be there or that couldn't be removed - so it\n"
-       "    decided to abort! This happened while processing this path:\n\n"
+/* Add a new bug to the store, growing the list and rebuilding the index
+   as needed. Returns the list index of the new entry. */
 
-       "    %s\n\n"
-       "    Please examine and manually delete the files, or specify a different\n"
-       "    output location for the tool.\n", fn);
+static u32 tb_register(u32 cksum, u8 sig, u8* fname) {
 
-  FATAL("Output directory cleanup failed");
+  if (tb_cnt == tb_alloc) {
 
-}
+    tb_alloc = tb_alloc ? tb_alloc * 2 : 1024;
+    tb_list  = ck_realloc(tb_list, tb_alloc * sizeof(struct triage_bug));
 
+  }
 
-static void check_term_size(void);
+  tb_list[tb_cnt].cksum = cksum;
+  tb_list[tb_cnt].hits  = 1;
+  tb_list[tb_cnt].fname = fname;
+  tb_list[tb_cnt].sig   = sig;
 
+  /* Keep the index load factor under 50%. */
 
-/* A spiffy retro stats screen! This is called every stats_update_freq
-   execve() calls, plus in several other circumstances. */
+  if (!tb_idx || tb_cnt + 1 > tb_idx_size / 2) {
 
-static void show_stats(void) {
+    u32 i;
 
-  static u64 last_stats_ms, last_plot_ms, last_ms, last_execs;
-  static double avg_exec;
-  double t_byte_ratio, stab_ratio;
+    tb_idx_size = tb_idx_size ? tb_idx_size * 2 : (1 << 12);
 
-  u64 cur_ms;
-  u32 t_bytes, t_bits;
+    ck_free(tb_idx);
+    tb_idx = ck_alloc(tb_idx_size * sizeof(u32));
 
-  u32 banner_len, banner_pad;
-  u8  tmp[256];
+    for (i = 0; i < tb_cnt; i++)
+      tb_index_insert(tb_list[i].cksum, i + 1);
 
-  cur_ms = get_cur_time();
+  }
 
-  /* If not enough time has passed since last UI update, bail out. */
+  tb_index_insert(cksum, tb_cnt + 1);
 
-  if (cur_ms - last_ms < 1000 / UI_TARGET_HZ) return;
+  return tb_cnt++;
 
-  /* Check if we're past the 10 minute mark. */
+}
 
-  if (cur_ms - start_time > 10 * 60 * 1000) run_over10m = 1;
 
-  /* Calculate smoothed exec speed stats. */
+/* Main loop of the forked-off triage process: pop crashes, re-run them
+   through a private fork server, dedup on the re-run signature, and save
+   or hard-link accordingly. Does not return. */
 
-  if (!last_execs) {
-  
-    avg_exec = ((double)total_execs) * 1000 / (cur_ms - start_time);
+static void triage_loop(char** argv) {
 
-  } else {
+  s32 fuzzer_pid = getppid();
+  u8* data = ck_alloc_nozero(MAX_FILE);
+  u8* cwd  = getcwd(NULL, 0);
+  u8* in_path;
+  u8* shm_str;
+  u8  op[256];
+  u8  dup_dir_ok = 0;
+  s32 fd;
+  u32 i;
 
-    double cur_avg = ((double)(total_execs - last_execs)) * 1000 /
-                     (cur_ms - last_ms);
+  FILE* index_f;
 
-    /* If there is a dramatic (5x+) jump in speed, reset the indicator
-       more quickly. */
+  if (!cwd) PFATAL("getcwd() failed");
 
-    if (cur_avg * 5 < avg_exec || cur_avg / 5 > avg_exec)
-      avg_exec = cur_avg;
+  /* Keyboard interrupts go to the whole process group; stopping is the
+     fuzzer's call, relayed through the quit flag once we have drained. */
 
-    avg_exec = avg_exec * (1.0 - 1.0 / AVG_SMOOTHING) +
-               cur_avg * (1.0 / AVG_SMOOTHING);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
 
-  }
+  /* Replace the inherited trace segment with one of our own. This also
+     repoints the inherited remove_shm() handler at the new segment, so
+     our exit leaves the fuzzer's one alone. */
 
-  last_ms = cur_ms;
-  last_execs = total_execs;
+  shm_id = shmget(IPC_PRIVATE, map_size, IPC_CREAT | IPC_EXCL | 0600);
 
-  /* Tell the callers when to contact us (as measured in execs). */
+  if (shm_id < 0) PFATAL("shmget() failed");
 
-  stats_update_freq = avg_exec / (UI_TARGET_HZ * 10);
-  if (!stats_update_freq) stats_update_freq = 1;
+  shm_str = alloc_printf("%d", shm_id);
+  setenv(SHM_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
 
-  /* Do some bitmap stats. */
+  trace_bits = shmat(shm_id, NULL, 0);
 
-  t_bytes = count_non_255_bytes(virgin_bits);
-  t_byte_ratio = ((double)t_bytes * 100) / MAP_SIZE;
+  if (trace_bits == (void*)-1) PFATAL("shmat() failed");
 
-  if (t_bytes) 
-    stab_ratio = 100 - ((double)var_byte_count) * 100 / t_bytes;
-  else
-    stab_ratio = 100;
+  trace_dirty_ok = 0;
 
-  /* Roughly every minute, update fuzzer stats and save auto tokens. */
+  if (shm_testcase_mode) {
 
-  if (cur_ms - last_stats_ms > STATS_UPDATE_SEC * 1000) {
+    shm_fuzz_id = shmget(IPC_PRIVATE, MAX_FILE + 4,
+                         IPC_CREAT | IPC_EXCL | 0600);
 
-    last_stats_ms = cur_ms;
-    write_stats_file(t_byte_ratio, stab_ratio, avg_exec);
-    save_auto();
-    write_bitmap();
+    if (shm_fuzz_id < 0) PFATAL("shmget() failed");
 
-  }
+    shm_str = alloc_printf("%d", shm_fuzz_id);
+    setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
 
-  /* Every now and then, write plot data. */
+    shm_fuzz = shmat(shm_fuzz_id, NULL, 0);
 
-  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
+    if (shm_fuzz == (void*)-1) PFATAL("shmat() failed");
 
-    last_plot_ms = cur_ms;
-    maybe_update_plot_file(t_byte_ratio, avg_exec);
- 
   }
 
-  /* Honor AFL_EXIT_WHEN_DONE and AFL_BENCH_UNTIL_CRASH. */
-
-  if (!dumb_mode && cycles_wo_finds > 100 && !pending_not_fuzzed &&
-      getenv("AFL_EXIT_WHEN_DONE")) stop_soon = 2;
+  /* Our own input file, so that re-runs never race the fuzzer's. */
 
-  if (total_crashes && getenv("AFL_BENCH_UNTIL_CRASH")) stop_soon = 2;
+  if (out_dir[0] == '/') in_path = alloc_printf("%s/.triage_input", out_dir);
+  else in_path = alloc_printf("%s/%s/.triage_input", cwd, out_dir);
 
-  /* If we're not on TTY, bail out. */
+  unlink(in_path); /* Ignore errors */
 
-  if (not_on_tty) return;
+  fd = open(in_path, O_RDWR | O_CREAT | O_EXCL, 0600);
 
-  /* Compute some mildly useful bitmap stats. */
+  if (fd < 0) PFATAL("Unable to create '%s'", in_path);
 
-  t_bits = (MAP_SIZE << 3) - count_bits(virgin_bits);
+  if (out_file) {
 
-  /* Now, for the visuals... */
+    /* File-input target: swap the fuzzer's input path for ours wherever
+       detect_file_args() put it into argv. */
 
-  if (clear_screen) {
+    u8* old = (out_file[0] == '/') ? out_file
+            : alloc_printf("%s/%s", cwd, out_file);
 
-    SAYF(TERM_CLEAR CURSOR_HIDE);
-    clear_screen = 0;
+    u32 old_len = strlen(old);
 
-    check_term_size();
+    for (i = 0; argv[i]; i++) {
 
-  }
+      u8* loc = strstr(argv[i], old);
 
-  SAYF(TERM_HOME);
+      if (loc) {
 
-  if (term_too_small) {
+        *loc = 0;
+        argv[i] = alloc_printf("%s%s%s", argv[i], in_path, loc + old_len);
 
-    SAYF(cBRI "Your terminal is too small to display the UI.\n"
-         "Please resize terminal window to at least 80x25.\n" cRST);
+      }
 
-    return;
+    }
 
-  }
+    out_file = in_path;
+    close(fd);
 
-  /* Let's start by drawing a centered banner. */
+  } else out_fd = fd;
 
-  banner_len = (crash_mode ? 24 : 22) + strlen(VERSION) + strlen(use_banner);
-  banner_pad = (80 - banner_len) / 2;
-  memset(tmp, ' ', banner_pad);
+  forksrv_pid = 0;
+  init_forkserver(argv);
 
-  sprintf(tmp + banner_pad, "%s " cLCY VERSION cLGN
-          " (%s)",  crash_mode ? cPIN "peruvian were-rabbit" : 
-          cYEL "american fuzzy lop", use_banner);
+  while (1) {
 
-  SAYF("\n%s\n\n", tmp);
+    struct triage_rec rec;
 
-  /* "Handy" shortcuts for drawing boxes... */
+    u32 tail = tr_hdr->tail;
+    u32 cksum, slot;
+    u8  fault, sig, repro;
+    u8* fn;
 
-#define bSTG    bSTART cGRA
-#define bH2     bH bH
-#define bH5     bH2 bH2 bH
-#define bH10    bH5 bH5
-#define bH20    bH10 bH10
-#define bH30    bH20 bH10
-#define SP5     "     "
-#define SP10    SP5 SP5
-#define SP20    SP10 SP10
+    if (tail == tr_hdr->head) {
 
-  /* Lord, forgive me this. */
+      if (tr_hdr->quit) exit(0);
+      if (getppid() != fuzzer_pid) exit(1);
 
-  SAYF(SET_G1 bSTG bLT bH bSTOP cCYA " process timing " bSTG bH30 bH5 bH2 bHB
-       bH bSTOP cCYA " overall results " bSTG bH5 bRT "\n");
+      usleep(1000);
+      continue;
 
-  if (dumb_mode) {
+    }
 
-    strcpy(tmp, cRST);
+    MEM_BARRIER();
 
-  } else {
+    tr_get(tail, &rec, sizeof(rec));
+    tr_get(tail + sizeof(rec), op, rec.op_len);
+    tr_get(tail + sizeof(rec) + rec.op_len, data, rec.len);
 
-    u64 min_wo_finds = (cur_ms - last_path_time) / 1000 / 60;
+    write_to_testcase(data, rec.len);
 
-    /* First queue cycle: don't stop now! */
-    if (queue_cycle == 1 || min_wo_finds < 15) strcpy(tmp, cMGN); else
+    fault = run_target(argv, exec_tmout);
 
-    /* Subsequent cycles, but we're still making finds. */
-    if (cycles_wo_finds < 25 || min_wo_finds < 30) strcpy(tmp, cYEL); else
+    if (fault == FAULT_CRASH) {
 
-    /* No finds for a long time and no test cases to try. */
-    if (cycles_wo_finds > 100 && !pending_not_fuzzed && min_wo_finds > 120)
-      strcpy(tmp, cLGN);
+      /* The trustworthy signature: simplified coverage of the re-run
+         plus the signal run_target() captured via WIFSIGNALED(). */
 
-    /* Default: cautiously OK to stop? */
-    else strcpy(tmp, cLBL);
+#ifdef WORD_SIZE_64
+      simplify_trace((u64*)trace_bits);
+#else
+      simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
 
-  }
+      trace_dirty_ok = 0;
 
-  SAYF(bV bSTOP "        run time : " cRST "%-34s " bSTG bV bSTOP
-       "  cycles done : %s%-5s  " bSTG bV "\n",
-       DTD(cur_ms, start_time), tmp, DI(queue_cycle - 1));
+      sig   = kill_signal;
+      cksum = hash32(trace_bits, map_size, HASH_CONST ^ sig);
+      repro = 1;
 
-  /* We want to warn people about not seeing new paths after a full cycle,
-     except when resuming fuzzing or running in non-instrumented mode. */
+    } else {
 
-  if (!dumb_mode && (last_path_time || resuming_fuzz || queue_cycle == 1 ||
-      in_bitmap || crash_mode)) {
+      /* Did not reproduce. Fall back to the fuzz-time signature so the
+         input is not lost, but keep it out of the unique-bug count. */
 
-    SAYF(bV bSTOP "   last new path : " cRST "%-34s ",
-         DTD(cur_ms, last_path_time));
+      sig   = rec.sig;
+      cksum = rec.cksum;
+      repro = 0;
 
-  } else {
+      tr_hdr->noise++;
 
-    if (dumb_mode)
+    }
 
-      SAYF(bV bSTOP "   last new path : " cPIN "n/a" cRST 
-           " (non-instrumented mode)        ");
+    slot = tb_lookup(cksum);
 
-     else
+    if (slot) {
 
-      SAYF(bV bSTOP "   last new path : " cRST "none yet " cLRD
-           "(odd, check syntax!)      ");
+      struct triage_bug* b = tb_list + slot - 1;
 
-  }
+      /* Known bug: record the sighting as a hard link to the first
+         file instead of writing the data out again. */
 
-  SAYF(bSTG bV bSTOP "  total paths : " cRST "%-5s  " bSTG bV "\n",
-       DI(queued_paths));
+      b->hits++;
 
-  /* Highlight crashes in red if found, denote going over the KEEP_UNIQUE_CRASH
-     limit with a '+' appended to the count. */
+      if (!dup_dir_ok) {
 
-  sprintf(tmp, "%s%s", DI(unique_crashes),
-          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+        fn = alloc_printf("%s/crashes/dups", out_dir);
+        if (mkdir(fn, 0700) && errno != EEXIST)
+          PFATAL("Unable to create '%s'", fn);
+        ck_free(fn);
 
-  SAYF(bV bSTOP " last uniq crash : " cRST "%-34s " bSTG bV bSTOP
-       " uniq crashes : %s%-6s " bSTG bV "\n",
-       DTD(cur_ms, last_crash_time), unique_crashes ? cLRD : cRST,
-       tmp);
+        dup_dir_ok = 1;
 
-  sprintf(tmp, "%s%s", DI(unique_hangs),
-         (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+      }
 
-  SAYF(bV bSTOP "  last uniq hang : " cRST "%-34s " bSTG bV bSTOP 
-       "   uniq hangs : " cRST "%-6s " bSTG bV "\n",
-       DTD(cur_ms, last_hang_time), tmp);
+#ifndef SIMPLE_FILES
 
-  SAYF(bVR bH bSTOP cCYA " cycle progress " bSTG bH20 bHB bH bSTOP cCYA
-       " map coverage " bSTG bH bHT bH20 bH2 bH bVL "\n");
+      fn = alloc_printf("%s/crashes/dups/id:%06u,bug:%06u", out_dir,
+                        tr_hdr->dups, slot - 1);
 
-  /* This gets funny because we want to print several variable-length variables
-     together, but then cram them into a fixed-width field - so we need to
-     put them in a temporary buffer first. */
+#else
 
-  sprintf(tmp, "%s%s (%0.02f%%)", DI(current_entry),
-          queue_cur->favored ? "" : "*",
-          ((double)current_entry * 100) / queued_paths);
+      fn = alloc_printf("%s/crashes/dups/id_%06u_%06u", out_dir,
+                        tr_hdr->dups, slot - 1);
 
-  SAYF(bV bSTOP "  now processing : " cRST "%-17s " bSTG bV bSTOP, tmp);
+#endif /* ^!SIMPLE_FILES */
 
-  sprintf(tmp, "%0.02f%% / %0.02f%%", ((double)queue_cur->bitmap_size) * 
-          100 / MAP_SIZE, t_byte_ratio);
+      if (link(b->fname, fn))
+        WARNF("Unable to link '%s'", fn);
 
-  SAYF("    map density : %s%-21s " bSTG bV "\n", t_byte_ratio > 70 ? cLRD : 
-       ((t_bytes < 200 && !dumb_mode) ? cPIN : cRST), tmp);
+      ck_free(fn);
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(cur_skipped_paths),
-          ((double)cur_skipped_paths * 100) / queued_paths);
+      tr_hdr->dups++;
 
-  SAYF(bV bSTOP " paths timed out : " cRST "%-17s " bSTG bV, tmp);
+    } else if (tb_cnt < KEEP_UNIQUE_CRASH) {
 
-  sprintf(tmp, "%0.02f bits/tuple",
-          t_bytes ? (((double)t_bits) / t_bytes) : 0);
+      if (!tb_cnt) write_crash_readme();
 
-  SAYF(bSTOP " count coverage : " cRST "%-21s " bSTG bV "\n", tmp);
+#ifndef SIMPLE_FILES
 
-  SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
-       " findings in depth " bSTG bH20 bVL "\n");
+      fn = alloc_printf("%s/crashes/id:%06u,sig:%02u,%s", out_dir,
+                        tb_cnt, sig, op);
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(queued_favored),
-          ((double)queued_favored) * 100 / queued_paths);
+#else
 
-  /* Yeah... it's still going on... halp? */
+      fn = alloc_printf("%s/crashes/id_%06u_%02u", out_dir, tb_cnt, sig);
 
-  SAYF(bV bSTOP "  now trying : " cRST "%-21s " bSTG bV bSTOP 
-       " favored paths : " cRST "%-22s " bSTG bV "\n", stage_name, tmp);
+#endif /* ^!SIMPLE_FILES */
 
-  if (!stage_max) {
+      fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      if (fd < 0) PFATAL("Unable to create '%s'", fn);
+      ck_write(fd, data, rec.len, fn);
+      close(fd);
 
-    sprintf(tmp, "%s/-", DI(stage_cur));
+      tb_register(cksum, sig, fn);
 
-  } else {
+      /* Keep the on-disk index in step; 'R' entries reproduced under
+         the triage fork server, 'N' ones did not. */
 
-    sprintf(tmp, "%s/%s (%0.02f%%)", DI(stage_cur), DI(stage_max),
-            ((double)stage_cur) * 100 / stage_max);
+      {
 
-  }
+        u8* ifn = alloc_printf("%s/crashes/triage_index", out_dir);
 
-  SAYF(bV bSTOP " stage execs : " cRST "%-21s " bSTG bV bSTOP, tmp);
+        index_f = fopen(ifn, "a");
+        ck_free(ifn);
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(queued_with_cov),
-          ((double)queued_with_cov) * 100 / queued_paths);
+        if (index_f) {
 
-  SAYF("  new edges on : " cRST "%-22s " bSTG bV "\n", tmp);
+          fprintf(index_f, "%c %08x %02u %s\n", repro ? 'R' : 'N', cksum,
+                  sig, strrchr(fn, '/') + 1);
+          fclose(index_f);
 
-  sprintf(tmp, "%s (%s%s unique)", DI(total_crashes), DI(unique_crashes),
-          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+        }
 
-  if (crash_mode) {
+      }
 
-    SAYF(bV bSTOP " total execs : " cRST "%-21s " bSTG bV bSTOP
-         "   new crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
-         unique_crashes ? cLRD : cRST, tmp);
+      if (repro) tr_hdr->uniq++;
 
-  } else {
+    }
 
-    SAYF(bV bSTOP " total execs : " cRST "%-21s " bSTG bV bSTOP
-         " total crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
-         unique_crashes ? cLRD : cRST, tmp);
+    MEM_BARRIER();
+    tr_hdr->tail = tail + sizeof(rec) + rec.op_len + rec.len;
 
   }
 
-  /* Show a warning about slow execution. */
+}
 
-  if (avg_exec < 100) {
 
-    sprintf(tmp, "%s/sec (%s)", DF(avg_exec), avg_exec < 20 ?
-            "zzzz..." : "slow!");
+/* Hand one crash over to the triage process. Unlike the write-behind
+   ring, this never blocks: if the worker is behind, the crash is dropped
+   and the seen set is left alone, so an identical crash found later gets
+   another chance. */
 
-    SAYF(bV bSTOP "  exec speed : " cLRD "%-21s ", tmp);
+static void triage_submit(void* mem, u32 len) {
 
-  } else {
+  struct triage_rec rec;
 
-    sprintf(tmp, "%s/sec", DF(avg_exec));
-    SAYF(bV bSTOP "  exec speed : " cRST "%-21s ", tmp);
+  u8* op;
+  u32 cksum, need, head;
 
-  }
+#ifdef WORD_SIZE_64
+  simplify_trace((u64*)trace_bits);
+#else
+  simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
 
-  sprintf(tmp, "%s (%s%s unique)", DI(total_tmouts), DI(unique_tmouts),
-          (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+  trace_dirty_ok = 0;
 
-  SAYF (bSTG bV bSTOP "  total tmouts : " cRST "%-22s " bSTG bV "\n", tmp);
+  cksum = hash32(trace_bits, map_size, HASH_CONST ^ kill_signal);
 
-  /* Aaaalmost there... hold on! */
+  if (ts_has(cksum)) return;
 
-  SAYF(bVR bH cCYA bSTOP " fuzzing strategy yields " bSTG bH10 bH bHT bH10
-       bH5 bHB bH bSTOP cCYA " path geometry " bSTG bH5 bH2 bH bVL "\n");
+  op = describe_op(0);
 
-  if (skip_deterministic) {
+  rec.len    = len;
+  rec.cksum  = cksum;
+  rec.op_len = strlen(op) + 1;
+  rec.sig    = kill_signal;
+  rec.unused = 0;
 
-    strcpy(tmp, "n/a, n/a, n/a");
+  need = sizeof(rec) + rec.op_len + len;
 
-  } else {
+  if (TRIAGE_RING_SIZE - (tr_hdr->head - tr_hdr->tail) < need) {
 
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_FLIP1]), DI(stage_cycles[STAGE_FLIP1]),
-            DI(stage_finds[STAGE_FLIP2]), DI(stage_cycles[STAGE_FLIP2]),
-            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP4]));
+    triage_check_worker();
+    triage_drops++;
+    return;
 
   }
 
-  SAYF(bV bSTOP "   bit flips : " cRST "%-37s " bSTG bV bSTOP "    levels : "
-       cRST "%-10s " bSTG bV "\n", tmp, DI(max_depth));
+  head = tr_hdr->head;
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_FLIP8]), DI(stage_cycles[STAGE_FLIP8]),
-            DI(stage_finds[STAGE_FLIP16]), DI(stage_cycles[STAGE_FLIP16]),
-            DI(stage_finds[STAGE_FLIP32]), DI(stage_cycles[STAGE_FLIP32]));
+  tr_put(head, &rec, sizeof(rec));
+  tr_put(head + sizeof(rec), op, rec.op_len);
+  tr_put(head + sizeof(rec) + rec.op_len, mem, len);
 
-  SAYF(bV bSTOP "  byte flips : " cRST "%-37s " bSTG bV bSTOP "   pending : "
-       cRST "%-10s " bSTG bV "\n", tmp, DI(pending_not_fuzzed));
+  MEM_BARRIER();
+  tr_hdr->head = head + need;
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_ARITH8]), DI(stage_cycles[STAGE_ARITH8]),
-            DI(stage_finds[STAGE_ARITH16]), DI(stage_cycles[STAGE_ARITH16]),
-            DI(stage_finds[STAGE_ARITH32]), DI(stage_cycles[STAGE_ARITH32]));
+  ts_add(cksum);
 
-  SAYF(bV bSTOP " arithmetics : " cRST "%-37s " bSTG bV bSTOP "  pend fav : "
-       cRST "%-10s " bSTG bV "\n", tmp, DI(pending_favored));
+}
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_INTEREST8]), DI(stage_cycles[STAGE_INTEREST8]),
-            DI(stage_finds[STAGE_INTEREST16]), DI(stage_cycles[STAGE_INTEREST16]),
-            DI(stage_finds[STAGE_INTEREST32]), DI(stage_cycles[STAGE_INTEREST32]));
 
-  SAYF(bV bSTOP "  known ints : " cRST "%-37s " bSTG bV bSTOP " own finds : "
-       cRST "%-10s " bSTG bV "\n", tmp, DI(queued_discovered));
+/* Fork off the triage process (AFL_CRASH_TRIAGE). */
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_EXTRAS_UO]), DI(stage_cycles[STAGE_EXTRAS_UO]),
-            DI(stage_finds[STAGE_EXTRAS_UI]), DI(stage_cycles[STAGE_EXTRAS_UI]),
-            DI(stage_finds[STAGE_EXTRAS_AO]), DI(stage_cycles[STAGE_EXTRAS_AO]));
+EXP_ST void setup_crash_triage(char** argv) {
 
-  SAYF(bV bSTOP "  dictionary : " cRST "%-37s " bSTG bV bSTOP
-       "  imported : " cRST "%-10s " bSTG bV "\n", tmp,
-       sync_id ? DI(queued_imported) : (u8*)"n/a");
+  if (!crash_triage_mode) return;
 
-  sprintf(tmp, "%s/%s, %s/%s",
-          DI(stage_finds[STAGE_HAVOC]), DI(stage_cycles[STAGE_HAVOC]),
-          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]));
+  ACTF("Spinning up the crash triage process...");
 
-  SAYF(bV bSTOP "       havoc : " cRST "%-37s " bSTG bV bSTOP, tmp);
+  if (out_file) {
 
-  if (t_bytes) sprintf(tmp, "%0.02f%%", stab_ratio);
-    else strcpy(tmp, "n/a");
+    u8* def = alloc_printf("%s/.cur_input", out_dir);
 
-  SAYF(" stability : %s%-10s " bSTG bV "\n", (stab_ratio < 85 && var_byte_count > 40) 
-       ? cLRD : ((queued_variable && (!persistent_mode || var_byte_count > 20))
-       ? cMGN : cRST), tmp);
+    if (strcmp(out_file, def))
+      FATAL("AFL_CRASH_TRIAGE does not support -f");
 
-  if (!bytes_trim_out) {
+    ck_free(def);
 
-    sprintf(tmp, "n/a, ");
+  }
 
-  } else {
+  tr_hdr = mmap(0, sizeof(struct triage_hdr) + TRIAGE_RING_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
-    sprintf(tmp, "%0.02f%%/%s, ",
-            ((double)(bytes_trim_in - bytes_trim_out)) * 100 / bytes_trim_in,
-            DI(trim_execs));
+  if (tr_hdr == MAP_FAILED) PFATAL("mmap() failed");
 
-  }
+  tr_ring = (u8*)(tr_hdr + 1);
 
-  if (!blocks_eff_total) {
+  /* Flush stdio before forking, or the worker inherits (and eventually
+     replays) whatever startup output is still sitting in the buffer. */
 
-    u8 tmp2[128];
+  fflush(stdout);
 
-    sprintf(tmp2, "n/a");
-    strcat(tmp, tmp2);
+  triage_pid = fork();
+  if (triage_pid < 0) PFATAL("fork() failed");
 
-  } else {
+  if (!triage_pid) triage_loop(argv); /* Does not return */
 
-    u8 tmp2[128];
+  OKF("All right - crash triage process is up.");
 
-    sprintf(tmp2, "%0.02f%%",
-            ((double)(blocks_eff_total - blocks_eff_select)) * 100 /
-            blocks_eff_total);
+}
 
-    strcat(tmp, tmp2);
 
-  }
+/* Wind down the triage process: let it chew through the backlog, then
+   reap it and report the tally. */
 
-  SAYF(bV bSTOP "        trim : " cRST "%-37s " bSTG bVR bH20 bH2 bH2 bRB "\n"
-       bLB bH30 bH20 bH2 bH bRB bSTOP cRST RESET_G1, tmp);
+static void stop_crash_triage(void) {
 
-  /* Provide some CPU utilization stats. */
+  if (triage_pid <= 0) return;
 
-  if (cpu_core_count) {
+  while (tr_hdr->tail != tr_hdr->head) {
 
-    double cur_runnable = get_runnable_processes();
-    u32 cur_utilization = cur_runnable * 100 / cpu_core_count;
+    if (waitpid(triage_pid, NULL, WNOHANG) > 0) {
 
-    u8* cpu_color = cCYA;
+      triage_pid = -1;
+      return;
 
-    /* If we could still run one or more processes, use green. */
+    }
 
-    if (cpu_core_count > 1 && cur_runnable + 1 <= cpu_core_count)
-      cpu_color = cLGN;
+    usleep(100);
 
-    /* If we're clearly oversubscribed, use red. */
+  }
 
-    if (!no_cpu_meter_red && cur_utilization >= 150) cpu_color = cLRD;
+  tr_hdr->quit = 1;
+  waitpid(triage_pid, NULL, 0);
+  triage_pid = -1;
 
-#ifdef HAVE_AFFINITY
+  OKF("Crash triage: %u unique bug(s), %u duplicate(s), %u not reproducible, "
+      "%u dropped.", tr_hdr->uniq, tr_hdr->dups, tr_hdr->noise, triage_drops);
 
-    if (cpu_aff >= 0) {
+}
 
-      SAYF(SP10 cGRA "[cpu%03u:%s%3u%%" cGRA "]\r" cRST, 
-           MIN(cpu_aff, 999), cpu_color,
-           MIN(cur_utilization, 999));
 
-    } else {
+/* Check if the result of an execve() during routine fuzzing is interesting,
+   save or queue the input test case for further analysis if so. Returns 1 if
+   entry is saved, 0 otherwise. */
 
-      SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
-           cpu_color, MIN(cur_utilization, 999));
- 
-   }
+static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
 
-#else
+  u8  *fn = "";
+  u8  hnb;
+  s32 fd;
+  u8  keeping = 0, res;
 
-    SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
-         cpu_color, MIN(cur_utilization, 999));
+  /* Frequency-based schedules need to know how often each path shows up,
+     so count every exec against its path bucket. The cksum was already
+     computed during trace classification. */
 
-#endif /* ^HAVE_AFFINITY */
+  if (n_fuzz_tab)
+    n_fuzz_tab[trace_cksum % N_FUZZ_SIZE]++;
 
-  } else SAYF("\r");
+  if (fault == crash_mode) {
 
-  /* Hallelujah! */
+    /* Keep only if there are new bits in the map, add to queue for
+       future fuzzing, etc. */
 
-  fflush(0);
+    if (!(hnb = has_new_bits(virgin_bits))) {
+      if (crash_mode) total_crashes++;
+      return 0;
+    }    
 
-}
+#ifndef SIMPLE_FILES
 
+    fn = alloc_printf("%s/queue/id:%06u,%s", out_dir, queued_paths,
+                      describe_op(hnb));
 
-/* Display quick statistics at the end of processing the input directory,
-   plus a bunch of warnings. Some calibration stuff also ended up here,
-   along with several hardcoded constants. Maybe clean up eventually. */
+#else
 
-static void show_init_stats(void) {
+    fn = alloc_printf("%s/queue/id_%06u", out_dir, queued_paths);
 
-  struct queue_entry* q = queue;
-  u32 min_bits = 0, max_bits = 0;
-  u64 min_us = 0, max_us = 0;
-  u64 avg_us = 0;
-  u32 max_len = 0;
+#endif /* ^!SIMPLE_FILES */
 
-  if (total_cal_cycles) avg_us = total_cal_us / total_cal_cycles;
+    add_to_queue(fn, len, 0);
 
-  while (q) {
+    if (hnb == 2) {
+      queue_top->has_new_cov = 1;
+      queued_with_cov++;
+    }
 
-    if (!min_us || q->exec_us < min_us) min_us = q->exec_us;
-    if (q->exec_us > max_us) max_us = q->exec_us;
+    queue_top->exec_cksum = n_fuzz_tab ? trace_cksum :
+                            hash32(trace_bits, map_size, HASH_CONST);
 
-    if (!min_bits || q->bitmap_size < min_bits) min_bits = q->bitmap_size;
-    if (q->bitmap_size > max_bits) max_bits = q->bitmap_size;
+    if (shm_sync_mode || net_sync_mode) cksum_set_add(queue_top->exec_cksum);
 
-    if (q->len > max_len) max_len = q->len;
+    /* Try to calibrate inline; this also calls update_bitmap_score() when
+       successful. */
 
-    q = q->next;
+    res = calibrate_case(argv, queue_top, mem, queue_cycle - 1, 0);
 
-  }
+    if (res == FAULT_ERROR)
+      FATAL("Unable to execute target application");
 
-  SAYF("\n");
+    if (async_write_mode) {
 
-  if (avg_us > (qemu_mode ? 50000 : 10000)) 
-    WARNF(cLRD "The target binary is pretty slow! See %s/perf_tips.txt.",
-          doc_path);
+      /* With SHM sync, peers may open the file the moment it is published,
+         so the backlog has to be flushed before we advertise it. */
 
-  /* Let's keep things moving with slow binaries. */
+      aw_submit(fn, mem, len, AW_EXCL);
+      if (shm_sync_mode) aw_drain();
 
-  if (avg_us > 50000) havoc_div = 10;     /* 0-19 execs/sec   */
-  else if (avg_us > 20000) havoc_div = 5; /* 20-49 execs/sec  */
-  else if (avg_us > 10000) havoc_div = 2; /* 50-100 execs/sec */
+    } else {
 
-  if (!resuming_fuzz) {
+      fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      if (fd < 0) PFATAL("Unable to create '%s'", fn);
+      ck_write(fd, mem, len, fn);
+      close(fd);
 
-    if (max_len > 50 * 1024)
-      WARNF(cLRD "Some test cases are huge (%s) - see %s/perf_tips.txt!",
-            DMS(max_len), doc_path);
-    else if (max_len > 10 * 1024)
-      WARNF("Some test cases are big (%s) - see %s/perf_tips.txt.",
-            DMS(max_len), doc_path);
+    }
 
-    if (useless_at_start && !in_bitmap)
-      WARNF(cLRD "Some test cases look useless. Consider using a smaller set.");
+    /* The bytes are right here in memory, so seed the corpus cache and
+       spare the read-back when the entry comes up for fuzzing. */
 
-    if (queued_paths > 100)
-      WARNF(cLRD "You probably have far too many input files! Consider trimming down.");
-    else if (queued_paths > 20)
-      WARNF("You have lots of input files; try starting small.");
+    queue_cache_put(queue_top, mem);
 
-  }
+    /* Tell our siblings about the find - but only once the file is in
+       place for them to read. */
 
-  OKF("Here are some useful stats:\n\n"
+    if (shm_sync_mode) sync_ring_publish(fn, len, queue_top->exec_cksum);
+    if (net_sync_mode) net_sync_publish(mem, len, queue_top->exec_cksum);
 
-      cGRA "    Test case count : " cRST "%u favored, %u variable, %u total\n"
-      cGRA "       Bitmap range : " cRST "%u to %u bits (average: %0.02f bits)\n"
-      cGRA "        Exec timing : " cRST "%s to %s us (average: %s us)\n",
-      queued_favored, queued_variable, queued_paths, min_bits, max_bits, 
-      ((double)total_bitmap_size) / (total_bitmap_entries ? total_bitmap_entries : 1),
-      DI(min_us), DI(max_us), DI(avg_us));
+    ck_free(fn);
+    fn = "";
 
-  if (!timeout_given) {
+    keeping = 1;
 
-    /* Figure out the appropriate timeout. The basic idea is: 5x average or
-       1x max, rounded up to EXEC_TM_ROUND ms and capped at 1 second.
+  }
 
-       If the program is slow, the multiplier is lowered to 2x or 3x, because
-       random scheduler jitter is less likely to have any impact, and because
-       our patience is wearing thin =) */
+  switch (fault) {
 
-    if (avg_us > 50000) exec_tmout = avg_us * 2 / 1000;
-    else if (avg_us > 10000) exec_tmout = avg_us * 3 / 1000;
-    else exec_tmout = avg_us * 5 / 1000;
+    case FAULT_TMOUT:
 
-    exec_tmout = MAX(exec_tmout, max_us / 1000);
-    exec_tmout = (exec_tmout + EXEC_TM_ROUND) / EXEC_TM_ROUND * EXEC_TM_ROUND;
+      /* Timeouts are not very interesting, but we're still obliged to keep
+         a handful of samples. We use the presence of new bits in the
+         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
+         just keep everything. */
 
-    if (exec_tmout > EXEC_TIMEOUT) exec_tmout = EXEC_TIMEOUT;
+      total_tmouts++;
 
-    ACTF("No -t option specified, so I'll use exec timeout of %u ms.", 
-         exec_tmout);
+      if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
 
-    timeout_given = 1;
+      if (!dumb_mode) {
 
-  } else if (timeout_given == 3) {
+#ifdef WORD_SIZE_64
+        simplify_trace((u64*)trace_bits);
+#else
+        simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
 
-    ACTF("Applying timeout settings from resumed session (%u ms).", exec_tmout);
+        /* Simplification just filled the whole map with 0x01s, so the
+           dirty-chunk log no longer covers it. */
 
-  }
+        trace_dirty_ok = 0;
 
-  /* In dumb mode, re-running every timing out test case with a generous time
-     limit is very expensive, so let's select a more conservative default. */
+        if (!has_new_bits(virgin_tmout)) return keeping;
 
-  if (dumb_mode && !getenv("AFL_HANG_TMOUT"))
-    hang_tmout = MIN(EXEC_TIMEOUT, exec_tmout * 2 + 100);
+      }
 
-  OKF("All set and ready to roll!");
+      unique_tmouts++;
 
-}
+      /* Before saving, we make sure that it's a genuine hang by re-running
+         the target with a more generous timeout (unless the default timeout
+         is already generous). */
 
+      if (exec_tmout < hang_tmout) {
 
-/* Find first power of two greater or equal to val (assuming val under
-   2^31). */
+        u8 new_fault;
+        write_to_testcase(mem, len);
+        new_fault = run_target(argv, hang_tmout);
 
-static u32 next_p2(u32 val) {
+        /* A corner case that one user reported bumping into: increasing the
+           timeout actually uncovers a crash. Make sure we don't discard it if
+           so. */
 
-  u32 ret = 1;
-  while (val > ret) ret <<= 1;
-  return ret;
+        if (!stop_soon && new_fault == FAULT_CRASH) goto keep_as_crash;
 
-} 
+        if (stop_soon || new_fault != FAULT_TMOUT) return keeping;
 
+      }
 
-/* Trim all new test cases to save cycles when doing deterministic checks. The
-   trimmer uses power-of-two increments somewhere between 1/16 and 1/1024 of
-   file size, to keep the stage short and sweet. */
+#ifndef SIMPLE_FILES
 
-static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
+      fn = alloc_printf("%s/hangs/id:%06llu,%s", out_dir,
+                        unique_hangs, describe_op(0));
 
-  static u8 tmp[64];
-  static u8 clean_trace[MAP_SIZE];
+#else
 
-  u8  needs_write = 0, fault = 0;
-  u32 trim_exec = 0;
-  u32 remove_len;
-  u32 len_p2;
+      fn = alloc_printf("%s/hangs/id_%06llu", out_dir,
+                        unique_hangs);
 
-  /* Although the trimmer will be less useful when variable behavior is
-     detected, it will still work to some extent, so we don't check for
-     this. */
+#endif /* ^!SIMPLE_FILES */
 
-  if (q->len < 5) return 0;
+      unique_hangs++;
 
-  stage_name = tmp;
-  bytes_trim_in += q->len;
+      last_hang_time = get_cur_time();
 
-  /* Select initial chunk len, starting with large steps. */
+      break;
 
-  len_p2 = next_p2(q->len);
+    case FAULT_CRASH:
 
-  remove_len = MAX(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
+keep_as_crash:
 
-  /* Continue until the number of steps gets too high or the stepover
-     gets too small. */
+      /* This is handled in a manner roughly similar to timeouts,
+         except for slightly different limits and no need to re-run test
+         cases. */
 
-  while (remove_len >= MAX(len_p2 / TRIM_END_STEPS, TRIM_MIN_BYTES)) {
+      total_crashes++;
 
-    u32 remove_pos = remove_len;
+      /* In triage mode, the hand-off is all we do here: the triage
+         process re-runs the case, dedups it on the exact faulting path,
+         and owns all writes to crashes/. */
 
-    sprintf(tmp, "trim %s/%s", DI(remove_len), DI(remove_len));
+      if (crash_triage_mode) {
 
-    stage_cur = 0;
-    stage_max = q->len / remove_len;
+        triage_submit(mem, len);
 
-    while (remove_pos < q->len) {
+        last_crash_time  = get_cur_time();
+        last_crash_execs = total_execs;
 
-      u32 trim_avail = MIN(remove_len, q->len - remove_pos);
-      u32 cksum;
+        return keeping;
 
-      write_with_gap(in_buf, q->len, remove_pos, trim_avail);
+      }
 
-      fault = run_target(argv, exec_tmout);
-      trim_execs++;
+      if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
 
-      if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+      if (!dumb_mode) {
 
-      /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
+#ifdef WORD_SIZE_64
+        simplify_trace((u64*)trace_bits);
+#else
+        simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
 
-      cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+        trace_dirty_ok = 0;
 
-      /* If the deletion had no impact on the trace, make it permanent. This
-         isn't perfect for variable-path inputs, but we're just making a
-         best-effort pass, so it's not a big deal if we end up with false
-         negatives every now and then. */
+        if (!has_new_bits(virgin_crash)) return keeping;
 
-      if (cksum == q->exec_cksum) {
+      }
 
-        u32 move_tail = q->len - remove_pos - trim_avail;
+      if (!unique_crashes) write_crash_readme();
+
+#ifndef SIMPLE_FILES
+
+      fn = alloc_printf("%s/crashes/id:%06llu,sig:%02u,%s", out_dir,
+                        unique_crashes, kill_signal, describe_op(0));
+
+#else
+
+      fn = alloc_printf("%s/crashes/id_%06llu_%02u", out_dir, unique_crashes,
+                        kill_signal);
+
+#endif /* ^!SIMPLE_FILES */
+
+      unique_crashes++;
+
+      last_crash_time = get_cur_time();
+      last_crash_execs = total_execs;
+
+      break;
+
+    case FAULT_ERROR: FATAL("Unable to execute target application");
+
+    default: return keeping;
+
+  }
+
+  /* If we're here, we apparently want to save the crash or hang
+     test case, too. */
+
+  if (async_write_mode) aw_submit(fn, mem, len, AW_EXCL);
+  else {
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", fn);
+    ck_write(fd, mem, len, fn);
+    close(fd);
+
+  }
+
+  ck_free(fn);
+
+  return keeping;
+
+}
+
+
+/* When resuming, try to find the queue position to start from. This makes sense
+   only when resuming, and when we can find the original fuzzer_stats. */
+
+static u32 find_start_position(void) {
+
+  static u8 tmp[4096]; /* Ought to be enough for anybody. */
+
+  u8  *fn, *off;
+  s32 fd, i;
+  u32 ret;
+
+  if (!resuming_fuzz) return 0;
+
+  if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+
+  fd = open(fn, O_RDONLY);
+  ck_free(fn);
+
+  if (fd < 0) return 0;
+
+  i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
+  close(fd);
+
+  off = strstr(tmp, "cur_path          : ");
+  if (!off) return 0;
+
+  ret = atoi(off + 20);
+  if (ret >= queued_paths) ret = 0;
+  return ret;
+
+}
+
+
+/* The same, but for timeouts. The idea is that when resuming sessions without
+   -t given, we don't want to keep auto-scaling the timeout over and over
+   again to prevent it from growing due to random flukes. */
+
+static void find_timeout(void) {
+
+  static u8 tmp[4096]; /* Ought to be enough for anybody. */
+
+  u8  *fn, *off;
+  s32 fd, i;
+  u32 ret;
+
+  if (!resuming_fuzz) return;
+
+  if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+
+  fd = open(fn, O_RDONLY);
+  ck_free(fn);
+
+  if (fd < 0) return;
+
+  i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
+  close(fd);
+
+  off = strstr(tmp, "exec_timeout      : ");
+  if (!off) return;
+
+  ret = atoi(off + 20);
+  if (ret <= 4) return;
+
+  exec_tmout = ret;
+  timeout_given = 3;
+
+}
+
+
+/* Refresh the mmap'd telemetry block. Called from show_stats() on every
+   UI pass, so monitoring tools see sub-second-fresh counters without us
+   rewriting fuzzer_stats any more often. */
+
+static void telemetry_update(double bitmap_cvg, double stability,
+                             double eps) {
+
+  if (!telemetry) return;
+
+  telemetry->seq++;
+  MEM_BARRIER();
+
+  telemetry->last_update      = get_cur_time() / 1000;
+  telemetry->start_time       = start_time / 1000;
+  telemetry->total_execs      = total_execs;
+  telemetry->eps_x100         = (u64)(eps * 100 + 0.5);
+  telemetry->cycles_done      = queue_cycle ? (queue_cycle - 1) : 0;
+  telemetry->unique_crashes   = unique_crashes;
+  telemetry->unique_hangs     = unique_hangs;
+  telemetry->last_path        = last_path_time / 1000;
+  telemetry->last_crash       = last_crash_time / 1000;
+  telemetry->last_hang        = last_hang_time / 1000;
+  telemetry->cur_path         = current_entry;
+  telemetry->paths_total      = queued_paths;
+  telemetry->pending_total    = pending_not_fuzzed;
+  telemetry->pending_favored  = pending_favored;
+  telemetry->paths_found      = queued_discovered;
+  telemetry->paths_imported   = queued_imported;
+  telemetry->max_depth        = max_depth;
+  telemetry->bitmap_cvg_x100  = (u32)(bitmap_cvg * 100 + 0.5);
+  telemetry->stability_x100   = (u32)(stability * 100 + 0.5);
+  telemetry->paths_favored    = queued_favored;
+
+  MEM_BARRIER();
+  telemetry->seq++;
+
+}
+
+
+/* Update stats file for unattended monitoring. */
+
+static void write_stats_file(double bitmap_cvg, double stability, double eps) {
+
+  static double last_bcvg, last_stab, last_eps;
+  static struct rusage usage;
+
+  u8* fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  s32 fd;
+  FILE* f;
+
+  char*  mem_buf  = NULL;
+  size_t mem_size = 0;
+
+  if (async_write_mode) {
+
+    /* Compose the file in memory and hand the blob to the writer. */
+
+    f = open_memstream(&mem_buf, &mem_size);
+    if (!f) PFATAL("open_memstream() failed");
+
+  } else {
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+    f = fdopen(fd, "w");
+
+    if (!f) PFATAL("fdopen() failed");
+
+  }
+
+  /* Keep last values in case we're called from another context
+     where exec/sec stats and such are not readily available. */
+
+  if (!bitmap_cvg && !stability && !eps) {
+    bitmap_cvg = last_bcvg;
+    stability  = last_stab;
+    eps        = last_eps;
+  } else {
+    last_bcvg = bitmap_cvg;
+    last_stab = stability;
+    last_eps  = eps;
+  }
+
+  /* In triage mode, the authoritative unique count comes from the worker. */
+
+  if (tr_hdr) unique_crashes = tr_hdr->uniq;
+
+  fprintf(f, "start_time        : %llu\n"
+             "last_update       : %llu\n"
+             "fuzzer_pid        : %u\n"
+             "cycles_done       : %llu\n"
+             "execs_done        : %llu\n"
+             "execs_per_sec     : %0.02f\n"
+             "paths_total       : %u\n"
+             "paths_favored     : %u\n"
+             "paths_found       : %u\n"
+             "paths_imported    : %u\n"
+             "max_depth         : %u\n"
+             "cur_path          : %u\n" /* Must match find_start_position() */
+             "pending_favs      : %u\n"
+             "pending_total     : %u\n"
+             "variable_paths    : %u\n"
+             "stability         : %0.02f%%\n"
+             "bitmap_cvg        : %0.02f%%\n"
+             "unique_crashes    : %llu\n"
+             "unique_hangs      : %llu\n"
+             "last_path         : %llu\n"
+             "last_crash        : %llu\n"
+             "last_hang         : %llu\n"
+             "execs_since_crash : %llu\n"
+             "exec_timeout      : %u\n" /* Must match find_timeout() */
+             "afl_banner        : %s\n"
+             "afl_version       : " VERSION "\n"
+             "target_mode       : %s%s%s%s%s%s%s\n"
+             "command_line      : %s\n"
+             "slowest_exec_ms   : %llu\n",
+             start_time / 1000, get_cur_time() / 1000, getpid(),
+             queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
+             queued_paths, queued_favored, queued_discovered, queued_imported,
+             max_depth, current_entry, pending_favored, pending_not_fuzzed,
+             queued_variable, stability, bitmap_cvg, unique_crashes,
+             unique_hangs, last_path_time / 1000, last_crash_time / 1000,
+             last_hang_time / 1000, total_execs - last_crash_execs,
+             exec_tmout, use_banner,
+             qemu_mode ? "qemu " : "", dumb_mode ? " dumb " : "",
+             no_forkserver ? "no_forksrv " : "", crash_mode ? "crash " : "",
+             persistent_mode ? "persistent " : "", deferred_mode ? "deferred " : "",
+             (qemu_mode || dumb_mode || no_forkserver || crash_mode ||
+              persistent_mode || deferred_mode) ? "" : "default",
+             orig_cmdline, slowest_exec_ms);
+             /* ignore errors */
+
+  if (tr_hdr)
+    fprintf(f, "triage_dups       : %u\n"
+               "triage_noise      : %u\n"
+               "triage_drops      : %u\n",
+            tr_hdr->dups, tr_hdr->noise, triage_drops);
+
+  /* Get rss value from the children
+     We must have killed the forkserver process and called waitpid
+     before calling getrusage */
+  if (getrusage(RUSAGE_CHILDREN, &usage)) {
+      WARNF("getrusage failed");
+  } else if (usage.ru_maxrss == 0) {
+    fprintf(f, "peak_rss_mb       : not available while afl is running\n");
+  } else {
+#ifdef __APPLE__
+    fprintf(f, "peak_rss_mb       : %zu\n", usage.ru_maxrss >> 20);
+#else
+    fprintf(f, "peak_rss_mb       : %zu\n", usage.ru_maxrss >> 10);
+#endif /* ^__APPLE__ */
+  }
+
+  fclose(f);
+
+  if (async_write_mode) {
+
+    aw_submit(fn, mem_buf, mem_size, AW_TRUNC);
+    free(mem_buf); /* not tracked */
+
+  }
+
+  ck_free(fn);
+
+}
+
+
+/* Update the plot file if there is a reason to. */
+
+static void maybe_update_plot_file(double bitmap_cvg, double eps) {
+
+  static u32 prev_qp, prev_pf, prev_pnf, prev_ce, prev_md;
+  static u64 prev_qc, prev_uc, prev_uh;
+
+  if (prev_qp == queued_paths && prev_pf == pending_favored && 
+      prev_pnf == pending_not_fuzzed && prev_ce == current_entry &&
+      prev_qc == queue_cycle && prev_uc == unique_crashes &&
+      prev_uh == unique_hangs && prev_md == max_depth) return;
+
+  prev_qp  = queued_paths;
+  prev_pf  = pending_favored;
+  prev_pnf = pending_not_fuzzed;
+  prev_ce  = current_entry;
+  prev_qc  = queue_cycle;
+  prev_uc  = unique_crashes;
+  prev_uh  = unique_hangs;
+  prev_md  = max_depth;
+
+  /* Fields in the file:
+
+     unix_time, cycles_done, cur_path, paths_total, paths_not_fuzzed,
+     favored_not_fuzzed, unique_crashes, unique_hangs, max_depth,
+     execs_per_sec */
+
+  if (async_write_mode) {
+
+    static u8* plot_fn;
+    u8 tmp[256];
+
+    if (!plot_fn) plot_fn = alloc_printf("%s/plot_data", out_dir);
+
+    snprintf(tmp, sizeof(tmp),
+             "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
+             get_cur_time() / 1000, queue_cycle - 1, current_entry,
+             queued_paths, pending_not_fuzzed, pending_favored, bitmap_cvg,
+             unique_crashes, unique_hangs, max_depth, eps);
+
+    aw_submit(plot_fn, tmp, strlen(tmp), AW_APPEND);
+    return;
+
+  }
+
+  fprintf(plot_file,
+          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
+          get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
+          pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
+          unique_hangs, max_depth, eps); /* ignore errors */
+
+  fflush(plot_file);
+
+}
+
+
+
+/* A helper function for maybe_delete_out_dir(), deleting all prefixed
+   files in a directory. */
+
+static u8 delete_files(u8* path, u8* prefix) {
+
+  DIR* d;
+  struct dirent* d_ent;
+
+  d = opendir(path);
+
+  if (!d) return 0;
+
+  while ((d_ent = readdir(d))) {
+
+    if (d_ent->d_name[0] != '.' && (!prefix ||
+        !strncmp(d_ent->d_name, prefix, strlen(prefix)))) {
+
+      u8* fname = alloc_printf("%s/%s", path, d_ent->d_name);
+      if (unlink(fname)) PFATAL("Unable to delete '%s'", fname);
+      ck_free(fname);
+
+    }
+
+  }
+
+  closedir(d);
+
+  return !!rmdir(path);
+
+}
+
+
+/* Get the number of runnable processes, with some simple smoothing. */
+
+static double get_runnable_processes(void) {
+
+  static double res;
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
+
+  /* I don't see any portable sysctl or so that would quickly give us the
+     number of runnable processes; the 1-minute load average can be a
+     semi-decent approximation, though. */
+
+  if (getloadavg(&res, 1) != 1) return 0;
+
+#else
+
+  /* On Linux, /proc/stat is probably the best way; load averages are
+     computed in funny ways and sometimes don't reflect extremely short-lived
+     processes well. */
+
+  FILE* f = fopen("/proc/stat", "r");
+  u8 tmp[1024];
+  u32 val = 0;
+
+  if (!f) return 0;
+
+  while (fgets(tmp, sizeof(tmp), f)) {
+
+    if (!strncmp(tmp, "procs_running ", 14) ||
+        !strncmp(tmp, "procs_blocked ", 14)) val += atoi(tmp + 14);
+
+  }
+ 
+  fclose(f);
+
+  if (!res) {
+
+    res = val;
+
+  } else {
+
+    res = res * (1.0 - 1.0 / AVG_SMOOTHING) +
+          ((double)val) * (1.0 / AVG_SMOOTHING);
+
+  }
+
+#endif /* ^(__APPLE__ || __FreeBSD__ || __OpenBSD__) */
+
+  return res;
+
+}
+
+
+/* Delete the temporary directory used for in-place session resume. */
+
+static void nuke_resume_dir(void) {
+
+  u8* fn;
+
+  fn = alloc_printf("%s/_resume/.state/deterministic_done", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state/auto_extras", out_dir);
+  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state/redundant_edges", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state/variable_behavior", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state/det_progress", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state", out_dir);
+  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  return;
+
+dir_cleanup_failed:
+
+  FATAL("_resume directory cleanup failed");
+
+}
+
+
+/* Delete fuzzer output directory if we recognize it as ours, if the fuzzer
+   is not currently running, and if the last run time isn't too great. */
+
+static void maybe_delete_out_dir(void) {
+
+  FILE* f;
+  u8 *fn = alloc_printf("%s/fuzzer_stats", out_dir);
+
+  /* See if the output directory is locked. If yes, bail out. If not,
+     create a lock that will persist for the lifetime of the process
+     (this requires leaving the descriptor open).*/
+
+  out_dir_fd = open(out_dir, O_RDONLY);
+  if (out_dir_fd < 0) PFATAL("Unable to open '%s'", out_dir);
+
+#ifndef __sun
+
+  if (flock(out_dir_fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK) {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Looks like the job output directory is being actively used by another\n"
+         "    instance of afl-fuzz. You will need to choose a different %s\n"
+         "    or stop the other process first.\n",
+         sync_id ? "fuzzer ID" : "output location");
+
+    FATAL("Directory '%s' is in use", out_dir);
+
+  }
+
+#endif /* !__sun */
+
+  f = fopen(fn, "r");
+
+  if (f) {
+
+    u64 start_time, last_update;
+
+    if (fscanf(f, "start_time     : %llu\n"
+                  "last_update    : %llu\n", &start_time, &last_update) != 2)
+      FATAL("Malformed data in '%s'", fn);
+
+    fclose(f);
+
+    /* Let's see how much work is at stake. */
+
+    if (!in_place_resume && last_update - start_time > OUTPUT_GRACE * 60) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "The job output directory already exists and contains the results of more\n"
+           "    than %u minutes worth of fuzzing. To avoid data loss, afl-fuzz will *NOT*\n"
+           "    automatically delete this data for you.\n\n"
+
+           "    If you wish to start a new session, remove or rename the directory manually,\n"
+           "    or specify a different output location for this job. To resume the old\n"
+           "    session, put '-' as the input directory in the command line ('-i -') and\n"
+           "    try again.\n", OUTPUT_GRACE);
+
+       FATAL("At-risk data found in '%s'", out_dir);
+
+    }
+
+  }
+
+  ck_free(fn);
+
+  /* The idea for in-place resume is pretty simple: we temporarily move the old
+     queue/ to a new location that gets deleted once import to the new queue/
+     is finished. If _resume/ already exists, the current queue/ may be
+     incomplete due to an earlier abort, so we want to use the old _resume/
+     dir instead, and we let rename() fail silently. */
+
+  if (in_place_resume) {
+
+    u8* orig_q = alloc_printf("%s/queue", out_dir);
+
+    in_dir = alloc_printf("%s/_resume", out_dir);
+
+    rename(orig_q, in_dir); /* Ignore errors */
+
+    OKF("Output directory exists, will attempt session resume.");
+
+    ck_free(orig_q);
+
+  } else {
+
+    OKF("Output directory exists but deemed OK to reuse.");
+
+  }
+
+  ACTF("Deleting old session data...");
+
+  /* Okay, let's get the ball rolling! First, we need to get rid of the entries
+     in <out_dir>/.synced/.../id:*, if any are present. */
+
+  if (!in_place_resume) {
+
+    fn = alloc_printf("%s/.synced", out_dir);
+    if (delete_files(fn, NULL)) goto dir_cleanup_failed;
+    ck_free(fn);
+
+  }
+
+  /* Next, we need to clean up <out_dir>/queue/.state/ subdirectories: */
+
+  fn = alloc_printf("%s/queue/.state/deterministic_done", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/auto_extras", out_dir);
+  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/redundant_edges", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/variable_behavior", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/det_progress", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* Then, get rid of the .state subdirectory itself (should be empty by now)
+     and everything matching <out_dir>/queue/id:*. */
+
+  fn = alloc_printf("%s/queue/.state", out_dir);
+  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* All right, let's do <out_dir>/crashes/id:* and <out_dir>/hangs/id:*. */
+
+  if (!in_place_resume) {
+
+    fn = alloc_printf("%s/crashes/README.txt", out_dir);
+    unlink(fn); /* Ignore errors */
+    ck_free(fn);
+
+    fn = alloc_printf("%s/crashes/triage_index", out_dir);
+    unlink(fn); /* Ignore errors */
+    ck_free(fn);
+
+    fn = alloc_printf("%s/crashes/dups", out_dir);
+    if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+    ck_free(fn);
+
+  }
+
+  fn = alloc_printf("%s/crashes", out_dir);
+
+  /* Make backup of the crashes directory if it's not empty and if we're
+     doing in-place resume. */
+
+  if (in_place_resume && rmdir(fn)) {
+
+    time_t cur_t = time(0);
+    struct tm* t = localtime(&cur_t);
+
+#ifndef SIMPLE_FILES
+
+    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+#else
+
+    u8* nfn = alloc_printf("%s_%04u%02u%02u%02u%02u%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+#endif /* ^!SIMPLE_FILES */
+
+    rename(fn, nfn); /* Ignore errors. */
+    ck_free(nfn);
+
+  }
+
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/hangs", out_dir);
+
+  /* Backup hangs, too. */
+
+  if (in_place_resume && rmdir(fn)) {
+
+    time_t cur_t = time(0);
+    struct tm* t = localtime(&cur_t);
+
+#ifndef SIMPLE_FILES
+
+    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+#else
+
+    u8* nfn = alloc_printf("%s_%04u%02u%02u%02u%02u%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+#endif /* ^!SIMPLE_FILES */
+
+    rename(fn, nfn); /* Ignore errors. */
+    ck_free(nfn);
+
+  }
+
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* And now, for some finishing touches. */
+
+  fn = alloc_printf("%s/.cur_input", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/fuzz_bitmap", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/telemetry", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  if (!in_place_resume) {
+    fn  = alloc_printf("%s/fuzzer_stats", out_dir);
+    if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+    ck_free(fn);
+  }
+
+  fn = alloc_printf("%s/plot_data", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  OKF("Output dir cleanup successful.");
+
+  /* Wow... is that all? If yes, celebrate! */
+
+  return;
+
+dir_cleanup_failed:
+
+  SAYF("\n" cLRD "[-] " cRST
+       "Whoops, the fuzzer tried to reuse your output directory, but bumped into\n"
+       "    some files that shouldn't be there or that couldn't be removed - so it\n"
+       "    decided to abort! This happened while processing this path:\n\n"
+
+       "    %s\n\n"
+       "    Please examine and manually delete the files, or specify a different\n"
+       "    output location for the tool.\n", fn);
+
+  FATAL("Output directory cleanup failed");
+
+}
+
+
+static void check_term_size(void);
+
+
+/* A spiffy retro stats screen! This is called every stats_update_freq
+   execve() calls, plus in several other circumstances. */
+
+static void show_stats(void) {
+
+  static u64 last_stats_ms, last_plot_ms, last_ms, last_execs;
+  static double avg_exec;
+  double t_byte_ratio, stab_ratio;
+
+  u64 cur_ms;
+  u32 t_bytes, t_bits;
+
+  u32 banner_len, banner_pad;
+  u8  tmp[256];
+
+  cur_ms = get_cur_time();
+
+  /* If not enough time has passed since last UI update, bail out. */
+
+  if (cur_ms - last_ms < 1000 / UI_TARGET_HZ) return;
+
+  /* In triage mode, the unique-crash counter belongs to the worker. */
+
+  if (tr_hdr) unique_crashes = tr_hdr->uniq;
+
+  /* Check if we're past the 10 minute mark. */
+
+  if (cur_ms - start_time > 10 * 60 * 1000) run_over10m = 1;
+
+  /* Calculate smoothed exec speed stats. */
+
+  if (!last_execs) {
+  
+    avg_exec = ((double)total_execs) * 1000 / (cur_ms - start_time);
+
+  } else {
+
+    double cur_avg = ((double)(total_execs - last_execs)) * 1000 /
+                     (cur_ms - last_ms);
+
+    /* If there is a dramatic (5x+) jump in speed, reset the indicator
+       more quickly. */
+
+    if (cur_avg * 5 < avg_exec || cur_avg / 5 > avg_exec)
+      avg_exec = cur_avg;
+
+    avg_exec = avg_exec * (1.0 - 1.0 / AVG_SMOOTHING) +
+               cur_avg * (1.0 / AVG_SMOOTHING);
+
+  }
+
+  last_ms = cur_ms;
+  last_execs = total_execs;
+
+  /* Tell the callers when to contact us (as measured in execs). */
+
+  stats_update_freq = avg_exec / (UI_TARGET_HZ * 10);
+  if (!stats_update_freq) stats_update_freq = 1;
+
+  /* Do some bitmap stats. */
+
+  t_bytes = count_non_255_bytes(virgin_bits, map_size);
+  t_byte_ratio = ((double)t_bytes * 100) / map_size;
+
+  if (t_bytes)
+    stab_ratio = 100 - ((double)var_byte_count) * 100 / t_bytes;
+  else
+    stab_ratio = 100;
+
+  telemetry_update(t_byte_ratio, stab_ratio, avg_exec);
+
+  /* Roughly every minute, update fuzzer stats and save auto tokens. */
+
+  if (cur_ms - last_stats_ms > STATS_UPDATE_SEC * 1000) {
+
+    last_stats_ms = cur_ms;
+    write_stats_file(t_byte_ratio, stab_ratio, avg_exec);
+    save_auto();
+    write_bitmap();
+
+  }
+
+  /* Every now and then, write plot data. */
+
+  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
+
+    last_plot_ms = cur_ms;
+    maybe_update_plot_file(t_byte_ratio, avg_exec);
+ 
+  }
+
+  /* Honor AFL_EXIT_WHEN_DONE and AFL_BENCH_UNTIL_CRASH. */
+
+  if (!dumb_mode && cycles_wo_finds > 100 && !pending_not_fuzzed &&
+      getenv("AFL_EXIT_WHEN_DONE")) stop_soon = 2;
+
+  if (total_crashes && getenv("AFL_BENCH_UNTIL_CRASH")) stop_soon = 2;
+
+  /* If we're not on TTY, bail out. */
+
+  if (not_on_tty) return;
+
+  /* Compute some mildly useful bitmap stats. */
+
+  t_bits = (map_size << 3) - count_bits(virgin_bits, map_size);
+
+  /* Now, for the visuals... */
+
+  if (clear_screen) {
+
+    SAYF(TERM_CLEAR CURSOR_HIDE);
+    clear_screen = 0;
+
+    check_term_size();
+
+  }
+
+  SAYF(TERM_HOME);
+
+  if (term_too_small) {
+
+    SAYF(cBRI "Your terminal is too small to display the UI.\n"
+         "Please resize terminal window to at least 80x25.\n" cRST);
+
+    return;
+
+  }
+
+  /* Let's start by drawing a centered banner. */
+
+  banner_len = (crash_mode ? 24 : 22) + strlen(VERSION) + strlen(use_banner);
+  banner_pad = (80 - banner_len) / 2;
+  memset(tmp, ' ', banner_pad);
+
+  sprintf(tmp + banner_pad, "%s " cLCY VERSION cLGN
+          " (%s)",  crash_mode ? cPIN "peruvian were-rabbit" : 
+          cYEL "american fuzzy lop", use_banner);
+
+  SAYF("\n%s\n\n", tmp);
+
+  /* "Handy" shortcuts for drawing boxes... */
+
+#define bSTG    bSTART cGRA
+#define bH2     bH bH
+#define bH5     bH2 bH2 bH
+#define bH10    bH5 bH5
+#define bH20    bH10 bH10
+#define bH30    bH20 bH10
+#define SP5     "     "
+#define SP10    SP5 SP5
+#define SP20    SP10 SP10
+
+  /* Lord, forgive me this. */
+
+  SAYF(SET_G1 bSTG bLT bH bSTOP cCYA " process timing " bSTG bH30 bH5 bH2 bHB
+       bH bSTOP cCYA " overall results " bSTG bH5 bRT "\n");
+
+  if (dumb_mode) {
+
+    strcpy(tmp, cRST);
+
+  } else {
+
+    u64 min_wo_finds = (cur_ms - last_path_time) / 1000 / 60;
+
+    /* First queue cycle: don't stop now! */
+    if (queue_cycle == 1 || min_wo_finds < 15) strcpy(tmp, cMGN); else
+
+    /* Subsequent cycles, but we're still making finds. */
+    if (cycles_wo_finds < 25 || min_wo_finds < 30) strcpy(tmp, cYEL); else
+
+    /* No finds for a long time and no test cases to try. */
+    if (cycles_wo_finds > 100 && !pending_not_fuzzed && min_wo_finds > 120)
+      strcpy(tmp, cLGN);
+
+    /* Default: cautiously OK to stop? */
+    else strcpy(tmp, cLBL);
+
+  }
+
+  SAYF(bV bSTOP "        run time : " cRST "%-34s " bSTG bV bSTOP
+       "  cycles done : %s%-5s  " bSTG bV "\n",
+       DTD(cur_ms, start_time), tmp, DI(queue_cycle - 1));
+
+  /* We want to warn people about not seeing new paths after a full cycle,
+     except when resuming fuzzing or running in non-instrumented mode. */
+
+  if (!dumb_mode && (last_path_time || resuming_fuzz || queue_cycle == 1 ||
+      in_bitmap || crash_mode)) {
+
+    SAYF(bV bSTOP "   last new path : " cRST "%-34s ",
+         DTD(cur_ms, last_path_time));
+
+  } else {
+
+    if (dumb_mode)
+
+      SAYF(bV bSTOP "   last new path : " cPIN "n/a" cRST 
+           " (non-instrumented mode)        ");
+
+     else
+
+      SAYF(bV bSTOP "   last new path : " cRST "none yet " cLRD
+           "(odd, check syntax!)      ");
+
+  }
+
+  SAYF(bSTG bV bSTOP "  total paths : " cRST "%-5s  " bSTG bV "\n",
+       DI(queued_paths));
+
+  /* Highlight crashes in red if found, denote going over the KEEP_UNIQUE_CRASH
+     limit with a '+' appended to the count. */
+
+  sprintf(tmp, "%s%s", DI(unique_crashes),
+          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+
+  SAYF(bV bSTOP " last uniq crash : " cRST "%-34s " bSTG bV bSTOP
+       " uniq crashes : %s%-6s " bSTG bV "\n",
+       DTD(cur_ms, last_crash_time), unique_crashes ? cLRD : cRST,
+       tmp);
+
+  sprintf(tmp, "%s%s", DI(unique_hangs),
+         (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+
+  SAYF(bV bSTOP "  last uniq hang : " cRST "%-34s " bSTG bV bSTOP 
+       "   uniq hangs : " cRST "%-6s " bSTG bV "\n",
+       DTD(cur_ms, last_hang_time), tmp);
+
+  SAYF(bVR bH bSTOP cCYA " cycle progress " bSTG bH20 bHB bH bSTOP cCYA
+       " map coverage " bSTG bH bHT bH20 bH2 bH bVL "\n");
+
+  /* This gets funny because we want to print several variable-length variables
+     together, but then cram them into a fixed-width field - so we need to
+     put them in a temporary buffer first. */
+
+  sprintf(tmp, "%s%s (%0.02f%%)", DI(current_entry),
+          queue_cur->favored ? "" : "*",
+          ((double)current_entry * 100) / queued_paths);
+
+  SAYF(bV bSTOP "  now processing : " cRST "%-17s " bSTG bV bSTOP, tmp);
+
+  sprintf(tmp, "%0.02f%% / %0.02f%%", ((double)queue_cur->bitmap_size) * 
+          100 / map_size, t_byte_ratio);
+
+  SAYF("    map density : %s%-21s " bSTG bV "\n", t_byte_ratio > 70 ? cLRD : 
+       ((t_bytes < 200 && !dumb_mode) ? cPIN : cRST), tmp);
+
+  sprintf(tmp, "%s (%0.02f%%)", DI(cur_skipped_paths),
+          ((double)cur_skipped_paths * 100) / queued_paths);
+
+  SAYF(bV bSTOP " paths timed out : " cRST "%-17s " bSTG bV, tmp);
+
+  sprintf(tmp, "%0.02f bits/tuple",
+          t_bytes ? (((double)t_bits) / t_bytes) : 0);
+
+  SAYF(bSTOP " count coverage : " cRST "%-21s " bSTG bV "\n", tmp);
+
+  SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
+       " findings in depth " bSTG bH20 bVL "\n");
+
+  sprintf(tmp, "%s (%0.02f%%)", DI(queued_favored),
+          ((double)queued_favored) * 100 / queued_paths);
+
+  /* Yeah... it's still going on... halp? */
+
+  SAYF(bV bSTOP "  now trying : " cRST "%-21s " bSTG bV bSTOP 
+       " favored paths : " cRST "%-22s " bSTG bV "\n", stage_name, tmp);
+
+  if (!stage_max) {
+
+    sprintf(tmp, "%s/-", DI(stage_cur));
+
+  } else {
+
+    sprintf(tmp, "%s/%s (%0.02f%%)", DI(stage_cur), DI(stage_max),
+            ((double)stage_cur) * 100 / stage_max);
+
+  }
+
+  SAYF(bV bSTOP " stage execs : " cRST "%-21s " bSTG bV bSTOP, tmp);
+
+  sprintf(tmp, "%s (%0.02f%%)", DI(queued_with_cov),
+          ((double)queued_with_cov) * 100 / queued_paths);
+
+  SAYF("  new edges on : " cRST "%-22s " bSTG bV "\n", tmp);
+
+  sprintf(tmp, "%s (%s%s unique)", DI(total_crashes), DI(unique_crashes),
+          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+
+  if (crash_mode) {
+
+    SAYF(bV bSTOP " total execs : " cRST "%-21s " bSTG bV bSTOP
+         "   new crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
+         unique_crashes ? cLRD : cRST, tmp);
+
+  } else {
+
+    SAYF(bV bSTOP " total execs : " cRST "%-21s " bSTG bV bSTOP
+         " total crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
+         unique_crashes ? cLRD : cRST, tmp);
+
+  }
+
+  /* Show a warning about slow execution. */
+
+  if (avg_exec < 100) {
+
+    sprintf(tmp, "%s/sec (%s)", DF(avg_exec), avg_exec < 20 ?
+            "zzzz..." : "slow!");
+
+    SAYF(bV bSTOP "  exec speed : " cLRD "%-21s ", tmp);
+
+  } else {
+
+    sprintf(tmp, "%s/sec", DF(avg_exec));
+    SAYF(bV bSTOP "  exec speed : " cRST "%-21s ", tmp);
+
+  }
+
+  sprintf(tmp, "%s (%s%s unique)", DI(total_tmouts), DI(unique_tmouts),
+          (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+
+  SAYF (bSTG bV bSTOP "  total tmouts : " cRST "%-22s " bSTG bV "\n", tmp);
+
+  /* Aaaalmost there... hold on! */
+
+  SAYF(bVR bH cCYA bSTOP " fuzzing strategy yields " bSTG bH10 bH bHT bH10
+       bH5 bHB bH bSTOP cCYA " path geometry " bSTG bH5 bH2 bH bVL "\n");
+
+  if (skip_deterministic) {
+
+    strcpy(tmp, "n/a, n/a, n/a");
+
+  } else {
+
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_FLIP1]), DI(stage_cycles[STAGE_FLIP1]),
+            DI(stage_finds[STAGE_FLIP2]), DI(stage_cycles[STAGE_FLIP2]),
+            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP4]));
+
+  }
+
+  SAYF(bV bSTOP "   bit flips : " cRST "%-37s " bSTG bV bSTOP "    levels : "
+       cRST "%-10s " bSTG bV "\n", tmp, DI(max_depth));
+
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_FLIP8]), DI(stage_cycles[STAGE_FLIP8]),
+            DI(stage_finds[STAGE_FLIP16]), DI(stage_cycles[STAGE_FLIP16]),
+            DI(stage_finds[STAGE_FLIP32]), DI(stage_cycles[STAGE_FLIP32]));
+
+  SAYF(bV bSTOP "  byte flips : " cRST "%-37s " bSTG bV bSTOP "   pending : "
+       cRST "%-10s " bSTG bV "\n", tmp, DI(pending_not_fuzzed));
+
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_ARITH8]), DI(stage_cycles[STAGE_ARITH8]),
+            DI(stage_finds[STAGE_ARITH16]), DI(stage_cycles[STAGE_ARITH16]),
+            DI(stage_finds[STAGE_ARITH32]), DI(stage_cycles[STAGE_ARITH32]));
+
+  SAYF(bV bSTOP " arithmetics : " cRST "%-37s " bSTG bV bSTOP "  pend fav : "
+       cRST "%-10s " bSTG bV "\n", tmp, DI(pending_favored));
+
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_INTEREST8]), DI(stage_cycles[STAGE_INTEREST8]),
+            DI(stage_finds[STAGE_INTEREST16]), DI(stage_cycles[STAGE_INTEREST16]),
+            DI(stage_finds[STAGE_INTEREST32]), DI(stage_cycles[STAGE_INTEREST32]));
+
+  SAYF(bV bSTOP "  known ints : " cRST "%-37s " bSTG bV bSTOP " own finds : "
+       cRST "%-10s " bSTG bV "\n", tmp, DI(queued_discovered));
+
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_EXTRAS_UO]), DI(stage_cycles[STAGE_EXTRAS_UO]),
+            DI(stage_finds[STAGE_EXTRAS_UI]), DI(stage_cycles[STAGE_EXTRAS_UI]),
+            DI(stage_finds[STAGE_EXTRAS_AO]), DI(stage_cycles[STAGE_EXTRAS_AO]));
+
+  SAYF(bV bSTOP "  dictionary : " cRST "%-37s " bSTG bV bSTOP
+       "  imported : " cRST "%-10s " bSTG bV "\n", tmp,
+       sync_id ? DI(queued_imported) : (u8*)"n/a");
+
+  sprintf(tmp, "%s/%s, %s/%s",
+          DI(stage_finds[STAGE_HAVOC]), DI(stage_cycles[STAGE_HAVOC]),
+          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]));
+
+  SAYF(bV bSTOP "       havoc : " cRST "%-37s " bSTG bV bSTOP, tmp);
+
+  if (t_bytes) sprintf(tmp, "%0.02f%%", stab_ratio);
+    else strcpy(tmp, "n/a");
+
+  SAYF(" stability : %s%-10s " bSTG bV "\n", (stab_ratio < 85 && var_byte_count > 40) 
+       ? cLRD : ((queued_variable && (!persistent_mode || var_byte_count > 20))
+       ? cMGN : cRST), tmp);
+
+  if (!bytes_trim_out) {
+
+    sprintf(tmp, "n/a, ");
+
+  } else {
+
+    sprintf(tmp, "%0.02f%%/%s, ",
+            ((double)(bytes_trim_in - bytes_trim_out)) * 100 / bytes_trim_in,
+            DI(trim_execs));
+
+  }
+
+  if (!blocks_eff_total) {
+
+    u8 tmp2[128];
+
+    sprintf(tmp2, "n/a");
+    strcat(tmp, tmp2);
+
+  } else {
+
+    u8 tmp2[128];
+
+    sprintf(tmp2, "%0.02f%%",
+            ((double)(blocks_eff_total - blocks_eff_select)) * 100 /
+            blocks_eff_total);
+
+    strcat(tmp, tmp2);
+
+  }
+
+  SAYF(bV bSTOP "        trim : " cRST "%-37s " bSTG bVR bH20 bH2 bH2 bRB "\n"
+       bLB bH30 bH20 bH2 bH bRB bSTOP cRST RESET_G1, tmp);
+
+  /* Provide some CPU utilization stats. */
+
+  if (cpu_core_count) {
+
+    double cur_runnable = get_runnable_processes();
+    u32 cur_utilization = cur_runnable * 100 / cpu_core_count;
+
+    u8* cpu_color = cCYA;
+
+    /* If we could still run one or more processes, use green. */
+
+    if (cpu_core_count > 1 && cur_runnable + 1 <= cpu_core_count)
+      cpu_color = cLGN;
+
+    /* If we're clearly oversubscribed, use red. */
+
+    if (!no_cpu_meter_red && cur_utilization >= 150) cpu_color = cLRD;
+
+#ifdef HAVE_AFFINITY
+
+    if (cpu_aff >= 0) {
+
+      SAYF(SP10 cGRA "[cpu%03u:%s%3u%%" cGRA "]\r" cRST, 
+           MIN(cpu_aff, 999), cpu_color,
+           MIN(cur_utilization, 999));
+
+    } else {
+
+      SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
+           cpu_color, MIN(cur_utilization, 999));
+ 
+   }
+
+#else
+
+    SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
+         cpu_color, MIN(cur_utilization, 999));
+
+#endif /* ^HAVE_AFFINITY */
+
+  } else SAYF("\r");
+
+  /* Hallelujah! */
+
+  fflush(0);
+
+}
+
+
+/* Display quick statistics at the end of processing the input directory,
+   plus a bunch of warnings. Some calibration stuff also ended up here,
+   along with several hardcoded constants. Maybe clean up eventually. */
+
+static void show_init_stats(void) {
+
+  struct queue_entry* q = queue;
+  u32 min_bits = 0, max_bits = 0;
+  u64 min_us = 0, max_us = 0;
+  u64 avg_us = 0;
+  u32 max_len = 0;
+
+  if (total_cal_cycles) avg_us = total_cal_us / total_cal_cycles;
+
+  while (q) {
+
+    if (!min_us || q->exec_us < min_us) min_us = q->exec_us;
+    if (q->exec_us > max_us) max_us = q->exec_us;
+
+    if (!min_bits || q->bitmap_size < min_bits) min_bits = q->bitmap_size;
+    if (q->bitmap_size > max_bits) max_bits = q->bitmap_size;
+
+    if (q->len > max_len) max_len = q->len;
+
+    q = q->next;
+
+  }
+
+  SAYF("\n");
+
+  if (avg_us > (qemu_mode ? 50000 : 10000)) 
+    WARNF(cLRD "The target binary is pretty slow! See %s/perf_tips.txt.",
+          doc_path);
+
+  /* Let's keep things moving with slow binaries. */
+
+  if (avg_us > 50000) havoc_div = 10;     /* 0-19 execs/sec   */
+  else if (avg_us > 20000) havoc_div = 5; /* 20-49 execs/sec  */
+  else if (avg_us > 10000) havoc_div = 2; /* 50-100 execs/sec */
+
+  if (!resuming_fuzz) {
+
+    if (max_len > 50 * 1024)
+      WARNF(cLRD "Some test cases are huge (%s) - see %s/perf_tips.txt!",
+            DMS(max_len), doc_path);
+    else if (max_len > 10 * 1024)
+      WARNF("Some test cases are big (%s) - see %s/perf_tips.txt.",
+            DMS(max_len), doc_path);
+
+    if (useless_at_start && !in_bitmap)
+      WARNF(cLRD "Some test cases look useless. Consider using a smaller set.");
+
+    if (queued_paths > 100)
+      WARNF(cLRD "You probably have far too many input files! Consider trimming down.");
+    else if (queued_paths > 20)
+      WARNF("You have lots of input files; try starting small.");
+
+  }
+
+  OKF("Here are some useful stats:\n\n"
+
+      cGRA "    Test case count : " cRST "%u favored, %u variable, %u total\n"
+      cGRA "       Bitmap range : " cRST "%u to %u bits (average: %0.02f bits)\n"
+      cGRA "        Exec timing : " cRST "%s to %s us (average: %s us)\n",
+      queued_favored, queued_variable, queued_paths, min_bits, max_bits, 
+      ((double)total_bitmap_size) / (total_bitmap_entries ? total_bitmap_entries : 1),
+      DI(min_us), DI(max_us), DI(avg_us));
+
+  if (!timeout_given) {
+
+    /* Figure out the appropriate timeout. The basic idea is: 5x average or
+       1x max, rounded up to EXEC_TM_ROUND ms and capped at 1 second.
+
+       If the program is slow, the multiplier is lowered to 2x or 3x, because
+       random scheduler jitter is less likely to have any impact, and because
+       our patience is wearing thin =) */
+
+    if (avg_us > 50000) exec_tmout = avg_us * 2 / 1000;
+    else if (avg_us > 10000) exec_tmout = avg_us * 3 / 1000;
+    else exec_tmout = avg_us * 5 / 1000;
+
+    exec_tmout = MAX(exec_tmout, max_us / 1000);
+    exec_tmout = (exec_tmout + EXEC_TM_ROUND) / EXEC_TM_ROUND * EXEC_TM_ROUND;
+
+    if (exec_tmout > EXEC_TIMEOUT) exec_tmout = EXEC_TIMEOUT;
+
+    ACTF("No -t option specified, so I'll use exec timeout of %u ms.", 
+         exec_tmout);
+
+    timeout_given = 1;
+
+  } else if (timeout_given == 3) {
+
+    ACTF("Applying timeout settings from resumed session (%u ms).", exec_tmout);
+
+  }
+
+  /* In dumb mode, re-running every timing out test case with a generous time
+     limit is very expensive, so let's select a more conservative default. */
+
+  if (dumb_mode && !getenv("AFL_HANG_TMOUT"))
+    hang_tmout = MIN(EXEC_TIMEOUT, exec_tmout * 2 + 100);
+
+  OKF("All set and ready to roll!");
+
+}
+
+
+/* Find first power of two greater or equal to val (assuming val under
+   2^31). */
+
+static u32 next_p2(u32 val) {
+
+  u32 ret = 1;
+  while (val > ret) ret <<= 1;
+  return ret;
+
+} 
+
+
+/* Candidate-hash cache used by trim_case(). Every attempted removal is
+   recorded under the checksum of the shortened input, so that identical
+   candidates produced at a different (offset, len) - common with repetitive
+   inputs - are not executed a second time. Looks up ck, inserting it on a
+   miss; returns 1 if it was already present. */
+
+#define TRIM_CKSUM_SLOTS 32768
+
+static u32 trim_cksum_tab[TRIM_CKSUM_SLOTS];
+
+static u8 trim_cksum_seen(u32 ck) {
+
+  u32 idx = ck & (TRIM_CKSUM_SLOTS - 1);
+
+  if (!ck) return 0;
+
+  while (trim_cksum_tab[idx]) {
+
+    if (trim_cksum_tab[idx] == ck) return 1;
+    idx = (idx + 1) & (TRIM_CKSUM_SLOTS - 1);
+
+  }
+
+  trim_cksum_tab[idx] = ck;
+  return 0;
+
+}
+
+
+/* Trim all new test cases to save cycles when doing deterministic checks. The
+   trimmer uses power-of-two increments somewhere between 1/16 and 1/1024 of
+   file size, to keep the stage short and sweet. */
+
+static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
+
+  static u8 tmp[64];
+  static u8* clean_trace;
+
+  u8  needs_write = 0, fault = 0;
+  u32 trim_exec = 0;
+  u32 remove_len;
+  u32 len_p2;
+  u32 fruitless_passes = 0;
+
+  /* Although the trimmer will be less useful when variable behavior is
+     detected, it will still work to some extent, so we don't check for
+     this. */
+
+  if (q->len < 5) return 0;
+
+  if (!clean_trace) clean_trace = ck_alloc(map_size);
+
+  stage_name = tmp;
+  bytes_trim_in += q->len;
+
+  memset(trim_cksum_tab, 0, sizeof(trim_cksum_tab));
+
+  /* Select initial chunk len, starting with large steps. */
+
+  len_p2 = next_p2(q->len);
+
+  remove_len = MAX(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
+
+  /* Continue until the number of steps gets too high or the stepover
+     gets too small. */
+
+  while (remove_len >= MAX(len_p2 / TRIM_END_STEPS, TRIM_MIN_BYTES)) {
+
+    u32 remove_pos = remove_len;
+    u8  removed_this_pass = 0;
+
+    sprintf(tmp, "trim %s/%s", DI(remove_len), DI(remove_len));
+
+    stage_cur = 0;
+    stage_max = q->len / remove_len;
+
+    while (remove_pos < q->len) {
+
+      u32 trim_avail = MIN(remove_len, q->len - remove_pos);
+      u32 cksum, cand_cksum;
+
+      /* Hash the candidate, i.e., the input with the current window removed.
+         If an identical candidate was attempted earlier - at any step size -
+         the verdict won't change, so skip the execution. Hash collisions
+         can make us pass up a removable window, but trimming is best-effort
+         anyway. */
+
+      cand_cksum = hash32(in_buf, remove_pos, HASH_CONST);
+      cand_cksum = hash32(in_buf + remove_pos + trim_avail,
+                          q->len - remove_pos - trim_avail, cand_cksum);
+
+      if (trim_cksum_seen(cand_cksum)) {
+
+        remove_pos += remove_len;
+        stage_cur++;
+        continue;
+
+      }
+
+      write_with_gap(in_buf, q->len, remove_pos, trim_avail);
+
+      fault = run_target(argv, exec_tmout);
+      trim_execs++;
+
+      if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+      /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
+
+      cksum = hash32(trace_bits, map_size, HASH_CONST);
+
+      /* If the deletion had no impact on the trace, make it permanent. This
+         isn't perfect for variable-path inputs, but we're just making a
+         best-effort pass, so it's not a big deal if we end up with false
+         negatives every now and then. */
+
+      if (cksum == q->exec_cksum) {
+
+        u32 move_tail = q->len - remove_pos - trim_avail;
 
         q->len -= trim_avail;
         len_p2  = next_p2(q->len);
+        removed_this_pass = 1;
 
         memmove(in_buf + remove_pos, in_buf + remove_pos + trim_avail, 
                 move_tail);
@@ -4597,7 +6717,7 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
         if (!needs_write) {
 
           needs_write = 1;
-          memcpy(clean_trace, trace_bits, MAP_SIZE);
+          memcpy(clean_trace, trace_bits, map_size);
 
         }
 
@@ -4610,7 +6730,12 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
 
     }
 
-    remove_len >>= 1;
+    /* Step down faster once two consecutive passes removed nothing; at that
+       point, the finer steps in between are very unlikely to succeed. */
+
+    if (!removed_this_pass) fruitless_passes++; else fruitless_passes = 0;
+
+    remove_len >>= (fruitless_passes >= 2) ? 2 : 1;
 
   }
 
@@ -4630,7 +6755,16 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
     ck_write(fd, in_buf, q->len, q->fname);
     close(fd);
 
-    memcpy(trace_bits, clean_trace, MAP_SIZE);
+    /* The on-disk contents changed, so refresh the cached copy too. */
+
+    queue_cache_drop(q);
+    queue_cache_put(q, in_buf);
+
+    /* This copy repopulates the map behind the dirty-chunk log's back. */
+
+    trace_dirty_ok = 0;
+
+    memcpy(trace_bits, clean_trace, map_size);
     update_bitmap_score(q);
 
   }
@@ -4643,24 +6777,10 @@ abort_trimming:
 }
 
 
-/* Write a modified test case, run program, process results. Handle
-   error conditions, returning 1 if it's time to bail out. This is
-   a helper function for fuzz_one(). */
-
-EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
-
-  u8 fault;
-
-  if (post_handler) {
-
-    out_buf = post_handler(out_buf, &len);
-    if (!out_buf || !len) return 0;
-
-  }
-
-  write_to_testcase(out_buf, len);
+/* Post-execution half of common_fuzz_stuff(), shared with the pipelined
+   havoc loop in fuzz_one(). Returns 1 if the entry should be abandoned. */
 
-  fault = run_target(argv, exec_tmout);
+static u8 common_post_exec(char** argv, u8* out_buf, u32 len, u8 fault) {
 
   if (stop_soon) return 1;
 
@@ -4696,6 +6816,30 @@ EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 }
 
 
+/* Write a modified test case, run program, process results. Handle
+   error conditions, returning 1 if it's time to bail out. This is
+   a helper function for fuzz_one(). */
+
+EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
+
+  u8 fault;
+
+  if (post_handler) {
+
+    out_buf = post_handler(out_buf, &len);
+    if (!out_buf || !len) return 0;
+
+  }
+
+  write_to_testcase(out_buf, len);
+
+  fault = run_target(argv, exec_tmout);
+
+  return common_post_exec(argv, out_buf, len, fault);
+
+}
+
+
 /* Helper to choose random block len for block operations in fuzz_one().
    Doesn't return zero, provided that max_len is > 0. */
 
@@ -4771,33 +6915,100 @@ static u32 calculate_score(struct queue_entry* q) {
   else if (q->bitmap_size * 2 < avg_bitmap_size) perf_score *= 0.5;
   else if (q->bitmap_size * 1.5 < avg_bitmap_size) perf_score *= 0.75;
 
-  /* Adjust score based on handicap. Handicap is proportional to how late
-     in the game we learned about this path. Latecomers are allowed to run
-     for a bit longer until they catch up with the rest. */
+  if (schedule == SCHED_EXPLOIT) {
 
-  if (q->handicap >= 4) {
+    /* Adjust score based on handicap. Handicap is proportional to how late
+       in the game we learned about this path. Latecomers are allowed to run
+       for a bit longer until they catch up with the rest. */
 
-    perf_score *= 4;
-    q->handicap -= 4;
+    if (q->handicap >= 4) {
 
-  } else if (q->handicap) {
+      perf_score *= 4;
+      q->handicap -= 4;
 
-    perf_score *= 2;
-    q->handicap--;
+    } else if (q->handicap) {
 
-  }
+      perf_score *= 2;
+      q->handicap--;
+
+    }
+
+    /* Final adjustment based on input depth, under the assumption that
+       fuzzing deeper test cases is more likely to reveal stuff that can't
+       be discovered with traditional fuzzers. */
+
+    switch (q->depth) {
+
+      case 0 ... 3:   break;
+      case 4 ... 7:   perf_score *= 2; break;
+      case 8 ... 13:  perf_score *= 3; break;
+      case 14 ... 25: perf_score *= 4; break;
+      default:        perf_score *= 5;
+
+    }
+
+  } else {
+
+    /* The other schedules drop the handicap and depth bonuses - the very
+       thing that pours energy into deep, slow entries - and instead scale
+       by how often the path has been exercised (n_fuzz_tab) versus how
+       many times we've fuzzed it (fuzz_level). Rarely-seen paths keep
+       accruing energy; saturated ones starve. */
+
+    u64 fuzz = n_fuzz_tab[q->exec_cksum % N_FUZZ_SIZE];
+    u64 factor = 1;
+
+    if (!fuzz) fuzz = 1;
+
+    switch (schedule) {
+
+      case SCHED_EXPLORE:
+
+        break;
 
-  /* Final adjustment based on input depth, under the assumption that fuzzing
-     deeper test cases is more likely to reveal stuff that can't be
-     discovered with traditional fuzzers. */
+      case SCHED_FAST:
 
-  switch (q->depth) {
+        if (q->fuzz_level < 16) factor = ((u64)1 << q->fuzz_level) / fuzz;
+        else factor = (fuzz > SCHED_MAX_FACTOR) ?
+                      0 : SCHED_MAX_FACTOR / next_p2(fuzz);
+        break;
+
+      case SCHED_COE: {
+
+          u64 fuzz_total = 0;
+          u32 n_items = 0;
+          struct queue_entry* it = queue;
+
+          while (it) {
+            fuzz_total += n_fuzz_tab[it->exec_cksum % N_FUZZ_SIZE];
+            n_items++;
+            it = it->next;
+          }
+
+          if (fuzz <= fuzz_total / n_items)
+            factor = (q->fuzz_level < 16) ? ((u64)1 << q->fuzz_level)
+                                          : SCHED_MAX_FACTOR;
+          else factor = 0;
+
+        }
+
+        break;
+
+      case SCHED_LIN:
+
+        factor = q->fuzz_level / fuzz;
+        break;
+
+      case SCHED_QUAD:
+
+        factor = (u64)q->fuzz_level * q->fuzz_level / fuzz;
+        break;
 
-    case 0 ... 3:   break;
-    case 4 ... 7:   perf_score *= 2; break;
-    case 8 ... 13:  perf_score *= 3; break;
-    case 14 ... 25: perf_score *= 4; break;
-    default:        perf_score *= 5;
+    }
+
+    if (factor > SCHED_MAX_FACTOR) factor = SCHED_MAX_FACTOR;
+
+    perf_score *= factor;
 
   }
 
@@ -4892,1657 +7103,1862 @@ static u8 could_be_arith(u32 old_val, u32 new_val, u8 blen) {
 
   if (diffs == 1) {
 
-    if ((u16)(ov - nv) <= ARITH_MAX ||
-        (u16)(nv - ov) <= ARITH_MAX) return 1;
+    if ((u16)(ov - nv) <= ARITH_MAX ||
+        (u16)(nv - ov) <= ARITH_MAX) return 1;
+
+    ov = SWAP16(ov); nv = SWAP16(nv);
+
+    if ((u16)(ov - nv) <= ARITH_MAX ||
+        (u16)(nv - ov) <= ARITH_MAX) return 1;
+
+  }
+
+  /* Finally, let's do the same thing for dwords. */
+
+  if (blen == 4) {
+
+    if ((u32)(old_val - new_val) <= ARITH_MAX ||
+        (u32)(new_val - old_val) <= ARITH_MAX) return 1;
+
+    new_val = SWAP32(new_val);
+    old_val = SWAP32(old_val);
+
+    if ((u32)(old_val - new_val) <= ARITH_MAX ||
+        (u32)(new_val - old_val) <= ARITH_MAX) return 1;
+
+  }
+
+  return 0;
+
+}
+
+
+/* Last but not least, a similar helper to see if insertion of an 
+   interesting integer is redundant given the insertions done for
+   shorter blen. The last param (check_le) is set if the caller
+   already executed LE insertion for current blen and wants to see
+   if BE variant passed in new_val is unique. */
+
+static u8 could_be_interest(u32 old_val, u32 new_val, u8 blen, u8 check_le) {
+
+  u32 i, j;
+
+  if (old_val == new_val) return 1;
+
+  /* See if one-byte insertions from interesting_8 over old_val could
+     produce new_val. */
+
+  for (i = 0; i < blen; i++) {
+
+    for (j = 0; j < sizeof(interesting_8); j++) {
+
+      u32 tval = (old_val & ~(0xff << (i * 8))) |
+                 (((u8)interesting_8[j]) << (i * 8));
+
+      if (new_val == tval) return 1;
+
+    }
+
+  }
+
+  /* Bail out unless we're also asked to examine two-byte LE insertions
+     as a preparation for BE attempts. */
+
+  if (blen == 2 && !check_le) return 0;
+
+  /* See if two-byte insertions over old_val could give us new_val. */
+
+  for (i = 0; i < blen - 1; i++) {
+
+    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
+
+      u32 tval = (old_val & ~(0xffff << (i * 8))) |
+                 (((u16)interesting_16[j]) << (i * 8));
+
+      if (new_val == tval) return 1;
+
+      /* Continue here only if blen > 2. */
+
+      if (blen > 2) {
+
+        tval = (old_val & ~(0xffff << (i * 8))) |
+               (SWAP16(interesting_16[j]) << (i * 8));
+
+        if (new_val == tval) return 1;
+
+      }
+
+    }
+
+  }
+
+  if (blen == 4 && check_le) {
+
+    /* See if four-byte insertions could produce the same result
+       (LE only). */
+
+    for (j = 0; j < sizeof(interesting_32) / 4; j++)
+      if (new_val == (u32)interesting_32[j]) return 1;
+
+  }
+
+  return 0;
+
+}
+
+
+#define FLIP_BIT(_ar, _b) do { \
+    u8* _arf = (u8*)(_ar); \
+    u32 _bf = (_b); \
+    _arf[(_bf) >> 3] ^= (128 >> ((_bf) & 7)); \
+  } while (0)
+
+
+/* Grow-only scratch buffers for the per-entry workspaces in fuzz_one().
+   They are retained across queue entries, so once warmed up, the hot
+   mutation stages get by without a single heap allocation. */
+
+static struct ck_scratch sc_in,       /* Pristine input copy (in_buf)     */
+                         sc_out,      /* Mutation buffer (out_buf)        */
+                         sc_next,     /* Pipelined havoc buffer           */
+                         sc_eff,      /* Effector map                     */
+                         sc_ex,       /* Extras insertion staging         */
+                         sc_splice,   /* Spliced input                    */
+                         sc_havoc;    /* Havoc block insertion staging    */
+
+#define SWAP_SCRATCH(_a, _b) do { \
+    struct ck_scratch _tmp = (_a); \
+    (_a) = (_b); \
+    (_b) = _tmp; \
+  } while (0)
+
+
+/* Apply one round of stacked havoc mutations to the scratch buffer sc
+   (which holds a copy of the current input), updating *len_p in place.
+   Block insertions are staged in sc_havoc and swapped in, so the buffer
+   address may change; the current pointer is returned. Factored out of
+   fuzz_one() so that the pipelined havoc loop can cook the next mutation
+   while the previous one is still executing. */
+
+static u8* havoc_mutate(struct ck_scratch* sc, u32* len_p) {
+
+  u8* out_buf  = sc->buf;
+  u32 temp_len = *len_p;
+  u32 i;
+
+  u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
+
+  stage_cur_val = use_stacking;
+ 
+  for (i = 0; i < use_stacking; i++) {
+
+    switch (UR(15 + ((extras_cnt + a_extras_cnt) ? 2 : 0))) {
+
+      case 0:
+
+        /* Flip a single bit somewhere. Spooky! */
+
+        FLIP_BIT(out_buf, UR(temp_len << 3));
+        break;
+
+      case 1: 
+
+        /* Set byte to interesting value. */
+
+        out_buf[UR(temp_len)] = interesting_8[UR(sizeof(interesting_8))];
+        break;
+
+      case 2:
+
+        /* Set word to interesting value, randomly choosing endian. */
+
+        if (temp_len < 2) break;
+
+        if (UR(2)) {
+
+          *(u16*)(out_buf + UR(temp_len - 1)) =
+            interesting_16[UR(sizeof(interesting_16) >> 1)];
+
+        } else {
+
+          *(u16*)(out_buf + UR(temp_len - 1)) = SWAP16(
+            interesting_16[UR(sizeof(interesting_16) >> 1)]);
+
+        }
+
+        break;
 
-    ov = SWAP16(ov); nv = SWAP16(nv);
+      case 3:
 
-    if ((u16)(ov - nv) <= ARITH_MAX ||
-        (u16)(nv - ov) <= ARITH_MAX) return 1;
+        /* Set dword to interesting value, randomly choosing endian. */
 
-  }
+        if (temp_len < 4) break;
 
-  /* Finally, let's do the same thing for dwords. */
+        if (UR(2)) {
 
-  if (blen == 4) {
+          *(u32*)(out_buf + UR(temp_len - 3)) =
+            interesting_32[UR(sizeof(interesting_32) >> 2)];
 
-    if ((u32)(old_val - new_val) <= ARITH_MAX ||
-        (u32)(new_val - old_val) <= ARITH_MAX) return 1;
+        } else {
 
-    new_val = SWAP32(new_val);
-    old_val = SWAP32(old_val);
+          *(u32*)(out_buf + UR(temp_len - 3)) = SWAP32(
+            interesting_32[UR(sizeof(interesting_32) >> 2)]);
 
-    if ((u32)(old_val - new_val) <= ARITH_MAX ||
-        (u32)(new_val - old_val) <= ARITH_MAX) return 1;
+        }
 
-  }
+        break;
 
-  return 0;
+      case 4:
 
-}
+        /* Randomly subtract from byte. */
 
+        out_buf[UR(temp_len)] -= 1 + UR(ARITH_MAX);
+        break;
 
-/* Last but not least, a similar helper to see if insertion of an 
-   interesting integer is redundant given the insertions done for
-   shorter blen. The last param (check_le) is set if the caller
-   already executed LE insertion for current blen and wants to see
-   if BE variant passed in new_val is unique. */
+      case 5:
 
-static u8 could_be_interest(u32 old_val, u32 new_val, u8 blen, u8 check_le) {
+        /* Randomly add to byte. */
 
-  u32 i, j;
+        out_buf[UR(temp_len)] += 1 + UR(ARITH_MAX);
+        break;
 
-  if (old_val == new_val) return 1;
+      case 6:
 
-  /* See if one-byte insertions from interesting_8 over old_val could
-     produce new_val. */
+        /* Randomly subtract from word, random endian. */
 
-  for (i = 0; i < blen; i++) {
+        if (temp_len < 2) break;
 
-    for (j = 0; j < sizeof(interesting_8); j++) {
+        if (UR(2)) {
 
-      u32 tval = (old_val & ~(0xff << (i * 8))) |
-                 (((u8)interesting_8[j]) << (i * 8));
+          u32 pos = UR(temp_len - 1);
 
-      if (new_val == tval) return 1;
+          *(u16*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
 
-    }
+        } else {
 
-  }
+          u32 pos = UR(temp_len - 1);
+          u16 num = 1 + UR(ARITH_MAX);
 
-  /* Bail out unless we're also asked to examine two-byte LE insertions
-     as a preparation for BE attempts. */
+          *(u16*)(out_buf + pos) =
+            SWAP16(SWAP16(*(u16*)(out_buf + pos)) - num);
 
-  if (blen == 2 && !check_le) return 0;
+        }
 
-  /* See if two-byte insertions over old_val could give us new_val. */
+        break;
 
-  for (i = 0; i < blen - 1; i++) {
+      case 7:
 
-    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
+        /* Randomly add to word, random endian. */
 
-      u32 tval = (old_val & ~(0xffff << (i * 8))) |
-                 (((u16)interesting_16[j]) << (i * 8));
+        if (temp_len < 2) break;
 
-      if (new_val == tval) return 1;
+        if (UR(2)) {
 
-      /* Continue here only if blen > 2. */
+          u32 pos = UR(temp_len - 1);
 
-      if (blen > 2) {
+          *(u16*)(out_buf + pos) += 1 + UR(ARITH_MAX);
 
-        tval = (old_val & ~(0xffff << (i * 8))) |
-               (SWAP16(interesting_16[j]) << (i * 8));
+        } else {
 
-        if (new_val == tval) return 1;
+          u32 pos = UR(temp_len - 1);
+          u16 num = 1 + UR(ARITH_MAX);
 
-      }
+          *(u16*)(out_buf + pos) =
+            SWAP16(SWAP16(*(u16*)(out_buf + pos)) + num);
 
-    }
+        }
 
-  }
+        break;
 
-  if (blen == 4 && check_le) {
+      case 8:
 
-    /* See if four-byte insertions could produce the same result
-       (LE only). */
+        /* Randomly subtract from dword, random endian. */
 
-    for (j = 0; j < sizeof(interesting_32) / 4; j++)
-      if (new_val == (u32)interesting_32[j]) return 1;
+        if (temp_len < 4) break;
 
-  }
+        if (UR(2)) {
 
-  return 0;
+          u32 pos = UR(temp_len - 3);
 
-}
+          *(u32*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
 
+        } else {
 
-/* Take the current entry from the queue, fuzz it for a while. This
-   function is a tad too long... returns 0 if fuzzed successfully, 1 if
-   skipped or bailed out. */
+          u32 pos = UR(temp_len - 3);
+          u32 num = 1 + UR(ARITH_MAX);
 
-static u8 fuzz_one(char** argv) {
+          *(u32*)(out_buf + pos) =
+            SWAP32(SWAP32(*(u32*)(out_buf + pos)) - num);
 
-  s32 len, fd, temp_len, i, j;
-  u8  *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0;
-  u64 havoc_queued,  orig_hit_cnt, new_hit_cnt;
-  u32 splice_cycle = 0, perf_score = 100, orig_perf, prev_cksum, eff_cnt = 1;
+        }
 
-  u8  ret_val = 1, doing_det = 0;
+        break;
 
-  u8  a_collect[MAX_AUTO_EXTRA];
-  u32 a_len = 0;
+      case 9:
 
-#ifdef IGNORE_FINDS
+        /* Randomly add to dword, random endian. */
 
-  /* In IGNORE_FINDS mode, skip any entries that weren't in the
-     initial data set. */
+        if (temp_len < 4) break;
 
-  if (queue_cur->depth > 1) return 1;
+        if (UR(2)) {
 
-#else
+          u32 pos = UR(temp_len - 3);
 
-  if (pending_favored) {
+          *(u32*)(out_buf + pos) += 1 + UR(ARITH_MAX);
 
-    /* If we have any favored, non-fuzzed new arrivals in the queue,
-       possibly skip to them at the expense of already-fuzzed or non-favored
-       cases. */
+        } else {
 
-    if ((queue_cur->was_fuzzed || !queue_cur->favored) &&
-        UR(100) < SKIP_TO_NEW_PROB) return 1;
+          u32 pos = UR(temp_len - 3);
+          u32 num = 1 + UR(ARITH_MAX);
 
-  } else if (!dumb_mode && !queue_cur->favored && queued_paths > 10) {
+          *(u32*)(out_buf + pos) =
+            SWAP32(SWAP32(*(u32*)(out_buf + pos)) + num);
 
-    /* Otherwise, still possibly skip non-favored cases, albeit less often.
-       The odds of skipping stuff are higher for already-fuzzed inputs and
-       lower for never-fuzzed entries. */
+        }
 
-    if (queue_cycle > 1 && !queue_cur->was_fuzzed) {
+        break;
 
-      if (UR(100) < SKIP_NFAV_NEW_PROB) return 1;
+      case 10:
 
-    } else {
+        /* Just set a random byte to a random value. Because,
+           why not. We use XOR with 1-255 to eliminate the
+           possibility of a no-op. */
 
-      if (UR(100) < SKIP_NFAV_OLD_PROB) return 1;
+        out_buf[UR(temp_len)] ^= 1 + UR(255);
+        break;
 
-    }
+      case 11 ... 12: {
 
-  }
+          /* Delete bytes. We're making this a bit more likely
+             than insertion (the next option) in hopes of keeping
+             files reasonably small. */
 
-#endif /* ^IGNORE_FINDS */
+          u32 del_from, del_len;
 
-  if (not_on_tty) {
-    ACTF("Fuzzing test case #%u (%u total, %llu uniq crashes found)...",
-         current_entry, queued_paths, unique_crashes);
-    fflush(stdout);
-  }
+          if (temp_len < 2) break;
 
-  /* Map the test case into memory. */
+          /* Don't delete too much. */
 
-  fd = open(queue_cur->fname, O_RDONLY);
+          del_len = choose_block_len(temp_len - 1);
 
-  if (fd < 0) PFATAL("Unable to open '%s'", queue_cur->fname);
+          del_from = UR(temp_len - del_len + 1);
 
-  len = queue_cur->len;
+          memmove(out_buf + del_from, out_buf + del_from + del_len,
+                  temp_len - del_from - del_len);
 
-  orig_in = in_buf = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+          temp_len -= del_len;
 
-  if (orig_in == MAP_FAILED) PFATAL("Unable to mmap '%s'", queue_cur->fname);
+          break;
 
-  close(fd);
+        }
 
-  /* We could mmap() out_buf as MAP_PRIVATE, but we end up clobbering every
-     single byte anyway, so it wouldn't give us any performance or memory usage
-     benefits. */
+      case 13:
 
-  out_buf = ck_alloc_nozero(len);
+        if (temp_len + HAVOC_BLK_XL < MAX_FILE) {
 
-  subseq_tmouts = 0;
+          /* Clone bytes (75%) or insert a block of constant bytes (25%). */
 
-  cur_depth = queue_cur->depth;
+          u8  actually_clone = UR(4);
+          u32 clone_from, clone_to, clone_len;
+          u8* new_buf;
 
-  /*******************************************
-   * CALIBRATION (only if failed earlier on) *
-   *******************************************/
+          if (actually_clone) {
 
-  if (queue_cur->cal_failed) {
+            clone_len  = choose_block_len(temp_len);
+            clone_from = UR(temp_len - clone_len + 1);
 
-    u8 res = FAULT_TMOUT;
+          } else {
 
-    if (queue_cur->cal_failed < CAL_CHANCES) {
+            clone_len = choose_block_len(HAVOC_BLK_XL);
+            clone_from = 0;
 
-      /* Reset exec_cksum to tell calibrate_case to re-execute the testcase
-         avoiding the usage of an invalid trace_bits.
-         For more info: https://github.com/AFLplusplus/AFLplusplus/pull/425 */
+          }
 
-      queue_cur->exec_cksum = 0;
+          clone_to   = UR(temp_len);
 
-      res = calibrate_case(argv, queue_cur, in_buf, queue_cycle - 1, 0);
+          new_buf = ck_scratch_get(&sc_havoc, temp_len + clone_len);
 
-      if (res == FAULT_ERROR)
-        FATAL("Unable to execute target application");
+          /* Head */
 
-    }
+          memcpy(new_buf, out_buf, clone_to);
 
-    if (stop_soon || res != crash_mode) {
-      cur_skipped_paths++;
-      goto abandon_entry;
-    }
+          /* Inserted part */
 
-  }
+          if (actually_clone)
+            memcpy(new_buf + clone_to, out_buf + clone_from, clone_len);
+          else
+            memset(new_buf + clone_to,
+                   UR(2) ? UR(256) : out_buf[UR(temp_len)], clone_len);
 
-  /************
-   * TRIMMING *
-   ************/
+          /* Tail */
+          memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
+                 temp_len - clone_to);
 
-  if (!dumb_mode && !queue_cur->trim_done) {
+          SWAP_SCRATCH(*sc, sc_havoc);
+          out_buf = new_buf;
+          temp_len += clone_len;
 
-    u8 res = trim_case(argv, queue_cur, in_buf);
+        }
 
-    if (res == FAULT_ERROR)
-      FATAL("Unable to execute target application");
+        break;
 
-    if (stop_soon) {
-      cur_skipped_paths++;
-      goto abandon_entry;
-    }
+      case 14: {
 
-    /* Don't retry trimming, even if it failed. */
+          /* Overwrite bytes with a randomly selected chunk (75%) or fixed
+             bytes (25%). */
 
-    queue_cur->trim_done = 1;
+          u32 copy_from, copy_to, copy_len;
 
-    if (len != queue_cur->len) len = queue_cur->len;
+          if (temp_len < 2) break;
 
-  }
+          copy_len  = choose_block_len(temp_len - 1);
 
-  memcpy(out_buf, in_buf, len);
+          copy_from = UR(temp_len - copy_len + 1);
+          copy_to   = UR(temp_len - copy_len + 1);
 
-  /*********************
-   * PERFORMANCE SCORE *
-   *********************/
+          if (UR(4)) {
 
-  orig_perf = perf_score = calculate_score(queue_cur);
+            if (copy_from != copy_to)
+              memmove(out_buf + copy_to, out_buf + copy_from, copy_len);
 
-  /* Skip right away if -d is given, if we have done deterministic fuzzing on
-     this entry ourselves (was_fuzzed), or if it has gone through deterministic
-     testing in earlier, resumed runs (passed_det). */
+          } else memset(out_buf + copy_to,
+                        UR(2) ? UR(256) : out_buf[UR(temp_len)], copy_len);
 
-  if (skip_deterministic || queue_cur->was_fuzzed || queue_cur->passed_det)
-    goto havoc_stage;
+          break;
 
-  /* Skip deterministic fuzzing if exec path checksum puts this out of scope
-     for this master instance. */
+        }
 
-  if (master_max && (queue_cur->exec_cksum % master_max) != master_id - 1)
-    goto havoc_stage;
+      /* Values 15 and 16 can be selected only if there are any extras
+         present in the dictionaries. */
 
-  doing_det = 1;
+      case 15: {
 
-  /*********************************************
-   * SIMPLE BITFLIP (+dictionary construction) *
-   *********************************************/
+          /* Overwrite bytes with an extra. */
 
-#define FLIP_BIT(_ar, _b) do { \
-    u8* _arf = (u8*)(_ar); \
-    u32 _bf = (_b); \
-    _arf[(_bf) >> 3] ^= (128 >> ((_bf) & 7)); \
-  } while (0)
+          if (!extras_cnt || (a_extras_cnt && UR(2))) {
 
-  /* Single walking bit. */
+            /* No user-specified extras or odds in our favor. Let's use an
+               auto-detected one. */
 
-  stage_short = "flip1";
-  stage_max   = len << 3;
-  stage_name  = "bitflip 1/1";
+            u32 use_extra = UR(a_extras_cnt);
+            u32 extra_len = a_extras[use_extra].len;
+            u32 insert_at;
 
-  stage_val_type = STAGE_VAL_NONE;
+            if (extra_len > temp_len) break;
 
-  orig_hit_cnt = queued_paths + unique_crashes;
+            insert_at = UR(temp_len - extra_len + 1);
+            memcpy(out_buf + insert_at, a_extras[use_extra].data, extra_len);
 
-  prev_cksum = queue_cur->exec_cksum;
+          } else {
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+            /* No auto extras or odds in our favor. Use the dictionary. */
 
-    stage_cur_byte = stage_cur >> 3;
+            u32 use_extra = UR(extras_cnt);
+            u32 extra_len = extras[use_extra].len;
+            u32 insert_at;
 
-    FLIP_BIT(out_buf, stage_cur);
+            if (extra_len > temp_len) break;
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+            insert_at = UR(temp_len - extra_len + 1);
+            memcpy(out_buf + insert_at, extras[use_extra].data, extra_len);
 
-    FLIP_BIT(out_buf, stage_cur);
+          }
 
-    /* While flipping the least significant bit in every byte, pull of an extra
-       trick to detect possible syntax tokens. In essence, the idea is that if
-       you have a binary blob like this:
+          break;
 
-       xxxxxxxxIHDRxxxxxxxx
+        }
 
-       ...and changing the leading and trailing bytes causes variable or no
-       changes in program flow, but touching any character in the "IHDR" string
-       always produces the same, distinctive path, it's highly likely that
-       "IHDR" is an atomically-checked magic value of special significance to
-       the fuzzed format.
+      case 16: {
 
-       We do this here, rather than as a separate stage, because it's a nice
-       way to keep the operation approximately "free" (i.e., no extra execs).
-       
-       Empirically, performing the check when flipping the least significant bit
-       is advantageous, compared to doing it at the time of more disruptive
-       changes, where the program flow may be affected in more violent ways.
+          u32 use_extra, extra_len, insert_at = UR(temp_len + 1);
+          u8* new_buf;
 
-       The caveat is that we won't generate dictionaries in the -d mode or -S
-       mode - but that's probably a fair trade-off.
+          /* Insert an extra. Do the same dice-rolling stuff as for the
+             previous case. */
 
-       This won't work particularly well with paths that exhibit variable
-       behavior, but fails gracefully, so we'll carry out the checks anyway.
+          if (!extras_cnt || (a_extras_cnt && UR(2))) {
 
-      */
+            use_extra = UR(a_extras_cnt);
+            extra_len = a_extras[use_extra].len;
 
-    if (!dumb_mode && (stage_cur & 7) == 7) {
+            if (temp_len + extra_len >= MAX_FILE) break;
 
-      u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+            new_buf = ck_scratch_get(&sc_havoc, temp_len + extra_len);
 
-      if (stage_cur == stage_max - 1 && cksum == prev_cksum) {
+            /* Head */
+            memcpy(new_buf, out_buf, insert_at);
 
-        /* If at end of file and we are still collecting a string, grab the
-           final character and force output. */
+            /* Inserted part */
+            memcpy(new_buf + insert_at, a_extras[use_extra].data, extra_len);
 
-        if (a_len < MAX_AUTO_EXTRA) a_collect[a_len] = out_buf[stage_cur >> 3];
-        a_len++;
+          } else {
 
-        if (a_len >= MIN_AUTO_EXTRA && a_len <= MAX_AUTO_EXTRA)
-          maybe_add_auto(a_collect, a_len);
+            use_extra = UR(extras_cnt);
+            extra_len = extras[use_extra].len;
 
-      } else if (cksum != prev_cksum) {
+            if (temp_len + extra_len >= MAX_FILE) break;
 
-        /* Otherwise, if the checksum has changed, see if we have something
-           worthwhile queued up, and collect that if the answer is yes. */
+            new_buf = ck_scratch_get(&sc_havoc, temp_len + extra_len);
 
-        if (a_len >= MIN_AUTO_EXTRA && a_len <= MAX_AUTO_EXTRA)
-          maybe_add_auto(a_collect, a_len);
+            /* Head */
+            memcpy(new_buf, out_buf, insert_at);
 
-        a_len = 0;
-        prev_cksum = cksum;
+            /* Inserted part */
+            memcpy(new_buf + insert_at, extras[use_extra].data, extra_len);
 
-      }
+          }
 
-      /* Continue collecting string, but only if the bit flip actually made
-         any difference - we don't want no-op tokens. */
+          /* Tail */
+          memcpy(new_buf + insert_at + extra_len, out_buf + insert_at,
+                 temp_len - insert_at);
 
-      if (cksum != queue_cur->exec_cksum) {
+          SWAP_SCRATCH(*sc, sc_havoc);
+          out_buf   = new_buf;
+          temp_len += extra_len;
 
-        if (a_len < MAX_AUTO_EXTRA) a_collect[a_len] = out_buf[stage_cur >> 3];        
-        a_len++;
+          break;
 
-      }
+        }
 
     }
 
   }
 
-  new_hit_cnt = queued_paths + unique_crashes;
+  *len_p = temp_len;
+  return out_buf;
+
+}
+
+
+/* Take the current entry from the queue, fuzz it for a while. This
+   function is a tad too long... returns 0 if fuzzed successfully, 1 if
+   skipped or bailed out. */
 
-  stage_finds[STAGE_FLIP1]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP1] += stage_max;
+static u8 fuzz_one(char** argv) {
 
-  /* Two walking bits. */
+  s32 len, temp_len, i, j;
+  u8  *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0, *next_buf = 0;
+  u32 next_len = 0;
+  u64 havoc_queued,  orig_hit_cnt, new_hit_cnt;
+  u32 splice_cycle = 0, perf_score = 100, orig_perf, prev_cksum, eff_cnt = 1;
 
-  stage_name  = "bitflip 2/1";
-  stage_short = "flip2";
-  stage_max   = (len << 3) - 1;
+  u8  ret_val = 1, doing_det = 0;
 
-  orig_hit_cnt = new_hit_cnt;
+  u8  a_collect[MAX_AUTO_EXTRA];
+  u32 a_len = 0;
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+#ifdef IGNORE_FINDS
 
-    stage_cur_byte = stage_cur >> 3;
+  /* In IGNORE_FINDS mode, skip any entries that weren't in the
+     initial data set. */
 
-    FLIP_BIT(out_buf, stage_cur);
-    FLIP_BIT(out_buf, stage_cur + 1);
+  if (queue_cur->depth > 1) return 1;
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+#else
 
-    FLIP_BIT(out_buf, stage_cur);
-    FLIP_BIT(out_buf, stage_cur + 1);
+  if (pending_favored) {
 
-  }
+    /* If we have any favored, non-fuzzed new arrivals in the queue,
+       possibly skip to them at the expense of already-fuzzed or non-favored
+       cases. */
 
-  new_hit_cnt = queued_paths + unique_crashes;
+    if ((queue_cur->was_fuzzed || !queue_cur->favored) &&
+        UR(100) < SKIP_TO_NEW_PROB) return 1;
 
-  stage_finds[STAGE_FLIP2]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP2] += stage_max;
+  } else if (!dumb_mode && !queue_cur->favored && queued_paths > 10) {
 
-  /* Four walking bits. */
+    /* Otherwise, still possibly skip non-favored cases, albeit less often.
+       The odds of skipping stuff are higher for already-fuzzed inputs and
+       lower for never-fuzzed entries. */
 
-  stage_name  = "bitflip 4/1";
-  stage_short = "flip4";
-  stage_max   = (len << 3) - 3;
+    if (queue_cycle > 1 && !queue_cur->was_fuzzed) {
 
-  orig_hit_cnt = new_hit_cnt;
+      if (UR(100) < SKIP_NFAV_NEW_PROB) return 1;
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+    } else {
 
-    stage_cur_byte = stage_cur >> 3;
+      if (UR(100) < SKIP_NFAV_OLD_PROB) return 1;
 
-    FLIP_BIT(out_buf, stage_cur);
-    FLIP_BIT(out_buf, stage_cur + 1);
-    FLIP_BIT(out_buf, stage_cur + 2);
-    FLIP_BIT(out_buf, stage_cur + 3);
+    }
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+  }
 
-    FLIP_BIT(out_buf, stage_cur);
-    FLIP_BIT(out_buf, stage_cur + 1);
-    FLIP_BIT(out_buf, stage_cur + 2);
-    FLIP_BIT(out_buf, stage_cur + 3);
+#endif /* ^IGNORE_FINDS */
 
+  if (not_on_tty) {
+    ACTF("Fuzzing test case #%u (%u total, %llu uniq crashes found)...",
+         current_entry, queued_paths, unique_crashes);
+    fflush(stdout);
   }
 
-  new_hit_cnt = queued_paths + unique_crashes;
+  /* Grab the test case, preferably straight from the corpus cache. The
+     trimmer and the splicing stage modify in_buf in place, so we work on
+     a scratch copy rather than the pinned cache buffer. */
 
-  stage_finds[STAGE_FLIP4]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP4] += stage_max;
+  len = queue_cur->len;
 
-  /* Effector map setup. These macros calculate:
+  orig_in = in_buf = ck_scratch_get(&sc_in, len);
 
-     EFF_APOS      - position of a particular file offset in the map.
-     EFF_ALEN      - length of a map with a particular number of bytes.
-     EFF_SPAN_ALEN - map span for a sequence of bytes.
+  memcpy(in_buf, queue_cache_fetch(queue_cur), len);
 
-   */
+  out_buf = ck_scratch_get(&sc_out, len);
 
-#define EFF_APOS(_p)          ((_p) >> EFF_MAP_SCALE2)
-#define EFF_REM(_x)           ((_x) & ((1 << EFF_MAP_SCALE2) - 1))
-#define EFF_ALEN(_l)          (EFF_APOS(_l) + !!EFF_REM(_l))
-#define EFF_SPAN_ALEN(_p, _l) (EFF_APOS((_p) + (_l) - 1) - EFF_APOS(_p) + 1)
+  subseq_tmouts = 0;
 
-  /* Initialize effector map for the next step (see comments below). Always
-     flag first and last byte as doing something. */
+  cur_depth = queue_cur->depth;
 
-  eff_map    = ck_alloc(EFF_ALEN(len));
-  eff_map[0] = 1;
+  /*******************************************
+   * CALIBRATION (only if failed earlier on) *
+   *******************************************/
 
-  if (EFF_APOS(len - 1) != 0) {
-    eff_map[EFF_APOS(len - 1)] = 1;
-    eff_cnt++;
-  }
+  if (queue_cur->cal_failed) {
 
-  /* Walking byte. */
+    u8 res = FAULT_TMOUT;
 
-  stage_name  = "bitflip 8/8";
-  stage_short = "flip8";
-  stage_max   = len;
+    if (queue_cur->cal_failed < CAL_CHANCES) {
 
-  orig_hit_cnt = new_hit_cnt;
+      /* Reset exec_cksum to tell calibrate_case to re-execute the testcase
+         avoiding the usage of an invalid trace_bits.
+         For more info: https://github.com/AFLplusplus/AFLplusplus/pull/425 */
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+      queue_cur->exec_cksum = 0;
 
-    stage_cur_byte = stage_cur;
+      res = calibrate_case(argv, queue_cur, in_buf, queue_cycle - 1, 0);
 
-    out_buf[stage_cur] ^= 0xFF;
+      if (res == FAULT_ERROR)
+        FATAL("Unable to execute target application");
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    }
 
-    /* We also use this stage to pull off a simple trick: we identify
-       bytes that seem to have no effect on the current execution path
-       even when fully flipped - and we skip them during more expensive
-       deterministic stages, such as arithmetics or known ints. */
+    if (stop_soon || res != crash_mode) {
+      cur_skipped_paths++;
+      goto abandon_entry;
+    }
 
-    if (!eff_map[EFF_APOS(stage_cur)]) {
+  }
 
-      u32 cksum;
+  /* Finish (part of) a calibration cut short by the adaptive early exit,
+     now that the entry has actually been picked for fuzzing. */
 
-      /* If in dumb mode or if the file is very short, just flag everything
-         without wasting time on checksums. */
+  if (queue_cur->cal_left && !queue_cur->cal_failed) {
 
-      if (!dumb_mode && len >= EFF_MIN_LEN)
-        cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
-      else
-        cksum = ~queue_cur->exec_cksum;
+    u8 res = calibrate_case(argv, queue_cur, in_buf, queue_cycle - 1, 0);
 
-      if (cksum != queue_cur->exec_cksum) {
-        eff_map[EFF_APOS(stage_cur)] = 1;
-        eff_cnt++;
-      }
+    if (res == FAULT_ERROR)
+      FATAL("Unable to execute target application");
 
+    if (stop_soon || res != crash_mode) {
+      cur_skipped_paths++;
+      goto abandon_entry;
     }
 
-    out_buf[stage_cur] ^= 0xFF;
-
   }
 
-  /* If the effector map is more than EFF_MAX_PERC dense, just flag the
-     whole thing as worth fuzzing, since we wouldn't be saving much time
-     anyway. */
+  /************
+   * TRIMMING *
+   ************/
 
-  if (eff_cnt != EFF_ALEN(len) &&
-      eff_cnt * 100 / EFF_ALEN(len) > EFF_MAX_PERC) {
+  if (!dumb_mode && !queue_cur->trim_done) {
 
-    memset(eff_map, 1, EFF_ALEN(len));
+    u8 res = trim_case(argv, queue_cur, in_buf);
 
-    blocks_eff_select += EFF_ALEN(len);
+    if (res == FAULT_ERROR)
+      FATAL("Unable to execute target application");
 
-  } else {
+    if (stop_soon) {
+      cur_skipped_paths++;
+      goto abandon_entry;
+    }
 
-    blocks_eff_select += eff_cnt;
+    /* Don't retry trimming, even if it failed. */
+
+    queue_cur->trim_done = 1;
+
+    if (len != queue_cur->len) len = queue_cur->len;
 
   }
 
-  blocks_eff_total += EFF_ALEN(len);
+  memcpy(out_buf, in_buf, len);
 
-  new_hit_cnt = queued_paths + unique_crashes;
+  /*********************
+   * PERFORMANCE SCORE *
+   *********************/
 
-  stage_finds[STAGE_FLIP8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP8] += stage_max;
+  orig_perf = perf_score = calculate_score(queue_cur);
 
-  /* Two walking bytes. */
+  /* Skip right away if -d is given, if we have done deterministic fuzzing on
+     this entry ourselves (was_fuzzed), or if it has gone through deterministic
+     testing in earlier, resumed runs (passed_det). */
 
-  if (len < 2) goto skip_bitflip;
+  if (skip_deterministic || queue_cur->was_fuzzed || queue_cur->passed_det)
+    goto havoc_stage;
 
-  stage_name  = "bitflip 16/8";
-  stage_short = "flip16";
-  stage_cur   = 0;
-  stage_max   = len - 1;
+  /* Skip deterministic fuzzing if exec path checksum puts this out of scope
+     for this master instance. */
 
-  orig_hit_cnt = new_hit_cnt;
+  if (master_max && (queue_cur->exec_cksum % master_max) != master_id - 1)
+    goto havoc_stage;
 
-  for (i = 0; i < len - 1; i++) {
+  doing_det = 1;
 
-    /* Let's consult the effector map... */
+  /* See if an earlier, interrupted session left a checkpoint to pick up. */
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max--;
-      continue;
-    }
+  load_det_checkpoint(queue_cur);
 
-    stage_cur_byte = i;
+  /*********************************************
+   * SIMPLE BITFLIP (+dictionary construction) *
+   *********************************************/
 
-    *(u16*)(out_buf + i) ^= 0xFFFF;
+  /* Single walking bit. */
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-    stage_cur++;
+  stage_short = "flip1";
+  stage_max   = len << 3;
+  stage_name  = "bitflip 1/1";
 
-    *(u16*)(out_buf + i) ^= 0xFFFF;
+  stage_val_type = STAGE_VAL_NONE;
 
+  orig_hit_cnt = queued_paths + unique_crashes;
 
-  }
+  prev_cksum = queue_cur->exec_cksum;
 
-  new_hit_cnt = queued_paths + unique_crashes;
+  for (stage_cur = det_stage_init(STAGE_FLIP1, stage_max);
+       stage_cur < stage_max; stage_cur++) {
 
-  stage_finds[STAGE_FLIP16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP16] += stage_max;
+    stage_cur_byte = stage_cur >> 3;
 
-  if (len < 4) goto skip_bitflip;
+    save_det_checkpoint(STAGE_FLIP1, stage_cur, len, 0, 0, 0);
 
-  /* Four walking bytes. */
+    FLIP_BIT(out_buf, stage_cur);
 
-  stage_name  = "bitflip 32/8";
-  stage_short = "flip32";
-  stage_cur   = 0;
-  stage_max   = len - 3;
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-  orig_hit_cnt = new_hit_cnt;
+    FLIP_BIT(out_buf, stage_cur);
 
-  for (i = 0; i < len - 3; i++) {
+    /* While flipping the least significant bit in every byte, pull of an extra
+       trick to detect possible syntax tokens. In essence, the idea is that if
+       you have a binary blob like this:
 
-    /* Let's consult the effector map... */
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max--;
-      continue;
-    }
+       xxxxxxxxIHDRxxxxxxxx
 
-    stage_cur_byte = i;
+       ...and changing the leading and trailing bytes causes variable or no
+       changes in program flow, but touching any character in the "IHDR" string
+       always produces the same, distinctive path, it's highly likely that
+       "IHDR" is an atomically-checked magic value of special significance to
+       the fuzzed format.
 
-    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+       We do this here, rather than as a separate stage, because it's a nice
+       way to keep the operation approximately "free" (i.e., no extra execs).
+       
+       Empirically, performing the check when flipping the least significant bit
+       is advantageous, compared to doing it at the time of more disruptive
+       changes, where the program flow may be affected in more violent ways.
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-    stage_cur++;
+       The caveat is that we won't generate dictionaries in the -d mode or -S
+       mode - but that's probably a fair trade-off.
 
-    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+       This won't work particularly well with paths that exhibit variable
+       behavior, but fails gracefully, so we'll carry out the checks anyway.
 
-  }
+      */
 
-  new_hit_cnt = queued_paths + unique_crashes;
+    if (!dumb_mode && (stage_cur & 7) == 7) {
 
-  stage_finds[STAGE_FLIP32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP32] += stage_max;
+      u32 cksum = hash32(trace_bits, map_size, HASH_CONST);
 
-skip_bitflip:
+      if (stage_cur == stage_max - 1 && cksum == prev_cksum) {
 
-  if (no_arith) goto skip_arith;
+        /* If at end of file and we are still collecting a string, grab the
+           final character and force output. */
 
-  /**********************
-   * ARITHMETIC INC/DEC *
-   **********************/
+        if (a_len < MAX_AUTO_EXTRA) a_collect[a_len] = out_buf[stage_cur >> 3];
+        a_len++;
 
-  /* 8-bit arithmetics. */
+        if (a_len >= MIN_AUTO_EXTRA && a_len <= MAX_AUTO_EXTRA)
+          maybe_add_auto(a_collect, a_len);
 
-  stage_name  = "arith 8/8";
-  stage_short = "arith8";
-  stage_cur   = 0;
-  stage_max   = 2 * len * ARITH_MAX;
+      } else if (cksum != prev_cksum) {
 
-  stage_val_type = STAGE_VAL_LE;
+        /* Otherwise, if the checksum has changed, see if we have something
+           worthwhile queued up, and collect that if the answer is yes. */
 
-  orig_hit_cnt = new_hit_cnt;
+        if (a_len >= MIN_AUTO_EXTRA && a_len <= MAX_AUTO_EXTRA)
+          maybe_add_auto(a_collect, a_len);
 
-  for (i = 0; i < len; i++) {
+        a_len = 0;
+        prev_cksum = cksum;
 
-    u8 orig = out_buf[i];
+      }
 
-    /* Let's consult the effector map... */
+      /* Continue collecting string, but only if the bit flip actually made
+         any difference - we don't want no-op tokens. */
 
-    if (!eff_map[EFF_APOS(i)]) {
-      stage_max -= 2 * ARITH_MAX;
-      continue;
-    }
+      if (cksum != queue_cur->exec_cksum) {
 
-    stage_cur_byte = i;
+        if (a_len < MAX_AUTO_EXTRA) a_collect[a_len] = out_buf[stage_cur >> 3];        
+        a_len++;
 
-    for (j = 1; j <= ARITH_MAX; j++) {
+      }
 
-      u8 r = orig ^ (orig + j);
+    }
 
-      /* Do arithmetic operations only if the result couldn't be a product
-         of a bitflip. */
+  }
 
-      if (!could_be_bitflip(r)) {
+  new_hit_cnt = queued_paths + unique_crashes;
 
-        stage_cur_val = j;
-        out_buf[i] = orig + j;
+  stage_finds[STAGE_FLIP1]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP1] += stage_max;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  /* Two walking bits. */
 
-      } else stage_max--;
+  stage_name  = "bitflip 2/1";
+  stage_short = "flip2";
+  stage_max   = (len << 3) - 1;
 
-      r =  orig ^ (orig - j);
+  orig_hit_cnt = new_hit_cnt;
 
-      if (!could_be_bitflip(r)) {
+  for (stage_cur = det_stage_init(STAGE_FLIP2, stage_max);
+       stage_cur < stage_max; stage_cur++) {
 
-        stage_cur_val = -j;
-        out_buf[i] = orig - j;
+    stage_cur_byte = stage_cur >> 3;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    save_det_checkpoint(STAGE_FLIP2, stage_cur, len, 0, 0, 0);
 
-      } else stage_max--;
+    FLIP_BIT(out_buf, stage_cur);
+    FLIP_BIT(out_buf, stage_cur + 1);
 
-      out_buf[i] = orig;
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-    }
+    FLIP_BIT(out_buf, stage_cur);
+    FLIP_BIT(out_buf, stage_cur + 1);
 
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_ARITH8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH8] += stage_max;
-
-  /* 16-bit arithmetics, both endians. */
+  stage_finds[STAGE_FLIP2]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP2] += stage_max;
 
-  if (len < 2) goto skip_arith;
+  /* Four walking bits. */
 
-  stage_name  = "arith 16/8";
-  stage_short = "arith16";
-  stage_cur   = 0;
-  stage_max   = 4 * (len - 1) * ARITH_MAX;
+  stage_name  = "bitflip 4/1";
+  stage_short = "flip4";
+  stage_max   = (len << 3) - 3;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len - 1; i++) {
-
-    u16 orig = *(u16*)(out_buf + i);
-
-    /* Let's consult the effector map... */
-
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max -= 4 * ARITH_MAX;
-      continue;
-    }
+  for (stage_cur = det_stage_init(STAGE_FLIP4, stage_max);
+       stage_cur < stage_max; stage_cur++) {
 
-    stage_cur_byte = i;
+    stage_cur_byte = stage_cur >> 3;
 
-    for (j = 1; j <= ARITH_MAX; j++) {
+    save_det_checkpoint(STAGE_FLIP4, stage_cur, len, 0, 0, 0);
 
-      u16 r1 = orig ^ (orig + j),
-          r2 = orig ^ (orig - j),
-          r3 = orig ^ SWAP16(SWAP16(orig) + j),
-          r4 = orig ^ SWAP16(SWAP16(orig) - j);
+    FLIP_BIT(out_buf, stage_cur);
+    FLIP_BIT(out_buf, stage_cur + 1);
+    FLIP_BIT(out_buf, stage_cur + 2);
+    FLIP_BIT(out_buf, stage_cur + 3);
 
-      /* Try little endian addition and subtraction first. Do it only
-         if the operation would affect more than one byte (hence the 
-         & 0xff overflow checks) and if it couldn't be a product of
-         a bitflip. */
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-      stage_val_type = STAGE_VAL_LE; 
+    FLIP_BIT(out_buf, stage_cur);
+    FLIP_BIT(out_buf, stage_cur + 1);
+    FLIP_BIT(out_buf, stage_cur + 2);
+    FLIP_BIT(out_buf, stage_cur + 3);
 
-      if ((orig & 0xff) + j > 0xff && !could_be_bitflip(r1)) {
+  }
 
-        stage_cur_val = j;
-        *(u16*)(out_buf + i) = orig + j;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
- 
-      } else stage_max--;
+  stage_finds[STAGE_FLIP4]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP4] += stage_max;
 
-      if ((orig & 0xff) < j && !could_be_bitflip(r2)) {
+  /* Effector map setup. These macros calculate:
 
-        stage_cur_val = -j;
-        *(u16*)(out_buf + i) = orig - j;
+     EFF_APOS      - position of a particular file offset in the map.
+     EFF_ALEN      - length of a map with a particular number of bytes.
+     EFF_SPAN_ALEN - map span for a sequence of bytes.
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+   */
 
-      } else stage_max--;
+#define EFF_APOS(_p)          ((_p) >> EFF_MAP_SCALE2)
+#define EFF_REM(_x)           ((_x) & ((1 << EFF_MAP_SCALE2) - 1))
+#define EFF_ALEN(_l)          (EFF_APOS(_l) + !!EFF_REM(_l))
+#define EFF_SPAN_ALEN(_p, _l) (EFF_APOS((_p) + (_l) - 1) - EFF_APOS(_p) + 1)
 
-      /* Big endian comes next. Same deal. */
+  /* Initialize effector map for the next step (see comments below). Always
+     flag first and last byte as doing something. */
 
-      stage_val_type = STAGE_VAL_BE;
+  eff_map    = ck_scratch_get(&sc_eff, EFF_ALEN(len));
+  memset(eff_map, 0, EFF_ALEN(len));
+  eff_map[0] = 1;
 
+  if (EFF_APOS(len - 1) != 0) {
+    eff_map[EFF_APOS(len - 1)] = 1;
+    eff_cnt++;
+  }
 
-      if ((orig >> 8) + j > 0xff && !could_be_bitflip(r3)) {
+  /* If the checkpoint points at or past the 8/8 stage, the previous
+     session already did (part of) the work of computing the map - restore
+     it instead of starting over. */
 
-        stage_cur_val = j;
-        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) + j);
+  if (det_resuming && det_ck_stage >= STAGE_FLIP8) {
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    if (det_ck_eff_len == EFF_ALEN(len)) {
 
-      } else stage_max--;
+      memcpy(eff_map, det_ck_eff, EFF_ALEN(len));
+      eff_cnt = det_ck_eff_cnt;
 
-      if ((orig >> 8) < j && !could_be_bitflip(r4)) {
+    } else det_resuming = 0; /* Stale - redo the stages. */
 
-        stage_cur_val = -j;
-        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) - j);
+  }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  /* Walking byte. */
 
-      } else stage_max--;
+  stage_name  = "bitflip 8/8";
+  stage_short = "flip8";
+  stage_max   = len;
 
-      *(u16*)(out_buf + i) = orig;
+  orig_hit_cnt = new_hit_cnt;
 
-    }
+  for (stage_cur = det_stage_init(STAGE_FLIP8, stage_max);
+       stage_cur < stage_max; stage_cur++) {
 
-  }
+    stage_cur_byte = stage_cur;
 
-  new_hit_cnt = queued_paths + unique_crashes;
+    save_det_checkpoint(STAGE_FLIP8, stage_cur, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-  stage_finds[STAGE_ARITH16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH16] += stage_max;
+    out_buf[stage_cur] ^= 0xFF;
 
-  /* 32-bit arithmetics, both endians. */
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-  if (len < 4) goto skip_arith;
+    /* We also use this stage to pull off a simple trick: we identify
+       bytes that seem to have no effect on the current execution path
+       even when fully flipped - and we skip them during more expensive
+       deterministic stages, such as arithmetics or known ints. */
 
-  stage_name  = "arith 32/8";
-  stage_short = "arith32";
-  stage_cur   = 0;
-  stage_max   = 4 * (len - 3) * ARITH_MAX;
+    if (!eff_map[EFF_APOS(stage_cur)]) {
 
-  orig_hit_cnt = new_hit_cnt;
+      u32 cksum;
 
-  for (i = 0; i < len - 3; i++) {
+      /* If in dumb mode or if the file is very short, just flag everything
+         without wasting time on checksums. */
 
-    u32 orig = *(u32*)(out_buf + i);
+      if (!dumb_mode && len >= EFF_MIN_LEN)
+        cksum = hash32(trace_bits, map_size, HASH_CONST);
+      else
+        cksum = ~queue_cur->exec_cksum;
 
-    /* Let's consult the effector map... */
+      if (cksum != queue_cur->exec_cksum) {
+        eff_map[EFF_APOS(stage_cur)] = 1;
+        eff_cnt++;
+      }
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max -= 4 * ARITH_MAX;
-      continue;
     }
 
-    stage_cur_byte = i;
+    out_buf[stage_cur] ^= 0xFF;
 
-    for (j = 1; j <= ARITH_MAX; j++) {
+  }
 
-      u32 r1 = orig ^ (orig + j),
-          r2 = orig ^ (orig - j),
-          r3 = orig ^ SWAP32(SWAP32(orig) + j),
-          r4 = orig ^ SWAP32(SWAP32(orig) - j);
+  /* If the effector map is more than EFF_MAX_PERC dense, just flag the
+     whole thing as worth fuzzing, since we wouldn't be saving much time
+     anyway. */
 
-      /* Little endian first. Same deal as with 16-bit: we only want to
-         try if the operation would have effect on more than two bytes. */
+  if (eff_cnt != EFF_ALEN(len) &&
+      eff_cnt * 100 / EFF_ALEN(len) > EFF_MAX_PERC) {
 
-      stage_val_type = STAGE_VAL_LE;
+    memset(eff_map, 1, EFF_ALEN(len));
 
-      if ((orig & 0xffff) + j > 0xffff && !could_be_bitflip(r1)) {
+    blocks_eff_select += EFF_ALEN(len);
 
-        stage_cur_val = j;
-        *(u32*)(out_buf + i) = orig + j;
+  } else {
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    blocks_eff_select += eff_cnt;
 
-      } else stage_max--;
+  }
 
-      if ((orig & 0xffff) < j && !could_be_bitflip(r2)) {
+  blocks_eff_total += EFF_ALEN(len);
 
-        stage_cur_val = -j;
-        *(u32*)(out_buf + i) = orig - j;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  stage_finds[STAGE_FLIP8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP8] += stage_max;
 
-      } else stage_max--;
+  /* Two walking bytes. */
 
-      /* Big endian next. */
+  if (len < 2) goto skip_bitflip;
 
-      stage_val_type = STAGE_VAL_BE;
+  stage_name  = "bitflip 16/8";
+  stage_short = "flip16";
+  stage_cur   = 0;
+  stage_max   = len - 1;
 
-      if ((SWAP32(orig) & 0xffff) + j > 0xffff && !could_be_bitflip(r3)) {
+  orig_hit_cnt = new_hit_cnt;
 
-        stage_cur_val = j;
-        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) + j);
+  for (i = det_stage_init(STAGE_FLIP16, len - 1); i < len - 1; i++) {
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    save_det_checkpoint(STAGE_FLIP16, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-      } else stage_max--;
+    /* Let's consult the effector map... */
 
-      if ((SWAP32(orig) & 0xffff) < j && !could_be_bitflip(r4)) {
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
+      stage_max--;
+      continue;
+    }
 
-        stage_cur_val = -j;
-        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) - j);
+    stage_cur_byte = i;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    *(u16*)(out_buf + i) ^= 0xFFFF;
 
-      } else stage_max--;
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    stage_cur++;
 
-      *(u32*)(out_buf + i) = orig;
+    *(u16*)(out_buf + i) ^= 0xFFFF;
 
-    }
 
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_ARITH32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH32] += stage_max;
+  stage_finds[STAGE_FLIP16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP16] += stage_max;
 
-skip_arith:
+  if (len < 4) goto skip_bitflip;
 
-  /**********************
-   * INTERESTING VALUES *
-   **********************/
+  /* Four walking bytes. */
 
-  stage_name  = "interest 8/8";
-  stage_short = "int8";
+  stage_name  = "bitflip 32/8";
+  stage_short = "flip32";
   stage_cur   = 0;
-  stage_max   = len * sizeof(interesting_8);
-
-  stage_val_type = STAGE_VAL_LE;
+  stage_max   = len - 3;
 
   orig_hit_cnt = new_hit_cnt;
 
-  /* Setting 8-bit integers. */
-
-  for (i = 0; i < len; i++) {
+  for (i = det_stage_init(STAGE_FLIP32, len - 3); i < len - 3; i++) {
 
-    u8 orig = out_buf[i];
+    save_det_checkpoint(STAGE_FLIP32, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
     /* Let's consult the effector map... */
-
-    if (!eff_map[EFF_APOS(i)]) {
-      stage_max -= sizeof(interesting_8);
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max--;
       continue;
     }
 
     stage_cur_byte = i;
 
-    for (j = 0; j < sizeof(interesting_8); j++) {
-
-      /* Skip if the value could be a product of bitflips or arithmetics. */
-
-      if (could_be_bitflip(orig ^ (u8)interesting_8[j]) ||
-          could_be_arith(orig, (u8)interesting_8[j], 1)) {
-        stage_max--;
-        continue;
-      }
-
-      stage_cur_val = interesting_8[j];
-      out_buf[i] = interesting_8[j];
-
-      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
 
-      out_buf[i] = orig;
-      stage_cur++;
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    stage_cur++;
 
-    }
+    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
 
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_INTEREST8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST8] += stage_max;
+  stage_finds[STAGE_FLIP32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP32] += stage_max;
 
-  /* Setting 16-bit integers, both endians. */
+skip_bitflip:
 
-  if (no_arith || len < 2) goto skip_interest;
+  if (no_arith) goto skip_arith;
 
-  stage_name  = "interest 16/8";
-  stage_short = "int16";
+  /**********************
+   * ARITHMETIC INC/DEC *
+   **********************/
+
+  /* 8-bit arithmetics. */
+
+  stage_name  = "arith 8/8";
+  stage_short = "arith8";
   stage_cur   = 0;
-  stage_max   = 2 * (len - 1) * (sizeof(interesting_16) >> 1);
+  stage_max   = 2 * len * ARITH_MAX;
+
+  stage_val_type = STAGE_VAL_LE;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len - 1; i++) {
+  for (i = det_stage_init(STAGE_ARITH8, len); i < len; i++) {
 
-    u16 orig = *(u16*)(out_buf + i);
+    u8 orig = out_buf[i];
+
+    save_det_checkpoint(STAGE_ARITH8, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
     /* Let's consult the effector map... */
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max -= sizeof(interesting_16);
+    if (!eff_map[EFF_APOS(i)]) {
+      stage_max -= 2 * ARITH_MAX;
       continue;
     }
 
     stage_cur_byte = i;
 
-    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
-
-      stage_cur_val = interesting_16[j];
+    for (j = 1; j <= ARITH_MAX; j++) {
 
-      /* Skip if this could be a product of a bitflip, arithmetics,
-         or single-byte interesting value insertion. */
+      u8 r = orig ^ (orig + j);
 
-      if (!could_be_bitflip(orig ^ (u16)interesting_16[j]) &&
-          !could_be_arith(orig, (u16)interesting_16[j], 2) &&
-          !could_be_interest(orig, (u16)interesting_16[j], 2, 0)) {
+      /* Do arithmetic operations only if the result couldn't be a product
+         of a bitflip. */
 
-        stage_val_type = STAGE_VAL_LE;
+      if (!could_be_bitflip(r)) {
 
-        *(u16*)(out_buf + i) = interesting_16[j];
+        stage_cur_val = j;
+        out_buf[i] = orig + j;
 
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-      if ((u16)interesting_16[j] != SWAP16(interesting_16[j]) &&
-          !could_be_bitflip(orig ^ SWAP16(interesting_16[j])) &&
-          !could_be_arith(orig, SWAP16(interesting_16[j]), 2) &&
-          !could_be_interest(orig, SWAP16(interesting_16[j]), 2, 1)) {
+      r =  orig ^ (orig - j);
 
-        stage_val_type = STAGE_VAL_BE;
+      if (!could_be_bitflip(r)) {
+
+        stage_cur_val = -j;
+        out_buf[i] = orig - j;
 
-        *(u16*)(out_buf + i) = SWAP16(interesting_16[j]);
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-    }
+      out_buf[i] = orig;
 
-    *(u16*)(out_buf + i) = orig;
+    }
 
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_INTEREST16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST16] += stage_max;
+  stage_finds[STAGE_ARITH8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH8] += stage_max;
 
-  if (len < 4) goto skip_interest;
+  /* 16-bit arithmetics, both endians. */
 
-  /* Setting 32-bit integers, both endians. */
+  if (len < 2) goto skip_arith;
 
-  stage_name  = "interest 32/8";
-  stage_short = "int32";
+  stage_name  = "arith 16/8";
+  stage_short = "arith16";
   stage_cur   = 0;
-  stage_max   = 2 * (len - 3) * (sizeof(interesting_32) >> 2);
+  stage_max   = 4 * (len - 1) * ARITH_MAX;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len - 3; i++) {
+  for (i = det_stage_init(STAGE_ARITH16, len - 1); i < len - 1; i++) {
 
-    u32 orig = *(u32*)(out_buf + i);
+    u16 orig = *(u16*)(out_buf + i);
+
+    save_det_checkpoint(STAGE_ARITH16, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
     /* Let's consult the effector map... */
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max -= sizeof(interesting_32) >> 1;
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
+      stage_max -= 4 * ARITH_MAX;
       continue;
     }
 
     stage_cur_byte = i;
 
-    for (j = 0; j < sizeof(interesting_32) / 4; j++) {
+    for (j = 1; j <= ARITH_MAX; j++) {
 
-      stage_cur_val = interesting_32[j];
+      u16 r1 = orig ^ (orig + j),
+          r2 = orig ^ (orig - j),
+          r3 = orig ^ SWAP16(SWAP16(orig) + j),
+          r4 = orig ^ SWAP16(SWAP16(orig) - j);
 
-      /* Skip if this could be a product of a bitflip, arithmetics,
-         or word interesting value insertion. */
+      /* Try little endian addition and subtraction first. Do it only
+         if the operation would affect more than one byte (hence the 
+         & 0xff overflow checks) and if it couldn't be a product of
+         a bitflip. */
 
-      if (!could_be_bitflip(orig ^ (u32)interesting_32[j]) &&
-          !could_be_arith(orig, interesting_32[j], 4) &&
-          !could_be_interest(orig, interesting_32[j], 4, 0)) {
+      stage_val_type = STAGE_VAL_LE; 
 
-        stage_val_type = STAGE_VAL_LE;
+      if ((orig & 0xff) + j > 0xff && !could_be_bitflip(r1)) {
 
-        *(u32*)(out_buf + i) = interesting_32[j];
+        stage_cur_val = j;
+        *(u16*)(out_buf + i) = orig + j;
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+ 
+      } else stage_max--;
+
+      if ((orig & 0xff) < j && !could_be_bitflip(r2)) {
+
+        stage_cur_val = -j;
+        *(u16*)(out_buf + i) = orig - j;
 
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-      if ((u32)interesting_32[j] != SWAP32(interesting_32[j]) &&
-          !could_be_bitflip(orig ^ SWAP32(interesting_32[j])) &&
-          !could_be_arith(orig, SWAP32(interesting_32[j]), 4) &&
-          !could_be_interest(orig, SWAP32(interesting_32[j]), 4, 1)) {
+      /* Big endian comes next. Same deal. */
 
-        stage_val_type = STAGE_VAL_BE;
+      stage_val_type = STAGE_VAL_BE;
+
+
+      if ((orig >> 8) + j > 0xff && !could_be_bitflip(r3)) {
+
+        stage_cur_val = j;
+        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) + j);
 
-        *(u32*)(out_buf + i) = SWAP32(interesting_32[j]);
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-    }
+      if ((orig >> 8) < j && !could_be_bitflip(r4)) {
 
-    *(u32*)(out_buf + i) = orig;
+        stage_cur_val = -j;
+        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) - j);
 
-  }
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  new_hit_cnt = queued_paths + unique_crashes;
+      } else stage_max--;
 
-  stage_finds[STAGE_INTEREST32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST32] += stage_max;
+      *(u16*)(out_buf + i) = orig;
 
-skip_interest:
+    }
 
-  /********************
-   * DICTIONARY STUFF *
-   ********************/
+  }
 
-  if (!extras_cnt) goto skip_user_extras;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-  /* Overwrite with user-supplied extras. */
+  stage_finds[STAGE_ARITH16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH16] += stage_max;
 
-  stage_name  = "user extras (over)";
-  stage_short = "ext_UO";
-  stage_cur   = 0;
-  stage_max   = extras_cnt * len;
+  /* 32-bit arithmetics, both endians. */
 
-  stage_val_type = STAGE_VAL_NONE;
+  if (len < 4) goto skip_arith;
+
+  stage_name  = "arith 32/8";
+  stage_short = "arith32";
+  stage_cur   = 0;
+  stage_max   = 4 * (len - 3) * ARITH_MAX;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len; i++) {
+  for (i = det_stage_init(STAGE_ARITH32, len - 3); i < len - 3; i++) {
 
-    u32 last_len = 0;
+    u32 orig = *(u32*)(out_buf + i);
 
-    stage_cur_byte = i;
+    save_det_checkpoint(STAGE_ARITH32, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-    /* Extras are sorted by size, from smallest to largest. This means
-       that we don't have to worry about restoring the buffer in
-       between writes at a particular offset determined by the outer
-       loop. */
+    /* Let's consult the effector map... */
 
-    for (j = 0; j < extras_cnt; j++) {
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max -= 4 * ARITH_MAX;
+      continue;
+    }
 
-      /* Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
-         skip them if there's no room to insert the payload, if the token
-         is redundant, or if its entire span has no bytes set in the effector
-         map. */
+    stage_cur_byte = i;
 
-      if ((extras_cnt > MAX_DET_EXTRAS && UR(extras_cnt) >= MAX_DET_EXTRAS) ||
-          extras[j].len > len - i ||
-          !memcmp(extras[j].data, out_buf + i, extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extras[j].len))) {
+    for (j = 1; j <= ARITH_MAX; j++) {
 
-        stage_max--;
-        continue;
+      u32 r1 = orig ^ (orig + j),
+          r2 = orig ^ (orig - j),
+          r3 = orig ^ SWAP32(SWAP32(orig) + j),
+          r4 = orig ^ SWAP32(SWAP32(orig) - j);
 
-      }
+      /* Little endian first. Same deal as with 16-bit: we only want to
+         try if the operation would have effect on more than two bytes. */
 
-      last_len = extras[j].len;
-      memcpy(out_buf + i, extras[j].data, last_len);
+      stage_val_type = STAGE_VAL_LE;
 
-      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+      if ((orig & 0xffff) + j > 0xffff && !could_be_bitflip(r1)) {
 
-      stage_cur++;
+        stage_cur_val = j;
+        *(u32*)(out_buf + i) = orig + j;
 
-    }
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-    /* Restore all the clobbered memory. */
-    memcpy(out_buf + i, in_buf + i, last_len);
+      } else stage_max--;
 
-  }
+      if ((orig & 0xffff) < j && !could_be_bitflip(r2)) {
 
-  new_hit_cnt = queued_paths + unique_crashes;
+        stage_cur_val = -j;
+        *(u32*)(out_buf + i) = orig - j;
 
-  stage_finds[STAGE_EXTRAS_UO]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_UO] += stage_max;
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  /* Insertion of user-supplied extras. */
+      } else stage_max--;
 
-  stage_name  = "user extras (insert)";
-  stage_short = "ext_UI";
-  stage_cur   = 0;
-  stage_max   = extras_cnt * (len + 1);
+      /* Big endian next. */
 
-  orig_hit_cnt = new_hit_cnt;
+      stage_val_type = STAGE_VAL_BE;
 
-  ex_tmp = ck_alloc(len + MAX_DICT_FILE);
+      if ((SWAP32(orig) & 0xffff) + j > 0xffff && !could_be_bitflip(r3)) {
 
-  for (i = 0; i <= len; i++) {
+        stage_cur_val = j;
+        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) + j);
 
-    stage_cur_byte = i;
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-    for (j = 0; j < extras_cnt; j++) {
+      } else stage_max--;
 
-      if (len + extras[j].len > MAX_FILE) {
-        stage_max--; 
-        continue;
-      }
+      if ((SWAP32(orig) & 0xffff) < j && !could_be_bitflip(r4)) {
 
-      /* Insert token */
-      memcpy(ex_tmp + i, extras[j].data, extras[j].len);
+        stage_cur_val = -j;
+        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) - j);
 
-      /* Copy tail */
-      memcpy(ex_tmp + i + extras[j].len, out_buf + i, len - i);
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-      if (common_fuzz_stuff(argv, ex_tmp, len + extras[j].len)) {
-        ck_free(ex_tmp);
-        goto abandon_entry;
-      }
+      } else stage_max--;
 
-      stage_cur++;
+      *(u32*)(out_buf + i) = orig;
 
     }
 
-    /* Copy head */
-    ex_tmp[i] = out_buf[i];
-
   }
 
-  ck_free(ex_tmp);
-
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_EXTRAS_UI]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_UI] += stage_max;
+  stage_finds[STAGE_ARITH32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH32] += stage_max;
 
-skip_user_extras:
+skip_arith:
 
-  if (!a_extras_cnt) goto skip_extras;
+  /**********************
+   * INTERESTING VALUES *
+   **********************/
 
-  stage_name  = "auto extras (over)";
-  stage_short = "ext_AO";
+  stage_name  = "interest 8/8";
+  stage_short = "int8";
   stage_cur   = 0;
-  stage_max   = MIN(a_extras_cnt, USE_AUTO_EXTRAS) * len;
+  stage_max   = len * sizeof(interesting_8);
 
-  stage_val_type = STAGE_VAL_NONE;
+  stage_val_type = STAGE_VAL_LE;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len; i++) {
+  /* Setting 8-bit integers. */
 
-    u32 last_len = 0;
+  for (i = det_stage_init(STAGE_INTEREST8, len); i < len; i++) {
 
-    stage_cur_byte = i;
+    u8 orig = out_buf[i];
 
-    for (j = 0; j < MIN(a_extras_cnt, USE_AUTO_EXTRAS); j++) {
+    save_det_checkpoint(STAGE_INTEREST8, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-      /* See the comment in the earlier code; extras are sorted by size. */
+    /* Let's consult the effector map... */
 
-      if (a_extras[j].len > len - i ||
-          !memcmp(a_extras[j].data, out_buf + i, a_extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, a_extras[j].len))) {
+    if (!eff_map[EFF_APOS(i)]) {
+      stage_max -= sizeof(interesting_8);
+      continue;
+    }
 
+    stage_cur_byte = i;
+
+    for (j = 0; j < sizeof(interesting_8); j++) {
+
+      /* Skip if the value could be a product of bitflips or arithmetics. */
+
+      if (could_be_bitflip(orig ^ (u8)interesting_8[j]) ||
+          could_be_arith(orig, (u8)interesting_8[j], 1)) {
         stage_max--;
         continue;
-
       }
 
-      last_len = a_extras[j].len;
-      memcpy(out_buf + i, a_extras[j].data, last_len);
+      stage_cur_val = interesting_8[j];
+      out_buf[i] = interesting_8[j];
 
       if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
+      out_buf[i] = orig;
       stage_cur++;
 
     }
 
-    /* Restore all the clobbered memory. */
-    memcpy(out_buf + i, in_buf + i, last_len);
-
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_EXTRAS_AO]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_AO] += stage_max;
-
-skip_extras:
-
-  /* If we made this to here without jumping to havoc_stage or abandon_entry,
-     we're properly done with deterministic steps and can mark it as such
-     in the .state/ directory. */
-
-  if (!queue_cur->passed_det) mark_as_det_done(queue_cur);
-
-  /****************
-   * RANDOM HAVOC *
-   ****************/
-
-havoc_stage:
-
-  stage_cur_byte = -1;
+  stage_finds[STAGE_INTEREST8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST8] += stage_max;
 
-  /* The havoc stage mutation code is also invoked when splicing files; if the
-     splice_cycle variable is set, generate different descriptions and such. */
+  /* Setting 16-bit integers, both endians. */
 
-  if (!splice_cycle) {
+  if (no_arith || len < 2) goto skip_interest;
 
-    stage_name  = "havoc";
-    stage_short = "havoc";
-    stage_max   = (doing_det ? HAVOC_CYCLES_INIT : HAVOC_CYCLES) *
-                  perf_score / havoc_div / 100;
+  stage_name  = "interest 16/8";
+  stage_short = "int16";
+  stage_cur   = 0;
+  stage_max   = 2 * (len - 1) * (sizeof(interesting_16) >> 1);
 
-  } else {
+  orig_hit_cnt = new_hit_cnt;
 
-    static u8 tmp[32];
+  for (i = det_stage_init(STAGE_INTEREST16, len - 1); i < len - 1; i++) {
 
-    perf_score = orig_perf;
+    u16 orig = *(u16*)(out_buf + i);
 
-    sprintf(tmp, "splice %u", splice_cycle);
-    stage_name  = tmp;
-    stage_short = "splice";
-    stage_max   = SPLICE_HAVOC * perf_score / havoc_div / 100;
+    save_det_checkpoint(STAGE_INTEREST16, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-  }
+    /* Let's consult the effector map... */
 
-  if (stage_max < HAVOC_MIN) stage_max = HAVOC_MIN;
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
+      stage_max -= sizeof(interesting_16);
+      continue;
+    }
 
-  temp_len = len;
+    stage_cur_byte = i;
 
-  orig_hit_cnt = queued_paths + unique_crashes;
+    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
 
-  havoc_queued = queued_paths;
+      stage_cur_val = interesting_16[j];
 
-  /* We essentially just do several thousand runs (depending on perf_score)
-     where we take the input file and make random stacked tweaks. */
+      /* Skip if this could be a product of a bitflip, arithmetics,
+         or single-byte interesting value insertion. */
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+      if (!could_be_bitflip(orig ^ (u16)interesting_16[j]) &&
+          !could_be_arith(orig, (u16)interesting_16[j], 2) &&
+          !could_be_interest(orig, (u16)interesting_16[j], 2, 0)) {
 
-    u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
+        stage_val_type = STAGE_VAL_LE;
 
-    stage_cur_val = use_stacking;
- 
-    for (i = 0; i < use_stacking; i++) {
+        *(u16*)(out_buf + i) = interesting_16[j];
 
-      switch (UR(15 + ((extras_cnt + a_extras_cnt) ? 2 : 0))) {
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-        case 0:
+      } else stage_max--;
 
-          /* Flip a single bit somewhere. Spooky! */
+      if ((u16)interesting_16[j] != SWAP16(interesting_16[j]) &&
+          !could_be_bitflip(orig ^ SWAP16(interesting_16[j])) &&
+          !could_be_arith(orig, SWAP16(interesting_16[j]), 2) &&
+          !could_be_interest(orig, SWAP16(interesting_16[j]), 2, 1)) {
 
-          FLIP_BIT(out_buf, UR(temp_len << 3));
-          break;
+        stage_val_type = STAGE_VAL_BE;
 
-        case 1: 
+        *(u16*)(out_buf + i) = SWAP16(interesting_16[j]);
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-          /* Set byte to interesting value. */
+      } else stage_max--;
 
-          out_buf[UR(temp_len)] = interesting_8[UR(sizeof(interesting_8))];
-          break;
+    }
 
-        case 2:
+    *(u16*)(out_buf + i) = orig;
 
-          /* Set word to interesting value, randomly choosing endian. */
+  }
 
-          if (temp_len < 2) break;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-          if (UR(2)) {
+  stage_finds[STAGE_INTEREST16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST16] += stage_max;
 
-            *(u16*)(out_buf + UR(temp_len - 1)) =
-              interesting_16[UR(sizeof(interesting_16) >> 1)];
+  if (len < 4) goto skip_interest;
 
-          } else {
+  /* Setting 32-bit integers, both endians. */
 
-            *(u16*)(out_buf + UR(temp_len - 1)) = SWAP16(
-              interesting_16[UR(sizeof(interesting_16) >> 1)]);
+  stage_name  = "interest 32/8";
+  stage_short = "int32";
+  stage_cur   = 0;
+  stage_max   = 2 * (len - 3) * (sizeof(interesting_32) >> 2);
 
-          }
+  orig_hit_cnt = new_hit_cnt;
 
-          break;
+  for (i = det_stage_init(STAGE_INTEREST32, len - 3); i < len - 3; i++) {
 
-        case 3:
+    u32 orig = *(u32*)(out_buf + i);
 
-          /* Set dword to interesting value, randomly choosing endian. */
+    save_det_checkpoint(STAGE_INTEREST32, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-          if (temp_len < 4) break;
+    /* Let's consult the effector map... */
 
-          if (UR(2)) {
-  
-            *(u32*)(out_buf + UR(temp_len - 3)) =
-              interesting_32[UR(sizeof(interesting_32) >> 2)];
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max -= sizeof(interesting_32) >> 1;
+      continue;
+    }
 
-          } else {
+    stage_cur_byte = i;
 
-            *(u32*)(out_buf + UR(temp_len - 3)) = SWAP32(
-              interesting_32[UR(sizeof(interesting_32) >> 2)]);
+    for (j = 0; j < sizeof(interesting_32) / 4; j++) {
 
-          }
+      stage_cur_val = interesting_32[j];
 
-          break;
+      /* Skip if this could be a product of a bitflip, arithmetics,
+         or word interesting value insertion. */
 
-        case 4:
+      if (!could_be_bitflip(orig ^ (u32)interesting_32[j]) &&
+          !could_be_arith(orig, interesting_32[j], 4) &&
+          !could_be_interest(orig, interesting_32[j], 4, 0)) {
 
-          /* Randomly subtract from byte. */
+        stage_val_type = STAGE_VAL_LE;
 
-          out_buf[UR(temp_len)] -= 1 + UR(ARITH_MAX);
-          break;
+        *(u32*)(out_buf + i) = interesting_32[j];
 
-        case 5:
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-          /* Randomly add to byte. */
+      } else stage_max--;
 
-          out_buf[UR(temp_len)] += 1 + UR(ARITH_MAX);
-          break;
+      if ((u32)interesting_32[j] != SWAP32(interesting_32[j]) &&
+          !could_be_bitflip(orig ^ SWAP32(interesting_32[j])) &&
+          !could_be_arith(orig, SWAP32(interesting_32[j]), 4) &&
+          !could_be_interest(orig, SWAP32(interesting_32[j]), 4, 1)) {
 
-        case 6:
+        stage_val_type = STAGE_VAL_BE;
 
-          /* Randomly subtract from word, random endian. */
+        *(u32*)(out_buf + i) = SWAP32(interesting_32[j]);
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-          if (temp_len < 2) break;
+      } else stage_max--;
 
-          if (UR(2)) {
+    }
 
-            u32 pos = UR(temp_len - 1);
+    *(u32*)(out_buf + i) = orig;
 
-            *(u16*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
+  }
 
-          } else {
+  new_hit_cnt = queued_paths + unique_crashes;
 
-            u32 pos = UR(temp_len - 1);
-            u16 num = 1 + UR(ARITH_MAX);
+  stage_finds[STAGE_INTEREST32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST32] += stage_max;
 
-            *(u16*)(out_buf + pos) =
-              SWAP16(SWAP16(*(u16*)(out_buf + pos)) - num);
+skip_interest:
 
-          }
+  /********************
+   * DICTIONARY STUFF *
+   ********************/
 
-          break;
+  if (!extras_cnt) goto skip_user_extras;
 
-        case 7:
+  /* Overwrite with user-supplied extras. */
 
-          /* Randomly add to word, random endian. */
+  stage_name  = "user extras (over)";
+  stage_short = "ext_UO";
+  stage_cur   = 0;
+  stage_max   = extras_cnt * len;
 
-          if (temp_len < 2) break;
+  stage_val_type = STAGE_VAL_NONE;
 
-          if (UR(2)) {
+  orig_hit_cnt = new_hit_cnt;
 
-            u32 pos = UR(temp_len - 1);
+  for (i = det_stage_init(STAGE_EXTRAS_UO, len); i < len; i++) {
 
-            *(u16*)(out_buf + pos) += 1 + UR(ARITH_MAX);
+    u32 last_len = 0;
 
-          } else {
+    stage_cur_byte = i;
 
-            u32 pos = UR(temp_len - 1);
-            u16 num = 1 + UR(ARITH_MAX);
+    save_det_checkpoint(STAGE_EXTRAS_UO, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-            *(u16*)(out_buf + pos) =
-              SWAP16(SWAP16(*(u16*)(out_buf + pos)) + num);
+    /* Extras are sorted by size, from smallest to largest. This means
+       that we don't have to worry about restoring the buffer in
+       between writes at a particular offset determined by the outer
+       loop. */
 
-          }
+    /* One trie walk flags every token that already matches the input at
+       this offset; the loop below then gets by without a memcmp() per
+       token. */
 
-          break;
+    extra_trie_matches(out_buf + i, len - i);
 
-        case 8:
+    for (j = 0; j < extras_cnt; j++) {
 
-          /* Randomly subtract from dword, random endian. */
+      /* Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
+         skip them if there's no room to insert the payload, if the token
+         is redundant (or a duplicate of an earlier one), or if its entire
+         span has no bytes set in the effector map. */
 
-          if (temp_len < 4) break;
+      if ((extras_cnt > MAX_DET_EXTRAS && UR(extras_cnt) >= MAX_DET_EXTRAS) ||
+          extras[j].len > len - i ||
+          ext_matched[j] || ext_dup[j] ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extras[j].len))) {
 
-          if (UR(2)) {
+        stage_max--;
+        continue;
 
-            u32 pos = UR(temp_len - 3);
+      }
 
-            *(u32*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
+      last_len = extras[j].len;
+      memcpy(out_buf + i, extras[j].data, last_len);
 
-          } else {
+      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-            u32 pos = UR(temp_len - 3);
-            u32 num = 1 + UR(ARITH_MAX);
+      stage_cur++;
 
-            *(u32*)(out_buf + pos) =
-              SWAP32(SWAP32(*(u32*)(out_buf + pos)) - num);
+    }
 
-          }
+    /* Restore all the clobbered memory. */
+    memcpy(out_buf + i, in_buf + i, last_len);
 
-          break;
+  }
 
-        case 9:
+  new_hit_cnt = queued_paths + unique_crashes;
 
-          /* Randomly add to dword, random endian. */
+  stage_finds[STAGE_EXTRAS_UO]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_UO] += stage_max;
 
-          if (temp_len < 4) break;
+  /* Insertion of user-supplied extras. */
 
-          if (UR(2)) {
+  stage_name  = "user extras (insert)";
+  stage_short = "ext_UI";
+  stage_cur   = 0;
+  stage_max   = extras_cnt * (len + 1);
 
-            u32 pos = UR(temp_len - 3);
+  orig_hit_cnt = new_hit_cnt;
 
-            *(u32*)(out_buf + pos) += 1 + UR(ARITH_MAX);
+  ex_tmp = ck_scratch_get(&sc_ex, len + MAX_DICT_FILE);
 
-          } else {
+  /* The loop below builds ex_tmp's head incrementally; when resuming
+     mid-stage, prefill the part the skipped iterations would have copied. */
 
-            u32 pos = UR(temp_len - 3);
-            u32 num = 1 + UR(ARITH_MAX);
+  i = det_stage_init(STAGE_EXTRAS_UI, len + 1);
+  memcpy(ex_tmp, out_buf, MIN(i, len));
 
-            *(u32*)(out_buf + pos) =
-              SWAP32(SWAP32(*(u32*)(out_buf + pos)) + num);
+  for (; i <= len; i++) {
 
-          }
+    stage_cur_byte = i;
 
-          break;
+    save_det_checkpoint(STAGE_EXTRAS_UI, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-        case 10:
+    for (j = 0; j < extras_cnt; j++) {
 
-          /* Just set a random byte to a random value. Because,
-             why not. We use XOR with 1-255 to eliminate the
-             possibility of a no-op. */
+      if (len + extras[j].len > MAX_FILE) {
+        stage_max--;
+        continue;
+      }
 
-          out_buf[UR(temp_len)] ^= 1 + UR(255);
-          break;
+      /* Insert token */
+      memcpy(ex_tmp + i, extras[j].data, extras[j].len);
 
-        case 11 ... 12: {
+      /* Copy tail */
+      memcpy(ex_tmp + i + extras[j].len, out_buf + i, len - i);
 
-            /* Delete bytes. We're making this a bit more likely
-               than insertion (the next option) in hopes of keeping
-               files reasonably small. */
+      if (common_fuzz_stuff(argv, ex_tmp, len + extras[j].len))
+        goto abandon_entry;
 
-            u32 del_from, del_len;
+      stage_cur++;
 
-            if (temp_len < 2) break;
+    }
 
-            /* Don't delete too much. */
+    /* Copy head */
+    ex_tmp[i] = out_buf[i];
 
-            del_len = choose_block_len(temp_len - 1);
+  }
 
-            del_from = UR(temp_len - del_len + 1);
+  new_hit_cnt = queued_paths + unique_crashes;
 
-            memmove(out_buf + del_from, out_buf + del_from + del_len,
-                    temp_len - del_from - del_len);
+  stage_finds[STAGE_EXTRAS_UI]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_UI] += stage_max;
 
-            temp_len -= del_len;
+skip_user_extras:
 
-            break;
+  if (!a_extras_cnt) goto skip_extras;
 
-          }
+  stage_name  = "auto extras (over)";
+  stage_short = "ext_AO";
+  stage_cur   = 0;
+  stage_max   = MIN(a_extras_cnt, USE_AUTO_EXTRAS) * len;
 
-        case 13:
+  stage_val_type = STAGE_VAL_NONE;
 
-          if (temp_len + HAVOC_BLK_XL < MAX_FILE) {
+  orig_hit_cnt = new_hit_cnt;
 
-            /* Clone bytes (75%) or insert a block of constant bytes (25%). */
+  for (i = det_stage_init(STAGE_EXTRAS_AO, len); i < len; i++) {
 
-            u8  actually_clone = UR(4);
-            u32 clone_from, clone_to, clone_len;
-            u8* new_buf;
+    u32 last_len = 0;
 
-            if (actually_clone) {
+    stage_cur_byte = i;
 
-              clone_len  = choose_block_len(temp_len);
-              clone_from = UR(temp_len - clone_len + 1);
+    save_det_checkpoint(STAGE_EXTRAS_AO, i, len, eff_map, EFF_ALEN(len),
+                        eff_cnt);
 
-            } else {
+    for (j = 0; j < MIN(a_extras_cnt, USE_AUTO_EXTRAS); j++) {
 
-              clone_len = choose_block_len(HAVOC_BLK_XL);
-              clone_from = 0;
+      /* See the comment in the earlier code; extras are sorted by size. */
 
-            }
+      if (a_extras[j].len > len - i ||
+          !memcmp(a_extras[j].data, out_buf + i, a_extras[j].len) ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, a_extras[j].len))) {
 
-            clone_to   = UR(temp_len);
+        stage_max--;
+        continue;
 
-            new_buf = ck_alloc_nozero(temp_len + clone_len);
+      }
 
-            /* Head */
+      last_len = a_extras[j].len;
+      memcpy(out_buf + i, a_extras[j].data, last_len);
 
-            memcpy(new_buf, out_buf, clone_to);
+      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-            /* Inserted part */
+      stage_cur++;
 
-            if (actually_clone)
-              memcpy(new_buf + clone_to, out_buf + clone_from, clone_len);
-            else
-              memset(new_buf + clone_to,
-                     UR(2) ? UR(256) : out_buf[UR(temp_len)], clone_len);
+    }
 
-            /* Tail */
-            memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
-                   temp_len - clone_to);
+    /* Restore all the clobbered memory. */
+    memcpy(out_buf + i, in_buf + i, last_len);
 
-            ck_free(out_buf);
-            out_buf = new_buf;
-            temp_len += clone_len;
+  }
 
-          }
+  new_hit_cnt = queued_paths + unique_crashes;
 
-          break;
+  stage_finds[STAGE_EXTRAS_AO]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_AO] += stage_max;
 
-        case 14: {
+skip_extras:
 
-            /* Overwrite bytes with a randomly selected chunk (75%) or fixed
-               bytes (25%). */
+  /* If we made this to here without jumping to havoc_stage or abandon_entry,
+     we're properly done with deterministic steps and can mark it as such
+     in the .state/ directory. */
 
-            u32 copy_from, copy_to, copy_len;
+  if (!queue_cur->passed_det) mark_as_det_done(queue_cur);
 
-            if (temp_len < 2) break;
+  /****************
+   * RANDOM HAVOC *
+   ****************/
 
-            copy_len  = choose_block_len(temp_len - 1);
+havoc_stage:
 
-            copy_from = UR(temp_len - copy_len + 1);
-            copy_to   = UR(temp_len - copy_len + 1);
+  det_resuming = 0;
 
-            if (UR(4)) {
+  stage_cur_byte = -1;
 
-              if (copy_from != copy_to)
-                memmove(out_buf + copy_to, out_buf + copy_from, copy_len);
+  /* The havoc stage mutation code is also invoked when splicing files; if the
+     splice_cycle variable is set, generate different descriptions and such. */
 
-            } else memset(out_buf + copy_to,
-                          UR(2) ? UR(256) : out_buf[UR(temp_len)], copy_len);
+  if (!splice_cycle) {
 
-            break;
+    stage_name  = "havoc";
+    stage_short = "havoc";
+    stage_max   = (doing_det ? HAVOC_CYCLES_INIT : HAVOC_CYCLES) *
+                  perf_score / havoc_div / 100;
 
-          }
+  } else {
 
-        /* Values 15 and 16 can be selected only if there are any extras
-           present in the dictionaries. */
+    static u8 tmp[32];
 
-        case 15: {
+    perf_score = orig_perf;
 
-            /* Overwrite bytes with an extra. */
+    sprintf(tmp, "splice %u", splice_cycle);
+    stage_name  = tmp;
+    stage_short = "splice";
+    stage_max   = SPLICE_HAVOC * perf_score / havoc_div / 100;
 
-            if (!extras_cnt || (a_extras_cnt && UR(2))) {
+  }
 
-              /* No user-specified extras or odds in our favor. Let's use an
-                 auto-detected one. */
+  if (stage_max < HAVOC_MIN) stage_max = HAVOC_MIN;
 
-              u32 use_extra = UR(a_extras_cnt);
-              u32 extra_len = a_extras[use_extra].len;
-              u32 insert_at;
+  temp_len = len;
 
-              if (extra_len > temp_len) break;
+  orig_hit_cnt = queued_paths + unique_crashes;
 
-              insert_at = UR(temp_len - extra_len + 1);
-              memcpy(out_buf + insert_at, a_extras[use_extra].data, extra_len);
+  havoc_queued = queued_paths;
 
-            } else {
+  /* We essentially just do several thousand runs (depending on perf_score)
+     where we take the input file and make random stacked tweaks. The loop
+     is double-buffered: while the target is busy with mutation k, mutation
+     k + 1 is cooked into next_buf, so the child's runtime overlaps with
+     our own mutation work instead of being spent blocking in waitpid(). */
 
-              /* No auto extras or odds in our favor. Use the dictionary. */
+  next_buf = ck_scratch_get(&sc_next, len);
+  memcpy(next_buf, in_buf, len);
+  next_len = len;
+  next_buf = havoc_mutate(&sc_next, &next_len);
 
-              u32 use_extra = UR(extras_cnt);
-              u32 extra_len = extras[use_extra].len;
-              u32 insert_at;
+  /* Adopt mutation zero up front, so that the first execution runs it
+     rather than the unmutated input; from then on, the bottom-of-loop
+     swap keeps the pipeline exactly one mutation ahead. */
 
-              if (extra_len > temp_len) break;
+  {
 
-              insert_at = UR(temp_len - extra_len + 1);
-              memcpy(out_buf + insert_at, extras[use_extra].data, extra_len);
+    u8* adopt_buf = out_buf;
 
-            }
+    SWAP_SCRATCH(sc_out, sc_next);
 
-            break;
+    out_buf  = next_buf;
+    next_buf = adopt_buf;
+    temp_len = next_len;
 
-          }
+  }
 
-        case 16: {
+  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
 
-            u32 use_extra, extra_len, insert_at = UR(temp_len + 1);
-            u8* new_buf;
+    u8* use_buf;
+    u32 use_len;
+    u8  fault, skip_exec = 0;
+    s32 live_val, cooked_val;
 
-            /* Insert an extra. Do the same dice-rolling stuff as for the
-               previous case. */
+    use_buf = out_buf;
+    use_len = temp_len;
 
-            if (!extras_cnt || (a_extras_cnt && UR(2))) {
+    if (post_handler) {
 
-              use_extra = UR(a_extras_cnt);
-              extra_len = a_extras[use_extra].len;
+      use_buf = post_handler(use_buf, &use_len);
+      if (!use_buf || !use_len) skip_exec = 1;
 
-              if (temp_len + extra_len >= MAX_FILE) break;
+    }
 
-              new_buf = ck_alloc_nozero(temp_len + extra_len);
+    if (!skip_exec) {
 
-              /* Head */
-              memcpy(new_buf, out_buf, insert_at);
+      write_to_testcase(use_buf, use_len);
 
-              /* Inserted part */
-              memcpy(new_buf + insert_at, a_extras[use_extra].data, extra_len);
+      if (run_target_start(argv, exec_tmout)) skip_exec = 2;
 
-            } else {
+    }
 
-              use_extra = UR(extras_cnt);
-              extra_len = extras[use_extra].len;
+    /* Overlap: cook the next mutation while the child is running. This
+       mirrors the out_buf restore that used to happen at the bottom of
+       the loop. havoc_mutate() clobbers stage_cur_val with the new
+       stacking count, so hold on to the in-flight one: describe_op()
+       needs it for the rep: field if this execution turns up a find. */
 
-              if (temp_len + extra_len >= MAX_FILE) break;
+    live_val = stage_cur_val;
 
-              new_buf = ck_alloc_nozero(temp_len + extra_len);
+    next_buf = ck_scratch_get(&sc_next, len);
+    memcpy(next_buf, in_buf, len);
+    next_len = len;
+    next_buf = havoc_mutate(&sc_next, &next_len);
 
-              /* Head */
-              memcpy(new_buf, out_buf, insert_at);
+    cooked_val    = stage_cur_val;
+    stage_cur_val = live_val;
 
-              /* Inserted part */
-              memcpy(new_buf + insert_at, extras[use_extra].data, extra_len);
+    if (skip_exec == 2) goto abandon_entry;
 
-            }
+    if (!skip_exec) {
 
-            /* Tail */
-            memcpy(new_buf + insert_at + extra_len, out_buf + insert_at,
-                   temp_len - insert_at);
+      fault = run_target_finish(exec_tmout);
 
-            ck_free(out_buf);
-            out_buf   = new_buf;
-            temp_len += extra_len;
+      if (common_post_exec(argv, use_buf, use_len, fault))
+        goto abandon_entry;
 
-            break;
+    }
 
-          }
+    /* The pre-cooked mutation goes in flight next. */
 
-      }
+    stage_cur_val = cooked_val;
 
-    }
+    /* Adopt the pre-cooked mutation for the next round. */
 
-    if (common_fuzz_stuff(argv, out_buf, temp_len))
-      goto abandon_entry;
+    SWAP_SCRATCH(sc_out, sc_next);
 
-    /* out_buf might have been mangled a bit, so let's restore it to its
-       original size and shape. */
+    use_buf  = out_buf;
+    out_buf  = next_buf;
+    next_buf = use_buf;
 
-    if (temp_len < len) out_buf = ck_realloc(out_buf, len);
-    temp_len = len;
-    memcpy(out_buf, in_buf, len);
+    use_len  = next_len;
+    next_len = temp_len;
+    temp_len = use_len;
 
     /* If we're finding new stuff, let's run for a bit longer, limits
        permitting. */
@@ -6595,7 +9011,6 @@ retry_splicing:
        up... */
 
     if (in_buf != orig_in) {
-      ck_free(in_buf);
       in_buf = orig_in;
       len = queue_cur->len;
     }
@@ -6621,15 +9036,9 @@ retry_splicing:
 
     /* Read the testcase into a new buffer. */
 
-    fd = open(target->fname, O_RDONLY);
-
-    if (fd < 0) PFATAL("Unable to open '%s'", target->fname);
-
-    new_buf = ck_alloc_nozero(target->len);
-
-    ck_read(fd, new_buf, target->len, target->fname);
+    new_buf = ck_scratch_get(&sc_splice, target->len);
 
-    close(fd);
+    memcpy(new_buf, queue_cache_fetch(target), target->len);
 
     /* Find a suitable splicing location, somewhere between the first and
        the last differing byte. Bail out if the difference is just a single
@@ -6637,67 +9046,215 @@ retry_splicing:
 
     locate_diffs(in_buf, new_buf, MIN(len, target->len), &f_diff, &l_diff);
 
-    if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) {
-      ck_free(new_buf);
-      goto retry_splicing;
-    }
+    if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) goto retry_splicing;
 
     /* Split somewhere between the first and last differing byte. */
 
     split_at = f_diff + UR(l_diff - f_diff);
 
-    /* Do the thing. */
+    /* Do the thing. */
+
+    len = target->len;
+    memcpy(new_buf, in_buf, split_at);
+    in_buf = new_buf;
+
+    out_buf = ck_scratch_get(&sc_out, len);
+    memcpy(out_buf, in_buf, len);
+
+    goto havoc_stage;
+
+  }
+
+#endif /* !IGNORE_FINDS */
+
+  ret_val = 0;
+
+abandon_entry:
+
+  splicing_with = -1;
+
+  /* Update pending_not_fuzzed count if we made it through the calibration
+     cycle and have not seen this entry before. */
+
+  if (!stop_soon && !queue_cur->cal_failed && !queue_cur->was_fuzzed) {
+    queue_cur->was_fuzzed = 1;
+    pending_not_fuzzed--;
+    if (queue_cur->favored) pending_favored--;
+  }
+
+  if (!stop_soon && !queue_cur->cal_failed) queue_cur->fuzz_level++;
+
+  return ret_val;
+
+#undef FLIP_BIT
+
+}
+
+
+/* Grab interesting test cases from other fuzzers. */
+
+/* Import new finds published in the sync ring. Much cheaper than the
+   directory walk in sync_fuzzers(): we only look at records appended since
+   our last visit, and skip anything whose checksum is already in our
+   queue without executing it. */
+
+static void sync_ring_consume(char** argv) {
+
+  static u8  party_tmp[64];
+  static u32 stall_pos;
+  static u8  stall_cnt;
+
+  u32 head = sync_ring->head;
+
+  if (sync_ring_pos == head) return;
+
+  /* If the ring lapped us, skip ahead to the oldest surviving record. */
+
+  if (head - sync_ring_pos > sync_ring->slots)
+    sync_ring_pos = head - sync_ring->slots;
+
+  stage_name = "sync ring";
+  stage_cur  = 0;
+  stage_max  = head - sync_ring_pos;
+
+  while (sync_ring_pos != head) {
+
+    struct sync_ring_rec* rec =
+      (struct sync_ring_rec*)(sync_ring + 1) +
+      (sync_ring_pos & (sync_ring->slots - 1));
+
+    u8  rpath[SYNC_RING_PATH];
+    u32 rcksum, plen;
+    u8  *path;
+    s32 fd;
+    struct stat st;
+
+    /* Not fully published yet? Come back on the next sync cycle. A slot
+       normally gets stamped microseconds after it is claimed, so if the
+       same one is still blank after several visits, its publisher must
+       have died mid-write; step over it instead of letting one dead
+       instance wedge ring imports for good. */
+
+    if (rec->seq != sync_ring_pos + 1) {
+
+      if (stall_pos != sync_ring_pos) {
+        stall_pos = sync_ring_pos;
+        stall_cnt = 0;
+      }
+
+      if (++stall_cnt <= SYNC_RING_STALL_LIMIT) break;
+
+      WARNF("Skipping dead sync ring slot %u (publisher crashed?)",
+            sync_ring_pos);
+
+      stall_cnt = 0;
+      sync_ring_pos++;
+      continue;
+
+    }
+
+    memcpy(rpath, (u8*)rec->path, SYNC_RING_PATH);
+    rcksum = rec->cksum;
+
+    /* If a fast producer overwrote the slot while we were copying, the
+       seq stamp will have moved on; drop the torn record. */
+
+    MEM_BARRIER();
+
+    if (rec->seq != sync_ring_pos + 1) {
+      sync_ring_pos++;
+      continue;
+    }
+
+    sync_ring_pos++;
+    stage_cur++;
+
+    rpath[SYNC_RING_PATH - 1] = 0;
+
+    /* Skip our own records... */
+
+    if (!strncmp(rpath, sync_id, strlen(sync_id)) &&
+        rpath[strlen(sync_id)] == '/') continue;
+
+    /* ...and those whose trace we evidently already have. */
+
+    if (cksum_set_has(rcksum)) continue;
+
+    path = alloc_printf("%s/%s", sync_dir, rpath);
+
+    /* Allow this to fail in case the publisher is winding down, etc. */
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+      ck_free(path);
+      continue;
+    }
+
+    if (fstat(fd, &st)) PFATAL("fstat() failed");
 
-    len = target->len;
-    memcpy(new_buf, in_buf, split_at);
-    in_buf = new_buf;
+    if (st.st_size && st.st_size <= MAX_FILE) {
 
-    ck_free(out_buf);
-    out_buf = ck_alloc_nozero(len);
-    memcpy(out_buf, in_buf, len);
+      u8  fault;
+      u8* mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    goto havoc_stage;
+      if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
 
-  }
+      write_to_testcase(mem, st.st_size);
 
-#endif /* !IGNORE_FINDS */
+      fault = run_target(argv, exec_tmout);
 
-  ret_val = 0;
+      if (stop_soon) {
+        close(fd);
+        ck_free(path);
+        return;
+      }
 
-abandon_entry:
+      for (plen = 0; rpath[plen] && rpath[plen] != '/' &&
+           plen < sizeof(party_tmp) - 1; plen++)
+        party_tmp[plen] = rpath[plen];
 
-  splicing_with = -1;
+      party_tmp[plen] = 0;
 
-  /* Update pending_not_fuzzed count if we made it through the calibration
-     cycle and have not seen this entry before. */
+      syncing_party = party_tmp;
+      queued_imported += save_if_interesting(argv, mem, st.st_size, fault);
+      syncing_party = 0;
 
-  if (!stop_soon && !queue_cur->cal_failed && !queue_cur->was_fuzzed) {
-    queue_cur->was_fuzzed = 1;
-    pending_not_fuzzed--;
-    if (queue_cur->favored) pending_favored--;
-  }
+      munmap(mem, st.st_size);
 
-  munmap(orig_in, queue_cur->len);
+      if (!(stage_cur % stats_update_freq)) show_stats();
 
-  if (in_buf != orig_in) ck_free(in_buf);
-  ck_free(out_buf);
-  ck_free(eff_map);
+    }
 
-  return ret_val;
+    ck_free(path);
+    close(fd);
 
-#undef FLIP_BIT
+  }
 
 }
 
 
-/* Grab interesting test cases from other fuzzers. */
-
 static void sync_fuzzers(char** argv) {
 
   DIR* sd;
   struct dirent* sd_ent;
   u32 sync_cnt = 0;
 
+  /* With the sync ring up, only the very first sync does the classic
+     directory walk (to pick up anything that predates us); after that,
+     everything goes through sync_ring_consume(). */
+
+  if (sync_ring) {
+
+    if (sync_ring_primed) {
+      sync_ring_consume(argv);
+      return;
+    }
+
+    sync_ring_primed = 1;
+
+  }
+
   sd = opendir(sync_dir);
   if (!sd) PFATAL("Unable to open '%s'", sync_dir);
 
@@ -6828,6 +9385,141 @@ static void sync_fuzzers(char** argv) {
 }
 
 
+/* Poll the broker for finds published by other instances; the mirror
+   image of net_sync_publish(). Imports are filtered twice before costing
+   an execution: frames whose cksum we already have are dropped outright,
+   and the coverage summary is checked against virgin_bits - if every
+   byte the sender touched is already fully explored here, the entry
+   cannot yield new bits and is skipped, too. */
+
+static void net_sync_pull(char** argv) {
+
+  if (net_sync_fd < 0) {
+
+    /* Try to quietly re-establish a dropped broker connection. */
+
+    if (get_cur_time() < net_retry_at) return;
+
+    net_sync_fd = net_sync_connect();
+
+    if (net_sync_fd < 0) {
+      net_retry_at = get_cur_time() + NET_SYNC_RETRY * 1000;
+      return;
+    }
+
+  }
+
+  if (!net_in_buf)
+    net_in_buf = ck_alloc_nozero(sizeof(struct net_sync_msg) +
+                                 (map_size >> 3) + MAX_FILE);
+
+  while (1) {
+
+    struct net_sync_msg* msg = (struct net_sync_msg*)net_in_buf;
+
+    u32 want = sizeof(struct net_sync_msg), i;
+    u8  *summary, *data;
+    u8  fault, worth;
+    s32 res;
+
+    /* Figure out how many bytes the frame at hand needs; until the header
+       is complete, that is just the header itself. */
+
+    if (net_in_len >= sizeof(struct net_sync_msg)) {
+
+      if (msg->magic != NET_SYNC_MAGIC || msg->version != NET_SYNC_VERSION)
+        FATAL("Unexpected data from sync broker (non-afl peer?)");
+
+      if (msg->map_size != map_size)
+        FATAL("Sync peer uses a different map size (%u vs %u) - mixed "
+              "builds?", msg->map_size, map_size);
+
+      if (!msg->len || msg->len > MAX_FILE)
+        FATAL("Sync broker relayed a malformed frame");
+
+      want += (map_size >> 3) + msg->len;
+
+    }
+
+    if (net_in_len < want) {
+
+      res = recv(net_sync_fd, net_in_buf + net_in_len, want - net_in_len,
+                 MSG_DONTWAIT);
+
+      if (!res) { net_sync_drop(); return; }
+
+      if (res < 0) {
+
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+        net_sync_drop();
+        return;
+
+      }
+
+      net_in_len += res;
+      continue;
+
+    }
+
+    /* A complete frame. */
+
+    summary = net_in_buf + sizeof(struct net_sync_msg);
+    data    = summary + (map_size >> 3);
+
+    net_in_len = 0;
+
+    if (cksum_set_has(msg->cksum)) continue;
+
+    /* Remember the cksum either way, so that a rebroadcast of the same
+       path is dropped without another execution. */
+
+    cksum_set_add(msg->cksum);
+
+    worth = 0;
+
+    for (i = 0; i < (map_size >> 3) && !worth; i++) {
+
+      u8  s = summary[i];
+      u32 j;
+
+      if (!s) continue;
+
+      for (j = 0; j < 8; j++)
+        if ((s & (1 << j)) && virgin_bits[i * 8 + j]) { worth = 1; break; }
+
+    }
+
+    if (!worth) continue;
+
+    /* Still promising - run it locally and let save_if_interesting()
+       have the final word. */
+
+    stage_name = "net sync";
+    stage_cur  = 0;
+    stage_max  = 0;
+
+    write_to_testcase(data, msg->len);
+
+    fault = run_target(argv, exec_tmout);
+
+    if (stop_soon) return;
+
+    syncing_party = "net";
+    syncing_case  = net_import_cnt++;
+    net_syncing   = 1;
+
+    queued_imported += save_if_interesting(argv, data, msg->len, fault);
+
+    net_syncing   = 0;
+    syncing_party = 0;
+
+  }
+
+}
+
+
 /* Handle stop signal (Ctrl-C, etc). */
 
 static void handle_stop_sig(int sig) {
@@ -7031,6 +9723,11 @@ EXP_ST void check_binary(u8* fname) {
 
   }
 
+  if (shm_testcase_mode &&
+      !memmem(f_data, f_len, SHM_FUZZ_SIG, strlen(SHM_FUZZ_SIG) + 1))
+    FATAL("AFL_SHM_TESTCASE set, but the target was not built with "
+          "__AFL_FUZZ_TESTCASE_BUF (see llvm_mode/README.llvm)");
+
   if (munmap(f_data, f_len)) PFATAL("unmap() failed");
 
 }
@@ -7130,12 +9827,15 @@ static void usage(u8* argv0) {
 
        "  -d            - quick & dirty mode (skips deterministic steps)\n"
        "  -n            - fuzz without instrumentation (dumb mode)\n"
+       "  -p schedule   - power schedule: exploit (default), explore, fast,\n"
+       "                  coe, lin, quad (see docs/power_schedules.txt)\n"
        "  -x dir        - optional fuzzer dictionary (see README)\n\n"
 
        "Other stuff:\n\n"
 
        "  -T text       - text banner to show on the screen\n"
        "  -M / -S id    - distributed mode (see parallel_fuzzing.txt)\n"
+       "  -j workers    - multicore mode: fork this many cooperating workers\n"
        "  -C            - crash exploration mode (the peruvian rabbit thing)\n"
        "  -V            - show version number and exit\n\n"
        "  -b cpu_id     - bind the fuzzing process to the specified CPU core\n\n"
@@ -7149,6 +9849,58 @@ static void usage(u8* argv0) {
 }
 
 
+/* Map (creating it if necessary) the shared sync ring in sync_dir. */
+
+static void setup_sync_ring(void) {
+
+  u8* fn = alloc_printf("%s/.sync_ring", sync_dir);
+
+  u32 size = sizeof(struct sync_ring_hdr) +
+             SYNC_RING_SLOTS * sizeof(struct sync_ring_rec);
+
+  s32 fd = open(fn, O_RDWR | O_CREAT, 0600);
+
+  struct stat st;
+
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  /* Whoever gets here first sizes the file and stamps the header; flock()
+     keeps concurrent starters from racing us. */
+
+  if (flock(fd, LOCK_EX)) PFATAL("flock() failed");
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (!st.st_size && ftruncate(fd, size)) PFATAL("ftruncate() failed");
+
+  sync_ring = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (sync_ring == MAP_FAILED) PFATAL("mmap() failed");
+
+  if (!sync_ring->version) {
+
+    sync_ring->slots   = SYNC_RING_SLOTS;
+    sync_ring->version = SYNC_RING_VERSION;
+
+  } else if (sync_ring->version != SYNC_RING_VERSION ||
+             sync_ring->slots != SYNC_RING_SLOTS)
+
+    FATAL("Incompatible .sync_ring in '%s' (delete it and try again)",
+          sync_dir);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  /* Start consuming at the current head; the first sync cycle does one
+     classic directory scan to cover everything older than that. */
+
+  sync_ring_pos = sync_ring->head;
+
+  ck_free(fn);
+
+}
+
+
 /* Prepare output directories and fds. */
 
 EXP_ST void setup_dirs_fds(void) {
@@ -7161,6 +9913,8 @@ EXP_ST void setup_dirs_fds(void) {
   if (sync_id && mkdir(sync_dir, 0700) && errno != EEXIST)
       PFATAL("Unable to create '%s'", sync_dir);
 
+  if (shm_sync_mode) setup_sync_ring();
+
   if (mkdir(out_dir, 0700)) {
 
     if (errno != EEXIST) PFATAL("Unable to create '%s'", out_dir);
@@ -7221,6 +9975,12 @@ EXP_ST void setup_dirs_fds(void) {
   if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
+  /* Partial deterministic-stage progress, one checkpoint per entry. */
+
+  tmp = alloc_printf("%s/queue/.state/det_progress/", out_dir);
+  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
   /* Sync directory for keeping track of cooperating fuzzers. */
 
   if (sync_id) {
@@ -7269,6 +10029,29 @@ EXP_ST void setup_dirs_fds(void) {
                      "unique_hangs, max_depth, execs_per_sec\n");
                      /* ignore errors */
 
+  /* Live telemetry block, updated in place (see telemetry.h). */
+
+  tmp = alloc_printf("%s/telemetry", out_dir);
+  fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
+  if (ftruncate(fd, sizeof(struct afl_telemetry)))
+    PFATAL("ftruncate() failed");
+
+  telemetry = mmap(0, sizeof(struct afl_telemetry), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+
+  if (telemetry == MAP_FAILED) PFATAL("mmap() failed");
+
+  close(fd);
+
+  telemetry->magic      = TELEMETRY_MAGIC;
+  telemetry->version    = TELEMETRY_VERSION;
+  telemetry->fuzzer_pid = getpid();
+
+  strncpy(telemetry->banner, use_banner, TELEMETRY_BANNER - 1);
+
 }
 
 
@@ -7498,6 +10281,128 @@ static void get_core_count(void) {
 }
 
 
+/* Allocate the virgin bitmaps and other map-sized buffers. Called before
+   option parsing, since -B needs virgin_bits to be in place. This is also
+   where AFL_MAP_SIZE is picked up, as everything downstream depends on it.
+   In multicore mode, the maps are later moved to a shared region by
+   setup_multicore(). */
+
+EXP_ST void setup_virgin_maps(void) {
+
+  u8* map_size_str = getenv("AFL_MAP_SIZE");
+
+  if (map_size_str) {
+
+    map_size = atoi(map_size_str);
+
+    if (map_size < 64 || map_size > (1 << 24) ||
+        (map_size & (map_size - 1)))
+      FATAL("AFL_MAP_SIZE must be a power of two between 64 and 2^24");
+
+  }
+
+  virgin_bits  = ck_alloc(map_size);
+  virgin_tmout = ck_alloc(map_size);
+  virgin_crash = ck_alloc(map_size);
+
+  var_bytes    = ck_alloc(map_size);
+
+  top_rated    = ck_alloc(map_size * sizeof(struct queue_entry*));
+  tr_slots     = ck_alloc(map_size * sizeof(u32));
+
+}
+
+
+/* Helper for setup_multicore(): move one virgin bitmap into an anonymous
+   MAP_SHARED region that survives fork(). */
+
+static u8* share_virgin_map(u8* old) {
+
+  u8* mem = mmap(0, map_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (mem == MAP_FAILED) PFATAL("mmap() failed");
+
+  memcpy(mem, old, map_size);
+  ck_free(old);
+
+  return mem;
+
+}
+
+
+/* Set up multicore mode (-j): fork off one worker per requested core, with
+   all workers sharing the virgin bitmaps. Each worker then proceeds like a
+   regular -S instance (own SHM trace map, own forkserver, own queue subdir),
+   so the rest of the code needs no locking; the shared virgin maps mean that
+   a path claimed by one worker is instantly dead weight for all its siblings,
+   and sync_fuzzers() imports skip everything already seen globally.
+
+   Updates to the shared maps are intentionally not locked: bits are only
+   ever cleared, so a lost race costs at most one redundant queue entry. */
+
+static void setup_multicore(void) {
+
+  u32 i;
+
+  if (sync_id)   FATAL("-j and -S / -M are mutually exclusive");
+  if (dumb_mode) FATAL("-j and -n are mutually exclusive");
+
+  virgin_bits  = share_virgin_map(virgin_bits);
+  virgin_tmout = share_virgin_map(virgin_tmout);
+  virgin_crash = share_virgin_map(virgin_crash);
+
+  /* Initialize the shared maps once, before any worker exists; the
+     per-instance wipes in setup_shm() are skipped in -j mode. */
+
+  if (!in_bitmap) memset(virgin_bits, 255, map_size);
+
+  memset(virgin_tmout, 255, map_size);
+  memset(virgin_crash, 255, map_size);
+
+  for (i = 1; i < multicore_jobs; i++) {
+
+    s32 pid = fork();
+
+    if (pid < 0) PFATAL("fork() failed");
+
+    if (!pid) {
+
+      worker_id = i;
+
+      /* Leave the status screen to the lead worker... */
+
+      setenv("AFL_NO_UI", "1", 1);
+
+#ifdef __linux__
+
+      /* ...and don't outlive the process that spawned us. */
+
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+#endif /* __linux__ */
+
+      /* Stagger worker startup a bit so that bind_to_free_cpu() does not
+         race to claim the same core in every worker at once. */
+
+      usleep(100000 * i);
+
+      break;
+
+    }
+
+  }
+
+  sync_id = alloc_printf("worker%02u", worker_id);
+
+  /* The lead worker doubles as the master instance and handles the
+     deterministic stages; everybody else behaves like -S. */
+
+  if (!worker_id) force_deterministic = 1;
+
+}
+
+
 /* Validate and fix up out_dir and sync_dir when using -S. */
 
 static void fix_up_sync(void) {
@@ -7795,7 +10700,9 @@ int main(int argc, char** argv) {
   gettimeofday(&tv, &tz);
   srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
 
-  while ((opt = getopt(argc, argv, "+i:o:f:m:b:t:T:dnCB:S:M:x:QV")) > 0)
+  setup_virgin_maps();
+
+  while ((opt = getopt(argc, argv, "+i:o:f:m:b:t:T:j:p:dnCB:S:M:x:QV")) > 0)
 
     switch (opt) {
 
@@ -7921,6 +10828,27 @@ int main(int argc, char** argv) {
 
       }
 
+      case 'j': /* multicore mode */
+
+        if (multicore_jobs) FATAL("Multiple -j options not supported");
+
+        if (sscanf(optarg, "%u", &multicore_jobs) < 1 || multicore_jobs < 2 ||
+            multicore_jobs > 256) FATAL("Bad or out-of-range value for -j");
+
+        break;
+
+      case 'p': /* power schedule */
+
+        if (!strcmp(optarg, "exploit"))      schedule = SCHED_EXPLOIT;
+        else if (!strcmp(optarg, "explore")) schedule = SCHED_EXPLORE;
+        else if (!strcmp(optarg, "fast"))    schedule = SCHED_FAST;
+        else if (!strcmp(optarg, "coe"))     schedule = SCHED_COE;
+        else if (!strcmp(optarg, "lin"))     schedule = SCHED_LIN;
+        else if (!strcmp(optarg, "quad"))    schedule = SCHED_QUAD;
+        else FATAL("Unknown -p power schedule");
+
+        break;
+
       case 'd': /* skip deterministic */
 
         if (skip_deterministic) FATAL("Multiple -d options not supported");
@@ -7988,9 +10916,19 @@ int main(int argc, char** argv) {
 
   if (optind == argc || !in_dir || !out_dir) usage(argv[0]);
 
+  if (schedule != SCHED_EXPLOIT) {
+
+    if (dumb_mode) FATAL("-p schedules require instrumentation");
+
+    n_fuzz_tab = ck_alloc(N_FUZZ_SIZE * sizeof(u32));
+
+  }
+
   setup_signal_handlers();
   check_asan_opts();
 
+  if (multicore_jobs) setup_multicore();
+
   if (sync_id) fix_up_sync();
 
   if (!strcmp(in_dir, out_dir))
@@ -8009,11 +10947,63 @@ int main(int argc, char** argv) {
   if (getenv("AFL_SHUFFLE_QUEUE")) shuffle_queue    = 1;
   if (getenv("AFL_FAST_CAL"))      fast_cal         = 1;
 
+  if (getenv("AFL_SHM_TESTCASE")) {
+
+    if (dumb_mode) FATAL("AFL_SHM_TESTCASE requires an instrumented target");
+    if (qemu_mode) FATAL("AFL_SHM_TESTCASE is not supported in QEMU mode");
+
+    shm_testcase_mode = 1;
+
+  }
+
+  if (getenv("AFL_SHM_SYNC")) {
+
+    if (!sync_id) FATAL("AFL_SHM_SYNC makes sense only with -M / -S / -j");
+
+    shm_sync_mode = 1;
+
+  }
+
+  if (getenv("AFL_ASYNC_WRITE")) want_async_write = 1;
+
+  if (getenv("AFL_CRASH_TRIAGE")) {
+
+    if (dumb_mode)
+      FATAL("AFL_CRASH_TRIAGE and dumb mode (-n) are mutually exclusive");
+
+    if (crash_mode)
+      FATAL("AFL_CRASH_TRIAGE and crash exploration (-C) are mutually "
+            "exclusive");
+
+    crash_triage_mode = 1;
+
+  }
+
+  if (getenv("AFL_NET_SYNC")) {
+
+    net_sync_addr = getenv("AFL_NET_SYNC");
+    net_sync_mode = 1;
+
+    /* Connect right away; a typo'd address should be loud, while later
+       drops are retried quietly. */
+
+    net_sync_fd = net_sync_connect();
+
+    if (net_sync_fd < 0)
+      FATAL("Unable to connect to sync broker at %s", net_sync_addr);
+
+    OKF("Connected to sync broker at %s.", net_sync_addr);
+
+  }
+
   if (getenv("AFL_HANG_TMOUT")) {
     hang_tmout = atoi(getenv("AFL_HANG_TMOUT"));
     if (!hang_tmout) FATAL("Invalid value of AFL_HANG_TMOUT");
   }
 
+  if (getenv("AFL_CORPUS_CACHE_MB"))
+    qc_budget = (u64)atoi(getenv("AFL_CORPUS_CACHE_MB")) << 20;
+
   if (dumb_mode == 2 && no_forkserver)
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
 
@@ -8078,6 +11068,9 @@ int main(int argc, char** argv) {
   write_stats_file(0, 0, 0);
   save_auto();
 
+  setup_async_writer();
+  setup_crash_triage(use_argv);
+
   if (stop_soon) goto stop_fuzzing;
 
   /* Woop woop woop */
@@ -8133,12 +11126,14 @@ int main(int argc, char** argv) {
     skipped_fuzz = fuzz_one(use_argv);
 
     if (!stop_soon && sync_id && !skipped_fuzz) {
-      
+
       if (!(sync_interval_cnt++ % SYNC_INTERVAL))
         sync_fuzzers(use_argv);
 
     }
 
+    if (!stop_soon && net_sync_mode) net_sync_pull(use_argv);
+
     if (!stop_soon && exit_1) stop_soon = 2;
 
     if (stop_soon) break;
@@ -8167,6 +11162,9 @@ int main(int argc, char** argv) {
 
 stop_fuzzing:
 
+  stop_async_writer();
+  stop_crash_triage();
+
   SAYF(CURSOR_SHOW cLRD "\n\n+++ Testing aborted %s +++\n" cRST,
        stop_soon == 2 ? "programmatically" : "by user");
 
@@ -8186,6 +11184,12 @@ stop_fuzzing:
   ck_free(target_path);
   ck_free(sync_id);
 
+  /* In multicore mode, the lead worker hangs around until its siblings are
+     done winding down, so that the shell prompt comes back clean. */
+
+  if (multicore_jobs && !worker_id)
+    while (wait(NULL) > 0);
+
   alloc_report();
 
   OKF("We're done here. Have a nice day!\n");
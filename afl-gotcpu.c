@@ -122,6 +122,88 @@ repeat_loop:
 }
 
 
+/* Upper bound used for the topology tables, matching the assumption made
+   by bind_to_free_cpu() in afl-fuzz. */
+
+#define MAX_CPUS 4096
+
+#ifdef HAVE_AFFINITY
+
+static s32 cpu_node[MAX_CPUS];        /* NUMA node of each CPU            */
+static s32 cpu_pair[MAX_CPUS];        /* Lowest sibling hardware thread   */
+static s32 child_pid[MAX_CPUS];       /* Per-CPU measurement child        */
+static u8  cpu_stat[MAX_CPUS];        /* Verdict: 0 free, 1 iffy, 2 busy  */
+
+
+/* Read the NUMA and SMT topology from /sys; same approach as afl-fuzz.
+   Returns the number of nodes (1 if the files are absent). */
+
+static u32 read_cpu_topology(u32 cnt) {
+
+  u32 i, node;
+
+  for (i = 0; i < cnt; i++) {
+    cpu_node[i] = 0;
+    cpu_pair[i] = i;
+  }
+
+  for (node = 0; node < cnt; node++) {
+
+    u8 fn[256], tmp[4096];
+    FILE* f;
+    u8* tok;
+
+    sprintf(fn, "/sys/devices/system/node/node%u/cpulist", node);
+
+    if (!(f = fopen(fn, "r"))) break;
+
+    if (fgets(tmp, sizeof(tmp), f)) {
+
+      tok = (u8*)strtok((char*)tmp, ",");
+
+      while (tok) {
+
+        u32 lo, hi;
+
+        if (sscanf((char*)tok, "%u-%u", &lo, &hi) == 1) hi = lo;
+
+        for (; lo <= hi && lo < cnt; lo++) cpu_node[lo] = node;
+
+        tok = (u8*)strtok(NULL, ",");
+
+      }
+
+    }
+
+    fclose(f);
+
+  }
+
+  for (i = 0; i < cnt; i++) {
+
+    u8 fn[256], tmp[4096];
+    FILE* f;
+    u32 first;
+
+    sprintf(fn, "/sys/devices/system/cpu/cpu%u/topology/"
+                "thread_siblings_list", i);
+
+    if (!(f = fopen(fn, "r"))) continue;
+
+    if (fgets(tmp, sizeof(tmp), f) && sscanf(tmp, "%u", &first) == 1 &&
+        first < cnt) cpu_pair[i] = first;
+
+    fclose(f);
+
+  }
+
+  return node ? node : 1;
+
+}
+
+#endif /* HAVE_AFFINITY */
+
+
 /* Do the benchmark thing. */
 
 int main(int argc, char** argv) {
@@ -129,7 +211,11 @@ int main(int argc, char** argv) {
 #ifdef HAVE_AFFINITY
 
   u32 cpu_cnt = sysconf(_SC_NPROCESSORS_ONLN),
-      idle_cpus = 0, maybe_cpus = 0, i;
+      idle_cpus = 0, maybe_cpus = 0, n_nodes, i;
+
+  if (cpu_cnt > MAX_CPUS) cpu_cnt = MAX_CPUS;
+
+  n_nodes = read_cpu_topology(cpu_cnt);
 
   SAYF(cCYA "afl-gotcpu " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
 
@@ -142,6 +228,8 @@ int main(int argc, char** argv) {
 
     if (fr < 0) PFATAL("fork failed");
 
+    child_pid[i] = fr;
+
     if (!fr) {
 
       cpu_set_t c;
@@ -178,13 +266,57 @@ int main(int argc, char** argv) {
   for (i = 0; i < cpu_cnt; i++) {
 
     int ret;
-    if (waitpid(-1, &ret, 0) < 0) PFATAL("waitpid failed");
+    if (waitpid(child_pid[i], &ret, 0) < 0) PFATAL("waitpid failed");
+
+    cpu_stat[i] = WEXITSTATUS(ret);
 
     if (WEXITSTATUS(ret) == 0) idle_cpus++;
     if (WEXITSTATUS(ret) <= 1) maybe_cpus++;
 
   }
 
+  /* On NUMA or SMT systems, break the verdict down per node, counting
+     physical cores with every hardware thread available - the spots
+     where afl-fuzz can claim a whole hyperthread pair for itself and
+     its fork server. */
+
+  if (n_nodes > 1 || cpu_pair[cpu_cnt - 1] != (s32)(cpu_cnt - 1)) {
+
+    u32 node;
+
+    SAYF(cGRA "\n");
+
+    for (node = 0; node < n_nodes; node++) {
+
+      u32 cpus = 0, free_cpus = 0, cores = 0, free_cores = 0, j;
+
+      for (i = 0; i < cpu_cnt; i++) {
+
+        u8 all_free = 1;
+
+        if (cpu_node[i] != (s32)node) continue;
+
+        cpus++;
+        if (!cpu_stat[i]) free_cpus++;
+
+        if (cpu_pair[i] != (s32)i) continue;  /* Not a pair leader. */
+
+        cores++;
+
+        for (j = 0; j < cpu_cnt; j++)
+          if (cpu_pair[j] == (s32)i && cpu_stat[j]) { all_free = 0; break; }
+
+        if (all_free) free_cores++;
+
+      }
+
+      SAYF("    Node #%u: %u of %u CPUs available, %u of %u physical cores"
+           " fully free\n", node, free_cpus, cpus, free_cores, cores);
+
+    }
+
+  }
+
   SAYF(cGRA "\n>>> ");
 
   if (idle_cpus) {
@@ -0,0 +1,541 @@
+/*
+  Copyright 2016 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - network sync broker
+   ----------------------------------------
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+
+   A small relay for campaigns that span multiple machines without a
+   shared filesystem. afl-fuzz instances started with AFL_NET_SYNC
+   connect here and stream their new queue entries (see netsync.h for
+   the wire format); the broker forwards every frame to all other
+   connected instances, dropping exact duplicates by exec cksum along
+   the way.
+
+   Frames are also kept in an in-memory backlog (up to NET_SYNC_BACKLOG
+   bytes) that is replayed to instances joining mid-campaign, so a
+   late-started box still inherits the corpus collected so far. Slow
+   consumers are never waited for: like with the AFL_SHM_SYNC ring, a
+   client that falls behind a full backlog simply skips ahead and loses
+   the oldest entries.
+
+   Usage: afl-netsync [ listen_port ]
+
+   The default port is 24698. The broker holds no on-disk state, so it
+   can be restarted at will; clients reconnect on their own.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "netsync.h"
+
+/* Frames live in a singly-linked replay log; the payload follows the
+   struct directly, sync-ring style. */
+
+struct ns_frame {
+
+  struct ns_frame* next;              /* Next (newer) frame, if any       */
+  u32 origin;                         /* Client id of the sender          */
+  u32 size;                           /* Total frame bytes                */
+
+};
+
+struct ns_client {
+
+  s32 fd;                             /* Socket, or -1 for a free slot    */
+  u32 id;                             /* Unique id, for origin checks     */
+
+  u8* in_buf;                         /* Frame reassembly buffer          */
+  u32 in_len,                         /* Bytes reassembled so far         */
+      in_size;                        /* Allocated size of in_buf         */
+
+  struct ns_frame* out_frame;         /* Next frame to relay, if any      */
+  u32 out_off;                        /* Bytes of it already sent         */
+
+};
+
+static struct ns_client clients[NET_SYNC_CLIENTS];
+
+static u32 next_client_id = 1;        /* Never reused, unlike slots       */
+
+static struct ns_frame *log_head,     /* Oldest backlog frame             */
+                       *log_tail;     /* Newest backlog frame             */
+
+static u64 log_bytes;                 /* Bytes currently in the backlog   */
+
+static u32 frames_in,                 /* Frames accepted so far           */
+           frames_dup;                /* Frames dropped as duplicates     */
+
+/* Checksums of every frame seen so far, in the same open-addressing hash
+   set afl-fuzz uses for its queue. */
+
+static u32 *cksum_set;                /* Hash set of frame checksums      */
+static u32 cksum_set_size,            /* Allocated slots (power of two)   */
+           cksum_set_used;            /* Populated slots                  */
+
+
+static u8 cksum_set_insert(u32 ck) {
+
+  u32 idx = ck & (cksum_set_size - 1);
+
+  while (cksum_set[idx]) {
+
+    if (cksum_set[idx] == ck) return 0;
+    idx = (idx + 1) & (cksum_set_size - 1);
+
+  }
+
+  cksum_set[idx] = ck;
+  return 1;
+
+}
+
+
+/* Add a checksum to the set, growing it once half full. */
+
+static void cksum_set_add(u32 ck) {
+
+  if (!ck) return;
+
+  if (!cksum_set) {
+
+    cksum_set_size = 1 << 16;
+    cksum_set = ck_alloc(cksum_set_size * sizeof(u32));
+
+  }
+
+  if (!cksum_set_insert(ck)) return;
+
+  if (++cksum_set_used > cksum_set_size / 2) {
+
+    u32* old_set  = cksum_set;
+    u32  old_size = cksum_set_size, i;
+
+    cksum_set_size <<= 1;
+    cksum_set = ck_alloc(cksum_set_size * sizeof(u32));
+
+    for (i = 0; i < old_size; i++)
+      if (old_set[i]) cksum_set_insert(old_set[i]);
+
+    ck_free(old_set);
+
+  }
+
+}
+
+
+static u8 cksum_set_has(u32 ck) {
+
+  u32 idx;
+
+  if (!cksum_set || !ck) return 0;
+
+  idx = ck & (cksum_set_size - 1);
+
+  while (cksum_set[idx]) {
+
+    if (cksum_set[idx] == ck) return 1;
+    idx = (idx + 1) & (cksum_set_size - 1);
+
+  }
+
+  return 0;
+
+}
+
+
+/* Close a client connection and free its slot. */
+
+static void client_drop(struct ns_client* c, u8* why) {
+
+  WARNF("Instance #%u dropped (%s).", c->id, why);
+
+  close(c->fd);
+  ck_free(c->in_buf);
+
+  c->fd        = -1;
+  c->in_buf    = 0;
+  c->in_len    = c->in_size = 0;
+  c->out_frame = 0;
+
+}
+
+
+/* Append a complete frame to the replay log, queue it to every other
+   client, and evict the oldest backlog entries once over budget. */
+
+static void log_append(u32 origin, const u8* data, u32 size) {
+
+  struct ns_frame* f = ck_alloc_nozero(sizeof(struct ns_frame) + size);
+  u32 i;
+
+  f->next   = 0;
+  f->origin = origin;
+  f->size   = size;
+
+  memcpy(f + 1, data, size);
+
+  if (log_tail) log_tail->next = f; else log_head = f;
+  log_tail = f;
+
+  log_bytes += size;
+
+  for (i = 0; i < NET_SYNC_CLIENTS; i++)
+    if (clients[i].fd >= 0 && clients[i].id != origin &&
+        !clients[i].out_frame) {
+
+      clients[i].out_frame = f;
+      clients[i].out_off   = 0;
+
+    }
+
+  while (log_bytes > NET_SYNC_BACKLOG && log_head != log_tail) {
+
+    struct ns_frame* v = log_head;
+
+    /* A client still pointing at the evicted frame is lapped and skips
+       ahead, same as with the shm sync ring - but only at a frame
+       boundary. If part of the frame is already on the wire, skipping
+       would splice the next frame onto a truncated one, and TCP has no
+       seq stamps to resync on; drop the client instead so it reconnects
+       with a clean stream. */
+
+    for (i = 0; i < NET_SYNC_CLIENTS; i++) {
+
+      if (clients[i].fd < 0 || clients[i].out_frame != v) continue;
+
+      if (clients[i].out_off) {
+
+        client_drop(&clients[i], "lapped mid-frame");
+        continue;
+
+      }
+
+      clients[i].out_frame = v->next;
+
+    }
+
+    log_head   = v->next;
+    log_bytes -= v->size;
+
+    ck_free(v);
+
+  }
+
+}
+
+
+/* Pull whatever the client has for us, relaying every completed frame.
+   Mirrors the reassembly loop in afl-fuzz's net_sync_pull(). */
+
+static void client_read(struct ns_client* c) {
+
+  while (1) {
+
+    struct net_sync_msg* msg = (struct net_sync_msg*)c->in_buf;
+
+    u32 want = sizeof(struct net_sync_msg);
+    s32 res;
+
+    if (c->in_size < want) {
+
+      c->in_size = 4096;
+      c->in_buf  = ck_alloc_nozero(c->in_size);
+
+    }
+
+    if (c->in_len >= sizeof(struct net_sync_msg)) {
+
+      /* Be merciless about framing errors; a desynced byte stream would
+         poison every other instance. */
+
+      if (msg->magic != NET_SYNC_MAGIC || msg->version != NET_SYNC_VERSION ||
+          !msg->len || msg->len > MAX_FILE ||
+          !msg->map_size || (msg->map_size & 7) ||
+          msg->map_size > (1 << 26)) {
+
+        client_drop(c, "protocol error");
+        return;
+
+      }
+
+      want += (msg->map_size >> 3) + msg->len;
+
+      if (want > c->in_size) {
+
+        c->in_size = want;
+        c->in_buf  = ck_realloc(c->in_buf, want);
+
+      }
+
+    }
+
+    if (c->in_len < want) {
+
+      res = recv(c->fd, c->in_buf + c->in_len, want - c->in_len,
+                 MSG_DONTWAIT);
+
+      if (!res) { client_drop(c, "disconnected"); return; }
+
+      if (res < 0) {
+
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+        client_drop(c, "read failed");
+        return;
+
+      }
+
+      c->in_len += res;
+      continue;
+
+    }
+
+    /* A complete frame; relay it unless we have seen the path before. */
+
+    c->in_len = 0;
+
+    if (cksum_set_has(((struct net_sync_msg*)c->in_buf)->cksum)) {
+      frames_dup++;
+      continue;
+    }
+
+    cksum_set_add(((struct net_sync_msg*)c->in_buf)->cksum);
+    frames_in++;
+
+    log_append(c->id, c->in_buf, want);
+
+  }
+
+}
+
+
+/* Push pending backlog to the client, as much as the socket will take
+   without blocking. */
+
+static void client_write(struct ns_client* c) {
+
+  while (c->out_frame) {
+
+    struct ns_frame* f = c->out_frame;
+    s32 res;
+
+    /* Never echo a client's own frames back at it. */
+
+    if (f->origin == c->id) {
+
+      c->out_frame = f->next;
+      c->out_off   = 0;
+      continue;
+
+    }
+
+    res = send(c->fd, (u8*)(f + 1) + c->out_off, f->size - c->out_off,
+               MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (res < 0) {
+
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+      client_drop(c, "send failed");
+      return;
+
+    }
+
+    c->out_off += res;
+
+    if (c->out_off == f->size) {
+
+      c->out_frame = f->next;
+      c->out_off   = 0;
+
+    }
+
+  }
+
+}
+
+
+/* Accept a new connection and start it off with the full backlog. */
+
+static void client_accept(s32 listen_fd) {
+
+  struct sockaddr_storage sa;
+  socklen_t sa_len = sizeof(sa);
+  u8 host[64] = "?";
+  int on = 1;
+  u32 i;
+
+  s32 fd = accept(listen_fd, (struct sockaddr*)&sa, &sa_len);
+
+  if (fd < 0) return;
+
+  for (i = 0; i < NET_SYNC_CLIENTS; i++)
+    if (clients[i].fd < 0) break;
+
+  if (i == NET_SYNC_CLIENTS) {
+
+    WARNF("Turning away a connection - all %u slots taken.",
+          NET_SYNC_CLIENTS);
+    close(fd);
+    return;
+
+  }
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  getnameinfo((struct sockaddr*)&sa, sa_len, (char*)host, sizeof(host),
+              0, 0, NI_NUMERICHOST);
+
+  clients[i].fd        = fd;
+  clients[i].id        = next_client_id++;
+  clients[i].in_len    = 0;
+  clients[i].out_frame = log_head;
+  clients[i].out_off   = 0;
+
+  ACTF("Instance #%u connected from %s (%llu MB of backlog to replay).",
+       clients[i].id, host, log_bytes >> 20);
+
+}
+
+
+/* Handle Ctrl-C and the like: print a parting summary. */
+
+static void handle_stop_sig(int sig) {
+
+  SAYF(cGRA "\n>>> " cRST "Relayed %u unique frames, dropped %u duplicates; "
+       "%llu MB in the backlog." cGRA " <<<" cRST "\n\n",
+       frames_in, frames_dup, log_bytes >> 20);
+
+  exit(0);
+
+}
+
+
+int main(int argc, char** argv) {
+
+  u32 port = NET_SYNC_PORT, i;
+  s32 listen_fd;
+  int on = 1;
+  struct sockaddr_in sin;
+
+  SAYF(cCYA "afl-netsync " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
+
+  if (argc > 2 || (argc == 2 && !(port = atoi(argv[1])))) {
+
+    SAYF("\nUsage: %s [ listen_port ]\n\n"
+         "Relays new queue entries between afl-fuzz instances started\n"
+         "with AFL_NET_SYNC=host:port. The default port is %u.\n\n",
+         argv[0], NET_SYNC_PORT);
+
+    exit(1);
+
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, handle_stop_sig);
+  signal(SIGTERM, handle_stop_sig);
+
+  for (i = 0; i < NET_SYNC_CLIENTS; i++) clients[i].fd = -1;
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (listen_fd < 0) PFATAL("socket() failed");
+
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family      = AF_INET;
+  sin.sin_port        = htons(port);
+  sin.sin_addr.s_addr = INADDR_ANY;
+
+  if (bind(listen_fd, (struct sockaddr*)&sin, sizeof(sin)))
+    PFATAL("Unable to bind to port %u", port);
+
+  if (listen(listen_fd, 16)) PFATAL("listen() failed");
+
+  OKF("Waiting for afl-fuzz instances on port %u.", port);
+
+  while (1) {
+
+    fd_set rd, wr;
+    s32 max_fd = listen_fd;
+
+    FD_ZERO(&rd);
+    FD_ZERO(&wr);
+    FD_SET(listen_fd, &rd);
+
+    for (i = 0; i < NET_SYNC_CLIENTS; i++) {
+
+      if (clients[i].fd < 0) continue;
+
+      FD_SET(clients[i].fd, &rd);
+      if (clients[i].out_frame) FD_SET(clients[i].fd, &wr);
+
+      if (clients[i].fd > max_fd) max_fd = clients[i].fd;
+
+    }
+
+    if (select(max_fd + 1, &rd, &wr, 0, 0) < 0) {
+
+      if (errno == EINTR) continue;
+      PFATAL("select() failed");
+
+    }
+
+    if (FD_ISSET(listen_fd, &rd)) client_accept(listen_fd);
+
+    for (i = 0; i < NET_SYNC_CLIENTS; i++) {
+
+      if (clients[i].fd < 0) continue;
+
+      if (FD_ISSET(clients[i].fd, &wr)) client_write(&clients[i]);
+
+      if (clients[i].fd >= 0 && FD_ISSET(clients[i].fd, &rd))
+        client_read(&clients[i]);
+
+    }
+
+  }
+
+  /* Not reached. */
+
+  return 0;
+
+}
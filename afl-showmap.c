@@ -26,6 +26,11 @@
 
    Exit code is 2 if the target program crashes; 1 if it times out or
    there is a problem executing it; or 0 if execution is successful.
+
+   With -i dir, the tool instead starts the target once, through the fork
+   server, and streams every file in the directory through it, writing one
+   map per input into the output directory. This skips the execve() and
+   linker costs that dominate when tracing whole corpora.
 */
 
 #define AFL_MAIN
@@ -58,7 +63,9 @@ static s32 child_pid;                 /* PID of the tested program         */
 
 static u8* trace_bits;                /* SHM with instrumentation bitmap   */
 
-static u8 *out_file,                  /* Trace output file                 */
+static u8 *out_file,                  /* Trace output file (or dir)        */
+          *in_dir,                    /* Input directory (batch mode)      */
+          *prog_in,                   /* Temp file for batch mode input    */
           *doc_path,                  /* Path to docs                      */
           *target_path,               /* Path to target binary             */
           *at_file;                   /* Substitution string for @@        */
@@ -67,13 +74,19 @@ static u32 exec_tmout;                /* Exec timeout (ms)                 */
 
 static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
 
-static s32 shm_id;                    /* ID of the SHM region              */
+static s32 shm_id,                    /* ID of the SHM region              */
+           prog_in_fd = -1,           /* Persistent FD for prog_in         */
+           fsrv_ctl_fd,               /* Fork server control pipe (write)  */
+           fsrv_st_fd;                /* Fork server status pipe (read)    */
+
+static s32 forksrv_pid;               /* PID of the fork server            */
 
 static u8  quiet_mode,                /* Hide non-essential messages?      */
            edges_only,                /* Ignore hit counts?                */
            cmin_mode,                 /* Generate output in afl-cmin mode? */
            binary_mode,               /* Write output as a binary map      */
-           keep_cores;                /* Allow coredumps?                  */
+           keep_cores,                /* Allow coredumps?                  */
+           use_stdin = 1;             /* Use stdin for batch mode input?   */
 
 static volatile u8
            stop_soon,                 /* Ctrl-C pressed?                   */
@@ -138,6 +151,7 @@ static void classify_counts(u8* mem, const u8* map) {
 
 static void remove_shm(void) {
 
+  if (prog_in) unlink(prog_in); /* Ignore errors */
   shmctl(shm_id, IPC_RMID, NULL);
 
 }
@@ -167,9 +181,9 @@ static void setup_shm(void) {
 
 }
 
-/* Write results. */
+/* Write results to the given path. */
 
-static u32 write_results(void) {
+static u32 write_results_to(u8* path) {
 
   s32 fd;
   u32 i, ret = 0;
@@ -177,21 +191,21 @@ static u32 write_results(void) {
   u8  cco = !!getenv("AFL_CMIN_CRASHES_ONLY"),
       caa = !!getenv("AFL_CMIN_ALLOW_ANY");
 
-  if (!strncmp(out_file, "/dev/", 5)) {
+  if (!strncmp(path, "/dev/", 5)) {
 
-    fd = open(out_file, O_WRONLY, 0600);
-    if (fd < 0) PFATAL("Unable to open '%s'", out_file);
+    fd = open(path, O_WRONLY, 0600);
+    if (fd < 0) PFATAL("Unable to open '%s'", path);
 
-  } else if (!strcmp(out_file, "-")) {
+  } else if (!strcmp(path, "-")) {
 
     fd = dup(1);
     if (fd < 0) PFATAL("Unable to open stdout");
 
   } else {
 
-    unlink(out_file); /* Ignore errors */
-    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+    unlink(path); /* Ignore errors */
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", path);
 
   }
 
@@ -200,8 +214,8 @@ static u32 write_results(void) {
 
     for (i = 0; i < MAP_SIZE; i++)
       if (trace_bits[i]) ret++;
-    
-    ck_write(fd, trace_bits, MAP_SIZE, out_file);
+
+    ck_write(fd, trace_bits, MAP_SIZE, path);
     close(fd);
 
   } else {
@@ -240,7 +254,9 @@ static u32 write_results(void) {
 static void handle_timeout(int sig) {
 
   child_timed_out = 1;
+
   if (child_pid > 0) kill(child_pid, SIGKILL);
+  else if (child_pid == -1 && forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
 
 }
 
@@ -360,6 +376,301 @@ static void run_target(char** argv) {
 }
 
 
+/* Spin up fork server for batch mode. This is a stripped-down cousin of
+   the afl-fuzz routine of the same name. */
+
+static void init_forkserver(char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
+  u32 wait_tmout = exec_tmout ? exec_tmout : EXEC_TIMEOUT;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  forksrv_pid = fork();
+
+  if (forksrv_pid < 0) PFATAL("fork() failed");
+
+  if (!forksrv_pid) {
+
+    struct rlimit r;
+    s32 dev_null_fd = open("/dev/null", O_RDWR);
+
+    if (dev_null_fd < 0) PFATAL("Unable to open /dev/null");
+
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+
+    }
+
+    if (mem_limit) {
+
+      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+    }
+
+    if (!keep_cores) r.rlim_max = r.rlim_cur = 0;
+    else r.rlim_max = r.rlim_cur = RLIM_INFINITY;
+
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+    setsid();
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (use_stdin) {
+
+      dup2(prog_in_fd, 0);
+      close(prog_in_fd);
+
+    } else dup2(dev_null_fd, 0);
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(dev_null_fd);
+
+    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+
+    execv(target_path, argv);
+
+    *(u32*)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((wait_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((wait_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  child_pid = -1;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  child_pid = 0;
+
+  if (rlen == 4) return;
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+
+  if (waitpid(forksrv_pid, &status, 0) <= 0)
+    PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status))
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute '%s'", argv[0]);
+
+  FATAL("No instrumentation detected (non-instrumented binary?)");
+
+}
+
+
+/* Run one input through the fork server; sets child_timed_out and
+   child_crashed much like run_target() does. */
+
+static void run_target_forkserver(char** argv) {
+
+  static struct itimerval it;
+  static u32 prev_timed_out;
+
+  int status = 0;
+  s32 res;
+
+  memset(trace_bits, 0, MAP_SIZE);
+  MEM_BARRIER();
+
+  child_timed_out = 0;
+  child_crashed   = 0;
+
+  if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  if (exec_tmout) {
+
+    it.it_value.tv_sec = (exec_tmout / 1000);
+    it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
+
+  }
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+
+  }
+
+  child_pid = 0;
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  prev_timed_out = child_timed_out;
+
+  MEM_BARRIER();
+
+  classify_counts(trace_bits, binary_mode ?
+                  count_class_binary : count_class_human);
+
+  if (!child_timed_out && !stop_soon && WIFSIGNALED(status))
+    child_crashed = 1;
+
+}
+
+
+/* Write a batch-mode input to the file fed to the target. */
+
+static void write_to_testcase(void* mem, u32 len) {
+
+  s32 fd = prog_in_fd;
+
+  if (!use_stdin) {
+
+    unlink(prog_in); /* Ignore errors */
+
+    fd = open(prog_in, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", prog_in);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  ck_write(fd, mem, len, prog_in);
+
+  if (!use_stdin) close(fd); else {
+
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  }
+
+}
+
+
+/* Batch mode: feed every file in in_dir through the fork server, writing
+   one map per input into the out_file directory. */
+
+static void run_batch_mode(char** argv) {
+
+  struct dirent** nl;
+  s32 nl_cnt, i;
+  u32 done = 0, crashes = 0, tmouts = 0;
+
+  if (mkdir(out_file, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", out_file);
+
+  nl_cnt = scandir(in_dir, &nl, NULL, alphasort);
+
+  if (nl_cnt < 0) PFATAL("Unable to open '%s'", in_dir);
+
+  init_forkserver(argv);
+
+  for (i = 0; i < nl_cnt; i++) {
+
+    struct stat st;
+    u8 *fn = alloc_printf("%s/%s", in_dir, nl[i]->d_name),
+       *ofn;
+    u8* mem;
+    s32 fd;
+
+    if (nl[i]->d_name[0] == '.' || lstat(fn, &st) || !S_ISREG(st.st_mode) ||
+        !st.st_size || st.st_size > MAX_FILE) {
+
+      ck_free(fn);
+      free(nl[i]);
+      continue;
+
+    }
+
+    fd = open(fn, O_RDONLY);
+
+    if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+    mem = ck_alloc_nozero(st.st_size);
+    ck_read(fd, mem, st.st_size, fn);
+    close(fd);
+
+    write_to_testcase(mem, st.st_size);
+    ck_free(mem);
+
+    run_target_forkserver(argv);
+
+    if (stop_soon) FATAL("Interrupted by user");
+
+    if (child_timed_out) tmouts++;
+    if (child_crashed) crashes++;
+
+    ofn = alloc_printf("%s/%s", out_file, nl[i]->d_name);
+    write_results_to(ofn);
+    ck_free(ofn);
+
+    ck_free(fn);
+    free(nl[i]);
+    done++;
+
+  }
+
+  free(nl); /* not tracked */
+
+  if (!done) FATAL("No usable files in '%s'", in_dir);
+
+  OKF("Processed %u input file%s (%u crash%s, %u timeout%s), maps saved "
+      "in '%s'." cRST, done, done == 1 ? "" : "s", crashes,
+      crashes == 1 ? "" : "es", tmouts, tmouts == 1 ? "" : "s", out_file);
+
+}
+
+
 /* Handle Ctrl-C and the like. */
 
 static void handle_stop_sig(int sig) {
@@ -367,6 +678,7 @@ static void handle_stop_sig(int sig) {
   stop_soon = 1;
 
   if (child_pid > 0) kill(child_pid, SIGKILL);
+  if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
 
 }
 
@@ -491,6 +803,12 @@ static void usage(u8* argv0) {
        "  -m megs       - memory limit for child process (%u MB)\n"
        "  -Q            - use binary-only instrumentation (QEMU mode)\n\n"
 
+       "Batch processing:\n\n"
+
+       "  -i dir        - process all files in this directory through a\n"
+       "                  single fork server instance; -o then names an\n"
+       "                  output directory with one map per input file\n\n"
+
        "Other settings:\n\n"
 
        "  -q            - sink program's output and don't show messages\n"
@@ -635,10 +953,16 @@ int main(int argc, char** argv) {
 
   doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
 
-  while ((opt = getopt(argc,argv,"+o:m:t:A:eqZQbcV")) > 0)
+  while ((opt = getopt(argc,argv,"+i:o:m:t:A:eqZQbcV")) > 0)
 
     switch (opt) {
 
+      case 'i':
+
+        if (in_dir) FATAL("Multiple -i options not supported");
+        in_dir = optarg;
+        break;
+
       case 'o':
 
         if (out_file) FATAL("Multiple -o options not supported");
@@ -766,9 +1090,45 @@ int main(int argc, char** argv) {
 
   find_binary(argv[optind]);
 
-  if (!quiet_mode) {
+  if (in_dir) {
+
+    /* In batch mode, the target's input is a temp file of our own; @@ (or
+       -A) points there, and stdin targets read it via a rewound fd. */
+
+    u32 i = optind;
+    u8  uses_at = 0;
+
+    while (argv[i]) if (strstr(argv[i++], "@@")) uses_at = 1;
+
+    if (uses_at || at_file) {
+
+      use_stdin = 0;
+      if (!at_file)
+        at_file = alloc_printf(".afl-showmap-temp-%u", getpid());
+      prog_in = at_file;
+
+    } else {
+
+      prog_in = alloc_printf(".afl-showmap-temp-%u", getpid());
+
+      unlink(prog_in); /* Ignore errors */
+
+      prog_in_fd = open(prog_in, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+      if (prog_in_fd < 0) PFATAL("Unable to create '%s'", prog_in);
+
+    }
+
+    if (!quiet_mode) {
+      show_banner();
+      ACTF("Batch-processing '%s' via '%s'...\n", in_dir, target_path);
+    }
+
+  } else if (!quiet_mode) {
+
     show_banner();
     ACTF("Executing '%s'...\n", target_path);
+
   }
 
   detect_file_args(argv + optind);
@@ -778,9 +1138,16 @@ int main(int argc, char** argv) {
   else
     use_argv = argv + optind;
 
+  if (in_dir) {
+
+    run_batch_mode(use_argv);
+    exit(0);
+
+  }
+
   run_target(use_argv);
 
-  tcnt = write_results();
+  tcnt = write_results_to(out_file);
 
   if (!quiet_mode) {
 
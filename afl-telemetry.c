@@ -0,0 +1,152 @@
+/*
+  Copyright 2016 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - telemetry dump utility
+   -------------------------------------------
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+
+   This tool reads the binary telemetry block that a running afl-fuzz
+   instance keeps updated in its output directory (see telemetry.h) and
+   prints it in the familiar fuzzer_stats key : value format. It exists
+   chiefly so that afl-whatsup can gather live counters from large
+   fleets with a single small read per instance, instead of depending on
+   fuzzer_stats, which is rewritten only every minute or so.
+
+   Usage: afl-telemetry output_dir
+
+   Exits with a non-zero status if the block is missing, truncated, or
+   from an incompatible afl-fuzz version, in which case the caller
+   should fall back to parsing fuzzer_stats.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "telemetry.h"
+
+/* Read the block at the given path, retrying while the seqlock indicates
+   an update in flight. Returns 0 on success. */
+
+static u8 read_telemetry(u8* fn, struct afl_telemetry* t) {
+
+  s32 fd = open(fn, O_RDONLY);
+  u32 tries = 100;
+
+  if (fd < 0) return 1;
+
+  while (tries--) {
+
+    u32 seq;
+
+    if (pread(fd, t, sizeof(struct afl_telemetry), 0) !=
+        sizeof(struct afl_telemetry)) { close(fd); return 1; }
+
+    seq = t->seq;
+
+    if (!(seq & 1)) {
+
+      struct afl_telemetry chk;
+
+      if (pread(fd, &chk, sizeof(struct afl_telemetry), 0) !=
+          sizeof(struct afl_telemetry)) { close(fd); return 1; }
+
+      if (chk.seq == seq) break;
+
+    }
+
+    usleep(100);
+
+  }
+
+  close(fd);
+
+  if (t->magic != TELEMETRY_MAGIC) return 1;
+  if (t->version != TELEMETRY_VERSION) return 1;
+
+  return 0;
+
+}
+
+
+int main(int argc, char** argv) {
+
+  struct afl_telemetry t;
+  u8* fn;
+
+  if (argc != 2) {
+
+    SAYF("%s output_dir\n\n"
+         "Dumps the live telemetry block of the afl-fuzz instance running in\n"
+         "output_dir, using the same format as its fuzzer_stats file.\n\n", argv[0]);
+
+    return 1;
+
+  }
+
+  fn = alloc_printf("%s/telemetry", argv[1]);
+
+  if (read_telemetry(fn, &t)) return 1;
+
+  t.banner[TELEMETRY_BANNER - 1] = 0;
+
+  printf("start_time        : %llu\n"
+         "last_update       : %llu\n"
+         "fuzzer_pid        : %u\n"
+         "cycles_done       : %llu\n"
+         "execs_done        : %llu\n"
+         "execs_per_sec     : %llu.%02llu\n"
+         "paths_total       : %u\n"
+         "paths_favored     : %u\n"
+         "paths_found       : %u\n"
+         "paths_imported    : %u\n"
+         "max_depth         : %u\n"
+         "cur_path          : %u\n"
+         "pending_favs      : %u\n"
+         "pending_total     : %u\n"
+         "stability         : %u.%02u%%\n"
+         "bitmap_cvg        : %u.%02u%%\n"
+         "unique_crashes    : %llu\n"
+         "unique_hangs      : %llu\n"
+         "last_path         : %llu\n"
+         "last_crash        : %llu\n"
+         "last_hang         : %llu\n"
+         "afl_banner        : %s\n",
+         t.start_time, t.last_update, t.fuzzer_pid, t.cycles_done,
+         t.total_execs, t.eps_x100 / 100, t.eps_x100 % 100, t.paths_total,
+         t.paths_favored, t.paths_found, t.paths_imported, t.max_depth,
+         t.cur_path, t.pending_favored, t.pending_total,
+         t.stability_x100 / 100, t.stability_x100 % 100,
+         t.bitmap_cvg_x100 / 100, t.bitmap_cvg_x100 % 100, t.unique_crashes,
+         t.unique_hangs, t.last_path, t.last_crash, t.last_hang, t.banner);
+
+  return 0;
+
+}
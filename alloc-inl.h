@@ -337,6 +337,148 @@ static inline u8* DFL_ck_memdup_str(u8* mem, u32 size) {
 }
 
 
+/* Bump ("arena") allocator for small objects that live until the very end
+   of the process - queue metadata and the like. Allocations are batched
+   into large blocks and handed out by advancing a cursor, so there is no
+   per-object malloc() overhead and no heap fragmentation; the flip side is
+   that individual objects can never be freed, only the whole arena at once.
+
+   Arena memory is zeroed, but sits outside the canary and leak-tracking
+   machinery above - never pass an arena pointer to ck_free() or
+   ck_realloc(). */
+
+#define ARENA_BLK_SIZE  (1 << 16)
+
+struct arena_blk {
+  struct arena_blk* next;
+  u32 used, size;
+};
+
+struct ck_arena {
+  struct arena_blk* blk;               /* Current (head) block */
+};
+
+
+/* Allocate a zeroed, u64-aligned object from the arena. */
+
+static inline void* ck_arena_alloc(struct ck_arena* a, u32 size) {
+
+  struct arena_blk* b = a->blk;
+  void* ret;
+
+  if (!size) return NULL;
+
+  ALLOC_CHECK_SIZE(size);
+
+  size = (size + 7) & ~7u;
+
+  if (!b || b->used + size > b->size) {
+
+    u32 bsize = (size > ARENA_BLK_SIZE) ? size : ARENA_BLK_SIZE;
+
+    b = malloc(sizeof(struct arena_blk) + bsize);
+    ALLOC_CHECK_RESULT(b, bsize);
+
+    b->next = a->blk;
+    b->used = 0;
+    b->size = bsize;
+
+    a->blk  = b;
+
+  }
+
+  ret = (u8*)(b + 1) + b->used;
+  b->used += size;
+
+  return memset(ret, 0, size);
+
+}
+
+
+/* Copy a string into the arena. Returns NULL for NULL inputs. */
+
+static inline u8* ck_arena_strdup(struct ck_arena* a, u8* str) {
+
+  u32 size;
+
+  if (!str) return NULL;
+
+  size = strlen((char*)str) + 1;
+
+  return memcpy(ck_arena_alloc(a, size), str, size);
+
+}
+
+
+/* Release every block in the arena, invalidating all objects at once. */
+
+static inline void ck_arena_destroy(struct ck_arena* a) {
+
+  struct arena_blk* b = a->blk;
+
+  while (b) {
+
+    struct arena_blk* n = b->next;
+    free(b);
+    b = n;
+
+  }
+
+  a->blk = NULL;
+
+}
+
+
+/* Grow-only scratch buffer for hot loops that need a temporary buffer of
+   varying size on every pass. The buffer is kept around and reused; it only
+   grows (in powers of two), so after a brief warm-up the owner performs no
+   heap allocations at all. Previous contents are NOT preserved when the
+   buffer grows, and the pointer must never be handed to ck_free() or
+   ck_realloc(). */
+
+struct ck_scratch {
+  void* buf;
+  u32   size;
+};
+
+
+/* Return the scratch buffer, grown to hold at least want bytes. */
+
+static inline void* ck_scratch_get(struct ck_scratch* s, u32 want) {
+
+  if (want > s->size) {
+
+    u32 size = s->size ? s->size : 4096;
+
+    ALLOC_CHECK_SIZE(want);
+
+    while (size < want) size <<= 1;
+
+    free(s->buf);
+
+    s->buf = malloc(size);
+    ALLOC_CHECK_RESULT(s->buf, size);
+
+    s->size = size;
+
+  }
+
+  return s->buf;
+
+}
+
+
+/* Free the scratch buffer (mostly to appease leak checkers at exit). */
+
+static inline void ck_scratch_destroy(struct ck_scratch* s) {
+
+  free(s->buf);
+  s->buf  = NULL;
+  s->size = 0;
+
+}
+
+
 #ifndef DEBUG_BUILD
 
 /* In non-debug mode, we just do straightforward aliasing of the above functions
@@ -0,0 +1,682 @@
+/*
+   Copyright 2013 Google LLC All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+*/
+
+/*
+   american fuzzy lop - trace bitmap kernels
+   -----------------------------------------
+
+   The hot loops that post-process the SHM trace map after every single
+   execution: execution count classification, virgin map comparison, and
+   the assorted bit / byte counters. Factored out of afl-fuzz.c so that
+   other tools and benchmarks can reuse them.
+
+   All routines take an explicit map size; afl-fuzz passes MAP_SIZE.
+
+   On x86-64, classify_counts() and has_new_bits_in() have AVX2 variants
+   selected at runtime. Both exploit the fact that after a typical run,
+   almost all of the map is zero (classification) or already known
+   (virgin comparison), so a 32-byte vector test can skip a chunk in a
+   single compare and the scalar code only ever sees the interesting
+   leftovers. Set AFL_NO_SIMD to force the scalar paths.
+*/
+
+#ifndef _HAVE_BITMAP_INL_H
+#define _HAVE_BITMAP_INL_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "hash.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define HAVE_AVX2_DISPATCH 1
+#  include <immintrin.h>
+#endif /* __x86_64__ && (__GNUC__ || __clang__) */
+
+
+/* Execution count buckets, as described in technical_details.txt. The
+   16-bit table is expanded at startup by init_count_class16(). */
+
+static const u8 count_class_lookup8[256] = {
+
+  [0]           = 0,
+  [1]           = 1,
+  [2]           = 2,
+  [3]           = 4,
+  [4 ... 7]     = 8,
+  [8 ... 15]    = 16,
+  [16 ... 31]   = 32,
+  [32 ... 127]  = 64,
+  [128 ... 255] = 128
+
+};
+
+static u16 count_class_lookup16[65536];
+
+
+static inline void init_count_class16(void) {
+
+  u32 b1, b2;
+
+  for (b1 = 0; b1 < 256; b1++)
+    for (b2 = 0; b2 < 256; b2++)
+      count_class_lookup16[(b1 << 8) + b2] =
+        (count_class_lookup8[b1] << 8) |
+        count_class_lookup8[b2];
+
+}
+
+
+#ifdef HAVE_AVX2_DISPATCH
+
+/* Runtime CPU dispatch, memoized on first use. */
+
+static inline u8 bitmap_use_avx2(void) {
+
+  static s8 cached = -1;
+
+  if (cached < 0)
+    cached = __builtin_cpu_supports("avx2") && !getenv("AFL_NO_SIMD");
+
+  return (u8)cached;
+
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+
+/* Optional dirty-chunk log. When a tool points cc_dirty at a buffer big
+   enough for map_size / 32 entries, the classify routines below append
+   the byte offset of every non-zero 32-byte chunk they come across; the
+   next map reset can then clear just those chunks via
+   classify_dirty_reset() instead of wiping the whole thing. Tools that
+   never set the pointer pay nothing. */
+
+static u32* cc_dirty;
+static u32  cc_dirty_cnt;
+
+
+/* Destructively classify execution counts in a trace. This is used as a
+   preprocessing step for any newly acquired traces. Called on every exec,
+   must be fast. */
+
+static inline void classify_counts_scalar(u8* trace, u32 map_size) {
+
+#ifdef WORD_SIZE_64
+
+  u64* mem = (u64*)trace;
+  u32  i   = map_size >> 3;
+
+  while (i--) {
+
+    /* Optimize for sparse bitmaps. */
+
+    if (unlikely(*mem)) {
+
+      u16* mem16 = (u16*)mem;
+
+      mem16[0] = count_class_lookup16[mem16[0]];
+      mem16[1] = count_class_lookup16[mem16[1]];
+      mem16[2] = count_class_lookup16[mem16[2]];
+      mem16[3] = count_class_lookup16[mem16[3]];
+
+      if (cc_dirty) {
+
+        u32 off = (u32)((u8*)mem - trace) & ~31;
+
+        /* Adjacent dirty words land in the same chunk back to back, so
+           comparing against the last entry is all the dedup we need. */
+
+        if (!cc_dirty_cnt || cc_dirty[cc_dirty_cnt - 1] != off)
+          cc_dirty[cc_dirty_cnt++] = off;
+
+      }
+
+    }
+
+    mem++;
+
+  }
+
+#else
+
+  u32* mem = (u32*)trace;
+  u32  i   = map_size >> 2;
+
+  while (i--) {
+
+    /* Optimize for sparse bitmaps. */
+
+    if (unlikely(*mem)) {
+
+      u16* mem16 = (u16*)mem;
+
+      mem16[0] = count_class_lookup16[mem16[0]];
+      mem16[1] = count_class_lookup16[mem16[1]];
+
+      if (cc_dirty) {
+
+        u32 off = (u32)((u8*)mem - trace) & ~31;
+
+        if (!cc_dirty_cnt || cc_dirty[cc_dirty_cnt - 1] != off)
+          cc_dirty[cc_dirty_cnt++] = off;
+
+      }
+
+    }
+
+    mem++;
+
+  }
+
+#endif /* ^WORD_SIZE_64 */
+
+}
+
+
+#ifdef HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static void classify_counts_avx2(u8* trace, u32 map_size) {
+
+  u32 i;
+
+  for (i = 0; i < map_size; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i*)(trace + i));
+
+    /* Skip all-zero chunks in a single vector test. */
+
+    if (likely(_mm256_testz_si256(v, v))) continue;
+
+    {
+
+      u16* mem16 = (u16*)(trace + i);
+      u32  j;
+
+      for (j = 0; j < 16; j++)
+        mem16[j] = count_class_lookup16[mem16[j]];
+
+    }
+
+    if (cc_dirty) cc_dirty[cc_dirty_cnt++] = i;
+
+  }
+
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+
+static inline void classify_counts(u8* trace, u32 map_size) {
+
+#ifdef HAVE_AVX2_DISPATCH
+
+  if (bitmap_use_avx2()) {
+    classify_counts_avx2(trace, map_size);
+    return;
+  }
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+  classify_counts_scalar(trace, map_size);
+
+}
+
+
+/* Classify execution counts and compute the 32-bit checksum of the
+   classified trace in a single sweep. Equivalent to classify_counts()
+   followed by hash32() on the result, minus the second pass over the
+   map; meant for callers that want the checksum after every exec
+   anyway, such as the frequency-based power schedules in afl-fuzz. */
+
+static inline u32 classify_counts_hash_scalar(u8* trace, u32 map_size,
+                                              u32 seed) {
+
+  u64 h1 = hash32_init(map_size, seed);
+  u32 i;
+
+  for (i = 0; i < map_size; i += 32) {
+
+#ifdef WORD_SIZE_64
+
+    u64* mem = (u64*)(trace + i);
+
+    if (unlikely(mem[0] | mem[1] | mem[2] | mem[3])) {
+
+#else
+
+    u32* mem = (u32*)(trace + i);
+
+    if (unlikely(mem[0] | mem[1] | mem[2] | mem[3] |
+                 mem[4] | mem[5] | mem[6] | mem[7])) {
+
+#endif /* ^WORD_SIZE_64 */
+
+      u16* mem16 = (u16*)mem;
+      u32  j;
+
+      for (j = 0; j < 16; j++)
+        mem16[j] = count_class_lookup16[mem16[j]];
+
+      if (cc_dirty) cc_dirty[cc_dirty_cnt++] = i;
+
+    }
+
+    h1 = hash32_update(h1, trace + i, 32);
+
+  }
+
+  return hash32_final(h1);
+
+}
+
+
+#ifdef HAVE_AVX2_DISPATCH
+
+/* Every AVX2-capable CPU also has SSE4.2, and AFL_NO_SIMD turns off both
+   dispatchers at once, so this variant can call the CRC32C update step
+   directly - keeping its output consistent with standalone hash32(). */
+
+__attribute__((target("avx2,sse4.2")))
+static u32 classify_counts_hash_avx2(u8* trace, u32 map_size, u32 seed) {
+
+  u64 h1 = hash32_init(map_size, seed);
+  u32 i;
+
+  for (i = 0; i < map_size; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i*)(trace + i));
+
+    if (unlikely(!_mm256_testz_si256(v, v))) {
+
+      u16* mem16 = (u16*)(trace + i);
+      u32  j;
+
+      for (j = 0; j < 16; j++)
+        mem16[j] = count_class_lookup16[mem16[j]];
+
+      if (cc_dirty) cc_dirty[cc_dirty_cnt++] = i;
+
+    }
+
+    h1 = hash32_update_crc(h1, trace + i, 32);
+
+  }
+
+  return hash32_final(h1);
+
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+
+static inline u32 classify_counts_hash(u8* trace, u32 map_size, u32 seed) {
+
+#ifdef HAVE_AVX2_DISPATCH
+
+  if (bitmap_use_avx2())
+    return classify_counts_hash_avx2(trace, map_size, seed);
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+  return classify_counts_hash_scalar(trace, map_size, seed);
+
+}
+
+
+/* Zero only the chunks logged by the last classify pass, consuming the
+   log. Only valid if nothing has written to the trace since that pass;
+   callers fall back to a full memset whenever in doubt, and should do so
+   periodically anyway as a safety net. */
+
+static inline void classify_dirty_reset(u8* trace) {
+
+  while (cc_dirty_cnt) memset(trace + cc_dirty[--cc_dirty_cnt], 0, 32);
+
+}
+
+
+/* Helper for has_new_bits_in(): handle one machine word that is known to
+   intersect the virgin map. Returns 1 if only hit-count changes are seen,
+   2 if a brand new tuple showed up. */
+
+#ifdef WORD_SIZE_64
+
+static inline u8 check_virgin_word(u64* current, u64* virgin) {
+
+  u8* cur = (u8*)current;
+  u8* vir = (u8*)virgin;
+  u8  ret;
+
+  /* Looks like we have not found any new bytes yet; see if any non-zero
+     bytes in current[] are pristine in virgin[]. */
+
+  if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
+      (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
+      (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
+      (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff)) ret = 2;
+  else ret = 1;
+
+  *virgin &= ~*current;
+
+  return ret;
+
+}
+
+#else
+
+static inline u8 check_virgin_word(u32* current, u32* virgin) {
+
+  u8* cur = (u8*)current;
+  u8* vir = (u8*)virgin;
+  u8  ret;
+
+  if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
+      (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff)) ret = 2;
+  else ret = 1;
+
+  *virgin &= ~*current;
+
+  return ret;
+
+}
+
+#endif /* ^WORD_SIZE_64 */
+
+
+/* Check if the classified trace contains any bits still set in the virgin
+   map, clearing them as we go. Returns 1 if the only changes are hit-count
+   variations; 2 if there are new tuples. Called after every exec, must be
+   fast. */
+
+static inline u8 has_new_bits_scalar(u8* trace, u8* virgin_map,
+                                     u32 map_size) {
+
+#ifdef WORD_SIZE_64
+
+  u64* current = (u64*)trace;
+  u64* virgin  = (u64*)virgin_map;
+
+  u32  i = map_size >> 3;
+
+#else
+
+  u32* current = (u32*)trace;
+  u32* virgin  = (u32*)virgin_map;
+
+  u32  i = map_size >> 2;
+
+#endif /* ^WORD_SIZE_64 */
+
+  u8   ret = 0;
+
+  while (i--) {
+
+    /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
+       that have not been already cleared from the virgin map - since this will
+       almost always be the case. */
+
+    if (unlikely(*current) && unlikely(*current & *virgin)) {
+
+      u8 w = check_virgin_word(current, virgin);
+      if (w > ret) ret = w;
+
+    }
+
+    current++;
+    virgin++;
+
+  }
+
+  return ret;
+
+}
+
+
+#ifdef HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static u8 has_new_bits_avx2(u8* trace, u8* virgin_map, u32 map_size) {
+
+  u8  ret = 0;
+  u32 i;
+
+  for (i = 0; i < map_size; i += 32) {
+
+    __m256i cur = _mm256_loadu_si256((__m256i*)(trace + i));
+    __m256i vir = _mm256_loadu_si256((__m256i*)(virgin_map + i));
+
+    /* The common no-new-bits case reduces to a single vector AND test. */
+
+    if (likely(_mm256_testz_si256(cur, vir))) continue;
+
+    {
+
+      u64* current = (u64*)(trace + i);
+      u64* virgin  = (u64*)(virgin_map + i);
+      u32  j;
+
+      for (j = 0; j < 4; j++)
+        if (current[j] & virgin[j]) {
+
+          u8 w = check_virgin_word(current + j, virgin + j);
+          if (w > ret) ret = w;
+
+        }
+
+    }
+
+  }
+
+  return ret;
+
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+
+static inline u8 has_new_bits_in(u8* trace, u8* virgin_map, u32 map_size) {
+
+#ifdef HAVE_AVX2_DISPATCH
+
+  if (bitmap_use_avx2())
+    return has_new_bits_avx2(trace, virgin_map, map_size);
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+  return has_new_bits_scalar(trace, virgin_map, map_size);
+
+}
+
+
+/* Compare two classified traces and mark every byte that differs in the
+   var map. Returns the number of newly marked bytes. Called only when
+   calibration sees a changing checksum, so the differences are sparse;
+   optimize for long identical stretches. */
+
+static inline u32 mark_var_bytes_scalar(u8* var, u8* first, u8* trace,
+                                        u32 map_size) {
+
+  u32 i, ret = 0;
+
+  for (i = 0; i < map_size; i += 4) {
+
+    if (likely(*(u32*)(first + i) == *(u32*)(trace + i))) continue;
+
+    {
+
+      u32 j;
+
+      for (j = 0; j < 4; j++)
+        if (first[i + j] != trace[i + j] && !var[i + j]) {
+
+          var[i + j] = 1;
+          ret++;
+
+        }
+
+    }
+
+  }
+
+  return ret;
+
+}
+
+
+#ifdef HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static u32 mark_var_bytes_avx2(u8* var, u8* first, u8* trace,
+                               u32 map_size) {
+
+  u32 i, ret = 0;
+
+  for (i = 0; i < map_size; i += 32) {
+
+    __m256i a = _mm256_loadu_si256((__m256i*)(first + i));
+    __m256i b = _mm256_loadu_si256((__m256i*)(trace + i));
+
+    u32 diff = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+    if (likely(!diff)) continue;
+
+    while (diff) {
+
+      u32 j = __builtin_ctz(diff);
+
+      diff &= diff - 1;
+
+      if (!var[i + j]) {
+
+        var[i + j] = 1;
+        ret++;
+
+      }
+
+    }
+
+  }
+
+  return ret;
+
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+
+static inline u32 mark_var_bytes(u8* var, u8* first, u8* trace,
+                                 u32 map_size) {
+
+#ifdef HAVE_AVX2_DISPATCH
+
+  if (bitmap_use_avx2())
+    return mark_var_bytes_avx2(var, first, trace, map_size);
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+  return mark_var_bytes_scalar(var, first, trace, map_size);
+
+}
+
+
+/* Count the number of bits set in the provided bitmap. Used for the status
+   screen several times every second, does not have to be fast. */
+
+static inline u32 count_bits(u8* mem, u32 map_size) {
+
+  u32* ptr = (u32*)mem;
+  u32  i   = (map_size >> 2);
+  u32  ret = 0;
+
+  while (i--) {
+
+    u32 v = *(ptr++);
+
+    /* This gets called on the inverse, virgin bitmap; optimize for sparse
+       data. */
+
+    if (v == 0xffffffff) {
+      ret += 32;
+      continue;
+    }
+
+    v -= ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
+
+  }
+
+  return ret;
+
+}
+
+
+#define FF(_b)  (0xff << ((_b) << 3))
+
+/* Count the number of bytes set in the bitmap. Called fairly sporadically,
+   mostly to update the status screen or calibrate and examine confirmed
+   new paths. */
+
+static inline u32 count_bytes(u8* mem, u32 map_size) {
+
+  u32* ptr = (u32*)mem;
+  u32  i   = (map_size >> 2);
+  u32  ret = 0;
+
+  while (i--) {
+
+    u32 v = *(ptr++);
+
+    if (!v) continue;
+    if (v & FF(0)) ret++;
+    if (v & FF(1)) ret++;
+    if (v & FF(2)) ret++;
+    if (v & FF(3)) ret++;
+
+  }
+
+  return ret;
+
+}
+
+
+/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
+   status screen, several calls per second or so. */
+
+static inline u32 count_non_255_bytes(u8* mem, u32 map_size) {
+
+  u32* ptr = (u32*)mem;
+  u32  i   = (map_size >> 2);
+  u32  ret = 0;
+
+  while (i--) {
+
+    u32 v = *(ptr++);
+
+    /* This is called on the virgin bitmap, so optimize for the most likely
+       case. */
+
+    if (v == 0xffffffff) continue;
+    if ((v & FF(0)) != FF(0)) ret++;
+    if ((v & FF(1)) != FF(1)) ret++;
+    if ((v & FF(2)) != FF(2)) ret++;
+    if ((v & FF(3)) != FF(3)) ret++;
+
+  }
+
+  return ret;
+
+}
+
+#endif /* !_HAVE_BITMAP_INL_H */
@@ -77,6 +77,12 @@
 #define CAL_CYCLES          8
 #define CAL_CYCLES_LONG     40
 
+/* Calibration runs after which a case whose checksum came out identical
+   every time is deemed stable enough to fuzz; the remaining runs are
+   deferred until the entry is actually selected (see calibrate_case()): */
+
+#define CAL_CYCLES_MIN      3
+
 /* Number of subsequent timeouts before abandoning an input file: */
 
 #define TMOUT_LIMIT         250
@@ -149,6 +155,22 @@
 #define TRIM_START_STEPS    16
 #define TRIM_END_STEPS      1024
 
+/* How many positions a deterministic stage may advance between two writes
+   of the on-disk progress checkpoint: */
+
+#define DET_CKPT_INTERVAL   256
+
+/* How many executions may rely on the incremental dirty-chunk trace map
+   reset before we do a full memset() as a safety net: */
+
+#define MAP_WIPE_INTERVAL   4096
+
+/* Default byte budget for the in-memory corpus cache that spares afl-fuzz
+   from re-reading queue entry files (AFL_CORPUS_CACHE_MB overrides, 0
+   disables): */
+
+#define CORPUS_CACHE_SIZE   (64 << 20)
+
 /* Maximum size of input file, in bytes (keep under 100MB): */
 
 #define MAX_FILE            (1 * 1024 * 1024)
@@ -216,6 +238,47 @@
 
 #define SYNC_INTERVAL       5
 
+/* Geometry of the shared-memory sync ring used with AFL_SHM_SYNC: number of
+   record slots (must be a power of two) and bytes reserved for the relative
+   path of each published find: */
+
+#define SYNC_RING_SLOTS     16384
+#define SYNC_RING_PATH      244
+
+/* Number of sync cycles a claimed-but-unstamped ring slot is allowed to
+   stay that way before consumers give up and step over it. Publishing a
+   record takes microseconds, so anything that survives this many visits
+   means the publisher died mid-write: */
+
+#define SYNC_RING_STALL_LIMIT 5
+
+/* Bump this when the on-disk layout of the sync ring changes: */
+
+#define SYNC_RING_VERSION   1
+
+/* Tunables for the network sync mode (AFL_NET_SYNC, see netsync.h for the
+   wire format): the default afl-netsync listen port, the interval between
+   broker reconnection attempts (seconds), the send timeout after which a
+   wedged broker connection is dropped (seconds), the maximum number of
+   instances a broker will serve, and the byte budget of the backlog it
+   replays to late joiners: */
+
+#define NET_SYNC_PORT       24698
+#define NET_SYNC_RETRY      30
+#define NET_SYNC_TIMEOUT    10
+#define NET_SYNC_CLIENTS    64
+#define NET_SYNC_BACKLOG    (64 << 20)
+
+/* Capacity of the write-behind ring used with AFL_ASYNC_WRITE, in bytes
+   (must be a power of two and comfortably exceed MAX_FILE): */
+
+#define AWRITE_RING_SIZE    (1 << 22)
+
+/* Capacity of the crash hand-off ring used with AFL_CRASH_TRIAGE, in
+   bytes (same constraints as above): */
+
+#define TRIAGE_RING_SIZE    (1 << 23)
+
 /* Output directory reuse grace period (minutes): */
 
 #define OUTPUT_GRACE        25
@@ -278,6 +341,11 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used to pass the test case SHM ID to the called
+   program when AFL_SHM_TESTCASE is in use. */
+
+#define SHM_FUZZ_ENV_VAR    "__AFL_SHM_FUZZ_ID"
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
@@ -289,6 +357,7 @@
 
 #define PERSIST_SIG         "##SIG_AFL_PERSISTENT##"
 #define DEFER_SIG           "##SIG_AFL_DEFER_FORKSRV##"
+#define SHM_FUZZ_SIG        "##SIG_AFL_SHM_FUZZ##"
 
 /* Distinctive bitmap signature used to indicate failed execution: */
 
@@ -322,12 +391,33 @@
 /* Map size for the traced binary (2^MAP_SIZE_POW2). Must be greater than
    2; you probably want to keep it under 18 or so for performance reasons
    (adjusting AFL_INST_RATIO when compiling is probably a better way to solve
-   problems with complex programs). You need to recompile the target binary
-   after changing this - otherwise, SEGVs may ensue. */
+   problems with complex programs). Can be overridden on the compiler command
+   line (-DMAP_SIZE_POW2=...) when rebuilding the instrumentation kit; the
+   LLVM runtime announces the resulting size through the fork server
+   handshake, and afl-fuzz adapts at runtime (see AFL_MAP_SIZE in
+   docs/env_variables.txt). */
 
+#ifndef MAP_SIZE_POW2
 #define MAP_SIZE_POW2       16
+#endif /* !MAP_SIZE_POW2 */
+
 #define MAP_SIZE            (1 << MAP_SIZE_POW2)
 
+/* Fork server "hello" words carrying a map size announcement have the top
+   24 bits set to this magic, with log2 of the map size in the low byte.
+   Anything else is treated as a legacy hello and implies MAP_SIZE: */
+
+#define FS_MAPSIZE_MAGIC    0x4d500000
+#define FS_IS_MAPSIZE(_x)   (((_x) & 0xffffff00) == FS_MAPSIZE_MAGIC)
+#define FS_MAPSIZE_POW2(_x) ((_x) & 0xff)
+
+/* Power schedule settings (see the -p option in afl-fuzz): number of
+   buckets used to track per-path exec counts, and the cap on the energy
+   multiplier applied by the frequency-based schedules: */
+
+#define N_FUZZ_SIZE         (1 << 21)
+#define SCHED_MAX_FACTOR    32
+
 /* Maximum allocator request size (keep well under INT_MAX): */
 
 #define MAX_ALLOC           0x40000000
@@ -26,6 +26,19 @@
    similar to the original; the 64-bit one is a custom hack with
    mostly-unproven properties.
 
+   The function is decomposed into an incremental init / update / final
+   API, so callers that already sweep over a buffer - say, a fused trace
+   classification pass - can fold the hash into the same traversal
+   instead of paying for a second one. hash32() is the one-shot wrapper.
+
+   On x86-64, update steps are computed with the SSE4.2 CRC32C
+   instruction (two interleaved streams to cover its latency), selected
+   at runtime and falling back to the scalar MurmurHash3 code on older
+   CPUs; set AFL_NO_SIMD to force the scalar path. Hash values therefore
+   differ between the two paths, but are stable within any one run - and
+   nothing in AFL persists them across runs. Incremental use matches the
+   one-shot result as long as update lengths are multiples of 16 bytes.
+
    Austin's original code is public domain.
 
    Other code written and maintained by Michal Zalewski <lcamtuf@google.com>
@@ -36,14 +49,25 @@
 
 #include "types.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define HAVE_CRC32_DISPATCH 1
+#  include <immintrin.h>
+#endif /* __x86_64__ && (__GNUC__ || __clang__) */
+
 #ifdef __x86_64__
 
 #define ROL64(_x, _r)  ((((u64)(_x)) << (_r)) | (((u64)(_x)) >> (64 - (_r))))
 
-static inline u32 hash32(const void* key, u32 len, u32 seed) {
+static inline u64 hash32_init(u32 len, u32 seed) {
+
+  return (u64)(seed ^ len);
+
+}
+
+
+static inline u64 hash32_update_scalar(u64 h1, const void* key, u32 len) {
 
   const u64* data = (u64*)key;
-  u64 h1 = seed ^ len;
 
   len >>= 3;
 
@@ -61,6 +85,73 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
 
   }
 
+  return h1;
+
+}
+
+
+#ifdef HAVE_CRC32_DISPATCH
+
+/* Runtime CPU dispatch, memoized on first use. */
+
+static inline u8 hash_use_crc32(void) {
+
+  static s8 cached = -1;
+
+  if (cached < 0)
+    cached = __builtin_cpu_supports("sse4.2") && !getenv("AFL_NO_SIMD");
+
+  return (u8)cached;
+
+}
+
+
+/* The crc32q instruction digests eight bytes in one go, but has a
+   three-cycle latency; two independent streams keep the unit busy, with
+   the finalizer responsible for merging and avalanching the lanes. */
+
+__attribute__((target("sse4.2")))
+static u64 hash32_update_crc(u64 h1, const void* key, u32 len) {
+
+  const u64* data = (u64*)key;
+
+  u32 c0 = (u32)h1;
+  u32 c1 = (u32)(h1 >> 32);
+  u32 i  = len >> 4;
+
+  while (i--) {
+
+    c0 = (u32)_mm_crc32_u64(c0, data[0]);
+    c1 = (u32)_mm_crc32_u64(c1, data[1]);
+
+    data += 2;
+
+  }
+
+  if ((len >> 3) & 1) c0 = (u32)_mm_crc32_u64(c0, *data);
+
+  return (((u64)c1) << 32) | c0;
+
+}
+
+#endif /* HAVE_CRC32_DISPATCH */
+
+
+static inline u64 hash32_update(u64 h1, const void* key, u32 len) {
+
+#ifdef HAVE_CRC32_DISPATCH
+
+  if (hash_use_crc32()) return hash32_update_crc(h1, key, len);
+
+#endif /* HAVE_CRC32_DISPATCH */
+
+  return hash32_update_scalar(h1, key, len);
+
+}
+
+
+static inline u32 hash32_final(u64 h1) {
+
   h1 ^= h1 >> 33;
   h1 *= 0xff51afd7ed558ccdULL;
   h1 ^= h1 >> 33;
@@ -71,14 +162,21 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
 
 }
 
-#else 
+#else
 
 #define ROL32(_x, _r)  ((((u32)(_x)) << (_r)) | (((u32)(_x)) >> (32 - (_r))))
 
-static inline u32 hash32(const void* key, u32 len, u32 seed) {
+static inline u64 hash32_init(u32 len, u32 seed) {
 
-  const u32* data  = (u32*)key;
-  u32 h1 = seed ^ len;
+  return (u64)(seed ^ len);
+
+}
+
+
+static inline u64 hash32_update(u64 h1, const void* key, u32 len) {
+
+  const u32* data = (u32*)key;
+  u32 h = (u32)h1;
 
   len >>= 2;
 
@@ -90,22 +188,37 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
     k1  = ROL32(k1, 15);
     k1 *= 0x1b873593;
 
-    h1 ^= k1;
-    h1  = ROL32(h1, 13);
-    h1  = h1 * 5 + 0xe6546b64;
+    h ^= k1;
+    h  = ROL32(h, 13);
+    h  = h * 5 + 0xe6546b64;
 
   }
 
-  h1 ^= h1 >> 16;
-  h1 *= 0x85ebca6b;
-  h1 ^= h1 >> 13;
-  h1 *= 0xc2b2ae35;
-  h1 ^= h1 >> 16;
+  return (u64)h;
 
-  return h1;
+}
+
+
+static inline u32 hash32_final(u64 h1) {
+
+  u32 h = (u32)h1;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
 
 }
 
 #endif /* ^__x86_64__ */
 
+static inline u32 hash32(const void* key, u32 len, u32 seed) {
+
+  return hash32_final(hash32_update(hash32_init(len, seed), key, len));
+
+}
+
 #endif /* !_HAVE_HASH_H */
@@ -76,17 +76,60 @@
 #define PTR_C(_p) (((u32*)(_p))[-1])
 #define PTR_L(_p) (((u32*)(_p))[-2])
 
+/* Size-classed slot pools for the AFL_LD_FAST mode. Class n holds slots
+   with n data pages followed by one PROT_NONE guard page; anything larger
+   falls back to the classic mmap() path. */
+
+#define POOL_MAX_PG  16                 /* Largest pooled class, in pages   */
+#define POOL_REFILL  64                 /* Slots mapped per pool refill     */
+
 /* Configurable stuff (use AFL_LD_* to set): */
 
 static u32 max_mem = MAX_ALLOC;         /* Max heap usage to permit         */
 static u8  alloc_verbose,               /* Additional debug messages        */
            hard_fail,                   /* abort() when max_mem exceeded?   */
-           no_calloc_over;              /* abort() on calloc() overflows?   */
+           no_calloc_over,              /* abort() on calloc() overflows?   */
+           fast_mode;                   /* Recycle slots via pools?         */
 
 static __thread size_t total_mem;       /* Currently allocated mem          */
 
 static __thread u32 call_depth;         /* To avoid recursion via fprintf() */
 
+/* Free slots, linked through their own first word: */
+
+static __thread void* pool_head[POOL_MAX_PG + 1];
+
+
+/* Top up one of the slot pools used in fast mode. We grab a batch of slots
+   in a single mmap() and then punch the guard pages out; the cost is one
+   mprotect() per slot, paid once - recycling is syscall-free after that. */
+
+static void* __dislocator_refill(u32 cls) {
+
+  u8* region;
+  u32 i;
+
+  region = mmap(NULL, POOL_REFILL * (cls + 1) * PAGE_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (region == (void*)-1) return NULL;
+
+  for (i = 0; i < POOL_REFILL; i++) {
+
+    u8* slot = region + i * (cls + 1) * PAGE_SIZE;
+
+    if (mprotect(slot + cls * PAGE_SIZE, PAGE_SIZE, PROT_NONE))
+      FATAL("mprotect() failed when refilling slot pool");
+
+    *(void**)slot = pool_head[cls];
+    pool_head[cls] = slot;
+
+  }
+
+  return pool_head[cls];
+
+}
+
 
 /* This is the main alloc function. It allocates one page more than necessary,
    sets that tailing page to PROT_NONE, and then increments the return address
@@ -110,6 +153,41 @@ static void* __dislocator_alloc(size_t len) {
 
   }
 
+  /* In fast mode, small requests are served from size-classed pools of
+     recycled, guard-terminated slots instead of a fresh mapping. Freed
+     slots had their data pages dropped with madvise(), so they come back
+     zeroed, just like a new mmap() would be. */
+
+  if (fast_mode && PG_COUNT(len + 8) <= POOL_MAX_PG) {
+
+    u32 cls = PG_COUNT(len + 8);
+    void* slot = pool_head[cls];
+
+    if (!slot) slot = __dislocator_refill(cls);
+
+    if (slot) {
+
+      pool_head[cls] = *(void**)slot;
+      *(void**)slot  = NULL;
+
+      ret = slot + PAGE_SIZE * cls - len - 8;
+
+      ret += 8;
+
+      PTR_L(ret) = len;
+      PTR_C(ret) = ALLOC_CANARY;
+
+      total_mem += len;
+
+      return ret;
+
+    }
+
+    /* Refill failed; take the classic path, which has its own OOM
+       handling. */
+
+  }
+
   /* We will also store buffer length and a canary below the actual buffer, so
      let's add 8 bytes for that. */
 
@@ -219,11 +297,31 @@ void free(void* ptr) {
 
   total_mem -= len;
 
+  ptr -= PAGE_SIZE * PG_COUNT(len + 8) - len - 8;
+
+  /* In fast mode, drop the data pages with madvise() and put the slot back
+     on its pool. The pages read back as zero, so the canary is gone and a
+     double free trips the check above; use-after-free reads see zeros
+     rather than segfaulting, which is the price of recycling. */
+
+  if (fast_mode && PG_COUNT(len + 8) <= POOL_MAX_PG) {
+
+    u32 cls = PG_COUNT(len + 8);
+    void* slot = ptr - 8;
+
+    if (madvise(slot, cls * PAGE_SIZE, MADV_DONTNEED))
+      FATAL("madvise() failed when freeing memory");
+
+    *(void**)slot = pool_head[cls];
+    pool_head[cls] = slot;
+
+    return;
+
+  }
+
   /* Protect everything. Note that the extra page at the end is already
      set as PROT_NONE, so we don't need to touch that. */
 
-  ptr -= PAGE_SIZE * PG_COUNT(len + 8) - len - 8;
-
   if (mprotect(ptr - 8, PG_COUNT(len + 8) * PAGE_SIZE, PROT_NONE))
     FATAL("mprotect() failed when freeing memory");
 
@@ -271,5 +369,6 @@ __attribute__((constructor)) void __dislocator_init(void) {
   alloc_verbose = !!getenv("AFL_LD_VERBOSE");
   hard_fail = !!getenv("AFL_LD_HARD_FAIL");
   no_calloc_over = !!getenv("AFL_LD_NO_CALLOC_OVER");
+  fast_mode = !!getenv("AFL_LD_FAST");
 
 }
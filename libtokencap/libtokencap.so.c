@@ -50,6 +50,20 @@ static u32   __tokencap_ro_cnt;
 static u8    __tokencap_ro_loaded;
 static FILE* __tokencap_out_file;
 
+/* In-process store for captured tokens. Tokens are deduplicated in a
+   fixed-size open-addressing hash set and written out in one go when the
+   process exits, instead of one fprintf() per intercepted comparison.
+   Everything is statically allocated - the interceptors may run inside
+   malloc() itself, so they cannot call it. */
+
+#define TOKEN_SET_SIZE   (1 << 16)      /* Hash set slots (power of two)    */
+#define TOKEN_ARENA_SIZE (1 << 21)      /* Bytes of token text retained     */
+
+static u32 __tokencap_set[TOKEN_SET_SIZE];
+static u32 __tokencap_set_cnt;
+static u8  __tokencap_arena[TOKEN_ARENA_SIZE];
+static u32 __tokencap_arena_pos = 1;    /* Offset 0 doubles as "empty slot" */
+
 
 /* Identify read-only regions in memory. Only parameters that fall into these
    ranges are worth dumping when passed to strcmp() and so on. Read-write
@@ -100,6 +114,54 @@ static u8 __tokencap_is_ro(const void* ptr) {
 }
 
 
+/* Record one escaped token in the dedup set. Returns from the first probe
+   in the common case of a previously-seen token; new tokens are copied
+   into the arena. Once the set or the arena fills up, further new tokens
+   go straight to the output file, so nothing is lost - they just may
+   repeat. */
+
+static void __tokencap_add_token(const u8* token, u32 token_len) {
+
+  u32 hash = 0x811c9dc5, i, slot;
+
+  for (i = 0; i < token_len; i++) {
+    hash ^= token[i];
+    hash *= 0x01000193;
+  }
+
+  slot = hash & (TOKEN_SET_SIZE - 1);
+
+  while (__tokencap_set[slot]) {
+
+    u8* stored = __tokencap_arena + __tokencap_set[slot];
+
+    if (!strcmp(stored, token)) return;
+
+    slot = (slot + 1) & (TOKEN_SET_SIZE - 1);
+
+  }
+
+  /* Keep the set sparse enough for the linear probes above to stay short
+     (and, more to the point, to terminate). Tokens that don't fit in the
+     set or the arena go straight out instead. */
+
+  if (__tokencap_set_cnt > TOKEN_SET_SIZE - TOKEN_SET_SIZE / 4 ||
+      __tokencap_arena_pos + token_len + 1 > TOKEN_ARENA_SIZE) {
+
+    fprintf(__tokencap_out_file, "\"%s\"\n", token);
+    return;
+
+  }
+
+  memcpy(__tokencap_arena + __tokencap_arena_pos, token, token_len + 1);
+
+  __tokencap_set[slot] = __tokencap_arena_pos;
+  __tokencap_set_cnt++;
+  __tokencap_arena_pos += token_len + 1;
+
+}
+
+
 /* Dump an interesting token to output file, quoting and escaping it
    properly. */
 
@@ -137,7 +199,7 @@ static void __tokencap_dump(const u8* ptr, size_t len, u8 is_text) {
 
   buf[pos] = 0;
 
-  fprintf(__tokencap_out_file, "\"%s\"\n", buf);    
+  __tokencap_add_token(buf, pos);
 
 }
 
@@ -310,3 +372,23 @@ __attribute__((constructor)) void __tokencap_init(void) {
 
 }
 
+
+/* Write out the deduplicated token set in one batch. Only runs on a clean
+   exit; a process torn down by a signal takes its tokens with it, which
+   is fine for the repeated-run usage pattern described in the README. */
+
+__attribute__((destructor)) void __tokencap_shutdown(void) {
+
+  u32 pos = 1;
+
+  while (pos < __tokencap_arena_pos) {
+
+    fprintf(__tokencap_out_file, "\"%s\"\n", __tokencap_arena + pos);
+    pos += strlen(__tokencap_arena + pos) + 1;
+
+  }
+
+  fflush(__tokencap_out_file);
+
+}
+
@@ -272,6 +272,33 @@ static void edit_params(u32 argc, char** argv) {
 #endif /* ^__APPLE__ */
     "_I(); } while (0)";
 
+  /* The same treatment for the shared-memory test case accessors: inject a
+     signature (so that afl-fuzz can tell whether AFL_SHM_TESTCASE is safe to
+     use with this binary) and route the macros to the runtime .o. */
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_BUF="
+    "({ static volatile char *_S __attribute__((used)); "
+    " _S = (char*)\"" SHM_FUZZ_SIG "\"; "
+#ifdef __APPLE__
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned char* _FB(void) __asm__(\"___afl_fuzz_testcase_buf\"); "
+#else
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned char* _FB(void) __asm__(\"__afl_fuzz_testcase_buf\"); "
+#endif /* ^__APPLE__ */
+    "_FB(); })";
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_LEN="
+    "({ "
+#ifdef __APPLE__
+    "__attribute__((visibility(\"default\"))) "
+    "int _FL(void) __asm__(\"___afl_fuzz_testcase_len\"); "
+#else
+    "__attribute__((visibility(\"default\"))) "
+    "int _FL(void) __asm__(\"__afl_fuzz_testcase_len\"); "
+#endif /* ^__APPLE__ */
+    "_FL(); })";
+
   if (x_set) {
     cc_params[cc_par_cnt++] = "-x";
     cc_params[cc_par_cnt++] = "none";
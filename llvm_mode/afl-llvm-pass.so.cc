@@ -43,6 +43,8 @@
 #include <map>
 
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
@@ -207,6 +209,11 @@ bool AFLCoverage::runOnModule(Module &M) {
 
     }
 
+    /* Dominator-based probe thinning is on by default; AFL_LLVM_NO_DOM_THIN
+        restores the old instrument-everything behavior. */
+
+    bool dom_thin = !getenv("AFL_LLVM_NO_DOM_THIN");
+
     /* Get globals for the SHM region and the previous location. Note that
         __afl_prev_loc is thread-local. */
 
@@ -221,8 +228,29 @@ bool AFLCoverage::runOnModule(Module &M) {
     /* Instrument all the things! */
 
     int inst_blocks = 0;
+    int dom_skipped = 0;
     int i = 1;
     for (auto &F : M) {
+
+        /* Find blocks whose coverage is implied by another one. A block
+            with a unique predecessor that dominates it, and which in turn
+            post-dominates that predecessor, always executes together with
+            it; probing both adds overhead but no distinguishable signal.
+            This collapses straight-line chains down to a single probe. */
+
+        set<BasicBlock*> redundant;
+
+        if (dom_thin && !F.empty()) {
+            DominatorTree DT(F);
+            PostDominatorTree PDT;
+            PDT.recalculate(F);
+            for (auto &B : F) {
+                BasicBlock *P = B.getSinglePredecessor();
+                if (P && DT.dominates(P, &B) && PDT.dominates(&B, P))
+                    redundant.insert(&B);
+            }
+        }
+
         for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b) {
             i++;
             BasicBlock* BB = &*b;
@@ -237,6 +265,7 @@ bool AFLCoverage::runOnModule(Module &M) {
                 BasicBlock *Succ = TInst->getSuccessor(I);
                 preds[BB].push_back(Succ);
             }
+            if (redundant.count(BB)) { dom_skipped++; continue; }
             if (AFL_R(100) >= inst_ratio) continue;
 
             /* Make up cur_loc */
@@ -321,10 +350,10 @@ bool AFLCoverage::runOnModule(Module &M) {
     if (!be_quiet) {
 
         if (!inst_blocks) WARNF("No instrumentation targets found.");
-        else OKF("Instrumented %u locations (%s mode, ratio %u%%).",
+        else OKF("Instrumented %u locations (%s mode, ratio %u%%, %u thinned).",
                 inst_blocks, getenv("AFL_HARDEN") ? "hardened" :
                 ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ?
-                "ASAN/MSAN" : "non-hardened"), inst_ratio);
+                "ASAN/MSAN" : "non-hardened"), inst_ratio, dom_skipped);
 
     }
 
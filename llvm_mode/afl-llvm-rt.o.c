@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
 
 #include <sys/mman.h>
 #include <sys/shm.h>
@@ -68,6 +69,14 @@ __thread u32 __afl_prev_loc;
 static u8 is_persistent;
 
 
+/* Shared-memory test case delivery, set up when the parent passes us
+   SHM_FUZZ_ENV_VAR. The segment starts with a 32-bit length word followed
+   by the test case proper; see __AFL_FUZZ_TESTCASE_BUF in README.llvm. */
+
+static u8*  __afl_fuzz_buf;
+static u32* __afl_fuzz_len_shm;
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
@@ -81,6 +90,21 @@ static void __afl_map_shm(void) {
   if (id_str) {
 
     u32 shm_id = atoi(id_str);
+    struct shmid_ds ds;
+
+    /* Refuse to attach to a segment smaller than our compiled-in map;
+       the instrumentation would scribble past its end. The parent learns
+       the right size from the fork server hello and can be told to grow
+       its map via AFL_MAP_SIZE. */
+
+    if (!shmctl(shm_id, IPC_STAT, &ds) && ds.shm_segsz < MAP_SIZE) {
+
+      fprintf(stderr, "[-] ERROR: Coverage map is %u bytes, but this binary "
+              "was built for %u (set AFL_MAP_SIZE=%u).\n",
+              (u32)ds.shm_segsz, MAP_SIZE, MAP_SIZE);
+      _exit(1);
+
+    }
 
     __afl_area_ptr = shmat(shm_id, NULL, 0);
 
@@ -95,6 +119,45 @@ static void __afl_map_shm(void) {
 
   }
 
+  /* If the parent set up a second segment for zero-copy test case delivery,
+     attach to it, too. */
+
+  id_str = getenv(SHM_FUZZ_ENV_VAR);
+
+  if (id_str) {
+
+    u8* mem = shmat(atoi(id_str), NULL, 0);
+
+    if (mem == (void *)-1) _exit(1);
+
+    __afl_fuzz_len_shm = (u32*)mem;
+    __afl_fuzz_buf     = mem + 4;
+
+  }
+
+}
+
+
+/* Accessors behind the __AFL_FUZZ_TESTCASE_BUF / _LEN macros. When the SHM
+   segment is absent (e.g., the binary is executed on its own or under the
+   file-based modes), we fall back to slurping stdin into a local buffer, so
+   that the same build works everywhere. */
+
+u8* __afl_fuzz_testcase_buf(void) {
+
+  if (!__afl_fuzz_buf) __afl_fuzz_buf = malloc(MAX_FILE);
+
+  return __afl_fuzz_buf;
+
+}
+
+
+int __afl_fuzz_testcase_len(void) {
+
+  if (__afl_fuzz_len_shm) return *__afl_fuzz_len_shm;
+
+  return read(0, __afl_fuzz_testcase_buf(), MAX_FILE);
+
 }
 
 
@@ -102,15 +165,16 @@ static void __afl_map_shm(void) {
 
 static void __afl_start_forkserver(void) {
 
-  static u8 tmp[4];
+  u32 hello = FS_MAPSIZE_MAGIC | MAP_SIZE_POW2;
   s32 child_pid;
 
   u8  child_stopped = 0;
 
-  /* Phone home and tell the parent that we're OK. If parent isn't there,
-     assume we're not running in forkserver mode and just execute program. */
+  /* Phone home and tell the parent that we're OK, announcing our map size
+     along the way. If parent isn't there, assume we're not running in
+     forkserver mode and just execute program. */
 
-  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return;
+  if (write(FORKSRV_FD + 1, &hello, 4) != 4) return;
 
   while (1) {
 
@@ -179,6 +243,232 @@ static void __afl_start_forkserver(void) {
 }
 
 
+/* Snapshot-restore support for persistent mode (AFL_SNAPSHOT), Linux-only.
+
+   On the first pass through __AFL_LOOP(), we record every writable private
+   mapping of the process (globals, heap, library data - but not the stack,
+   which is owned by the loop itself) and arm the kernel's soft-dirty page
+   tracking. Between iterations, we copy back just the pages the previous
+   run actually touched, so targets that trash global state can still use
+   persistent mode instead of paying a full fork() per exec.
+
+   If soft-dirty tracking is unavailable, we degrade to restoring the
+   recorded segments wholesale - still typically cheaper than fork() on
+   large processes. Mappings created by the target *during* a run are not
+   torn down; the iteration bound on __AFL_LOOP() keeps that in check. */
+
+#ifdef __linux__
+
+#define SNAP_MAX_REGIONS 1024
+
+static struct {
+  u8* addr;
+  u32 len;
+  u8* saved;
+} __afl_snap_region[SNAP_MAX_REGIONS];
+
+static u32 __afl_snap_cnt;
+static u8  __afl_snap_on;
+static u8  __afl_snap_soft_dirty;
+static s32 __afl_snap_pagemap_fd = -1,
+           __afl_snap_clear_fd = -1;
+static u32 __afl_snap_page_sz;
+
+
+/* Decide whether a /proc/self/maps entry should be snapshotted. */
+
+static u8 __afl_snap_want(u8* perms, u8* path) {
+
+  if (perms[1] != 'w' || perms[3] != 'p') return 0;
+
+  /* The stack is live while we restore; the SYSV segments are shared with
+     the parent and reset by it. */
+
+  if (strstr(path, "[stack")) return 0;
+  if (strstr(path, "SYSV"))   return 0;
+  if (!strncmp(path, "/dev/", 5)) return 0;
+
+  return 1;
+
+}
+
+
+/* Re-arm soft-dirty tracking so the next iteration starts clean. */
+
+static void __afl_snap_clear_refs(void) {
+
+  if (__afl_snap_clear_fd >= 0 &&
+      pwrite(__afl_snap_clear_fd, "4", 1, 0) != 1)
+    __afl_snap_soft_dirty = 0;
+
+}
+
+
+/* Take the initial snapshot. Returns 1 on success. Called once, at the
+   bottom of the first __AFL_LOOP() pass, so that every static variable in
+   this file already holds its steady-state value when captured. */
+
+static u8 __afl_snap_init(void) {
+
+  FILE* f = fopen("/proc/self/maps", "r");
+  char  line[1024];
+  u64   total = 0;
+  u8*   arena;
+  u32   i;
+
+  if (!f) return 0;
+
+  __afl_snap_page_sz = sysconf(_SC_PAGESIZE);
+
+  while (fgets(line, sizeof(line), f)) {
+
+    u64  start, end;
+    char perms[8], path[512];
+
+    path[0] = 0;
+
+    if (sscanf(line, "%llx-%llx %7s %*s %*s %*s %511s",
+               &start, &end, perms, path) < 3) continue;
+
+    if (!__afl_snap_want((u8*)perms, (u8*)path)) continue;
+
+    if (__afl_snap_cnt == SNAP_MAX_REGIONS) {
+      fclose(f);
+      return 0;
+    }
+
+    __afl_snap_region[__afl_snap_cnt].addr = (u8*)(uintptr_t)start;
+    __afl_snap_region[__afl_snap_cnt].len  = end - start;
+    __afl_snap_cnt++;
+
+    total += end - start;
+
+  }
+
+  fclose(f);
+
+  if (!__afl_snap_cnt) return 0;
+
+  /* The arena holding the pristine copies is mapped after the walk above,
+     so it never shows up in its own region list. */
+
+  arena = mmap(0, total, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (arena == MAP_FAILED) return 0;
+
+  for (i = 0; i < __afl_snap_cnt; i++) {
+
+    __afl_snap_region[i].saved = arena;
+    arena += __afl_snap_region[i].len;
+
+  }
+
+  __afl_snap_pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+  __afl_snap_clear_fd   = open("/proc/self/clear_refs", O_WRONLY);
+
+  __afl_snap_soft_dirty = (__afl_snap_pagemap_fd >= 0 &&
+                           __afl_snap_clear_fd >= 0);
+
+  /* CONFIG_MEM_SOFT_DIRTY may be compiled out, in which case the files
+     exist but the dirty bit never gets set; probe with a write of our own
+     before trusting it. */
+
+  if (__afl_snap_soft_dirty) {
+
+    static volatile u8 probe;
+    u64 ent = 0, off;
+
+    __afl_snap_clear_refs();
+    probe = 1;
+
+    off = (((uintptr_t)&probe) / __afl_snap_page_sz) * 8;
+
+    if (pread(__afl_snap_pagemap_fd, &ent, 8, off) != 8 ||
+        !(ent & (1ULL << 55)))
+      __afl_snap_soft_dirty = 0;
+
+  }
+
+  /* Capture contents only now, once every static above - the region table,
+     the fds, the soft-dirty verdict - holds its steady-state value. One of
+     the captured segments is our own .bss, and restoring a stale copy of
+     this bookkeeping would be fatal. */
+
+  for (i = 0; i < __afl_snap_cnt; i++)
+    memcpy(__afl_snap_region[i].saved, __afl_snap_region[i].addr,
+           __afl_snap_region[i].len);
+
+  __afl_snap_clear_refs();
+
+  return 1;
+
+}
+
+
+/* Roll the tracked segments back to the snapshot. With soft-dirty data
+   available, only pages touched since the last __afl_snap_clear_refs() are
+   copied; otherwise everything is. */
+
+static void __afl_snap_restore(void) {
+
+  u32 i;
+
+  for (i = 0; i < __afl_snap_cnt; i++) {
+
+    u8* addr  = __afl_snap_region[i].addr;
+    u8* saved = __afl_snap_region[i].saved;
+    u32 len   = __afl_snap_region[i].len;
+
+    if (__afl_snap_soft_dirty) {
+
+      u32 pages = len / __afl_snap_page_sz;
+      u64 ent;
+      u32 p;
+
+      for (p = 0; p < pages; p++) {
+
+        u64 off = (((uintptr_t)addr / __afl_snap_page_sz) + p) * 8;
+
+        if (pread(__afl_snap_pagemap_fd, &ent, 8, off) != 8) {
+
+          /* Tracking just fell over; start again from scratch, restoring
+             every region wholesale. */
+
+          __afl_snap_soft_dirty = 0;
+          i = (u32)-1;
+          break;
+
+        }
+
+        /* Bit 55: page is soft-dirty. */
+
+        if (ent & (1ULL << 55))
+          memcpy(addr + p * __afl_snap_page_sz,
+                 saved + p * __afl_snap_page_sz, __afl_snap_page_sz);
+
+      }
+
+      continue;
+
+    }
+
+    memcpy(addr, saved, len);
+
+  }
+
+  __afl_snap_clear_refs();
+
+  /* The restore itself just rewound every static in this file, including
+     the flag saying that we are active. Undo that. */
+
+  __afl_snap_on = 1;
+
+}
+
+#endif /* __linux__ */
+
+
 /* A simplified persistent mode handler, used as explained in README.llvm. */
 
 int __afl_persistent_loop(unsigned int max_cnt) {
@@ -202,6 +492,17 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     cycle_cnt  = max_cnt;
     first_pass = 0;
+
+#ifdef __linux__
+
+    /* Taken last, so that the snapshot captures every static above in its
+       steady state. */
+
+    if (is_persistent && getenv("AFL_SNAPSHOT"))
+      __afl_snap_on = __afl_snap_init();
+
+#endif /* __linux__ */
+
     return 1;
 
   }
@@ -212,6 +513,23 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
       raise(SIGSTOP);
 
+#ifdef __linux__
+
+      if (__afl_snap_on) {
+
+        /* cycle_cnt lives in the snapshotted segments; carry it across the
+           restore on the (untracked) stack. */
+
+        u32 saved_cnt = cycle_cnt;
+
+        __afl_snap_restore();
+
+        cycle_cnt = saved_cnt;
+
+      }
+
+#endif /* __linux__ */
+
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
 
@@ -0,0 +1,58 @@
+/*
+  Copyright 2016 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - network sync wire format
+   ---------------------------------------------
+
+   The frame layout spoken between afl-fuzz instances (AFL_NET_SYNC) and
+   the afl-netsync broker. Each new queue entry travels as one frame: the
+   fixed header below, followed by map_size / 8 bytes of minimized
+   coverage summary (one bit per trace byte that the entry touches), and
+   then len bytes of raw input.
+
+   The summary lets receivers discard an import without executing it
+   whenever every byte the sender touched is already fully explored in
+   the local virgin map; the cksum catches exact path duplicates. All
+   fields are in host byte order - the protocol is meant for clusters of
+   identical machines, and the map_size check will reject an accidental
+   mismatch.
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+*/
+
+#ifndef _HAVE_NETSYNC_H
+#define _HAVE_NETSYNC_H
+
+#include "types.h"
+
+#define NET_SYNC_MAGIC      0x4146534e /* 'AFSN' */
+
+/* Bump this whenever the struct below changes: */
+
+#define NET_SYNC_VERSION    1
+
+struct net_sync_msg {
+
+  u32 magic;                          /* NET_SYNC_MAGIC                   */
+  u32 version;                        /* NET_SYNC_VERSION                 */
+  u32 map_size;                       /* Sender's coverage map size       */
+  u32 cksum;                          /* exec_cksum of the find           */
+  u32 len;                            /* Input length                     */
+
+};
+
+#endif /* !_HAVE_NETSYNC_H */
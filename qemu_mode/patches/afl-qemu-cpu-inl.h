@@ -66,6 +66,23 @@
 
 #define TSL_FD (FORKSRV_FD - 1)
 
+/* Number of translation requests the child batches into one pipe write;
+   sized so that a full batch stays within PIPE_BUF and hence atomic. */
+
+#define TSL_BATCH (4096 / sizeof(struct afl_tsl))
+
+/* Number of newly translated blocks after which the persistent cache is
+   rewritten. afl-fuzz kills the fork server outright when it exits, so
+   waiting for an orderly shutdown would mean (almost) never saving; the
+   rewrites taper off on their own once the block set stops growing. */
+
+#define TSL_CACHE_SYNC 512
+
+/* On-disk header of the persistent translation cache (AFL_QEMU_TB_CACHE). */
+
+#define TSL_CACHE_MAGIC   0x41465443 /* 'AFTC' */
+#define TSL_CACHE_VERSION 1
+
 /* This is equivalent to afl-as.h: */
 
 static unsigned char *afl_area_ptr;
@@ -102,6 +119,27 @@ struct afl_tsl {
   uint64_t flags;
 };
 
+/* Header of the persistent translation cache file: */
+
+struct afl_tsl_cache_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t unused;
+  uint64_t entry_point;
+};
+
+/* Accumulated set of blocks the fork server has translated, rewritten to
+   the cache file (if configured) every TSL_CACHE_SYNC new blocks: */
+
+static struct afl_tsl *tsl_cache;
+static uint32_t tsl_cache_len, tsl_cache_size, tsl_cache_synced;
+static const char *tsl_cache_fn;
+
+static void afl_translate_tsl(CPUState*, struct afl_tsl*);
+static void afl_load_tsl_cache(CPUState*);
+static void afl_save_tsl_cache(void);
+
 /* Some forward decls: */
 
 TranslationBlock *tb_htable_lookup(CPUState*, target_ulong, target_ulong, uint32_t);
@@ -172,6 +210,11 @@ static void afl_forkserver(CPUState *cpu) {
 
   if (!afl_area_ptr) return;
 
+  /* Warm up the translation cache from a previous session before the
+     handshake, while afl-fuzz is still on its generous startup timeout. */
+
+  afl_load_tsl_cache(cpu);
+
   /* Tell the parent that we're alive. If the parent doesn't want
      to talk, assume that we're not running in forkserver mode. */
 
@@ -186,9 +229,13 @@ static void afl_forkserver(CPUState *cpu) {
     pid_t child_pid;
     int status, t_fd[2];
 
-    /* Whoops, parent dead? */
+    /* Whoops, parent dead? Flush the cache tail (if our pipe outlived
+       the parent at all; afl-fuzz normally just kills us) and wind down. */
 
-    if (read(FORKSRV_FD, tmp, 4) != 4) exit(2);
+    if (read(FORKSRV_FD, tmp, 4) != 4) {
+      afl_save_tsl_cache();
+      exit(2);
+    }
 
     /* Establish a channel with child to grab translation commands. We'll
        read from t_fd[0], child will write to TSL_FD. */
@@ -226,6 +273,13 @@ static void afl_forkserver(CPUState *cpu) {
     if (waitpid(child_pid, &status, 0) < 0) exit(6);
     if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
 
+    /* Checkpoint the persistent cache once enough new blocks have piled
+       up; this runs between executions, where the rewrite cost is not
+       charged to any measured run. */
+
+    if (tsl_cache_len - tsl_cache_synced >= TSL_CACHE_SYNC)
+      afl_save_tsl_cache();
+
   }
 
 }
@@ -261,6 +315,25 @@ static inline void afl_maybe_log(abi_ulong cur_loc) {
 }
 
 
+/* Child-side batch buffer for translation requests. A chain of blocks
+   discovered in one run goes out as a single pipe transaction instead of
+   one write() per block. */
+
+static struct afl_tsl tsl_batch[TSL_BATCH];
+static int tsl_batch_len;
+
+static void afl_flush_tsl(void) {
+
+  if (!tsl_batch_len) return;
+
+  if (write(TSL_FD, tsl_batch, tsl_batch_len * sizeof(struct afl_tsl)) < 0)
+    { /* Pipe gone; nothing to be done. */ }
+
+  tsl_batch_len = 0;
+
+}
+
+
 /* This code is invoked whenever QEMU decides that it doesn't have a
    translation of a particular block and needs to compute it. When this happens,
    we tell the parent to mirror the operation, so that the next fork() has a
@@ -268,46 +341,182 @@ static inline void afl_maybe_log(abi_ulong cur_loc) {
 
 static void afl_request_tsl(target_ulong pc, target_ulong cb, uint64_t flags) {
 
-  struct afl_tsl t;
+  static unsigned char atexit_set;
+  struct afl_tsl *t;
 
   if (!afl_fork_child) return;
 
-  t.pc      = pc;
-  t.cs_base = cb;
-  t.flags   = flags;
+  /* Flush whatever is still buffered when the child winds down; crashes
+     and kills lose the tail, which merely means a re-request next run. */
 
-  if (write(TSL_FD, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
-    return;
+  if (!atexit_set) {
+    atexit(afl_flush_tsl);
+    atexit_set = 1;
+  }
+
+  t = &tsl_batch[tsl_batch_len++];
+
+  t->pc      = pc;
+  t->cs_base = cb;
+  t->flags   = flags;
+
+  if (tsl_batch_len == TSL_BATCH) afl_flush_tsl();
 
 }
 
+
+/* Translate one block in the fork server's context, unless it is already
+   there, and remember it for the persistent cache. */
+
+static void afl_translate_tsl(CPUState *cpu, struct afl_tsl *t) {
+
+  if (tb_htable_lookup(cpu, t->pc, t->cs_base, t->flags)) return;
+
+  mmap_lock();
+  tb_lock();
+  tb_gen_code(cpu, t->pc, t->cs_base, t->flags, 0);
+  mmap_unlock();
+  tb_unlock();
+
+  if (!tsl_cache_fn) return;
+
+  if (tsl_cache_len == tsl_cache_size) {
+
+    tsl_cache_size = tsl_cache_size ? tsl_cache_size * 2 : 4096;
+    tsl_cache = realloc(tsl_cache, tsl_cache_size * sizeof(struct afl_tsl));
+    if (!tsl_cache) exit(8);
+
+  }
+
+  tsl_cache[tsl_cache_len++] = *t;
+
+}
+
+
 /* This is the other side of the same channel. Since timeouts are handled by
-   afl-fuzz simply killing the child, we can just wait until the pipe breaks. */
+   afl-fuzz simply killing the child, we can just wait until the pipe breaks.
+   Requests arrive in batches; records may still straddle a read() boundary,
+   so we keep the unconsumed tail around. */
 
 static void afl_wait_tsl(CPUState *cpu, int fd) {
 
-  struct afl_tsl t;
-  TranslationBlock *tb;
+  unsigned char buf[TSL_BATCH * sizeof(struct afl_tsl)];
+  int fill = 0;
 
   while (1) {
 
+    int n, recs, i;
+
     /* Broken pipe means it's time to return to the fork server routine. */
 
-    if (read(fd, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
-      break;
+    n = read(fd, buf + fill, sizeof(buf) - fill);
+    if (n <= 0) break;
 
-    tb = tb_htable_lookup(cpu, t.pc, t.cs_base, t.flags);
+    fill += n;
+    recs  = fill / sizeof(struct afl_tsl);
 
-    if(!tb) {
-      mmap_lock();
-      tb_lock();
-      tb_gen_code(cpu, t.pc, t.cs_base, t.flags, 0);
-      mmap_unlock();
-      tb_unlock();
-    }
+    for (i = 0; i < recs; i++)
+      afl_translate_tsl(cpu, (struct afl_tsl*)buf + i);
+
+    fill -= recs * sizeof(struct afl_tsl);
+    if (fill) memmove(buf, buf + recs * sizeof(struct afl_tsl), fill);
 
   }
 
   close(fd);
 
 }
+
+
+/* Pre-translate the set of blocks recorded by a previous session
+   (AFL_QEMU_TB_CACHE). Entries are revalidated against the current memory
+   map, so a stale or foreign file costs us nothing but the read. */
+
+static void afl_load_tsl_cache(CPUState *cpu) {
+
+  struct afl_tsl_cache_hdr hdr;
+  struct afl_tsl t;
+  FILE *f;
+  uint32_t i;
+
+  tsl_cache_fn = getenv("AFL_QEMU_TB_CACHE");
+  if (!tsl_cache_fn) return;
+
+  f = fopen(tsl_cache_fn, "rb");
+  if (!f) return;
+
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      hdr.magic != TSL_CACHE_MAGIC ||
+      hdr.version != TSL_CACHE_VERSION ||
+      hdr.entry_point != afl_entry_point) {
+
+    fclose(f);
+    return;
+
+  }
+
+  for (i = 0; i < hdr.count; i++) {
+
+    if (fread(&t, sizeof(t), 1, f) != 1) break;
+
+    /* Only replay blocks that still point at executable guest memory;
+       afl_translate_tsl() re-adds them to the in-memory set, so the
+       rewritten file keeps everything that is still valid. */
+
+    if (!(page_get_flags(t.pc) & PAGE_EXEC)) continue;
+
+    afl_translate_tsl(cpu, &t);
+
+  }
+
+  fclose(f);
+
+  /* What we just replayed is already on disk; only blocks recorded past
+     this point count towards the next checkpoint. */
+
+  tsl_cache_synced = tsl_cache_len;
+
+}
+
+
+/* Write the accumulated translation set back out. Done atomically via a
+   temp file, so concurrent instances sharing a cache path at worst waste
+   a rewrite, not the file. */
+
+static void afl_save_tsl_cache(void) {
+
+  struct afl_tsl_cache_hdr hdr;
+  char tmp_fn[PATH_MAX];
+  FILE *f;
+
+  if (!tsl_cache_fn || !tsl_cache_len) return;
+
+  if (snprintf(tmp_fn, sizeof(tmp_fn), "%s.%u", tsl_cache_fn,
+               (unsigned int)getpid()) >= (int)sizeof(tmp_fn)) return;
+
+  f = fopen(tmp_fn, "wb");
+  if (!f) return;
+
+  hdr.magic       = TSL_CACHE_MAGIC;
+  hdr.version     = TSL_CACHE_VERSION;
+  hdr.count       = tsl_cache_len;
+  hdr.unused      = 0;
+  hdr.entry_point = afl_entry_point;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fwrite(tsl_cache, sizeof(struct afl_tsl), tsl_cache_len, f) !=
+      tsl_cache_len) {
+
+    fclose(f);
+    unlink(tmp_fn);
+    return;
+
+  }
+
+  fclose(f);
+
+  if (rename(tmp_fn, tsl_cache_fn)) { unlink(tmp_fn); return; }
+
+  tsl_cache_synced = tsl_cache_len;
+
+}
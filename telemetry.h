@@ -0,0 +1,85 @@
+/*
+  Copyright 2016 Google LLC All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at:
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+   american fuzzy lop - live telemetry block
+   -----------------------------------------
+
+   Layout of the small binary file (<out_dir>/telemetry) that afl-fuzz
+   keeps mmap'd and updates in place on every stats refresh, so that
+   fleet monitoring tools can grab fresh counters with a single page
+   read instead of parsing fuzzer_stats, which is rewritten only every
+   STATS_UPDATE_SEC seconds.
+
+   Consistency is handled with a seqlock: the writer bumps seq to an odd
+   value, updates the counters, and bumps it again. Readers retry until
+   they see the same even seq before and after copying the block.
+
+   Written and maintained by Michal Zalewski <lcamtuf@google.com>
+*/
+
+#ifndef _HAVE_TELEMETRY_H
+#define _HAVE_TELEMETRY_H
+
+#include "types.h"
+
+#define TELEMETRY_MAGIC     0x41464c54 /* 'AFLT' */
+
+/* Bump this whenever the struct below changes: */
+
+#define TELEMETRY_VERSION   1
+
+#define TELEMETRY_BANNER    64
+
+struct afl_telemetry {
+
+  u32 magic;                          /* TELEMETRY_MAGIC                  */
+  u32 version;                        /* TELEMETRY_VERSION                */
+
+  volatile u32 seq;                   /* Seqlock; odd = update in flight  */
+  u32 fuzzer_pid;                     /* PID of the afl-fuzz instance     */
+
+  u64 start_time;                     /* Session start (unix seconds)     */
+  u64 last_update;                    /* Last refresh (unix seconds)      */
+
+  u64 total_execs;                    /* Total execve() calls             */
+  u64 eps_x100;                       /* Smoothed execs/sec, times 100    */
+  u64 cycles_done;                    /* Queue cycles completed           */
+
+  u64 unique_crashes;                 /* Crashes with unique signatures   */
+  u64 unique_hangs;                   /* Hangs with unique signatures     */
+
+  u64 last_path;                      /* Most recent find (unix seconds)  */
+  u64 last_crash;                     /* Most recent crash (unix seconds) */
+  u64 last_hang;                      /* Most recent hang (unix seconds)  */
+
+  u32 cur_path;                       /* Current queue entry ID           */
+  u32 paths_total;                    /* Total number of queued testcases */
+  u32 pending_total;                  /* Queued but not done yet          */
+  u32 pending_favored;                /* Pending favored paths            */
+  u32 paths_found;                    /* Items discovered during this run */
+  u32 paths_imported;                 /* Items imported via -S            */
+  u32 max_depth;                      /* Max path depth                   */
+
+  u32 bitmap_cvg_x100;                /* Bitmap coverage %, times 100     */
+  u32 stability_x100;                 /* Stability %, times 100           */
+  u32 paths_favored;                  /* Paths deemed favorable           */
+
+  u8  banner[TELEMETRY_BANNER];       /* Instance banner, NUL-terminated  */
+
+};
+
+#endif /* !_HAVE_TELEMETRY_H */